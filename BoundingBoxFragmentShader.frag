@@ -0,0 +1,8 @@
+#version 330 core
+
+out vec4 FragColor;
+
+void main()
+{
+	FragColor = vec4(1.0);		// never seen; color writes are off while boxes are drawn, only whether fragments pass the depth test matters
+}
\ No newline at end of file
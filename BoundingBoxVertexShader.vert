@@ -0,0 +1,12 @@
+#version 330 core
+
+layout (location = 0) in vec3 aPos;		// corner of a unit cube, from (0, 0, 0) to (1, 1, 1)
+
+uniform mat4 viewProjection;
+uniform vec3 boxMin;
+uniform vec3 boxMax;
+
+void main()
+{
+	gl_Position = viewProjection * vec4(mix(boxMin, boxMax, aPos), 1.0);		// stretch the unit cube over the world-space box
+}
\ No newline at end of file
@@ -0,0 +1,132 @@
+#ifndef BOUNDS_H
+#define BOUNDS_H
+
+#include <cmath>
+#include <algorithm>
+#include <glm/glm/glm.hpp>
+
+struct BoundingSphere {
+	glm::vec3 center = glm::vec3(0.0f);
+	float radius = 0.0f;
+};
+
+// axis-aligned bounding box; starts out empty (min > max) so the first point added sets it
+struct AABB {
+	glm::vec3 min = glm::vec3(INFINITY);
+	glm::vec3 max = glm::vec3(-INFINITY);
+
+	bool empty(void) const
+	{
+		return min.x > max.x;
+	}
+
+	void expand(const glm::vec3& point)
+	{
+		min = glm::min(min, point);
+		max = glm::max(max, point);
+	}
+
+	void expand(const AABB& other)
+	{
+		if (other.empty())
+			return;
+		min = glm::min(min, other.min);
+		max = glm::max(max, other.max);
+	}
+
+	glm::vec3 center(void) const
+	{
+		return (min + max) * 0.5f;
+	}
+
+	glm::vec3 extents(void) const		// half the size along each axis
+	{
+		return (max - min) * 0.5f;
+	}
+
+	/// <summary>
+	/// Sphere around the box (not the tightest possible sphere, but cheap and good enough for culling and LOD)
+	/// </summary>
+	BoundingSphere sphere(void) const
+	{
+		BoundingSphere s;
+		if (empty())
+			return s;
+		s.center = center();
+		s.radius = glm::length(extents());
+		return s;
+	}
+};
+
+/// <summary>
+/// Bounding sphere after a transform: the center is transformed, and the radius is scaled by the transform's largest scale factor
+/// </summary>
+inline BoundingSphere transformSphere(const BoundingSphere& sphere, const glm::mat4& matrix)
+{
+	BoundingSphere result;
+	result.center = glm::vec3(matrix * glm::vec4(sphere.center, 1.0f));
+	float scale = std::max(glm::length(glm::vec3(matrix[0])), std::max(glm::length(glm::vec3(matrix[1])), glm::length(glm::vec3(matrix[2]))));
+	result.radius = sphere.radius * scale;
+	return result;
+}
+
+/// <summary>
+/// Axis-aligned box around a transformed box (each axis of the result gets the extremes of every column's contribution)
+/// </summary>
+inline AABB transformAABB(const AABB& box, const glm::mat4& matrix)
+{
+	if (box.empty())
+		return box;
+
+	glm::vec3 center = glm::vec3(matrix * glm::vec4(box.center(), 1.0f));
+	glm::vec3 extents = box.extents();
+	glm::vec3 newExtents = glm::abs(glm::vec3(matrix[0])) * extents.x + glm::abs(glm::vec3(matrix[1])) * extents.y + glm::abs(glm::vec3(matrix[2])) * extents.z;
+
+	AABB result;
+	result.min = center - newExtents;
+	result.max = center + newExtents;
+	return result;
+}
+
+// the six planes of a view-projection matrix's frustum, as (normal, distance) with the normals pointing inwards
+struct Frustum {
+	glm::vec4 planes[6];
+
+	/// <summary>
+	/// Extracts the planes straight from the matrix's rows (left, right, bottom, top, near, far).
+	/// The planes aren't normalized; the box test only needs their signs.
+	/// </summary>
+	static Frustum fromMatrix(const glm::mat4& viewProjection)
+	{
+		glm::vec4 rows[4];
+		for (int i = 0; i < 4; ++i)
+			rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+
+		Frustum frustum;
+		for (int i = 0; i < 3; ++i) {
+			frustum.planes[i * 2] = rows[3] + rows[i];
+			frustum.planes[i * 2 + 1] = rows[3] - rows[i];
+		}
+		return frustum;
+	}
+
+	/// <summary>
+	/// Whether a box is at least partly inside (boxes near a corner outside the frustum can pass, which is fine for culling)
+	/// </summary>
+	bool intersects(const AABB& box) const
+	{
+		if (box.empty())
+			return false;
+
+		glm::vec3 center = box.center();
+		glm::vec3 extents = box.extents();
+		for (const glm::vec4& plane : planes) {
+			glm::vec3 normal(plane);
+			if (glm::dot(normal, center) + plane.w + glm::dot(glm::abs(normal), extents) < 0.0f)
+				return false;
+		}
+		return true;
+	}
+};
+
+#endif
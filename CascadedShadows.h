@@ -0,0 +1,426 @@
+#ifndef CASCADED_SHADOWS_H
+#define CASCADED_SHADOWS_H
+
+#include <cmath>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <glad/glad.h>
+#include <glm/glm/glm.hpp>
+#include <glm/glm/gtc/matrix_transform.hpp>
+#include <glm/glm/gtc/type_ptr.hpp>
+#include "Bounds.h"
+#include "GLState.h"
+#include "GeometryBuffer.h"
+#include "Object.h"
+#include "PassTimers.h"
+#include "RingBuffer.h"
+#include "ShaderProgram.h"
+
+/// <summary>
+/// Cascaded shadow maps for the sun: the view frustum is cut into slices by distance, and each slice gets its own depth map
+/// (a layer of one GL_TEXTURE_2D_ARRAY), rendered from the sun with an orthographic projection that just covers the slice.
+/// Near slices are small, so their texels are small; far slices trade resolution for coverage.
+///
+/// Each cascade covers the bounding sphere of its slice rather than the slice itself, so its size doesn't change as the
+/// camera turns, and its center is snapped to whole shadow map texels in the sun's view, so as the camera moves the
+/// texels stay put in the world instead of crawling along the edges of the shadows.
+///
+/// Cascades from Settings::firstCachedCascade on only draw static objects, and are kept between frames: they cover a sphere a
+/// little bigger than their slice, and are only rendered again once the slice gets near their edge, the sun moves, or
+/// invalidate() is called (static content changed). At most Settings::maxCachedUpdatesPerFrame of them are rendered in one
+/// frame (the one rendered longest ago first); one that's waiting keeps the matrix it was rendered with, and fragments it no
+/// longer covers fall through to the next cascade. So a frame renders the near cascades plus a bounded number of far ones.
+///
+/// The fragment shader picks a cascade from the fragment's distance in front of the camera, and filters 3x3 hardware-compared
+/// taps (PCF). Acne is kept off with polygon offset when rendering and a normal offset of a texel or so when sampling.
+/// </summary>
+class CascadedShadows
+{
+	public:
+		static const int MAX_CASCADES = 4;		// the ShadowCascades block in FragmentShader.frag has room for this many
+		static_assert(PassTimers::SHADOW_CASCADE_0 + MAX_CASCADES <= PassTimers::NUM_PASSES, "Every cascade needs its own pass timer");
+
+		struct Settings {
+			int cascadeCount;
+			int resolution;				// of each cascade's map
+			float maxDistance;			// shadows end this far in front of the camera
+			float splitLambda;			// 0 splits the distance evenly, 1 logarithmically (like the eye sees detail)
+			std::vector<float> splits;	// where each cascade ends (distances in front of the camera); overrides the two above when set
+			int firstCachedCascade;		// this one and the ones after it only have static objects, and are cached
+			int maxCachedUpdatesPerFrame;
+			float cacheMargin;			// how much bigger than its slice's sphere a cached cascade is (a fraction of the radius)
+			float polygonOffsetFactor;
+			float polygonOffsetUnits;
+			float normalOffset;			// how far fragments are pushed along their normal before sampling, in texels
+
+			Settings() : cascadeCount{ 4 }, resolution{ 2048 }, maxDistance{ 60.0f }, splitLambda{ 0.75f }, firstCachedCascade{ 2 }, maxCachedUpdatesPerFrame{ 1 },
+				cacheMargin{ 0.25f }, polygonOffsetFactor{ 2.0f }, polygonOffsetUnits{ 4.0f }, normalOffset{ 1.5f } {}
+		};
+
+		struct Stats {
+			unsigned int cascadesRendered = 0;
+			unsigned int cascadesCached = 0;		// cached cascades that were still good
+			unsigned int cascadesWaiting = 0;		// cached cascades that need rendering again, but are over this frame's budget
+			unsigned int castersDrawn = 0;			// (cascade, object) pairs
+			unsigned int drawCalls = 0;
+		};
+
+	private:
+		// matches the std140 layout of the ShadowCascades uniform block in FragmentShader.frag
+		struct ShadowUniforms {
+			glm::mat4 cascadeMatrices[MAX_CASCADES];	// world space to shadow map coordinates (0 to 1) and depth
+			glm::vec4 cascadeEnds;			// distance in front of the camera where each cascade ends
+			glm::vec4 cascadeTexelSizes;	// world size of a shadow map texel, times the normal offset
+			glm::vec4 viewDepth;			// dot with (world position, 1) gives the distance in front of the camera
+			int cascadeCount;				// 0 turns shadows off
+			int pad0, pad1, pad2;
+		};
+
+		static_assert(sizeof(ShadowUniforms) == 320, "ShadowUniforms must match the std140 layout of the shader's uniform block");
+
+		struct Cascade {
+			glm::mat4 viewProjection = glm::mat4(1.0f);		// what the map was last rendered with
+			glm::vec2 center = glm::vec2(0.0f);				// of the map, in the sun's view (snapped to texels)
+			float radius = 0.0f;							// half the map's width, in world units
+			float end = 0.0f;
+			bool rendered = false;
+			bool dirty = false;		// rendered, but for a different sun or static content
+			unsigned long long renderedFrame = 0;
+		};
+
+		Settings settings;
+		ShaderProgram& shadowProgram;
+		unsigned int programID;		// the program the uniform location below belongs to (it changes when the shaders are hot reloaded)
+		int viewProjectionLocation;
+		unsigned int texture;
+		unsigned int framebuffer;
+		Cascade cascades[MAX_CASCADES];
+		std::vector<const Object*> drawn;		// the casters of the cascade being rendered (kept, so its storage is reused every frame)
+		glm::vec3 sunDirection;			// what the cached cascades were rendered for
+		unsigned long long frame;
+		Stats lastStats;
+
+		/// <summary>
+		/// Where each cascade ends, from Settings::splits or the blend of even and logarithmic splits
+		/// </summary>
+		void computeSplits(float nearDepth, float* ends) const
+		{
+			int count = std::min(settings.cascadeCount, (int)MAX_CASCADES);
+			for (int i = 0; i < count; ++i) {
+				if (i < (int)settings.splits.size())
+					ends[i] = settings.splits[i];
+				else {
+					float fraction = float(i + 1) / count;
+					float logarithmic = nearDepth * std::pow(settings.maxDistance / nearDepth, fraction);
+					float even = nearDepth + (settings.maxDistance - nearDepth) * fraction;
+					ends[i] = settings.splitLambda * logarithmic + (1.0f - settings.splitLambda) * even;
+				}
+			}
+		}
+
+		/// <summary>
+		/// Smallest sphere around the slice of a symmetric perspective frustum between two depths
+		/// </summary>
+		/// <returns>Radius (the center is on the view axis, centerDepth in front of the camera)</returns>
+		static float sliceSphere(const glm::mat4& projection, float nearDepth, float farDepth, float& centerDepth)
+		{
+			float tanX = 1.0f / projection[0][0], tanY = 1.0f / projection[1][1];
+			float corner = tanX * tanX + tanY * tanY;		// squared distance of a corner from the axis, per unit of depth squared
+
+			// where the near and far corners are the same distance away, unless that's past the far plane
+			centerDepth = std::min(0.5f * (nearDepth + farDepth) * (1.0f + corner), farDepth);
+			float nearDistance = std::sqrt(nearDepth * nearDepth * corner + (centerDepth - nearDepth) * (centerDepth - nearDepth));
+			float farDistance = std::sqrt(farDepth * farDepth * corner + (farDepth - centerDepth) * (farDepth - centerDepth));
+			return std::max(nearDistance, farDistance);
+		}
+
+		static glm::mat4 sunView(const glm::vec3& direction)
+		{
+			glm::vec3 up = std::abs(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+			return glm::lookAt(glm::vec3(0.0f), -direction, up);		// a rotation only; where each map is goes in its projection
+		}
+
+		/// <summary>
+		/// Picks the coarsest level of a caster whose error is under a shadow map texel
+		/// </summary>
+		static int casterLOD(const Object& caster, float texelSize)
+		{
+			const Model& model = caster.getModel();
+			const BoundingSphere& modelSphere = model.getBoundingSphere();
+			float scale = modelSphere.radius > 0.0f ? caster.getWorldSphere().radius / modelSphere.radius : 1.0f;		// errors are in model units
+
+			int level = 0;
+			while (level + 1 < (int)model.getLODCount() && model.getLODError(level + 1) * scale <= texelSize)
+				++level;
+			return level;
+		}
+
+		/// <summary>
+		/// Renders a cascade's casters into its layer, around a center in the sun's view
+		/// </summary>
+		void renderCascade(int index, const std::vector<Object*>& casters, bool staticOnly, const glm::mat4& view, const glm::vec2& center, float radius, Stats& stats)
+		{
+			Cascade& cascade = cascades[index];
+			float texelSize = 2.0f * radius / settings.resolution;
+
+			// casters whose sphere reaches into the map's square; anything between it and the sun casts into it, so depth isn't culled
+			drawn.clear();
+			float nearDepth = INFINITY, farDepth = -INFINITY;
+			for (const Object* caster : casters) {
+				if ((staticOnly && !caster->isStatic()) || !caster->getModel().isLoaded())
+					continue;
+				BoundingSphere sphere = caster->getWorldSphere();
+				glm::vec3 position = glm::vec3(view * glm::vec4(sphere.center, 1.0f));
+				if (std::abs(position.x - center.x) > radius + sphere.radius || std::abs(position.y - center.y) > radius + sphere.radius)
+					continue;
+				drawn.push_back(caster);
+				nearDepth = std::min(nearDepth, -position.z - sphere.radius);
+				farDepth = std::max(farDepth, -position.z + sphere.radius);
+			}
+			if (drawn.empty()) {
+				nearDepth = 0.0f;
+				farDepth = 1.0f;
+			}
+
+			cascade.viewProjection = glm::ortho(center.x - radius, center.x + radius, center.y - radius, center.y + radius, nearDepth - 1.0f, farDepth + 1.0f) * view;
+			cascade.center = center;
+			cascade.radius = radius;
+			cascade.rendered = true;
+			cascade.dirty = false;
+			cascade.renderedFrame = frame;
+
+			glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0, index);
+			glClear(GL_DEPTH_BUFFER_BIT);
+
+			shadowProgram.use();
+			if (programID != shadowProgram.ID) {
+				programID = shadowProgram.ID;
+				viewProjectionLocation = glGetUniformLocation(programID, "lightViewProjection");
+			}
+			glUniformMatrix4fv(viewProjectionLocation, 1, GL_FALSE, glm::value_ptr(cascade.viewProjection));
+			for (const Object* caster : drawn) {
+				glVertexAttribI1i(OBJECT_INDEX_ATTRIB, caster->getConstantIndex());		// its model matrix was uploaded by ObjectConstants
+				int lod = casterLOD(*caster, texelSize);
+				for (const Mesh& mesh : caster->getModel().getMeshes()) {
+					mesh.DrawGeometry(lod);		// depth only, so the material doesn't matter
+					++stats.drawCalls;
+				}
+				++stats.castersDrawn;
+			}
+			++stats.cascadesRendered;
+		}
+
+		/// <summary>
+		/// Whether a waiting cascade is more overdue than another: never rendered, or rendered longer ago
+		/// </summary>
+		bool rendersBefore(int a, int b) const
+		{
+			if (cascades[a].rendered != cascades[b].rendered)
+				return !cascades[a].rendered;
+			return cascades[a].renderedFrame < cascades[b].renderedFrame;
+		}
+
+		static void write(RingBuffer& ring, const ShadowUniforms& uniforms)
+		{
+			RingBuffer::Allocation allocation = ring.allocate(sizeof(ShadowUniforms), ring.getUniformAlignment());
+			*(ShadowUniforms*)allocation.data = uniforms;
+			ring.commit(allocation);
+			GLState::get().bindBufferRange(GL_UNIFORM_BUFFER, SHADOW_DATA_BINDING, allocation.buffer, allocation.offset, sizeof(ShadowUniforms));
+		}
+
+	public:
+		CascadedShadows(ShaderProgram& shadowShaderProgram, const Settings& shadowSettings = Settings())
+			: settings{ shadowSettings }, shadowProgram{ shadowShaderProgram }, programID{ 0 }, viewProjectionLocation{ -1 }, sunDirection{ 0.0f }, frame{ 0 }
+		{
+			settings.cascadeCount = std::min(std::max(settings.cascadeCount, 1), (int)MAX_CASCADES);
+
+			glGenTextures(1, &texture);
+			GLState::get().bindTexture(SHADOW_MAP_UNIT, GL_TEXTURE_2D_ARRAY, texture);
+			glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT32F, settings.resolution, settings.resolution, settings.cascadeCount, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);		// with comparison on, linear filters the results of 4 compares
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+			// whatever was bound before is put back afterwards
+			int previousFramebuffer = 0;
+			glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+			glGenFramebuffers(1, &framebuffer);
+			glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+			glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0, 0);
+			glDrawBuffer(GL_NONE);
+			glReadBuffer(GL_NONE);
+			if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+				std::cout << "ERROR: Shadow map framebuffer is incomplete" << std::endl;
+			glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+		}
+
+		CascadedShadows(const CascadedShadows&) = delete;
+		CascadedShadows& operator=(const CascadedShadows&) = delete;
+
+		~CascadedShadows()
+		{
+			glDeleteFramebuffers(1, &framebuffer);
+			GLState::get().deleteTexture(texture);
+		}
+
+		/// <summary>
+		/// Renders the cascades that are due, writes the ShadowCascades block into the ring and binds it
+		/// (call every frame after ObjectConstants has given every caster its index, before drawing anything lit, then bind())
+		/// </summary>
+		/// <param name="casters">Every object that casts a shadow, whether it's on screen or not</param>
+		/// <param name="direction">Towards the sun</param>
+		/// <param name="projection">Symmetric perspective projection</param>
+		/// <param name="timers">Each cascade rendered is timed as its own pass</param>
+		void update(RingBuffer& ring, const std::vector<Object*>& casters, const glm::vec3& direction, const glm::mat4& view, const glm::mat4& projection, float nearDepth, PassTimers& timers)
+		{
+			Stats stats;
+			++frame;
+
+			glm::vec3 sun = glm::normalize(direction);
+			if (sun != sunDirection) {
+				sunDirection = sun;
+				invalidate();
+			}
+			glm::mat4 lightView = sunView(sunDirection);
+			glm::mat4 inverseView = glm::inverse(view);
+
+			// where each cascade has to be this frame, and which ones get rendered
+			float ends[MAX_CASCADES];
+			computeSplits(nearDepth, ends);
+			glm::vec2 centers[MAX_CASCADES];
+			float radii[MAX_CASCADES];
+			bool due[MAX_CASCADES] = {};
+			int waiting[MAX_CASCADES];
+			int waitingCount = 0;
+			for (int i = 0; i < settings.cascadeCount; ++i) {
+				float sliceStart = i == 0 ? nearDepth : ends[i - 1];
+				float centerDepth;
+				float sliceRadius = sliceSphere(projection, sliceStart, ends[i], centerDepth);
+				bool cached = i >= settings.firstCachedCascade;
+				float radius = cached ? sliceRadius * (1.0f + settings.cacheMargin) : sliceRadius;
+				radius *= float(settings.resolution) / (settings.resolution - 2);		// room for the center to move by the texel it's snapped to
+				radius = std::ceil(radius * 16.0f) / 16.0f;		// so rounding doesn't change the texel size from frame to frame
+
+				glm::vec3 sphereCenter = glm::vec3(inverseView * glm::vec4(0.0f, 0.0f, -centerDepth, 1.0f));
+				glm::vec2 sliceCenter = glm::vec2(lightView * glm::vec4(sphereCenter, 1.0f));
+				float texelSize = 2.0f * radius / settings.resolution;
+				glm::vec2 center = glm::floor(sliceCenter / texelSize) * texelSize;
+
+				Cascade& cascade = cascades[i];
+				cascade.end = ends[i];
+				centers[i] = center;
+				radii[i] = radius;
+				if (!cached)
+					due[i] = true;
+				else if (!cascade.rendered || cascade.dirty || cascade.radius != radius || std::abs(sliceCenter.x - cascade.center.x) > radius - sliceRadius
+					|| std::abs(sliceCenter.y - cascade.center.y) > radius - sliceRadius)
+					waiting[waitingCount++] = i;		// out of date, or the slice has moved out of it
+				else
+					++stats.cascadesCached;
+			}
+
+			// ones that were never rendered go first, then the ones rendered longest ago (insertion sort: there are a few at most)
+			for (int i = 1; i < waitingCount; ++i) {
+				int cascade = waiting[i];
+				int j = i;
+				while (j > 0 && rendersBefore(cascade, waiting[j - 1])) {
+					waiting[j] = waiting[j - 1];
+					--j;
+				}
+				waiting[j] = cascade;
+			}
+			for (int i = 0; i < waitingCount; ++i) {
+				if (i < settings.maxCachedUpdatesPerFrame)
+					due[waiting[i]] = true;
+				else
+					++stats.cascadesWaiting;
+			}
+
+			// whatever was bound before is put back afterwards
+			int previousFramebuffer = 0;
+			int viewport[4];
+			glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+			glGetIntegerv(GL_VIEWPORT, viewport);
+			GeometryBuffer::Stream previousStream = GeometryBuffer::get().getStream();
+
+			glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+			glViewport(0, 0, settings.resolution, settings.resolution);
+			GeometryBuffer::get().useStream(GeometryBuffer::POSITION_STREAM);
+			GLState::get().depthMask(true);
+			GLState::get().setEnabled(GL_POLYGON_OFFSET_FILL, true);
+			glPolygonOffset(settings.polygonOffsetFactor, settings.polygonOffsetUnits);
+			for (int i = 0; i < settings.cascadeCount; ++i) {
+				if (!due[i])
+					continue;
+				timers.begin((PassTimers::Pass)(PassTimers::SHADOW_CASCADE_0 + i));
+				renderCascade(i, casters, i >= settings.firstCachedCascade, lightView, centers[i], radii[i], stats);
+				timers.end();
+			}
+			GLState::get().setEnabled(GL_POLYGON_OFFSET_FILL, false);
+			GeometryBuffer::get().useStream(previousStream);
+			glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+			glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+			ShadowUniforms uniforms = {};
+			const glm::mat4 bias = glm::mat4(glm::vec4(0.5f, 0.0f, 0.0f, 0.0f), glm::vec4(0.0f, 0.5f, 0.0f, 0.0f), glm::vec4(0.0f, 0.0f, 0.5f, 0.0f), glm::vec4(0.5f, 0.5f, 0.5f, 1.0f));		// -1..1 to 0..1
+			for (int i = 0; i < settings.cascadeCount; ++i) {
+				uniforms.cascadeEnds[i] = cascades[i].end;
+				if (cascades[i].rendered)
+					uniforms.cascadeMatrices[i] = bias * cascades[i].viewProjection;
+				else
+					uniforms.cascadeMatrices[i][3] = glm::vec4(2.0f, 2.0f, 0.0f, 1.0f);		// everything lands off the map, so it falls through to the next cascade
+				uniforms.cascadeTexelSizes[i] = 2.0f * cascades[i].radius / settings.resolution * settings.normalOffset;
+			}
+			uniforms.viewDepth = -glm::vec4(view[0][2], view[1][2], view[2][2], view[3][2]);		// minus the view matrix's third row
+			uniforms.cascadeCount = settings.cascadeCount;
+			write(ring, uniforms);
+
+			lastStats = stats;
+		}
+
+		/// <summary>
+		/// Writes a ShadowCascades block with no cascades (call instead of update() on frames without shadows)
+		/// </summary>
+		void disable(RingBuffer& ring)
+		{
+			ShadowUniforms uniforms = {};
+			write(ring, uniforms);
+			for (Cascade& cascade : cascades)
+				cascade.rendered = false;		// static content can change while they're off, so start over
+			lastStats = Stats();
+		}
+
+		/// <summary>
+		/// Renders every cached cascade again (after static objects change), still within the per-frame budget;
+		/// until its turn comes, each one keeps being sampled as it was
+		/// </summary>
+		void invalidate(void)
+		{
+			for (Cascade& cascade : cascades)
+				cascade.dirty = true;
+		}
+
+		/// <summary>
+		/// Binds the shadow maps to the unit the fragment shader's shadowMap sampler reads from
+		/// </summary>
+		void bind(void) const
+		{
+			GLState::get().bindTexture(SHADOW_MAP_UNIT, GL_TEXTURE_2D_ARRAY, texture);
+		}
+
+		const Settings& getSettings(void) const
+		{
+			return settings;
+		}
+
+		const Stats& getLastStats(void) const
+		{
+			return lastStats;
+		}
+};
+
+#endif
@@ -0,0 +1,330 @@
+#ifndef CLUSTERED_LIGHTS_H
+#define CLUSTERED_LIGHTS_H
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <glad/glad.h>
+#include <glm/glm/glm.hpp>
+#include "Bounds.h"
+#include "GLState.h"
+#include "RingBuffer.h"
+#include "ShaderProgram.h"
+#include "ThreadPool.h"
+
+// a point or spot light, in world space; laid out exactly as its three texels in lightData (see FragmentShader.frag)
+struct Light {
+	glm::vec3 position;
+	float range = 1.0f;					// the light fades out smoothly to nothing at this distance
+	glm::vec3 color = glm::vec3(1.0f);	// intensity included
+	float spotCosOuter = -2.0f;			// cosine of the cone's half-angle where a spot light ends; below -1 for a point light
+	glm::vec3 direction = glm::vec3(0.0f, -1.0f, 0.0f);		// where a spot light points
+	float spotCosInner = -1.0f;			// cosine of the half-angle where a spot light starts to fade
+};
+
+static_assert(sizeof(Light) == 48, "Light must match its three texels in the shader's lightData");
+
+/// <summary>
+/// Clustered forward shading: the view frustum is split into a grid of clusters (tiles of the screen, by slices of depth that
+/// get thicker with distance), and every frame each light is binned into the clusters its sphere of influence touches.
+/// The fragment shader finds its own cluster from its screen position and depth, and only loops over that cluster's lights,
+/// so a pixel's lighting costs as much as the lights that reach it, however many lights there are in total.
+///
+/// Binning runs on the CPU, split over the ThreadPool one depth slice at a time (a slice's clusters only get written by its job).
+/// Everything is written into the frame's RingBuffer: the visible lights (lightData, 3 RGBA32F texels each), then one
+/// R32UI buffer with each cluster's (first, count) followed by the light indices those point into (lightGrid), and the
+/// LightClusters uniform block that says how to find a cluster. The textures cover the whole ring, like ObjectConstants'.
+///
+/// Spot lights are binned by their sphere, not their cone. The projection has to be a symmetric perspective (glm::perspective).
+/// </summary>
+class ClusteredLights
+{
+	public:
+		static const int CLUSTERS_X = 16;
+		static const int CLUSTERS_Y = 9;
+		static const int CLUSTERS_Z = 24;
+		static const int CLUSTER_COUNT = CLUSTERS_X * CLUSTERS_Y * CLUSTERS_Z;
+		static const int TEXELS_PER_LIGHT = 3;
+
+		struct Stats {
+			unsigned int lights = 0;
+			unsigned int visibleLights = 0;			// lights that touch the view frustum (the rest aren't uploaded)
+			unsigned int occupiedClusters = 0;		// clusters with at least one light
+			unsigned int lightIndices = 0;			// (cluster, light) pairs
+			unsigned int maxClusterLights = 0;		// most lights in one cluster
+			float binMilliseconds = 0.0f;
+		};
+
+	private:
+		// matches the std140 layout of the LightClusters uniform block in FragmentShader.frag
+		struct ClusterUniforms {
+			glm::vec4 viewDepth;		// dot with (world position, 1) gives the distance in front of the camera
+			glm::vec2 clusterScale;		// clusters per pixel
+			float sliceScale;			// depth slice = log(depth) * sliceScale + sliceBias
+			float sliceBias;
+			int clustersX, clustersY, clustersZ;
+			int lightCount;
+			int lightBase;				// first texel of this frame's lights in lightData
+			int gridBase;				// first texel of this frame's cluster records in lightGrid
+			int pad0, pad1;
+		};
+
+		static_assert(sizeof(ClusterUniforms) == 64, "ClusterUniforms must match the std140 layout of the shader's uniform block");
+
+		// a visible light's sphere in view space, and the range of clusters it can touch
+		struct ViewLight {
+			glm::vec3 center;
+			float radius;
+			int x0, x1, y0, y1, z0, z1;
+			uint32_t light;		// its entry among this frame's uploaded lights
+		};
+
+		unsigned int dataTexture, gridTexture;
+		unsigned int dataBuffer, gridBuffer;	// the ring's buffers the textures cover
+		int maxTexels;							// GL_MAX_TEXTURE_BUFFER_SIZE
+
+		// what the cluster bounds were built for
+		float projectionX, projectionY;			// projection[0][0] and projection[1][1]
+		float nearPlane, farPlane;
+		float sliceScale, sliceBias;
+		std::vector<AABB> clusterBounds;		// view space
+
+		std::vector<ViewLight> visible;
+		std::vector<std::vector<uint32_t>> clusterLights;	// per cluster, entries in visibleData (kept between frames so they don't reallocate)
+		std::vector<Light> visibleData;		// the lights that get uploaded, in the same order as visible
+		Stats lastStats;
+
+		static int clusterIndex(int x, int y, int z)
+		{
+			return (z * CLUSTERS_Y + y) * CLUSTERS_X + x;
+		}
+
+		int sliceOf(float depth) const
+		{
+			int slice = (int)std::floor(std::log(depth) * sliceScale + sliceBias);
+			return std::min(std::max(slice, 0), CLUSTERS_Z - 1);
+		}
+
+		/// <summary>
+		/// Builds every cluster's view-space box (again only when the projection changes)
+		/// </summary>
+		void buildClusterBounds(const glm::mat4& projection, float nearDepth, float farDepth)
+		{
+			if (!clusterBounds.empty() && projection[0][0] == projectionX && projection[1][1] == projectionY && nearDepth == nearPlane && farDepth == farPlane)
+				return;
+
+			projectionX = projection[0][0];
+			projectionY = projection[1][1];
+			nearPlane = nearDepth;
+			farPlane = farDepth;
+			sliceScale = float(CLUSTERS_Z) / std::log(farPlane / nearPlane);
+			sliceBias = -float(CLUSTERS_Z) * std::log(nearPlane) / std::log(farPlane / nearPlane);
+
+			clusterBounds.assign(CLUSTER_COUNT, AABB());
+			for (int z = 0; z < CLUSTERS_Z; ++z) {
+				float depths[2] = { nearPlane * std::pow(farPlane / nearPlane, float(z) / CLUSTERS_Z), nearPlane * std::pow(farPlane / nearPlane, float(z + 1) / CLUSTERS_Z) };
+				for (int y = 0; y < CLUSTERS_Y; ++y) {
+					for (int x = 0; x < CLUSTERS_X; ++x) {
+						AABB& bounds = clusterBounds[clusterIndex(x, y, z)];
+						for (float depth : depths) {
+							for (int corner = 0; corner < 4; ++corner) {
+								float ndcX = float(x + (corner & 1)) / CLUSTERS_X * 2.0f - 1.0f;
+								float ndcY = float(y + (corner >> 1)) / CLUSTERS_Y * 2.0f - 1.0f;
+								bounds.expand(glm::vec3(ndcX * depth / projectionX, ndcY * depth / projectionY, -depth));
+							}
+						}
+					}
+				}
+			}
+		}
+
+		/// <summary>
+		/// Range of cluster columns (or rows) that a view-space sphere can cover, from where its box projects to
+		/// </summary>
+		/// <param name="coordinate">Center's x (or y)</param>
+		/// <param name="scale">projection[0][0] (or [1][1])</param>
+		/// <returns>Whether any of it is on screen</returns>
+		static bool tileRange(float coordinate, float depth, float radius, float scale, int clusters, int& first, int& last)
+		{
+			// smallest and largest coordinate / depth over the box around the sphere
+			float nearDepth = depth - radius, farDepth = depth + radius;
+			float low = coordinate - radius, high = coordinate + radius;
+			float minNdc = low * scale / (low < 0.0f ? nearDepth : farDepth);
+			float maxNdc = high * scale / (high > 0.0f ? nearDepth : farDepth);
+			if (maxNdc < -1.0f || minNdc > 1.0f)
+				return false;
+
+			first = std::max((int)std::floor((minNdc * 0.5f + 0.5f) * clusters), 0);
+			last = std::min((int)std::floor((maxNdc * 0.5f + 0.5f) * clusters), clusters - 1);
+			return true;
+		}
+
+		static bool sphereTouchesBox(const glm::vec3& center, float radius, const AABB& box)
+		{
+			glm::vec3 closest = glm::min(glm::max(center, box.min), box.max);
+			glm::vec3 offset = center - closest;
+			return glm::dot(offset, offset) <= radius * radius;
+		}
+
+		/// <summary>
+		/// Makes a texture cover the buffer an allocation was made in (the ring switches to a new buffer when it grows)
+		/// </summary>
+		void follow(unsigned int texture, TextureUnit unit, GLenum format, unsigned int& covered, const RingBuffer::Allocation& allocation, size_t texelSize, const RingBuffer& ring)
+		{
+			if (allocation.buffer == 0 || allocation.buffer == covered)
+				return;
+
+			covered = allocation.buffer;
+			if (ring.getSize() / texelSize > (size_t)maxTexels)
+				std::cout << "ERROR: The ring buffer is bigger than a texture buffer can be (" << maxTexels << " texels)" << std::endl;
+			GLState::get().bindTexture(unit, GL_TEXTURE_BUFFER, texture);
+			glTexBuffer(GL_TEXTURE_BUFFER, format, covered);
+		}
+
+	public:
+		ClusteredLights() : dataBuffer{ 0 }, gridBuffer{ 0 }, maxTexels{ 0 }, projectionX{ 0.0f }, projectionY{ 0.0f }, nearPlane{ 0.0f }, farPlane{ 0.0f },
+			sliceScale{ 0.0f }, sliceBias{ 0.0f }, clusterLights(CLUSTER_COUNT)
+		{
+			glGenTextures(1, &dataTexture);
+			glGenTextures(1, &gridTexture);
+			glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+		}
+
+		/// <summary>
+		/// Bins the lights into this frame's clusters, writes them into the ring, and binds the LightClusters block
+		/// (call every frame before drawing, then bind())
+		/// </summary>
+		/// <param name="lights">World space</param>
+		/// <param name="projection">Symmetric perspective projection</param>
+		void update(RingBuffer& ring, const std::vector<Light>& lights, const glm::mat4& view, const glm::mat4& projection, float nearDepth, float farDepth, int viewportWidth, int viewportHeight)
+		{
+			auto start = std::chrono::steady_clock::now();
+			Stats stats;
+			stats.lights = (unsigned int)lights.size();
+			buildClusterBounds(projection, nearDepth, farDepth);
+
+			// each light's sphere in view space, and the clusters it could reach (lights outside the frustum are dropped here)
+			visible.clear();
+			visibleData.clear();
+			for (size_t i = 0; i < lights.size(); ++i) {
+				const Light& light = lights[i];
+				if (light.range <= 0.0f)
+					continue;
+				glm::vec3 center = glm::vec3(view * glm::vec4(light.position, 1.0f));
+				float depth = -center.z;
+				if (depth + light.range < nearPlane || depth - light.range > farPlane)
+					continue;
+
+				ViewLight entry;
+				entry.center = center;
+				entry.radius = light.range;
+				entry.light = (uint32_t)visibleData.size();
+				entry.z0 = sliceOf(std::max(depth - light.range, nearPlane));
+				entry.z1 = sliceOf(std::min(depth + light.range, farPlane));
+				if (depth - light.range <= nearPlane) {
+					// reaches behind the near plane, where projecting its box doesn't work
+					entry.x0 = 0;
+					entry.x1 = CLUSTERS_X - 1;
+					entry.y0 = 0;
+					entry.y1 = CLUSTERS_Y - 1;
+				}
+				else if (!tileRange(center.x, depth, light.range, projectionX, CLUSTERS_X, entry.x0, entry.x1)
+					|| !tileRange(center.y, depth, light.range, projectionY, CLUSTERS_Y, entry.y0, entry.y1))
+					continue;
+
+				visible.push_back(entry);
+				visibleData.push_back(light);
+			}
+			stats.visibleLights = (unsigned int)visible.size();
+
+			// every depth slice is one job; a light is only tested against the clusters its projection covers
+			ThreadPool::get().parallelFor(CLUSTERS_Z, [this](size_t slice) {
+				int z = (int)slice;
+				for (int cluster = clusterIndex(0, 0, z); cluster < clusterIndex(0, 0, z + 1); ++cluster)
+					clusterLights[cluster].clear();
+
+				for (uint32_t i = 0; i < (uint32_t)visible.size(); ++i) {
+					const ViewLight& light = visible[i];
+					if (z < light.z0 || z > light.z1)
+						continue;
+					for (int y = light.y0; y <= light.y1; ++y) {
+						for (int x = light.x0; x <= light.x1; ++x) {
+							int cluster = clusterIndex(x, y, z);
+							if (sphereTouchesBox(light.center, light.radius, clusterBounds[cluster]))
+								clusterLights[cluster].push_back(light.light);
+						}
+					}
+				}
+			});
+
+			for (const std::vector<uint32_t>& indices : clusterLights) {
+				stats.lightIndices += (unsigned int)indices.size();
+				stats.occupiedClusters += indices.empty() ? 0 : 1;
+				stats.maxClusterLights = std::max(stats.maxClusterLights, (unsigned int)indices.size());
+			}
+
+			// the lights (at least one entry, so the allocation always exists)
+			RingBuffer::Allocation lightAllocation = ring.allocate(std::max(visibleData.size(), size_t(1)) * sizeof(Light), 16);
+			if (!visibleData.empty())
+				std::memcpy(lightAllocation.data, visibleData.data(), visibleData.size() * sizeof(Light));
+			ring.commit(lightAllocation);
+			follow(dataTexture, LIGHT_DATA_UNIT, GL_RGBA32F, dataBuffer, lightAllocation, 16, ring);
+
+			// each cluster's (first, count), then the indices they point to
+			RingBuffer::Allocation gridAllocation = ring.allocate((CLUSTER_COUNT * 2 + stats.lightIndices) * sizeof(uint32_t), sizeof(uint32_t));
+			uint32_t* grid = (uint32_t*)gridAllocation.data;
+			uint32_t gridBase = (uint32_t)(gridAllocation.offset / sizeof(uint32_t));
+			uint32_t next = CLUSTER_COUNT * 2;
+			for (int cluster = 0; cluster < CLUSTER_COUNT; ++cluster) {
+				const std::vector<uint32_t>& indices = clusterLights[cluster];
+				grid[cluster * 2] = gridBase + next;
+				grid[cluster * 2 + 1] = (uint32_t)indices.size();
+				if (!indices.empty())
+					std::memcpy(grid + next, indices.data(), indices.size() * sizeof(uint32_t));
+				next += (uint32_t)indices.size();
+			}
+			ring.commit(gridAllocation);
+			follow(gridTexture, LIGHT_GRID_UNIT, GL_R32UI, gridBuffer, gridAllocation, sizeof(uint32_t), ring);
+
+			ClusterUniforms uniforms;
+			uniforms.viewDepth = -glm::vec4(view[0][2], view[1][2], view[2][2], view[3][2]);		// minus the view matrix's third row
+			uniforms.clusterScale = glm::vec2(float(CLUSTERS_X) / viewportWidth, float(CLUSTERS_Y) / viewportHeight);
+			uniforms.sliceScale = sliceScale;
+			uniforms.sliceBias = sliceBias;
+			uniforms.clustersX = CLUSTERS_X;
+			uniforms.clustersY = CLUSTERS_Y;
+			uniforms.clustersZ = CLUSTERS_Z;
+			uniforms.lightCount = (int)visibleData.size();
+			uniforms.lightBase = (int)(lightAllocation.offset / 16);
+			uniforms.gridBase = (int)gridBase;
+			uniforms.pad0 = uniforms.pad1 = 0;
+
+			RingBuffer::Allocation uniformAllocation = ring.allocate(sizeof(ClusterUniforms), ring.getUniformAlignment());
+			*(ClusterUniforms*)uniformAllocation.data = uniforms;
+			ring.commit(uniformAllocation);
+			GLState::get().bindBufferRange(GL_UNIFORM_BUFFER, LIGHT_CLUSTERS_BINDING, uniformAllocation.buffer, uniformAllocation.offset, sizeof(ClusterUniforms));
+
+			stats.binMilliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+			lastStats = stats;
+		}
+
+		/// <summary>
+		/// Binds the light and cluster buffers to the units the fragment shader's lightData and lightGrid samplers read from
+		/// </summary>
+		void bind(void) const
+		{
+			GLState::get().bindTexture(LIGHT_DATA_UNIT, GL_TEXTURE_BUFFER, dataTexture);
+			GLState::get().bindTexture(LIGHT_GRID_UNIT, GL_TEXTURE_BUFFER, gridTexture);
+		}
+
+		const Stats& getLastStats(void) const
+		{
+			return lastStats;
+		}
+};
+
+#endif
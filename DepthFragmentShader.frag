@@ -0,0 +1,7 @@
+#version 330 core
+
+// depth pre-pass: only depth is written (color writes are off while this is drawn)
+
+void main()
+{
+}
\ No newline at end of file
@@ -0,0 +1,19 @@
+#version 330 core
+
+// depth pre-pass: positions only (GeometryBuffer::POSITION_STREAM), transformed exactly as in VertexShader.vert
+
+layout (location = 0) in vec3 aPos;
+layout (location = 3) in int aObjectIndex;		// per instance when drawn instanced (see Mesh::DrawInstanced)
+
+// per-object matrices, computed once per frame on the CPU (see ObjectConstants.h for the layout)
+uniform samplerBuffer objectData;
+
+invariant gl_Position;		// must land on the same depths as VertexShader.vert, so the lit pass passes the depth test where this pass wrote
+
+void main()
+{
+	int base = aObjectIndex * 12;
+	mat4 mvp = mat4(texelFetch(objectData, base), texelFetch(objectData, base + 1), texelFetch(objectData, base + 2), texelFetch(objectData, base + 3));
+
+	gl_Position = mvp * vec4(aPos, 1.0);
+}
\ No newline at end of file
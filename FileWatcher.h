@@ -0,0 +1,162 @@
+#ifndef FILE_WATCHER_H
+#define FILE_WATCHER_H
+
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <chrono>
+#include <thread>
+#include <filesystem>
+#include <iostream>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+/// <summary>
+/// Watches directories for files that get written, created, or moved into place (editors often save by renaming a temp file).
+/// Uses inotify on Linux; elsewhere it falls back to polling file modification times.
+/// Paths are reported in the same normalized form that normalizePath() produces, so they can be compared directly.
+/// </summary>
+class FileWatcher
+{
+	private:
+		std::set<std::string> directories;
+
+#ifdef __linux__
+		int inotifyFd;
+		std::map<int, std::string> watchDirs;	// inotify watch descriptor -> directory
+
+		void readEvents(std::set<std::string>& changed)
+		{
+			alignas(inotify_event) char buffer[4096];
+			ssize_t len;
+			while ((len = read(inotifyFd, buffer, sizeof(buffer))) > 0) {
+				for (char* ptr = buffer; ptr < buffer + len; ptr += sizeof(inotify_event) + ((inotify_event*)ptr)->len) {
+					const inotify_event* event = (const inotify_event*)ptr;
+					if (event->len == 0 || watchDirs.find(event->wd) == watchDirs.end())
+						continue;
+					changed.insert(normalizePath(watchDirs[event->wd] + '/' + event->name));
+				}
+			}
+		}
+#else
+		std::map<std::string, std::filesystem::file_time_type> writeTimes;
+
+		void scan(std::set<std::string>* changed)
+		{
+			std::error_code ec;
+			for (const std::string& dir : directories) {
+				for (const auto& entry : std::filesystem::directory_iterator(dir, ec)) {
+					if (!entry.is_regular_file(ec))
+						continue;
+					std::string file = normalizePath(entry.path().string());
+					std::filesystem::file_time_type time = entry.last_write_time(ec);
+					auto it = writeTimes.find(file);
+					if (it == writeTimes.end() || it->second != time) {
+						if (changed && it != writeTimes.end())
+							changed->insert(file);
+						writeTimes[file] = time;
+					}
+				}
+			}
+		}
+#endif
+
+	public:
+		FileWatcher()
+		{
+#ifdef __linux__
+			inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+			if (inotifyFd < 0)
+				std::cout << "ERROR: FileWatcher: inotify_init1 failed" << std::endl;
+#endif
+		}
+
+		~FileWatcher()
+		{
+#ifdef __linux__
+			if (inotifyFd >= 0)
+				close(inotifyFd);
+#endif
+		}
+
+		FileWatcher(const FileWatcher&) = delete;
+		FileWatcher& operator=(const FileWatcher&) = delete;
+
+		static std::string normalizePath(const std::string& path)
+		{
+			return std::filesystem::path(path).lexically_normal().generic_string();
+		}
+
+		/// <summary>
+		/// Returns the (normalized) directory a file lives in, using "." for files given without a directory
+		/// </summary>
+		static std::string directoryOf(const std::string& file)
+		{
+			std::string dir = std::filesystem::path(normalizePath(file)).parent_path().generic_string();
+			return dir.empty() ? "." : dir;
+		}
+
+		void watchDirectory(const std::string& dir)
+		{
+			std::string normalized = normalizePath(dir);
+			if (!directories.insert(normalized).second)
+				return;
+
+#ifdef __linux__
+			if (inotifyFd < 0)
+				return;
+			int wd = inotify_add_watch(inotifyFd, normalized.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+			if (wd < 0)
+				std::cout << "ERROR: FileWatcher: couldn't watch " << normalized << std::endl;
+			else
+				watchDirs[wd] = normalized;
+#else
+			scan(nullptr);		// record the current modification times so only later changes get reported
+#endif
+		}
+
+		void watchFile(const std::string& file)
+		{
+			watchDirectory(directoryOf(file));
+		}
+
+		/// <summary>
+		/// Blocks for up to timeoutMs waiting for changes, then keeps collecting for settleMs so that
+		/// one save (which can fire several events) is only reported once
+		/// </summary>
+		/// <returns>Normalized paths of the files that changed (empty on timeout)</returns>
+		std::vector<std::string> waitForChanges(int timeoutMs, int settleMs = 100)
+		{
+			std::set<std::string> changed;
+
+#ifdef __linux__
+			if (inotifyFd < 0) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMs));
+				return {};
+			}
+
+			pollfd pfd = { inotifyFd, POLLIN, 0 };
+			if (poll(&pfd, 1, timeoutMs) > 0) {
+				readEvents(changed);
+				while (poll(&pfd, 1, settleMs) > 0)
+					readEvents(changed);
+			}
+#else
+			std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMs));
+			scan(&changed);
+			if (!changed.empty()) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(settleMs));
+				scan(&changed);
+			}
+#endif
+
+			return std::vector<std::string>(changed.begin(), changed.end());
+		}
+};
+
+#endif
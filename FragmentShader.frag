@@ -1,14 +1,99 @@
 #version 330 core
 
+// 0 = per-pixel lighting, 1 = per-vertex lighting, 2 = per-vertex diffuse only (see ShaderLOD.h)
+#ifndef SHADER_LOD
+#define SHADER_LOD 0
+#endif
+
+// 1 = the sun and sky are read from the baked lightmap (static objects at full detail, see Lightmaps.h)
+#ifndef LIGHTMAP
+#define LIGHTMAP 0
+#endif
+
 in vec2 TexCoords;
+flat in int MaterialIndex;
 in vec3 Normal;
 in vec3 FragPos;
+in vec2 Occlusion;		// baked per vertex: share of the sky (x) and the sun (y) that's blocked (see VertexOcclusion.h)
+#if SHADER_LOD > 0
+in vec2 Lighting;
+#endif
+#if LIGHTMAP
+in vec2 LightmapCoords;
+#endif
 
 out vec4 FragColor;
 
-// naming convention from mesh's Draw() function
-uniform sampler2D texture_diffuse1;
-uniform sampler2D texture_specular1;
+// every material's constants, texture layers and atlas rects, 5 texels each (see MaterialTable.h for the layout)
+uniform samplerBuffer materialData;
+
+// material textures, one array per texture size (samplers are assigned to texture units once when the program is built)
+uniform sampler2DArray materialTextures0;
+uniform sampler2DArray materialTextures1;
+uniform sampler2DArray materialTextures2;
+uniform sampler2DArray materialTextures3;
+
+struct Material
+{
+	vec3 diffuse;		// Kd and Ks from the .mtl file; used in place of the maps when a mesh doesn't have them
+	vec3 specular;
+	float shininess;	// Ns (not used for lighting yet; the sunlight's shininess is)
+	int diffuseArray;	// which materialTextures array each map is in (-1 when the material doesn't have it)
+	int specularArray;
+	float diffuseLayer;
+	float specularLayer;
+	vec4 diffuseRect;	// where each map is in its atlas (offset, scale), or all zero for a whole texture (see TextureAtlas.h)
+	vec4 specularRect;
+	float atlasMipLevels;
+};
+
+Material fetchMaterial(int index)
+{
+	int base = index * 5;
+	vec4 texel0 = texelFetch(materialData, base);
+	vec4 texel1 = texelFetch(materialData, base + 1);
+	vec4 texel2 = texelFetch(materialData, base + 2);
+
+	Material material;
+	material.diffuse = texel0.rgb;
+	material.diffuseArray = int(texel0.a);
+	material.specular = texel1.rgb;
+	material.specularArray = int(texel1.a);
+	material.diffuseLayer = texel2.x;
+	material.specularLayer = texel2.y;
+	material.shininess = texel2.z;
+	material.atlasMipLevels = texel2.w;
+	material.diffuseRect = texelFetch(materialData, base + 3);
+	material.specularRect = texelFetch(materialData, base + 4);
+	return material;
+}
+
+vec3 sampleLayer(sampler2DArray textures, float layer, vec4 rect, float atlasMipLevels)
+{
+	if (rect.z == 0.0)
+		return texture(textures, vec3(TexCoords, layer)).rgb;
+
+	// a texture in an atlas: wrap inside its rect (the sampler's GL_REPEAT would wrap around the whole atlas), and pick the
+	// mip level from the unwrapped coordinates, kept to the levels where its block doesn't mix with its neighbors
+	vec2 size = vec2(textureSize(textures, 0).xy) * rect.zw;
+	vec2 dx = dFdx(TexCoords) * size;
+	vec2 dy = dFdy(TexCoords) * size;
+	float lod = min(0.5 * log2(max(dot(dx, dx), dot(dy, dy))), atlasMipLevels);
+	return textureLod(textures, vec3(rect.xy + fract(TexCoords) * rect.zw, layer), lod).rgb;
+}
+
+// GLSL 3.30 can't index sampler arrays with a variable, hence the branches. The material index is flat, so every fragment
+// of a triangle (and so of each 2x2 quad) takes the same branch, and the implicit derivatives for mipmapping stay defined
+vec3 sampleMaterialTexture(int array, float layer, vec4 rect, float atlasMipLevels)
+{
+	if (array == 0)
+		return sampleLayer(materialTextures0, layer, rect, atlasMipLevels);
+	else if (array == 1)
+		return sampleLayer(materialTextures1, layer, rect, atlasMipLevels);
+	else if (array == 2)
+		return sampleLayer(materialTextures2, layer, rect, atlasMipLevels);
+	return sampleLayer(materialTextures3, layer, rect, atlasMipLevels);
+}
 
 struct SunLight 
 {
@@ -22,25 +107,160 @@ struct SunLight
 	int shininess;
 };
 
-uniform SunLight sunlight;
-uniform vec3 viewPos;
+// uploaded once per frame and shared by every model program (see FrameData.h)
+layout (std140) uniform FrameData
+{
+	SunLight sunlight;
+	vec3 viewPos;
+};
+
+// point and spot lights, 3 texels each, and each cluster's (first, count) into the light indices after them
+// (binned on the CPU every frame, see ClusteredLights.h for the layouts)
+uniform samplerBuffer lightData;
+uniform usamplerBuffer lightGrid;
+
+layout (std140) uniform LightClusters
+{
+	vec4 viewDepth;			// dot with (world position, 1) gives the distance in front of the camera
+	vec2 clusterScale;		// clusters per pixel
+	float sliceScale;		// depth slice = log(depth) * sliceScale + sliceBias
+	float sliceBias;
+	ivec4 clusterCounts;	// clusters across, up, and deep, and the number of lights
+	int lightBase;			// first texel of this frame's lights in lightData
+	int gridBase;			// first texel of this frame's cluster records in lightGrid
+};
+
+// RGB: the sun's and sky's diffuse light, bounces included; A: how much of the sun gets through (see Lightmaps.h)
+uniform sampler2D lightmap;
+
+// the sun's shadow cascades, one layer each (see CascadedShadows.h)
+uniform sampler2DArrayShadow shadowMap;
+
+layout (std140) uniform ShadowCascades
+{
+	mat4 cascadeMatrices[4];	// world space to shadow map coordinates and depth
+	vec4 cascadeEnds;			// distance in front of the camera where each cascade ends
+	vec4 cascadeTexelSizes;		// how far to push a fragment along its normal in each cascade (about a texel)
+	vec4 shadowViewDepth;		// dot with (world position, 1) gives the distance in front of the camera
+	int cascadeCount;			// 0 when shadows are off
+};
+
+// how much of the sun reaches the fragment: from the nearest cascade that covers it, 3x3 compares each filtered over 2x2
+// texels (one filtered compare for diffuse-only shading); past the last cascade (or with shadows off), the baked per-vertex visibility
+float sunVisibility(vec3 normal)
+{
+	float depth = dot(shadowViewDepth, vec4(FragPos, 1.0));
+	for (int i = 0; i < cascadeCount; ++i) {
+		if (depth > cascadeEnds[i])
+			continue;
+		vec4 coords = cascadeMatrices[i] * vec4(FragPos + normal * cascadeTexelSizes[i], 1.0);
+		if (any(lessThan(coords.xy, vec2(0.0))) || any(greaterThan(coords.xy, vec2(1.0))))
+			continue;		// a cached cascade that hasn't caught up with the camera yet; the next one covers more
+		float reference = min(coords.z, 1.0);		// past the farthest caster is as far as the map goes
+#if SHADER_LOD == 2
+		return texture(shadowMap, vec4(coords.xy, float(i), reference));
+#else
+		vec2 texel = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+		float lit = 0.0;
+		for (int y = -1; y <= 1; ++y) {
+			for (int x = -1; x <= 1; ++x)
+				lit += texture(shadowMap, vec4(coords.xy + vec2(x, y) * texel, float(i), reference));
+		}
+		return lit / 9.0;
+#endif
+	}
+	return 1.0 - Occlusion.y;
+}
+
+// diffuse (and at full detail, specular) light from the lights in the fragment's cluster
+vec3 clusteredLighting(vec3 normal, vec3 viewDir, vec3 diffuseColor, vec3 specularColor)
+{
+	float depth = dot(viewDepth, vec4(FragPos, 1.0));
+	int slice = clamp(int(floor(log(max(depth, 1e-4)) * sliceScale + sliceBias)), 0, clusterCounts.z - 1);
+	ivec2 tile = clamp(ivec2(gl_FragCoord.xy * clusterScale), ivec2(0), clusterCounts.xy - 1);
+	int cluster = gridBase + ((slice * clusterCounts.y + tile.y) * clusterCounts.x + tile.x) * 2;
+	int first = int(texelFetch(lightGrid, cluster).r);
+	int count = int(texelFetch(lightGrid, cluster + 1).r);
+
+	vec3 result = vec3(0.0);
+	for (int i = 0; i < count; ++i) {
+		int light = lightBase + int(texelFetch(lightGrid, first + i).r) * 3;
+		vec4 positionRange = texelFetch(lightData, light);
+		vec4 colorCosOuter = texelFetch(lightData, light + 1);
+
+		vec3 toLight = positionRange.xyz - FragPos;
+		float distance = length(toLight);
+		if (distance >= positionRange.w)
+			continue;
+		vec3 lightDir = toLight / distance;
+
+		// inverse-square, windowed so it reaches zero at the light's range
+		float window = clamp(1.0 - pow(distance / positionRange.w, 4.0), 0.0, 1.0);
+		float attenuation = window * window / (distance * distance + 1.0);
+		if (colorCosOuter.w >= -1.0) {
+			vec4 directionCosInner = texelFetch(lightData, light + 2);
+			attenuation *= smoothstep(colorCosOuter.w, directionCosInner.w, dot(-lightDir, directionCosInner.xyz));
+		}
+		vec3 radiance = colorCosOuter.rgb * attenuation;
+
+		result += max(dot(normal, lightDir), 0.0) * diffuseColor * radiance;
+#if SHADER_LOD == 0
+		vec3 reflectDir = reflect(-lightDir, normal);
+		result += pow(max(dot(viewDir, reflectDir), 0.0), sunlight.shininess) * specularColor * radiance;
+#endif
+	}
+	return result;
+}
 
 void main()
 {
-	// ambient
-	vec3 ambient = sunlight.ambientIntensity * sunlight.ambientColor * texture(texture_diffuse1, TexCoords).xyz;
+	Material material = fetchMaterial(MaterialIndex);
+	vec3 diffuseColor = material.diffuseArray >= 0 ? sampleMaterialTexture(material.diffuseArray, material.diffuseLayer, material.diffuseRect, material.atlasMipLevels) : material.diffuse;
+
+#if LIGHTMAP
+	// the baked light replaces the ambient term (it has the sky and the bounces in it) and the sun's diffuse term and shadow
+	vec4 baked = texture(lightmap, LightmapCoords);
+	vec3 ambient = vec3(0.0);
+#else
+	// ambient, less whatever the vertices were baked as blocking of the sky
+	vec3 ambient = (1.0 - Occlusion.x) * sunlight.ambientIntensity * sunlight.ambientColor * diffuseColor;
+#endif
+
+#if SHADER_LOD == 0
+	vec3 specularColor = material.specularArray >= 0 ? sampleMaterialTexture(material.specularArray, material.specularLayer, material.specularRect, material.atlasMipLevels) : material.specular;
 
 	// diffuse
 	vec3 normal = normalize(Normal);
 	vec3 lightDir = normalize(sunlight.position);	// for the sunlight, light's direction is same for all fragments; doesn't depend on fragment position
+#if LIGHTMAP
+	float shadow = baked.a;
+	vec3 diffuse = baked.rgb * diffuseColor;
+#else
+	float shadow = sunVisibility(normal);
 	float diff = max(dot(normal, lightDir), 0.0);
-	vec3 diffuse = diff * texture(texture_diffuse1, TexCoords).xyz * sunlight.diffuse; 
+	vec3 diffuse = shadow * diff * diffuseColor * sunlight.diffuse; 
+#endif
 
 	// specular
 	vec3 reflectDir = reflect(-lightDir, normal);	// lightDir is from origin to light (since it's just the position of the light); need it to be from light to origin, so use negative
 	vec3 viewDir = normalize(viewPos - FragPos);
 	float spec = pow(max(dot(viewDir, reflectDir), 0.0), sunlight.shininess);
-	vec3 specular = spec * texture(texture_specular1, TexCoords).xyz * sunlight.specular;
+	vec3 specular = shadow * spec * specularColor * sunlight.specular;
+
+	FragColor = vec4(ambient + diffuse + specular + clusteredLighting(normal, viewDir, diffuseColor, specularColor), 1.0);
+#else
+	// lighting factors were computed per vertex (see VertexShader.vert), but shadows still come from the fragment's own position
+	vec3 normal = normalize(Normal);
+	float shadow = sunVisibility(normal);
+	vec3 diffuse = shadow * Lighting.x * diffuseColor * sunlight.diffuse;
+#if SHADER_LOD == 1
+	vec3 specularColor = material.specularArray >= 0 ? sampleMaterialTexture(material.specularArray, material.specularLayer, material.specularRect, material.atlasMipLevels) : material.specular;
+	vec3 specular = shadow * Lighting.y * specularColor * sunlight.specular;
+#else
+	vec3 specular = vec3(0.0);
+#endif
 
-	FragColor = vec4(ambient + diffuse + specular, 1.0);
+	// point and spot lights are still per fragment here (their direction changes across a triangle), but diffuse only
+	FragColor = vec4(ambient + diffuse + specular + clusteredLighting(normal, vec3(0.0), diffuseColor, vec3(0.0)), 1.0);
+#endif
 }
\ No newline at end of file
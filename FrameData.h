@@ -0,0 +1,44 @@
+#ifndef FRAME_DATA_H
+#define FRAME_DATA_H
+
+#include <glad/glad.h>
+#include <glm/glm/glm.hpp>
+#include "GLState.h"
+#include "ShaderProgram.h"
+#include "RingBuffer.h"
+
+/// <summary>
+/// Matches the std140 layout of the FrameData uniform block in the model shaders. It's uploaded once per frame and
+/// shared by every program (and every shader LOD variant), instead of setting the same uniforms on each program.
+/// </summary>
+struct FrameData {
+	glm::vec3 sunPosition;
+	float sunAmbientIntensity;
+	glm::vec3 sunAmbientColor;
+	float pad0;
+	glm::vec3 sunDiffuse;
+	float pad1;
+	glm::vec3 sunSpecular;
+	int sunShininess;
+	glm::vec3 viewPos;
+	float pad2;
+};
+
+static_assert(sizeof(FrameData) == 80, "FrameData must match the std140 layout of the shader's uniform block");
+
+class FrameDataBuffer
+{
+	public:
+		/// <summary>
+		/// Writes the block into the frame's ring and binds it to FRAME_DATA_BINDING (call every frame, before drawing)
+		/// </summary>
+		void update(RingBuffer& ring, const FrameData& data)
+		{
+			RingBuffer::Allocation allocation = ring.allocate(sizeof(FrameData), ring.getUniformAlignment());
+			*(FrameData*)allocation.data = data;
+			ring.commit(allocation);
+			GLState::get().bindBufferRange(GL_UNIFORM_BUFFER, FRAME_DATA_BINDING, allocation.buffer, allocation.offset, sizeof(FrameData));
+		}
+};
+
+#endif
@@ -0,0 +1,226 @@
+#ifndef FRUSTUM_CULLER_H
+#define FRUSTUM_CULLER_H
+
+#include <vector>
+#include <glm/glm/glm.hpp>
+#include "Bounds.h"
+#include "Object.h"
+#include "SceneBVH.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FRUSTUM_CULLER_SSE
+#include <xmmintrin.h>
+#endif
+
+/// <summary>
+/// Culls objects, then the meshes of the objects that survive, against the view frustum.
+/// World-space boxes are gathered into structure-of-arrays form so they can be tested four at a time.
+/// Given a SceneBVH over the objects, objects are found with a hierarchical query instead of testing every one, and given
+/// precomputed visibility (e.g. from a PotentiallyVisibleSet), objects that can't be seen from the camera's position aren't tested at all.
+/// </summary>
+class FrustumCuller
+{
+	public:
+		struct Stats {
+			unsigned int objectsVisible = 0;
+			unsigned int objectsCulled = 0;
+			unsigned int objectsCulledByPVS = 0;	// included in objectsCulled
+			unsigned int meshesVisible = 0;		// only counts meshes of visible objects
+			unsigned int meshesCulled = 0;
+			unsigned int nodesVisited = 0;		// scene index nodes visited finding the visible objects
+		};
+
+	private:
+		// world-space boxes as center and extents, one array per component (padded to a multiple of 4)
+		struct BoxArrays {
+			std::vector<float> centerX, centerY, centerZ;
+			std::vector<float> extentX, extentY, extentZ;
+			std::vector<unsigned char> valid;		// empty boxes are never visible
+			size_t count = 0;
+
+			void clear(void)
+			{
+				count = 0;
+			}
+
+			void add(const AABB& box)
+			{
+				size_t padded = (count + 4) & ~size_t(3);
+				if (centerX.size() < padded) {
+					for (std::vector<float>* array : { &centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ })
+						array->resize(padded, 0.0f);
+					valid.resize(padded, 0);
+				}
+
+				glm::vec3 center = box.empty() ? glm::vec3(0.0f) : box.center();
+				glm::vec3 extents = box.empty() ? glm::vec3(0.0f) : box.extents();
+				centerX[count] = center.x;
+				centerY[count] = center.y;
+				centerZ[count] = center.z;
+				extentX[count] = extents.x;
+				extentY[count] = extents.y;
+				extentZ[count] = extents.z;
+				valid[count] = box.empty() ? 0 : 1;
+				++count;
+			}
+		};
+
+		BoxArrays boxes;
+		std::vector<unsigned char> objectVisible;
+		std::vector<unsigned char> meshVisible;		// every object's meshes, one after another
+		std::vector<size_t> meshOffsets;			// where each object's meshes start in meshVisible
+		std::vector<unsigned char> results;
+		std::vector<size_t> visibleObjects;
+		std::vector<int> queryResults;
+		Stats lastStats;
+
+		/// <summary>
+		/// Tests every box in boxes against the frustum; results[i] is 1 if box i is at least partly inside
+		/// </summary>
+		void testBoxes(const Frustum& frustum)
+		{
+			results.assign(boxes.count, 0);
+
+#ifdef FRUSTUM_CULLER_SSE
+			__m128 planeX[6], planeY[6], planeZ[6], planeW[6], absX[6], absY[6], absZ[6];
+			for (int p = 0; p < 6; ++p) {
+				const glm::vec4& plane = frustum.planes[p];
+				planeX[p] = _mm_set1_ps(plane.x);
+				planeY[p] = _mm_set1_ps(plane.y);
+				planeZ[p] = _mm_set1_ps(plane.z);
+				planeW[p] = _mm_set1_ps(plane.w);
+				absX[p] = _mm_set1_ps(std::fabs(plane.x));
+				absY[p] = _mm_set1_ps(std::fabs(plane.y));
+				absZ[p] = _mm_set1_ps(std::fabs(plane.z));
+			}
+
+			for (size_t i = 0; i < boxes.count; i += 4) {
+				__m128 cx = _mm_loadu_ps(&boxes.centerX[i]), cy = _mm_loadu_ps(&boxes.centerY[i]), cz = _mm_loadu_ps(&boxes.centerZ[i]);
+				__m128 ex = _mm_loadu_ps(&boxes.extentX[i]), ey = _mm_loadu_ps(&boxes.extentY[i]), ez = _mm_loadu_ps(&boxes.extentZ[i]);
+
+				__m128 outside = _mm_setzero_ps();
+				for (int p = 0; p < 6; ++p) {
+					// distance of the box's center from the plane, plus the box's projected radius onto the plane's normal
+					__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX[p], cx), _mm_mul_ps(planeY[p], cy)), _mm_add_ps(_mm_mul_ps(planeZ[p], cz), planeW[p]));
+					__m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(absX[p], ex), _mm_mul_ps(absY[p], ey)), _mm_mul_ps(absZ[p], ez));
+					outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(d, r), _mm_setzero_ps()));
+				}
+
+				int mask = _mm_movemask_ps(outside);
+				for (size_t j = 0; j < 4 && i + j < boxes.count; ++j)
+					results[i + j] = ((mask >> j) & 1) == 0 && boxes.valid[i + j];
+			}
+#else
+			for (size_t i = 0; i < boxes.count; ++i) {
+				bool inside = boxes.valid[i] != 0;
+				for (int p = 0; p < 6 && inside; ++p) {
+					const glm::vec4& plane = frustum.planes[p];
+					float d = plane.x * boxes.centerX[i] + plane.y * boxes.centerY[i] + plane.z * boxes.centerZ[i] + plane.w;
+					float r = std::fabs(plane.x) * boxes.extentX[i] + std::fabs(plane.y) * boxes.extentY[i] + std::fabs(plane.z) * boxes.extentZ[i];
+					inside = d + r >= 0.0f;
+				}
+				results[i] = inside;
+			}
+#endif
+		}
+
+	public:
+		/// <summary>
+		/// Decides which objects, and which of their meshes, can be seen this frame
+		/// </summary>
+		/// <param name="sceneIndex">Index over the objects' world bounds, with object i as item i (null tests every object)</param>
+		/// <param name="potentiallyVisible">One flag per object, 0 if it can't be seen from where the camera is (null if that isn't known)</param>
+		void cull(const std::vector<Object*>& objects, const glm::mat4& viewProjection, const SceneBVH* sceneIndex = nullptr, const unsigned char* potentiallyVisible = nullptr)
+		{
+			Frustum frustum = Frustum::fromMatrix(viewProjection);
+			Stats stats;
+			if (potentiallyVisible) {
+				for (size_t i = 0; i < objects.size(); ++i)
+					stats.objectsCulledByPVS += !potentiallyVisible[i];
+			}
+
+			// objects first
+			if (sceneIndex) {
+				SceneBVH::Stats indexStats = sceneIndex->getStats();
+				queryResults.clear();
+				sceneIndex->queryFrustum(frustum, queryResults);
+				stats.nodesVisited = sceneIndex->getStats().nodesVisited - indexStats.nodesVisited;
+
+				objectVisible.assign(objects.size(), 0);
+				for (int item : queryResults) {
+					if (item < (int)objects.size() && objects[item]->getModel().isLoaded() && (!potentiallyVisible || potentiallyVisible[item]))
+						objectVisible[item] = 1;
+				}
+			}
+			else {
+				boxes.clear();
+				for (size_t i = 0; i < objects.size(); ++i) {
+					bool test = objects[i]->getModel().isLoaded() && (!potentiallyVisible || potentiallyVisible[i]);
+					boxes.add(test ? objects[i]->getWorldBounds() : AABB());
+				}
+				testBoxes(frustum);
+				objectVisible = results;
+			}
+
+			// then the meshes of the objects that passed (an object with a single mesh already has its answer)
+			meshOffsets.resize(objects.size());
+			meshVisible.clear();
+			visibleObjects.clear();
+			boxes.clear();
+			for (size_t i = 0; i < objects.size(); ++i) {
+				const std::vector<Mesh>& meshes = objects[i]->getModel().getMeshes();
+				meshOffsets[i] = meshVisible.size();
+				meshVisible.resize(meshVisible.size() + meshes.size(), objectVisible[i]);
+
+				if (!objectVisible[i]) {
+					++stats.objectsCulled;
+					continue;
+				}
+				++stats.objectsVisible;
+				if (meshes.size() > 1) {
+					visibleObjects.push_back(i);
+					for (const Mesh& mesh : meshes)
+						boxes.add(transformAABB(mesh.getBounds(), objects[i]->getMatrix()));
+				}
+				else
+					stats.meshesVisible += (unsigned int)meshes.size();
+			}
+			testBoxes(frustum);
+
+			size_t box = 0;
+			for (size_t i : visibleObjects) {
+				size_t meshCount = objects[i]->getModel().getMeshes().size();
+				for (size_t j = 0; j < meshCount; ++j, ++box) {
+					meshVisible[meshOffsets[i] + j] = results[box];
+					if (results[box])
+						++stats.meshesVisible;
+					else
+						++stats.meshesCulled;
+				}
+			}
+
+			lastStats = stats;
+		}
+
+		/// <param name="object">Index in the vector passed to cull()</param>
+		bool isVisible(size_t object) const
+		{
+			return objectVisible[object] != 0;
+		}
+
+		/// <summary>
+		/// One flag per mesh of an object (for Object::Submit)
+		/// </summary>
+		/// <param name="object">Index in the vector passed to cull()</param>
+		const unsigned char* getMeshVisibility(size_t object) const
+		{
+			return meshVisible.data() + meshOffsets[object];
+		}
+
+		const Stats& getLastStats(void) const
+		{
+			return lastStats;
+		}
+};
+
+#endif
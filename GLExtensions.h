@@ -0,0 +1,103 @@
+#ifndef GL_EXTENSIONS_H
+#define GL_EXTENSIONS_H
+
+#include <cstring>
+#include <glad/glad.h>
+
+// glad is only generated for GL 3.3 core, so anything newer is defined and loaded here
+
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+// one command in a GL_DRAW_INDIRECT_BUFFER, as read by glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand {
+	unsigned int count;				// indices
+	unsigned int instanceCount;
+	unsigned int firstIndex;
+	int baseVertex;
+	unsigned int baseInstance;		// added to the instance number when fetching per-instance attributes
+};
+
+/// <summary>
+/// Entry points from GL versions (or extensions) newer than the 3.3 core that glad loads.
+/// Each one is null when the context doesn't support it, so callers check before using it and fall back to the 3.3 path.
+/// There is only one GL context, so there is one instance: GLExtensions::get().
+/// </summary>
+class GLExtensions
+{
+	public:
+		typedef void (APIENTRYP MultiDrawElementsIndirectProc)(GLenum mode, GLenum type, const void* indirect, GLsizei drawcount, GLsizei stride);
+
+		typedef void (APIENTRYP BufferStorageProc)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+
+		MultiDrawElementsIndirectProc multiDrawElementsIndirect;	// GL 4.3, or ARB_multi_draw_indirect + ARB_base_instance
+		BufferStorageProc bufferStorage;							// GL 4.4, or ARB_buffer_storage (immutable storage that can stay mapped)
+
+	private:
+		int major, minor;
+
+		GLExtensions() : multiDrawElementsIndirect{ nullptr }, bufferStorage{ nullptr }, major{ 3 }, minor{ 3 } {}
+
+	public:
+		static GLExtensions& get(void)
+		{
+			static GLExtensions extensions;
+			return extensions;
+		}
+
+		GLExtensions(const GLExtensions&) = delete;
+		GLExtensions& operator=(const GLExtensions&) = delete;
+
+		/// <summary>
+		/// Looks up everything the current context supports (call once, after gladLoadGLLoader)
+		/// </summary>
+		/// <param name="loader">Same function that was passed to gladLoadGLLoader</param>
+		void load(GLADloadproc loader)
+		{
+			glGetIntegerv(GL_MAJOR_VERSION, &major);
+			glGetIntegerv(GL_MINOR_VERSION, &minor);
+
+			if (hasVersion(4, 3) || (hasExtension("GL_ARB_multi_draw_indirect") && hasExtension("GL_ARB_base_instance")))
+				multiDrawElementsIndirect = (MultiDrawElementsIndirectProc)loader("glMultiDrawElementsIndirect");
+			if (hasVersion(4, 4) || hasExtension("GL_ARB_buffer_storage"))
+				bufferStorage = (BufferStorageProc)loader("glBufferStorage");
+		}
+
+		bool hasVersion(int requiredMajor, int requiredMinor) const
+		{
+			return major > requiredMajor || (major == requiredMajor && minor >= requiredMinor);
+		}
+
+		static bool hasExtension(const char* name)
+		{
+			int count = 0;
+			glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+			for (int i = 0; i < count; ++i) {
+				const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+				if (extension && std::strcmp(extension, name) == 0)
+					return true;
+			}
+			return false;
+		}
+
+		bool hasMultiDrawIndirect(void) const
+		{
+			return multiDrawElementsIndirect != nullptr;
+		}
+
+		bool hasBufferStorage(void) const
+		{
+			return bufferStorage != nullptr;
+		}
+};
+
+#endif
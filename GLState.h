@@ -0,0 +1,306 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <glad/glad.h>
+#include "GLExtensions.h"
+
+/// <summary>
+/// Tracks the GL state we change while drawing (program, vertex array, buffers, textures, samplers, depth/blend state)
+/// and only issues a GL call when the requested value differs from the current one.
+/// There is only one GL context, so there is one instance: GLState::get().
+/// NOTE: Everything that binds or deletes these objects has to go through this class (or call invalidate() afterwards),
+/// otherwise the cached values won't match the real GL state.
+/// </summary>
+class GLState
+{
+	public:
+		struct Stats {
+			unsigned int issued = 0;	// GL calls that were actually made
+			unsigned int elided = 0;	// GL calls skipped because the state already matched
+		};
+
+		static const int MAX_TEXTURE_UNITS = 16;
+
+	private:
+		static const unsigned int UNKNOWN = 0xFFFFFFFFu;	// forces the next call to be issued
+		static const int NUM_TEXTURE_TARGETS = 4;
+		static const int NUM_BUFFER_TARGETS = 5;
+		static const int NUM_CAPS = 4;
+
+		unsigned int program;
+		unsigned int vertexArray;
+		unsigned int buffers[NUM_BUFFER_TARGETS];
+		unsigned int activeUnit;
+		unsigned int textures[MAX_TEXTURE_UNITS][NUM_TEXTURE_TARGETS];
+		unsigned int samplers[MAX_TEXTURE_UNITS];
+		unsigned int caps[NUM_CAPS];		// 0 = disabled, 1 = enabled, UNKNOWN
+		unsigned int depthFuncValue;
+		unsigned int depthMaskValue;
+		unsigned int blendSrc, blendDst;
+
+		Stats frameStats;
+		Stats lastFrameStats;
+
+		GLState()
+		{
+			invalidate();
+		}
+
+		static int textureSlot(GLenum target)
+		{
+			switch (target) {
+				case GL_TEXTURE_2D:			return 0;
+				case GL_TEXTURE_CUBE_MAP:	return 1;
+				case GL_TEXTURE_2D_ARRAY:	return 2;
+				case GL_TEXTURE_BUFFER:		return 3;
+				default:					return -1;
+			}
+		}
+
+		static int bufferSlot(GLenum target)
+		{
+			switch (target) {
+				case GL_ARRAY_BUFFER:			return 0;
+				case GL_ELEMENT_ARRAY_BUFFER:	return 1;		// part of the vertex array's state; reset whenever the vertex array changes
+				case GL_UNIFORM_BUFFER:			return 2;
+				case GL_TEXTURE_BUFFER:			return 3;
+				case GL_DRAW_INDIRECT_BUFFER:	return 4;
+				default:						return -1;
+			}
+		}
+
+		static int capSlot(GLenum cap)
+		{
+			switch (cap) {
+				case GL_DEPTH_TEST:				return 0;
+				case GL_BLEND:					return 1;
+				case GL_CULL_FACE:				return 2;
+				case GL_POLYGON_OFFSET_FILL:	return 3;
+				default:						return -1;
+			}
+		}
+
+		/// <returns>Whether the call has to be issued (and records the new value if so)</returns>
+		bool change(unsigned int& current, unsigned int value)
+		{
+			if (current == value) {
+				++frameStats.elided;
+				return false;
+			}
+			current = value;
+			++frameStats.issued;
+			return true;
+		}
+
+		void passThrough(void)
+		{
+			++frameStats.issued;
+		}
+
+	public:
+		static GLState& get(void)
+		{
+			static GLState state;
+			return state;
+		}
+
+		GLState(const GLState&) = delete;
+		GLState& operator=(const GLState&) = delete;
+
+		/// <summary>
+		/// Forget everything that's cached, so the next call for each piece of state is issued.
+		/// Call this after any code that changes GL state directly.
+		/// </summary>
+		void invalidate(void)
+		{
+			program = UNKNOWN;
+			vertexArray = UNKNOWN;
+			for (unsigned int& buffer : buffers)
+				buffer = UNKNOWN;
+			activeUnit = UNKNOWN;
+			for (int i = 0; i < MAX_TEXTURE_UNITS; ++i) {
+				for (int j = 0; j < NUM_TEXTURE_TARGETS; ++j)
+					textures[i][j] = UNKNOWN;
+				samplers[i] = UNKNOWN;
+			}
+			for (unsigned int& cap : caps)
+				cap = UNKNOWN;
+			depthFuncValue = UNKNOWN;
+			depthMaskValue = UNKNOWN;
+			blendSrc = blendDst = UNKNOWN;
+		}
+
+		/// <summary>
+		/// Call at the start of every frame; the counts for the frame that just finished become available through getLastFrameStats()
+		/// </summary>
+		void beginFrame(void)
+		{
+			lastFrameStats = frameStats;
+			frameStats = Stats();
+		}
+
+		const Stats& getLastFrameStats(void) const
+		{
+			return lastFrameStats;
+		}
+
+		void useProgram(unsigned int id)
+		{
+			if (change(program, id))
+				glUseProgram(id);
+		}
+
+		void bindVertexArray(unsigned int id)
+		{
+			if (change(vertexArray, id)) {
+				glBindVertexArray(id);
+				buffers[bufferSlot(GL_ELEMENT_ARRAY_BUFFER)] = UNKNOWN;
+			}
+		}
+
+		void bindBuffer(GLenum target, unsigned int id)
+		{
+			int slot = bufferSlot(target);
+			if (slot < 0) {
+				passThrough();
+				glBindBuffer(target, id);
+			}
+			else if (change(buffers[slot], id))
+				glBindBuffer(target, id);
+		}
+
+		/// <summary>
+		/// Binds a buffer to an indexed binding point (uniform blocks); this also changes the target's generic binding
+		/// </summary>
+		void bindBufferBase(GLenum target, unsigned int index, unsigned int id)
+		{
+			passThrough();
+			glBindBufferBase(target, index, id);
+			int slot = bufferSlot(target);
+			if (slot >= 0)
+				buffers[slot] = id;
+		}
+
+		/// <summary>
+		/// Binds part of a buffer to an indexed binding point; like bindBufferBase(), this also changes the target's generic binding
+		/// </summary>
+		void bindBufferRange(GLenum target, unsigned int index, unsigned int id, size_t offset, size_t size)
+		{
+			passThrough();
+			glBindBufferRange(target, index, id, (GLintptr)offset, (GLsizeiptr)size);
+			int slot = bufferSlot(target);
+			if (slot >= 0)
+				buffers[slot] = id;
+		}
+
+		void activeTexture(unsigned int unit)
+		{
+			if (change(activeUnit, unit))
+				glActiveTexture(GL_TEXTURE0 + unit);
+		}
+
+		/// <summary>
+		/// Binds a texture to a texture unit and leaves that unit active, so glTexImage2D and the like edit this texture
+		/// even when the bind itself is skipped (switching the active unit is cached too, so that costs nothing extra)
+		/// </summary>
+		void bindTexture(unsigned int unit, GLenum target, unsigned int id)
+		{
+			activeTexture(unit);
+			int slot = textureSlot(target);
+			if (slot < 0 || unit >= MAX_TEXTURE_UNITS) {
+				passThrough();
+				glBindTexture(target, id);
+			}
+			else if (change(textures[unit][slot], id))
+				glBindTexture(target, id);
+		}
+
+		void bindSampler(unsigned int unit, unsigned int id)
+		{
+			if (unit >= MAX_TEXTURE_UNITS) {
+				passThrough();
+				glBindSampler(unit, id);
+			}
+			else if (change(samplers[unit], id))
+				glBindSampler(unit, id);
+		}
+
+		void setEnabled(GLenum cap, bool enabled)
+		{
+			int slot = capSlot(cap);
+			if (slot >= 0 && !change(caps[slot], enabled ? 1 : 0))
+				return;
+			if (slot < 0)
+				passThrough();
+
+			if (enabled)
+				glEnable(cap);
+			else
+				glDisable(cap);
+		}
+
+		void depthFunc(GLenum func)
+		{
+			if (change(depthFuncValue, func))
+				glDepthFunc(func);
+		}
+
+		void depthMask(bool write)
+		{
+			if (change(depthMaskValue, write ? 1 : 0))
+				glDepthMask(write ? GL_TRUE : GL_FALSE);
+		}
+
+		void blendFunc(GLenum src, GLenum dst)
+		{
+			if (blendSrc == src && blendDst == dst) {
+				++frameStats.elided;
+				return;
+			}
+			blendSrc = src;
+			blendDst = dst;
+			passThrough();
+			glBlendFunc(src, dst);
+		}
+
+		// deleting an object unbinds it everywhere it's bound, so the cache has to follow suit
+		// (otherwise a new object that reuses the name could wrongly be treated as already bound)
+
+		void deleteProgram(unsigned int id)
+		{
+			glDeleteProgram(id);
+			if (program == id)
+				program = UNKNOWN;		// a deleted program stays in use until another is selected, so just force the next use
+		}
+
+		void deleteVertexArray(unsigned int id)
+		{
+			glDeleteVertexArrays(1, &id);
+			if (vertexArray == id) {
+				vertexArray = 0;
+				buffers[bufferSlot(GL_ELEMENT_ARRAY_BUFFER)] = UNKNOWN;
+			}
+		}
+
+		void deleteBuffer(unsigned int id)
+		{
+			glDeleteBuffers(1, &id);
+			for (unsigned int& buffer : buffers) {
+				if (buffer == id)
+					buffer = 0;
+			}
+		}
+
+		void deleteTexture(unsigned int id)
+		{
+			glDeleteTextures(1, &id);
+			for (int i = 0; i < MAX_TEXTURE_UNITS; ++i) {
+				for (int j = 0; j < NUM_TEXTURE_TARGETS; ++j) {
+					if (textures[i][j] == id)
+						textures[i][j] = 0;
+				}
+			}
+		}
+};
+
+#endif
@@ -0,0 +1,376 @@
+#ifndef GEOMETRY_BUFFER_H
+#define GEOMETRY_BUFFER_H
+
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+#include <glad/glad.h>
+#include <glm/glm/glm.hpp>
+#include "GLState.h"
+
+struct Vertex {
+	glm::vec3 Position;
+	glm::vec3 Normal;
+	glm::vec2 TexCoords;
+	glm::vec2 LightmapCoords;	// in the model's lightmap charts (see LightmapCharts.h), which Lightmaps places per object
+	unsigned char Occlusion[2];	// baked share of the sky (0) and the sun (1) that's blocked, 0-255 (see VertexOcclusion.h); 0 is open
+};
+
+// the object's entry in ObjectConstants (layout = 3): read per instance when drawing instanced,
+// otherwise it's the attribute's constant value, set with glVertexAttribI1i
+const unsigned int OBJECT_INDEX_ATTRIB = 3;
+
+// the mesh's entry in MaterialTable (layout = 4): read per instance next to the object index when drawing instanced,
+// otherwise it's the attribute's constant value, set by Material::apply()
+const unsigned int MATERIAL_INDEX_ATTRIB = 4;
+
+// one instance's entry in an instance buffer
+struct InstanceIndices {
+	int object;			// OBJECT_INDEX_ATTRIB
+	int material;		// MATERIAL_INDEX_ATTRIB
+};
+
+// where a mesh's vertices and indices live in the GeometryBuffer (indices are relative to baseVertex)
+// ranges from addIndices() have a vertexCount of 0: they use another range's vertices, which they don't own
+struct GeometryRange {
+	size_t baseVertex = 0;
+	size_t vertexCount = 0;
+	size_t firstIndex = 0;
+	size_t indexCount = 0;
+};
+
+/// <summary>
+/// One vertex buffer and one index buffer that every mesh's geometry is suballocated from, drawn through a single vertex array.
+/// Since all meshes share the vertex array, switching meshes never changes vertex state, and a whole pass can be drawn
+/// with glMultiDrawElementsIndirect when the context supports it.
+/// Every vertex's position is also copied into a position-only buffer with its own vertex array (same vertex offsets, same
+/// index buffer), which depth-only passes draw from after useStream(POSITION_STREAM) so they fetch 12 bytes per vertex instead of a whole Vertex.
+/// There is only one GL context, so there is one instance: GeometryBuffer::get().
+/// </summary>
+class GeometryBuffer
+{
+	public:
+		// the vertex data that draws read
+		enum Stream {
+			FULL_STREAM = 0,		// interleaved Vertex: position, normal, texture and lightmap coordinates, baked occlusion
+			POSITION_STREAM = 1,	// positions only (layout = 0), for passes that only write depth
+			NUM_STREAMS = 2
+		};
+
+	private:
+		// first-fit allocator over [0, end) that reuses freed ranges (models get re-uploaded when they're hot reloaded)
+		class RangeAllocator
+		{
+			private:
+				std::vector<std::pair<size_t, size_t>> freeRanges;		// (offset, size), sorted by offset
+				size_t end = 0;
+
+			public:
+				size_t allocate(size_t size)
+				{
+					for (size_t i = 0; i < freeRanges.size(); ++i) {
+						if (freeRanges[i].second >= size) {
+							size_t offset = freeRanges[i].first;
+							freeRanges[i].first += size;
+							freeRanges[i].second -= size;
+							if (freeRanges[i].second == 0)
+								freeRanges.erase(freeRanges.begin() + i);
+							return offset;
+						}
+					}
+
+					size_t offset = end;
+					end += size;
+					return offset;
+				}
+
+				void release(size_t offset, size_t size)
+				{
+					if (size == 0)
+						return;
+
+					auto it = std::lower_bound(freeRanges.begin(), freeRanges.end(), std::make_pair(offset, size_t(0)));
+					it = freeRanges.insert(it, { offset, size });
+
+					// merge with the following and preceding ranges
+					if (it + 1 != freeRanges.end() && it->first + it->second == (it + 1)->first) {
+						it->second += (it + 1)->second;
+						freeRanges.erase(it + 1);
+					}
+					if (it != freeRanges.begin() && (it - 1)->first + (it - 1)->second == it->first) {
+						(it - 1)->second += it->second;
+						it = freeRanges.erase(it) - 1;
+					}
+
+					// give the tail back, so the buffer's used size shrinks
+					if (it + 1 == freeRanges.end() && it->first + it->second == end) {
+						end = it->first;
+						freeRanges.erase(it);
+					}
+				}
+
+				size_t size(void) const
+				{
+					return end;
+				}
+		};
+
+		unsigned int VAOs[NUM_STREAMS];
+		unsigned int VBO, positionVBO, EBO;
+		size_t vertexCapacity, indexCapacity;	// in vertices and indices
+		RangeAllocator vertexRanges, indexRanges;
+		Stream stream;		// which vertex array draws go through
+		bool instanceArrayEnabled[NUM_STREAMS];		// whether OBJECT_INDEX_ATTRIB and MATERIAL_INDEX_ATTRIB are read from an instance buffer instead of their constant values
+		std::vector<const void*> partOffsets;		// reused by drawParts()
+		std::vector<GLint> partBaseVertices;
+		std::vector<glm::vec3> positions;			// reused by add()
+
+		GeometryBuffer() : VBO{ 0 }, positionVBO{ 0 }, EBO{ 0 }, vertexCapacity{ 0 }, indexCapacity{ 0 }, stream{ FULL_STREAM }, instanceArrayEnabled{ false, false }
+		{
+			glGenVertexArrays(NUM_STREAMS, VAOs);
+			reserve(1 << 16, 1 << 18);
+		}
+
+		/// <summary>
+		/// Replaces a buffer with a larger one, copying over the used part
+		/// </summary>
+		static void grow(unsigned int& buffer, size_t usedBytes, size_t newBytes)
+		{
+			unsigned int newBuffer;
+			glGenBuffers(1, &newBuffer);
+			GLState::get().bindBuffer(GL_COPY_WRITE_BUFFER, newBuffer);
+			glBufferData(GL_COPY_WRITE_BUFFER, newBytes, NULL, GL_STATIC_DRAW);
+
+			if (usedBytes > 0) {
+				GLState::get().bindBuffer(GL_COPY_READ_BUFFER, buffer);
+				glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, usedBytes);
+			}
+
+			if (buffer != 0)
+				GLState::get().deleteBuffer(buffer);
+			buffer = newBuffer;
+		}
+
+		void reserve(size_t vertices, size_t indices)
+		{
+			if (vertices <= vertexCapacity && indices <= indexCapacity)
+				return;
+
+			if (vertices > vertexCapacity) {
+				size_t newCapacity = std::max(vertices, vertexCapacity * 2);
+				grow(VBO, std::min(vertexRanges.size(), vertexCapacity) * sizeof(Vertex), newCapacity * sizeof(Vertex));		// the allocator has already counted the range being added
+				grow(positionVBO, std::min(vertexRanges.size(), vertexCapacity) * sizeof(glm::vec3), newCapacity * sizeof(glm::vec3));
+				vertexCapacity = newCapacity;
+			}
+			if (indices > indexCapacity) {
+				size_t newCapacity = std::max(indices, indexCapacity * 2);
+				grow(EBO, std::min(indexRanges.size(), indexCapacity) * sizeof(unsigned int), newCapacity * sizeof(unsigned int));
+				indexCapacity = newCapacity;
+			}
+
+			// the vertex arrays refer to the buffers by name, so point them at the new ones
+			GLState::get().bindVertexArray(VAOs[FULL_STREAM]);
+			GLState::get().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+			GLState::get().bindBuffer(GL_ARRAY_BUFFER, VBO);
+
+			// position data	(layout = 0)
+			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);	// using sizeof(Vertex) for the stride
+			glEnableVertexAttribArray(0);
+
+			// normal data	(layout = 1)
+			glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+			glEnableVertexAttribArray(1);
+
+			// texture coordinate data	 (layout = 2)
+			glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+			glEnableVertexAttribArray(2);
+
+			// lightmap coordinate data	 (layout = 5)
+			glVertexAttribPointer(5, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, LightmapCoords));
+			glEnableVertexAttribArray(5);
+
+			// baked occlusion data	 (layout = 6), normalized to [0, 1]
+			glVertexAttribPointer(6, 2, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), (void*)offsetof(Vertex, Occlusion));
+			glEnableVertexAttribArray(6);
+
+			// object and material indices	(layout = 3, 4); the arrays are only enabled for instanced draws, which point them at an instance buffer
+			glVertexAttribDivisor(OBJECT_INDEX_ATTRIB, 1);
+			glVertexAttribDivisor(MATERIAL_INDEX_ATTRIB, 1);
+
+			// the position-only array shares the index buffer, so the same ranges draw the same triangles from either
+			GLState::get().bindVertexArray(VAOs[POSITION_STREAM]);
+			GLState::get().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+			GLState::get().bindBuffer(GL_ARRAY_BUFFER, positionVBO);
+
+			// position data	(layout = 0)
+			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+			glEnableVertexAttribArray(0);
+
+			glVertexAttribDivisor(OBJECT_INDEX_ATTRIB, 1);
+			glVertexAttribDivisor(MATERIAL_INDEX_ATTRIB, 1);
+		}
+
+		void useConstantIndices(void)
+		{
+			if (instanceArrayEnabled[stream]) {
+				glDisableVertexAttribArray(OBJECT_INDEX_ATTRIB);		// back to the constant values set with glVertexAttribI1i
+				glDisableVertexAttribArray(MATERIAL_INDEX_ATTRIB);
+				instanceArrayEnabled[stream] = false;
+			}
+		}
+
+	public:
+		static GeometryBuffer& get(void)
+		{
+			static GeometryBuffer geometry;
+			return geometry;
+		}
+
+		GeometryBuffer(const GeometryBuffer&) = delete;
+		GeometryBuffer& operator=(const GeometryBuffer&) = delete;
+
+		/// <summary>
+		/// Copies a mesh's vertices and indices into the buffers
+		/// </summary>
+		GeometryRange add(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices)
+		{
+			GeometryRange range;
+			range.vertexCount = vertices.size();
+			range.indexCount = indices.size();
+			range.baseVertex = vertexRanges.allocate(range.vertexCount);
+			range.firstIndex = indexRanges.allocate(range.indexCount);
+			reserve(vertexRanges.size(), indexRanges.size());
+
+			GLState::get().bindBuffer(GL_ARRAY_BUFFER, VBO);
+			if (!vertices.empty())
+				glBufferSubData(GL_ARRAY_BUFFER, range.baseVertex * sizeof(Vertex), vertices.size() * sizeof(Vertex), vertices.data());
+
+			positions.clear();
+			for (const Vertex& vertex : vertices)
+				positions.push_back(vertex.Position);
+			GLState::get().bindBuffer(GL_ARRAY_BUFFER, positionVBO);
+			if (!positions.empty())
+				glBufferSubData(GL_ARRAY_BUFFER, range.baseVertex * sizeof(glm::vec3), positions.size() * sizeof(glm::vec3), positions.data());
+
+			GLState::get().bindVertexArray(VAOs[FULL_STREAM]);		// the element buffer binding belongs to the vertex array
+			GLState::get().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+			if (!indices.empty())
+				glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, range.firstIndex * sizeof(unsigned int), indices.size() * sizeof(unsigned int), indices.data());
+
+			return range;
+		}
+
+		/// <summary>
+		/// Copies another index list for vertices that are already in the buffers (e.g. a simplified version of a mesh)
+		/// </summary>
+		/// <param name="vertices">Range the indices refer to</param>
+		GeometryRange addIndices(const GeometryRange& vertices, const std::vector<unsigned int>& indices)
+		{
+			GeometryRange range;
+			range.baseVertex = vertices.baseVertex;
+			range.indexCount = indices.size();
+			range.firstIndex = indexRanges.allocate(range.indexCount);
+			reserve(vertexRanges.size(), indexRanges.size());
+
+			GLState::get().bindVertexArray(VAOs[FULL_STREAM]);
+			GLState::get().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+			if (!indices.empty())
+				glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, range.firstIndex * sizeof(unsigned int), indices.size() * sizeof(unsigned int), indices.data());
+
+			return range;
+		}
+
+		/// <summary>
+		/// Frees a range so later meshes can reuse it
+		/// </summary>
+		void remove(const GeometryRange& range)
+		{
+			vertexRanges.release(range.baseVertex, range.vertexCount);
+			indexRanges.release(range.firstIndex, range.indexCount);
+		}
+
+		unsigned int getVAO(void) const
+		{
+			return VAOs[stream];
+		}
+
+		/// <summary>
+		/// Selects the vertex data that the following draws read (switch back to FULL_STREAM after a depth-only pass)
+		/// </summary>
+		void useStream(Stream newStream)
+		{
+			stream = newStream;
+		}
+
+		Stream getStream(void) const
+		{
+			return stream;
+		}
+
+		/// <summary>
+		/// Draws one copy of a range (the object and material indices come from the constant values of their attributes)
+		/// </summary>
+		void draw(const GeometryRange& range)
+		{
+			GLState::get().bindVertexArray(VAOs[stream]);
+			useConstantIndices();
+			glDrawElementsBaseVertex(GL_TRIANGLES, (GLsizei)range.indexCount, GL_UNSIGNED_INT, (void*)(range.firstIndex * sizeof(unsigned int)), (GLint)range.baseVertex);
+		}
+
+		/// <summary>
+		/// Draws several parts of a range's indices in one call (e.g. the parts of a static batch that are on screen)
+		/// </summary>
+		/// <param name="counts">Number of indices in each part</param>
+		/// <param name="firstIndices">Where each part starts, relative to the range's first index</param>
+		void drawParts(const GeometryRange& range, const std::vector<GLsizei>& counts, const std::vector<size_t>& firstIndices)
+		{
+			if (counts.size() == 1) {
+				GeometryRange part = range;
+				part.firstIndex += firstIndices[0];
+				part.indexCount = counts[0];
+				draw(part);
+				return;
+			}
+
+			partOffsets.resize(counts.size());
+			partBaseVertices.assign(counts.size(), (GLint)range.baseVertex);
+			for (size_t i = 0; i < counts.size(); ++i)
+				partOffsets[i] = (const void*)((range.firstIndex + firstIndices[i]) * sizeof(unsigned int));
+
+			GLState::get().bindVertexArray(VAOs[stream]);
+			useConstantIndices();
+			glMultiDrawElementsBaseVertex(GL_TRIANGLES, counts.data(), GL_UNSIGNED_INT, partOffsets.data(), (GLsizei)counts.size(), partBaseVertices.data());
+		}
+
+		/// <summary>
+		/// Draws several copies of a range in one call
+		/// </summary>
+		/// <param name="instanceBuffer">Buffer of InstanceIndices, one per instance</param>
+		/// <param name="firstInstance">Index in the buffer of the first instance's entry</param>
+		/// <param name="count">Number of instances</param>
+		void drawInstanced(const GeometryRange& range, unsigned int instanceBuffer, size_t firstInstance, int count)
+		{
+			bindInstanceBuffer(instanceBuffer, firstInstance);		// no base instance in GL 3.3, so the offset goes in the pointer
+			glDrawElementsInstancedBaseVertex(GL_TRIANGLES, (GLsizei)range.indexCount, GL_UNSIGNED_INT, (void*)(range.firstIndex * sizeof(unsigned int)), count, (GLint)range.baseVertex);
+		}
+
+		/// <summary>
+		/// Binds the vertex array and makes OBJECT_INDEX_ATTRIB and MATERIAL_INDEX_ATTRIB read per instance from a buffer of
+		/// InstanceIndices, starting at firstInstance (indirect draws leave this at 0 and select their range with the command's base instance)
+		/// </summary>
+		void bindInstanceBuffer(unsigned int instanceBuffer, size_t firstInstance)
+		{
+			GLState::get().bindVertexArray(VAOs[stream]);
+			GLState::get().bindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+			size_t offset = firstInstance * sizeof(InstanceIndices);
+			glVertexAttribIPointer(OBJECT_INDEX_ATTRIB, 1, GL_INT, sizeof(InstanceIndices), (void*)(offset + offsetof(InstanceIndices, object)));
+			glVertexAttribIPointer(MATERIAL_INDEX_ATTRIB, 1, GL_INT, sizeof(InstanceIndices), (void*)(offset + offsetof(InstanceIndices, material)));
+			if (!instanceArrayEnabled[stream]) {
+				glEnableVertexAttribArray(OBJECT_INDEX_ATTRIB);
+				glEnableVertexAttribArray(MATERIAL_INDEX_ATTRIB);
+				instanceArrayEnabled[stream] = true;
+			}
+		}
+};
+
+#endif
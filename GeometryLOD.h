@@ -0,0 +1,129 @@
+#ifndef GEOMETRY_LOD_H
+#define GEOMETRY_LOD_H
+
+#include <cmath>
+#include <algorithm>
+#include <glm/glm/glm.hpp>
+#include "Object.h"
+#include "Bounds.h"
+#include "ShaderLOD.h"
+
+/// <summary>
+/// Picks which of its levels of detail (built by MeshSimplifier when the model was imported) each object is drawn with:
+/// the coarsest level whose error, projected to the screen from the closest point of the object's bounds, stays under a pixel threshold.
+/// Switching to a coarser level needs the error to be well under the threshold (and switching to a finer one, over it),
+/// so objects near a switching distance don't flicker between levels. Objects that cover almost no pixels aren't drawn at all.
+/// The current level is kept in each Object.
+/// </summary>
+class GeometryLOD
+{
+	public:
+		static const int MAX_LEVELS = 5;		// full detail plus MeshSimplifier's simplified levels
+		static const int CULLED = -1;
+
+		struct Settings {
+			float maxPixelError = 1.0f;		// on-screen error allowed, in pixels
+			float hysteresis = 0.25f;		// a coarser level is only picked once its error is this much (as a fraction) under maxPixelError
+			float cullBelow = 2.0f;			// objects whose projected diameter is smaller (in pixels) aren't drawn
+		};
+
+		struct Stats {
+			unsigned int objects[MAX_LEVELS] = {};		// objects drawn at each level
+			unsigned int culled = 0;					// objects too small to draw
+			unsigned int switches = 0;					// objects whose level changed this frame
+			size_t triangles = 0;						// triangles of the levels picked
+			size_t fullTriangles = 0;					// triangles the same objects have at full detail
+		};
+
+		Settings settings;
+
+	private:
+		Stats frameStats;
+		Stats lastFrameStats;
+
+		static size_t triangleCount(const Model& model, size_t lod)
+		{
+			size_t triangles = 0;
+			for (const Mesh& mesh : model.getMeshes())
+				triangles += mesh.getGeometry(lod).indexCount / 3;
+			return triangles;
+		}
+
+	public:
+		/// <summary>
+		/// Size in pixels of a world-space length at a distance from the camera
+		/// </summary>
+		static float projectedLength(float length, float distance, const glm::mat4& projection, float viewportHeight)
+		{
+			if (distance <= 0.0f)
+				return INFINITY;
+			return length / distance * projection[1][1] * viewportHeight * 0.5f;	// projection[1][1] = 1 / tan(fovy / 2)
+		}
+
+		/// <summary>
+		/// Picks an object's level of detail (updating the object), and records it in this frame's stats
+		/// </summary>
+		/// <param name="projection">Perspective projection matrix</param>
+		/// <param name="viewportHeight">Viewport height in pixels</param>
+		/// <returns>The level to draw, or CULLED if the object is too small to be worth drawing</returns>
+		int select(Object& object, const glm::vec3& cameraPos, const glm::mat4& projection, float viewportHeight)
+		{
+			const Model& model = object.getModel();
+			if (!model.isLoaded())
+				return 0;
+
+			BoundingSphere sphere = object.getWorldSphere();
+			int previous = object.getLODLevel();
+			int level;
+
+			float diameter = ShaderLOD::projectedDiameter(sphere, cameraPos, projection, viewportHeight);
+			if (diameter < settings.cullBelow || (previous == CULLED && diameter < settings.cullBelow * (1.0f + settings.hysteresis)))
+				level = CULLED;
+			else {
+				// the model's errors are in model units; scale them like the bounding sphere was
+				const BoundingSphere& modelSphere = model.getBoundingSphere();
+				float scale = modelSphere.radius > 0.0f ? sphere.radius / modelSphere.radius : 1.0f;
+				float distance = glm::length(sphere.center - cameraPos) - sphere.radius;	// closest any part of the object can be
+
+				int levels = std::min((int)model.getLODCount(), (int)MAX_LEVELS);
+				int current = std::min(std::max(previous, 0), levels - 1);
+				auto pixelError = [&](int lod) { return projectedLength(model.getLODError(lod) * scale, distance, projection, viewportHeight); };
+
+				level = current;
+				if (pixelError(current) > settings.maxPixelError) {
+					while (level > 0 && pixelError(level) > settings.maxPixelError)
+						--level;
+				}
+				else {
+					while (level + 1 < levels && pixelError(level + 1) <= settings.maxPixelError * (1.0f - settings.hysteresis))
+						++level;
+				}
+			}
+
+			if (level != previous)
+				++frameStats.switches;
+			object.setLODLevel(level);
+
+			if (level == CULLED)
+				++frameStats.culled;
+			else {
+				++frameStats.objects[level];
+				frameStats.triangles += triangleCount(model, level);
+				frameStats.fullTriangles += triangleCount(model, 0);
+			}
+			return level;
+		}
+
+		void beginFrame(void)
+		{
+			lastFrameStats = frameStats;
+			frameStats = Stats();
+		}
+
+		const Stats& getLastFrameStats(void) const
+		{
+			return lastFrameStats;
+		}
+};
+
+#endif
@@ -0,0 +1,397 @@
+#ifndef HIERARCHICAL_LOD_H
+#define HIERARCHICAL_LOD_H
+
+#include <cmath>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <glad/glad.h>
+#include <glm/glm/glm.hpp>
+#include "Object.h"
+#include "Bounds.h"
+#include "GLState.h"
+#include "MeshSimplifier.h"
+
+/// <summary>
+/// Hierarchical LOD: groups static objects into spatial clusters and merges each cluster into one proxy object
+/// (one simplified mesh in world space, with the members' textures baked into an atlas), so a distant cluster is one draw
+/// instead of one per member mesh. Each frame, a cluster is swapped for its proxy once the proxy's error (geometric, or a texel
+/// of its atlas, whichever is larger) projects to under a pixel.
+/// Proxies are built on the render thread, since the atlases are read back from the members' GL textures.
+/// </summary>
+class HierarchicalLOD
+{
+	public:
+		struct Settings {
+			float cellSize = 32.0f;			// clusters are the objects whose centers share a cell of a grid on the ground plane
+			int minObjects = 2;				// smaller clusters aren't worth a proxy
+			float triangleRatio = 0.25f;	// proxy triangles, as a fraction of the members'
+			int tileSize = 128;				// atlas texels per member material
+			float maxPixelError = 1.0f;		// on-screen error allowed, in pixels
+			float hysteresis = 0.1f;		// clusters switch back to their members this much (as a fraction) closer than they switched to the proxy
+		};
+
+		struct Stats {
+			unsigned int clusters = 0;
+			unsigned int proxiesDrawn = 0;			// clusters drawn as their proxy
+			unsigned int objectsReplaced = 0;		// members not drawn because their cluster's proxy was
+			unsigned int meshesReplaced = 0;		// member meshes those proxies stand in for (one proxy is one mesh)
+			size_t trianglesReplaced = 0;			// full-detail triangles of those members
+			size_t proxyTriangles = 0;				// triangles of the proxies drawn instead
+		};
+
+		Settings settings;
+
+	private:
+		struct Cluster {
+			std::vector<size_t> members;		// indices in the vector passed to build()
+			std::unique_ptr<Object> proxy;
+			AABB bounds;						// world space, of the members
+			float error = 0.0f;					// world units
+			size_t memberMeshes = 0;
+			size_t memberTriangles = 0;
+			bool proxied = false;				// currently drawn as the proxy
+		};
+
+		std::vector<Cluster> clusters;
+		std::vector<Object*> proxies;
+		size_t objectCount = 0;
+		float buildMilliseconds = 0.0f;
+		Stats lastStats;
+
+		// one tile of the atlases: a member mesh's material
+		struct Tile {
+			Material material;
+			bool averaged;		// its texture repeats across the mesh, so the tile is just the texture's average color
+		};
+
+		static float distanceToBox(const AABB& box, const glm::vec3& point)
+		{
+			glm::vec3 closest = glm::clamp(point, box.min, box.max);
+			return glm::length(point - closest);
+		}
+
+		/// <summary>
+		/// Fills a tile of an atlas from a texture (read back at the smallest mip level that still covers the tile),
+		/// or with a constant color if there's no texture
+		/// </summary>
+		/// <param name="rect">Where the map is in the texture, if it was packed into a TextureAtlas (all zero otherwise)</param>
+		/// <param name="maxLevel">Coarsest mip level that keeps a packed map apart from its neighbors</param>
+		void bakeTile(unsigned int texture, const glm::vec4& rect, int maxLevel, const glm::vec3& color, bool averaged, std::vector<unsigned char>& atlas, int atlasWidth, int tileX, int tileY) const
+		{
+			int tile = settings.tileSize;
+			std::vector<unsigned char> pixels(3, 0);
+			int width = 1, height = 1;
+
+			if (texture == 0) {
+				for (int c = 0; c < 3; ++c)
+					pixels[c] = (unsigned char)(std::min(std::max(color[c], 0.0f), 1.0f) * 255.0f + 0.5f);
+			}
+			else {
+				GLState::get().bindTexture(0, GL_TEXTURE_2D, texture);
+				int textureWidth = 0, textureHeight = 0;
+				glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &textureWidth);
+				glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &textureHeight);
+
+				bool packed = rect.z > 0.0f;
+				int baseWidth = packed ? (int)std::lround(rect.z * textureWidth) : textureWidth;
+				int baseHeight = packed ? (int)std::lround(rect.w * textureHeight) : textureHeight;
+
+				int level = 0;
+				int largest = std::max(baseWidth, baseHeight);
+				while (largest > 1 && (!packed || level < maxLevel) && (averaged || std::max(baseWidth >> (level + 1), baseHeight >> (level + 1)) >= tile)) {
+					++level;
+					largest >>= 1;
+				}
+				int levelWidth = std::max(textureWidth >> level, 1), levelHeight = std::max(textureHeight >> level, 1);
+
+				std::vector<unsigned char> levelPixels(size_t(levelWidth) * levelHeight * 3);
+				glPixelStorei(GL_PACK_ALIGNMENT, 1);
+				glGetTexImage(GL_TEXTURE_2D, level, GL_RGB, GL_UNSIGNED_BYTE, levelPixels.data());
+				glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+				// a packed map is just its rect of the atlas
+				int left = packed ? (int)std::lround(rect.x * levelWidth) : 0, bottom = packed ? (int)std::lround(rect.y * levelHeight) : 0;
+				width = packed ? std::max((int)std::lround(rect.z * levelWidth), 1) : levelWidth;
+				height = packed ? std::max((int)std::lround(rect.w * levelHeight), 1) : levelHeight;
+				pixels.resize(size_t(width) * height * 3);
+				for (int y = 0; y < height; ++y)
+					std::memcpy(&pixels[size_t(y) * width * 3], &levelPixels[(size_t(bottom + y) * levelWidth + left) * 3], size_t(width) * 3);
+
+				if (averaged && (width > 1 || height > 1)) {
+					// it stopped short of 1x1 to stay inside its rect
+					unsigned long long sums[3] = {};
+					for (size_t i = 0; i < pixels.size(); ++i)
+						sums[i % 3] += pixels[i];
+					size_t count = size_t(width) * height;
+					for (int c = 0; c < 3; ++c)
+						pixels[c] = (unsigned char)((sums[c] + count / 2) / count);
+					width = height = 1;
+					pixels.resize(3);
+				}
+			}
+
+			// nearest resample into the tile (rows go up in t, same as the texture)
+			for (int y = 0; y < tile; ++y) {
+				for (int x = 0; x < tile; ++x) {
+					const unsigned char* source = &pixels[(size_t(y * height / tile) * width + x * width / tile) * 3];
+					unsigned char* destination = &atlas[(size_t(tileY * tile + y) * atlasWidth + tileX * tile + x) * 3];
+					destination[0] = source[0];
+					destination[1] = source[1];
+					destination[2] = source[2];
+				}
+			}
+		}
+
+		/// <summary>
+		/// Merges a cluster's meshes into one simplified world-space mesh with atlas texture coordinates, and uploads it as the proxy's model
+		/// </summary>
+		void buildProxy(Cluster& cluster, const std::vector<Object*>& objects, int index)
+		{
+			std::vector<Tile> tiles;
+			std::vector<int> meshTiles;
+			MeshData merged;
+			float texelError = 0.0f;
+			float shininessSum = 0.0f, areaSum = 0.0f;
+
+			// gather the member materials, one tile each
+			for (size_t member : cluster.members) {
+				for (const Mesh& mesh : objects[member]->getModel().getMeshes()) {
+					bool averaged = false;
+					for (const Vertex& vertex : mesh.vertices)
+						averaged |= vertex.TexCoords.x < -0.001f || vertex.TexCoords.x > 1.001f || vertex.TexCoords.y < -0.001f || vertex.TexCoords.y > 1.001f;
+
+					int tile = -1;
+					for (size_t t = 0; t < tiles.size() && tile < 0; ++t) {
+						if (tiles[t].material.sameAs(mesh.material) && tiles[t].averaged == averaged)
+							tile = (int)t;
+					}
+					if (tile < 0) {
+						tile = (int)tiles.size();
+						tiles.push_back({ mesh.material, averaged });
+					}
+					meshTiles.push_back(tile);
+				}
+			}
+
+			int tilesPerRow = (int)std::ceil(std::sqrt((double)tiles.size()));
+			int tileRows = ((int)tiles.size() + tilesPerRow - 1) / tilesPerRow;
+			int atlasWidth = tilesPerRow * settings.tileSize, atlasHeight = tileRows * settings.tileSize;
+			float inset = 1.0f;		// texels kept clear of the tile's edges, so filtering doesn't pick up the next tile
+
+			// merge the meshes in world space, squeezing each one's texture coordinates into its tile
+			size_t meshIndex = 0;
+			for (size_t member : cluster.members) {
+				const glm::mat4& matrix = objects[member]->getMatrix();
+				glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(matrix)));
+
+				for (const Mesh& mesh : objects[member]->getModel().getMeshes()) {
+					const Tile& tile = tiles[meshTiles[meshIndex]];
+					int tileX = meshTiles[meshIndex] % tilesPerRow, tileY = meshTiles[meshIndex] / tilesPerRow;
+					++meshIndex;
+
+					unsigned int firstVertex = (unsigned int)merged.vertices.size();
+					AABB worldBounds;
+					for (const Vertex& vertex : mesh.vertices) {
+						Vertex world = vertex;
+						world.Position = glm::vec3(matrix * glm::vec4(vertex.Position, 1.0f));
+						world.Normal = glm::normalize(normalMatrix * vertex.Normal);
+						glm::vec2 uv = tile.averaged ? glm::vec2(0.5f) : glm::clamp(vertex.TexCoords, glm::vec2(0.0f), glm::vec2(1.0f));
+						world.TexCoords.x = (tileX * settings.tileSize + inset + uv.x * (settings.tileSize - 2.0f * inset)) / atlasWidth;
+						world.TexCoords.y = (tileY * settings.tileSize + inset + uv.y * (settings.tileSize - 2.0f * inset)) / atlasHeight;
+						merged.vertices.push_back(world);
+						worldBounds.expand(world.Position);
+					}
+					for (unsigned int i : mesh.indices)
+						merged.indices.push_back(firstVertex + i);
+
+					float area = 0.0f, uvArea = 0.0f;
+					for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+						const Vertex& a = merged.vertices[firstVertex + mesh.indices[i]];
+						const Vertex& b = merged.vertices[firstVertex + mesh.indices[i + 1]];
+						const Vertex& c = merged.vertices[firstVertex + mesh.indices[i + 2]];
+						area += 0.5f * glm::length(glm::cross(b.Position - a.Position, c.Position - a.Position));
+						glm::vec2 ab = mesh.vertices[mesh.indices[i + 1]].TexCoords - mesh.vertices[mesh.indices[i]].TexCoords;
+						glm::vec2 ac = mesh.vertices[mesh.indices[i + 2]].TexCoords - mesh.vertices[mesh.indices[i]].TexCoords;
+						uvArea += 0.5f * std::abs(ab.x * ac.y - ab.y * ac.x);
+					}
+
+					// world size of one repeat of the texture; an atlas texel covers a tile's worth of that, and an averaged tile
+					// stands in for a whole repeat (which mipmapping would have blurred to its average by then anyway)
+					float repeat = uvArea > 0.0f ? std::sqrt(area / uvArea) : glm::length(worldBounds.max - worldBounds.min);
+					texelError = std::max(texelError, tile.averaged ? repeat : repeat / settings.tileSize);
+
+					shininessSum += area * mesh.material.shininess;
+					areaSum += area;
+				}
+			}
+			cluster.memberMeshes = meshIndex;
+			cluster.memberTriangles = merged.indices.size() / 3;
+
+			// simplify, then drop the vertices nothing uses any more
+			float geometricError = 0.0f;
+			std::vector<unsigned int> indices = MeshSimplifier::simplify(merged.vertices, merged.indices,
+				size_t(merged.indices.size() * settings.triangleRatio) / 3 * 3, geometricError);
+			std::vector<unsigned int> remap(merged.vertices.size(), ~0u);
+			std::vector<Vertex> vertices;
+			for (unsigned int& i : indices) {
+				if (remap[i] == ~0u) {
+					remap[i] = (unsigned int)vertices.size();
+					vertices.push_back(merged.vertices[i]);
+				}
+				i = remap[i];
+			}
+			merged.vertices = std::move(vertices);
+			merged.indices = std::move(indices);
+			merged.lods = MeshSimplifier::buildLODs(merged.vertices, merged.indices);
+			cluster.error = std::max(geometricError, texelError);
+
+			// bake the atlases
+			ModelData data;
+			data.valid = true;
+			std::string name = "hlod" + std::to_string(index);
+			for (int map = 0; map < 2; ++map) {
+				ImageData image;
+				image.path = name + (map == 0 ? "_diffuse" : "_specular");
+				image.width = atlasWidth;
+				image.height = atlasHeight;
+				image.nrChannels = 3;
+				image.pixels.assign(size_t(atlasWidth) * atlasHeight * 3, 0);
+				for (size_t t = 0; t < tiles.size(); ++t) {
+					const Material& material = tiles[t].material;
+					if (map == 0)
+						bakeTile(material.diffuseMap, material.diffuseRect, material.atlasMipLevels, material.diffuseColor, tiles[t].averaged, image.pixels, atlasWidth, (int)t % tilesPerRow, (int)t / tilesPerRow);
+					else
+						bakeTile(material.specularMap, material.specularRect, material.atlasMipLevels, material.specularColor, tiles[t].averaged, image.pixels, atlasWidth, (int)t % tilesPerRow, (int)t / tilesPerRow);
+				}
+
+				Texture texture;
+				texture.id = 0;
+				texture.type = map == 0 ? "texture_diffuse" : "texture_specular";
+				texture.path = image.path;
+				merged.textures.push_back(texture);
+				data.images.push_back(std::move(image));
+			}
+			merged.material.shininess = areaSum > 0.0f ? shininessSum / areaSum : 32.0f;
+			data.meshes.push_back(std::move(merged));
+
+			std::shared_ptr<Model> model = std::make_shared<Model>();
+			model->upload(data);
+			cluster.proxy.reset(new Object(model));
+		}
+
+	public:
+		/// <summary>
+		/// Clusters objects and builds a proxy for each cluster with enough members, replacing any proxies from before
+		/// (whatever pointers getProxies() returned are invalid afterwards)
+		/// </summary>
+		/// <param name="objects">Objects that won't move (moving one means building again)</param>
+		void build(const std::vector<Object*>& objects)
+		{
+			auto start = std::chrono::steady_clock::now();
+			clusters.clear();
+			proxies.clear();
+			objectCount = objects.size();
+
+			std::vector<std::pair<long long, size_t>> cells;		// (grid cell, object)
+			for (size_t i = 0; i < objects.size(); ++i) {
+				if (!objects[i]->getModel().isLoaded())
+					continue;
+				glm::vec3 center = objects[i]->getWorldSphere().center;
+				long long x = (long long)std::floor(center.x / settings.cellSize), z = (long long)std::floor(center.z / settings.cellSize);
+				cells.push_back({ (x << 32) ^ (z & 0xFFFFFFFFll), i });
+			}
+			std::sort(cells.begin(), cells.end());
+
+			for (size_t first = 0; first < cells.size();) {
+				size_t last = first;
+				while (last < cells.size() && cells[last].first == cells[first].first)
+					++last;
+
+				if ((int)(last - first) >= settings.minObjects) {
+					Cluster cluster;
+					for (size_t i = first; i < last; ++i) {
+						cluster.members.push_back(cells[i].second);
+						cluster.bounds.expand(objects[cells[i].second]->getWorldBounds());
+					}
+					buildProxy(cluster, objects, (int)clusters.size());
+					proxies.push_back(cluster.proxy.get());
+					clusters.push_back(std::move(cluster));
+				}
+				first = last;
+			}
+
+			buildMilliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+		}
+
+		/// <summary>
+		/// Picks which clusters are drawn as their proxy, and combines that with which objects could be seen at all
+		/// </summary>
+		/// <param name="potentiallyVisible">One flag per object passed to build() (e.g. from the PVS), or null if they all could be</param>
+		/// <param name="drawn">Set to one flag per object, followed by one per proxy (in the order of getProxies())</param>
+		/// <param name="projection">Perspective projection matrix</param>
+		/// <param name="viewportHeight">Viewport height in pixels</param>
+		void select(const glm::vec3& cameraPos, const glm::mat4& projection, float viewportHeight, const unsigned char* potentiallyVisible, std::vector<unsigned char>& drawn)
+		{
+			Stats stats;
+			stats.clusters = (unsigned int)clusters.size();
+			drawn.resize(objectCount + proxies.size());
+			for (size_t i = 0; i < objectCount; ++i)
+				drawn[i] = !potentiallyVisible || potentiallyVisible[i];
+
+			for (size_t c = 0; c < clusters.size(); ++c) {
+				Cluster& cluster = clusters[c];
+
+				// far enough that the proxy's error is under maxPixelError (projection[1][1] = 1 / tan(fovy / 2))
+				float switchDistance = cluster.error * projection[1][1] * viewportHeight * 0.5f / settings.maxPixelError;
+				float distance = distanceToBox(cluster.bounds, cameraPos);
+				if (cluster.proxied)
+					cluster.proxied = distance > switchDistance * (1.0f - settings.hysteresis);
+				else
+					cluster.proxied = distance > switchDistance;
+
+				bool anyVisible = false;
+				for (size_t member : cluster.members)
+					anyVisible |= drawn[member] != 0;
+
+				drawn[objectCount + c] = cluster.proxied && anyVisible;
+				if (cluster.proxied) {
+					for (size_t member : cluster.members) {
+						stats.objectsReplaced += drawn[member];
+						drawn[member] = 0;
+					}
+					if (anyVisible) {
+						++stats.proxiesDrawn;
+						stats.meshesReplaced += (unsigned int)cluster.memberMeshes;
+						stats.trianglesReplaced += cluster.memberTriangles;
+						for (const Mesh& mesh : cluster.proxy->getModel().getMeshes())
+							stats.proxyTriangles += mesh.getGeometry().indexCount / 3;
+					}
+				}
+			}
+			lastStats = stats;
+		}
+
+		/// <summary>
+		/// The proxy objects, one per cluster (draw them like any other object)
+		/// </summary>
+		const std::vector<Object*>& getProxies(void) const
+		{
+			return proxies;
+		}
+
+		float getBuildMilliseconds(void) const
+		{
+			return buildMilliseconds;
+		}
+
+		const Stats& getLastStats(void) const
+		{
+			return lastStats;
+		}
+};
+
+#endif
@@ -0,0 +1,293 @@
+#ifndef HOT_RELOAD_H
+#define HOT_RELOAD_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <cctype>
+#include <filesystem>
+#include <initializer_list>
+#include <algorithm>
+#include <iostream>
+#include "FileWatcher.h"
+#include "ShaderProgram.h"
+#include "model.h"
+
+/// <summary>
+/// Reloads shaders, models, and textures when their files change on disk.
+/// Files are read, parsed, and decoded on a background thread; the GL side (compiling, uploading) only happens
+/// in applyPending(), which should be called once per frame before drawing so that swaps happen at a frame boundary.
+/// Only the affected program, model, or texture is rebuilt.
+/// </summary>
+class AssetReloader
+{
+	private:
+		struct ShaderEntry {
+			ShaderProgram* program;
+			std::string vertexPath;
+			std::string fragmentPath;
+			std::string defines;
+			std::function<void(ShaderProgram&)> onReload;	// used to set uniforms again on the new program
+		};
+
+		struct ModelEntry {
+			Model* model;
+			std::string path;		// normalized
+			std::string directory;	// normalized
+		};
+
+		// results prepared by the worker thread, waiting to be applied on the GL thread
+		struct PendingShader {
+			size_t entry;
+			std::unique_ptr<ShaderFile> vertex;
+			std::unique_ptr<ShaderFile> fragment;
+		};
+
+		struct PendingModel {
+			std::string path;
+			ModelData data;
+		};
+
+		struct PendingImage {
+			std::string directory;	// only models in this directory use the image
+			ImageData image;
+		};
+
+		std::vector<ShaderEntry> shaders;
+		std::vector<ModelEntry> models;
+		FileWatcher watcher;
+
+		std::mutex pendingMutex;
+		std::vector<PendingShader> pendingShaders;
+		std::vector<PendingModel> pendingModels;
+		std::vector<PendingImage> pendingImages;
+		std::vector<std::string> pendingImports;	// models whose textures outgrew their atlas blocks, for the worker to re-import
+
+		std::thread worker;
+		std::atomic<bool> running{ false };
+
+		static bool hasExtension(const std::string& file, std::initializer_list<const char*> extensions)
+		{
+			std::string ext = std::filesystem::path(file).extension().string();
+			for (char& c : ext)
+				c = char(std::tolower((unsigned char)c));
+			for (const char* e : extensions) {
+				if (ext == e)
+					return true;
+			}
+			return false;
+		}
+
+		/// <param name="imports">Models to re-import whether or not their files changed (normalized paths)</param>
+		void prepare(const std::vector<std::string>& changed, const std::vector<std::string>& imports)
+		{
+			std::vector<PendingShader> newShaders;
+			std::vector<PendingModel> newModels;
+			std::vector<PendingImage> newImages;
+
+			for (size_t i = 0; i < shaders.size(); ++i) {
+				bool affected = false;
+				for (const std::string& file : changed)
+					affected = affected || file == shaders[i].vertexPath || file == shaders[i].fragmentPath;
+				if (!affected)
+					continue;
+
+				PendingShader pending;
+				pending.entry = i;
+				pending.vertex = std::make_unique<ShaderFile>(shaders[i].vertexPath, "vertex", shaders[i].defines);
+				pending.fragment = std::make_unique<ShaderFile>(shaders[i].fragmentPath, "fragment", shaders[i].defines);
+				if (!pending.vertex->empty() && !pending.fragment->empty())		// file may have been caught half-written
+					newShaders.push_back(std::move(pending));
+			}
+
+			// each model is imported at most once, however many of its files changed
+			auto queueImport = [&newModels](const std::string& path) {
+				for (const PendingModel& pending : newModels) {
+					if (pending.path == path)
+						return;
+				}
+				newModels.push_back({ path, Model::import(path) });
+			};
+
+			for (const std::string& path : imports)
+				queueImport(path);
+
+			for (const std::string& file : changed) {
+				std::string dir = FileWatcher::directoryOf(file);
+
+				if (hasExtension(file, { ".obj", ".mtl" })) {
+					// a geometry or material change means re-importing every model in that directory
+					for (const ModelEntry& entry : models) {
+						if (entry.directory == dir)
+							queueImport(entry.path);
+					}
+				}
+
+				else if (hasExtension(file, { ".png", ".jpg", ".jpeg", ".bmp", ".tga" })) {
+					bool used = false;
+					for (const ModelEntry& entry : models)
+						used = used || entry.directory == dir;
+					if (!used)
+						continue;
+
+					// models refer to their textures relative to their own directory
+					PendingImage pending;
+					pending.directory = dir;
+					pending.image.path = std::filesystem::path(file).filename().generic_string();
+					if (Model::LoadImageData(file, pending.image))
+						newImages.push_back(std::move(pending));
+				}
+			}
+
+			std::lock_guard<std::mutex> lock(pendingMutex);
+			for (PendingShader& pending : newShaders)
+				pendingShaders.push_back(std::move(pending));
+			for (PendingModel& pending : newModels)
+				pendingModels.push_back(std::move(pending));
+			for (PendingImage& pending : newImages)
+				pendingImages.push_back(std::move(pending));
+		}
+
+		void run(void)
+		{
+			while (running) {
+				std::vector<std::string> changed = watcher.waitForChanges(250);
+				std::vector<std::string> imports;
+				{
+					std::lock_guard<std::mutex> lock(pendingMutex);
+					imports.swap(pendingImports);
+				}
+				if (!changed.empty() || !imports.empty())
+					prepare(changed, imports);
+			}
+		}
+
+	public:
+		AssetReloader() {}
+
+		~AssetReloader()
+		{
+			stop();
+		}
+
+		AssetReloader(const AssetReloader&) = delete;
+		AssetReloader& operator=(const AssetReloader&) = delete;
+
+		/// <summary>
+		/// Register a shader program to be recompiled when either of its source files changes
+		/// NOTE: Register everything before calling start()
+		/// </summary>
+		/// <param name="defines">Same defines the program was built with (see ShaderFile)</param>
+		/// <param name="onReload">Called after a successful reload (the new program is in use), to set its uniforms again</param>
+		void watchShader(ShaderProgram& program, const std::string& vertexPath, const std::string& fragmentPath, const std::string& defines = "", std::function<void(ShaderProgram&)> onReload = nullptr)
+		{
+			shaders.push_back({ &program, FileWatcher::normalizePath(vertexPath), FileWatcher::normalizePath(fragmentPath), defines, onReload });
+			watcher.watchFile(vertexPath);
+			watcher.watchFile(fragmentPath);
+		}
+
+		/// <summary>
+		/// Register a model to be re-imported when its OBJ/MTL files change, and to have its textures re-uploaded when they change
+		/// NOTE: Register everything before calling start()
+		/// </summary>
+		void watchModel(Model& model)
+		{
+			for (const ModelEntry& entry : models) {
+				if (entry.model == &model)
+					return;		// objects made from the same file share a model, so it may be passed in more than once
+			}
+
+			std::string path = FileWatcher::normalizePath(model.getPath());
+			models.push_back({ &model, path, FileWatcher::directoryOf(path) });
+			watcher.watchFile(path);
+		}
+
+		void start(void)
+		{
+			if (running)
+				return;
+			running = true;
+			worker = std::thread(&AssetReloader::run, this);
+		}
+
+		void stop(void)
+		{
+			running = false;
+			if (worker.joinable())
+				worker.join();
+		}
+
+		/// <summary>
+		/// Applies everything the worker thread has finished preparing. Call once per frame, before drawing.
+		/// </summary>
+		/// <returns>Number of assets that were swapped in</returns>
+		int applyPending(void)
+		{
+			std::vector<PendingShader> readyShaders;
+			std::vector<PendingModel> readyModels;
+			std::vector<PendingImage> readyImages;
+			{
+				std::lock_guard<std::mutex> lock(pendingMutex);
+				readyShaders.swap(pendingShaders);
+				readyModels.swap(pendingModels);
+				readyImages.swap(pendingImages);
+			}
+
+			int applied = 0;
+			for (const PendingShader& pending : readyShaders) {
+				ShaderEntry& entry = shaders[pending.entry];
+				if (entry.program->reload(*pending.vertex, *pending.fragment)) {
+					std::cout << "Reloaded shader program (" << entry.vertexPath << ", " << entry.fragmentPath << ")" << std::endl;
+					entry.program->use();
+					if (entry.onReload)
+						entry.onReload(*entry.program);
+					++applied;
+				}
+			}
+
+			for (const PendingModel& pending : readyModels) {
+				for (ModelEntry& entry : models) {
+					if (entry.path == pending.path && pending.data.valid) {
+						entry.model->upload(pending.data);
+						++applied;
+					}
+				}
+				if (pending.data.valid)
+					std::cout << "Reloaded model " << pending.path << std::endl;
+			}
+
+			std::vector<std::string> imports;
+			for (const PendingImage& pending : readyImages) {
+				bool reloaded = false;
+				for (ModelEntry& entry : models) {
+					if (entry.directory != pending.directory)
+						continue;
+
+					Model::TextureReload result = entry.model->reloadTexture(pending.image);
+					reloaded = reloaded || result == Model::TEXTURE_RELOADED;
+					if (result == Model::NEEDS_IMPORT && std::find(imports.begin(), imports.end(), entry.path) == imports.end()) {
+						// the atlas has to be packed again, which the worker does like any other model reload
+						std::cout << "Texture " << pending.directory << '/' << pending.image.path << " changed size, re-importing " << entry.path << std::endl;
+						imports.push_back(entry.path);
+					}
+				}
+				if (reloaded) {
+					std::cout << "Reloaded texture " << pending.directory << '/' << pending.image.path << std::endl;
+					++applied;
+				}
+			}
+
+			if (!imports.empty()) {
+				std::lock_guard<std::mutex> lock(pendingMutex);
+				pendingImports.insert(pendingImports.end(), imports.begin(), imports.end());
+			}
+
+			return applied;
+		}
+};
+
+#endif
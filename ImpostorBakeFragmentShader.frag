@@ -0,0 +1,53 @@
+#version 330 core
+
+in vec2 TexCoords;
+flat in int MaterialIndex;
+in vec3 Normal;
+in float Depth;
+
+layout (location = 0) out vec4 Albedo;			// alpha is coverage (the atlas is cleared to 0)
+layout (location = 1) out vec4 NormalDepth;		// model-space normal packed into [0, 1], and depth through the bounding sphere
+
+// material constants and textures (see MaterialTable.h and FragmentShader.frag); only the diffuse part is baked
+uniform samplerBuffer materialData;
+uniform sampler2DArray materialTextures0;
+uniform sampler2DArray materialTextures1;
+uniform sampler2DArray materialTextures2;
+uniform sampler2DArray materialTextures3;
+
+vec3 sampleLayer(sampler2DArray textures, float layer, vec4 rect, float atlasMipLevels)
+{
+	if (rect.z == 0.0)
+		return texture(textures, vec3(TexCoords, layer)).rgb;
+
+	// a texture in an atlas: wrapped inside its rect, and kept to the mip levels that don't mix it with its neighbors
+	vec2 size = vec2(textureSize(textures, 0).xy) * rect.zw;
+	vec2 dx = dFdx(TexCoords) * size;
+	vec2 dy = dFdy(TexCoords) * size;
+	float lod = min(0.5 * log2(max(dot(dx, dx), dot(dy, dy))), atlasMipLevels);
+	return textureLod(textures, vec3(rect.xy + fract(TexCoords) * rect.zw, layer), lod).rgb;
+}
+
+vec3 diffuseColor(int index)
+{
+	vec4 texel0 = texelFetch(materialData, index * 5);
+	int array = int(texel0.a);
+	if (array < 0)
+		return texel0.rgb;
+
+	vec4 texel2 = texelFetch(materialData, index * 5 + 2);
+	vec4 rect = texelFetch(materialData, index * 5 + 3);
+	if (array == 0)		// (the branches are the same across a triangle, see FragmentShader.frag)
+		return sampleLayer(materialTextures0, texel2.x, rect, texel2.w);
+	else if (array == 1)
+		return sampleLayer(materialTextures1, texel2.x, rect, texel2.w);
+	else if (array == 2)
+		return sampleLayer(materialTextures2, texel2.x, rect, texel2.w);
+	return sampleLayer(materialTextures3, texel2.x, rect, texel2.w);
+}
+
+void main()
+{
+	Albedo = vec4(diffuseColor(MaterialIndex), 1.0);
+	NormalDepth = vec4(normalize(Normal) * 0.5 + 0.5, Depth);
+}
\ No newline at end of file
@@ -0,0 +1,25 @@
+#version 330 core
+
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+layout (location = 4) in int aMaterialIndex;	// entry in MaterialTable
+
+out vec2 TexCoords;
+flat out int MaterialIndex;
+out vec3 Normal;
+out float Depth;
+
+uniform mat4 viewProjection;	// orthographic, looking at the model from one of its impostor's view directions (see Impostors.h)
+uniform vec3 viewDir;			// from the model toward that view, in model space
+uniform vec3 center;			// the model's bounding sphere
+uniform float radius;
+
+void main()
+{
+	gl_Position = viewProjection * vec4(aPos, 1.0);
+	TexCoords = aTexCoords;
+	MaterialIndex = aMaterialIndex;
+	Normal = aNormal;		// kept in model space; the impostor shader rotates it with each instance
+	Depth = 0.5 - 0.5 * dot(aPos - center, viewDir) / radius;		// 0 at the front of the bounding sphere, 1 at the back
+}
\ No newline at end of file
@@ -0,0 +1,62 @@
+#version 330 core
+
+in vec3 WorldPos;
+in vec2 FrameUV[3];
+flat in vec2 FrameOrigin[3];
+flat in vec3 Weights;
+flat in mat3 Rotation;
+flat in vec3 ToCamera;
+flat in float Radius;
+
+out vec4 FragColor;
+
+// atlases baked by Impostors.h: albedo with coverage in alpha, and model-space normal with depth through the bounding sphere
+uniform sampler2D impostorAlbedo;
+uniform sampler2D impostorNormalDepth;
+uniform mat4 viewProjection;
+uniform int framesPerSide;
+
+struct SunLight 
+{
+	vec3 position;
+	float ambientIntensity;
+	vec3 ambientColor;
+	vec3 diffuse;
+	vec3 specular;
+	int shininess;
+};
+
+layout (std140) uniform FrameData		// must match FragmentShader.frag and FrameData.h
+{
+	SunLight sunlight;
+	vec3 viewPos;
+};
+
+void main()
+{
+	vec4 albedo = vec4(0.0);
+	vec4 normalDepth = vec4(0.0);
+	for (int i = 0; i < 3; ++i) {
+		vec2 uv = (FrameOrigin[i] + clamp(FrameUV[i], 0.0, 1.0)) / float(framesPerSide);
+		float inside = all(equal(FrameUV[i], clamp(FrameUV[i], 0.0, 1.0))) ? 1.0 : 0.0;		// past the frame's edge there's only the next frame
+		vec4 frameAlbedo = texture(impostorAlbedo, uv);
+		float weight = Weights[i] * frameAlbedo.a * inside;
+		albedo += vec4(frameAlbedo.xyz * weight, weight);
+		normalDepth += texture(impostorNormalDepth, uv) * weight;
+	}
+	if (albedo.a < 0.5)
+		discard;
+	albedo.xyz /= albedo.a;
+	normalDepth /= albedo.a;
+
+	// push the depth back from the quad to the surface that was captured, so impostors intersect the ground and each other properly
+	vec3 surface = WorldPos + ToCamera * (1.0 - 2.0 * normalDepth.w) * Radius;
+	vec4 clip = viewProjection * vec4(surface, 1.0);
+	gl_FragDepth = clip.z / clip.w * 0.5 + 0.5;
+
+	// ambient and diffuse sunlight (impostors are only used far away, where specular highlights are lost anyway)
+	vec3 normal = normalize(Rotation * (normalDepth.xyz * 2.0 - 1.0));
+	vec3 ambient = sunlight.ambientIntensity * sunlight.ambientColor * albedo.xyz;
+	vec3 diffuse = max(dot(normal, normalize(sunlight.position)), 0.0) * albedo.xyz * sunlight.diffuse;
+	FragColor = vec4(ambient + diffuse, 1.0);
+}
\ No newline at end of file
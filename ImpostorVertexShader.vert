@@ -0,0 +1,108 @@
+#version 330 core
+
+layout (location = 0) in vec2 aCorner;			// corner of the quad, from (-1, -1) to (1, 1)
+layout (location = 1) in vec4 aCenterRadius;	// per instance: world-space bounding sphere
+layout (location = 2) in vec3 aAxisX;			// per instance: the object's rotation (model to world, without scale)
+layout (location = 3) in vec3 aAxisY;
+layout (location = 4) in vec3 aAxisZ;
+
+out vec3 WorldPos;
+out vec2 FrameUV[3];				// where the fragment falls inside each of the three blended frames
+flat out vec2 FrameOrigin[3];		// each frame's corner in the atlas, in frames
+flat out vec3 Weights;
+flat out mat3 Rotation;
+flat out vec3 ToCamera;
+flat out float Radius;
+
+uniform mat4 viewProjection;
+uniform int framesPerSide;
+
+struct SunLight 
+{
+	vec3 position;
+	float ambientIntensity;
+	vec3 ambientColor;
+	vec3 diffuse;
+	vec3 specular;
+	int shininess;
+};
+
+layout (std140) uniform FrameData		// must match FragmentShader.frag and FrameData.h
+{
+	SunLight sunlight;
+	vec3 viewPos;
+};
+
+// octahedral mapping of directions (y up) to [0, 1]^2; must match Impostors.h
+vec2 signNotZero(vec2 v)
+{
+	return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+vec2 octEncode(vec3 n)
+{
+	n /= abs(n.x) + abs(n.y) + abs(n.z);
+	vec2 p = n.xz;
+	if (n.y < 0.0)
+		p = (1.0 - abs(p.yx)) * signNotZero(p);
+	return p * 0.5 + 0.5;
+}
+
+vec3 octDecode(vec2 uv)
+{
+	vec2 p = uv * 2.0 - 1.0;
+	vec3 n = vec3(p.x, 1.0 - abs(p.x) - abs(p.y), p.y);
+	if (n.y < 0.0)
+		n.xz = (1.0 - abs(n.zx)) * signNotZero(n.xz);
+	return normalize(n);
+}
+
+// screen axes of a view looking back along dir (the same ones glm::lookAt builds when the frames are baked)
+void viewAxes(vec3 dir, out vec3 right, out vec3 up)
+{
+	vec3 worldUp = abs(dir.y) > 0.999 ? vec3(0.0, 0.0, 1.0) : vec3(0.0, 1.0, 0.0);
+	right = normalize(cross(-dir, worldUp));
+	up = cross(right, -dir);
+}
+
+void main()
+{
+	Rotation = mat3(aAxisX, aAxisY, aAxisZ);
+	Radius = aCenterRadius.w;
+	ToCamera = normalize(viewPos - aCenterRadius.xyz);
+	vec3 viewDir = normalize(transpose(Rotation) * ToCamera);		// model space
+
+	// the quad faces the camera, through the center of the bounding sphere
+	vec3 right, up;
+	viewAxes(viewDir, right, up);
+	vec3 offset = right * aCorner.x + up * aCorner.y;		// model space, in sphere radii
+	WorldPos = aCenterRadius.xyz + Rotation * offset * Radius;
+	gl_Position = viewProjection * vec4(WorldPos, 1.0);
+
+	// the three captured views around this one, and their barycentric weights
+	float last = float(framesPerSide - 1);
+	vec2 grid = octEncode(viewDir) * last;
+	vec2 cell = clamp(floor(grid), vec2(0.0), vec2(last - 1.0));
+	vec2 f = grid - cell;
+	vec2 frames[3];
+	if (f.x + f.y <= 1.0) {
+		frames[0] = cell;
+		frames[1] = cell + vec2(1.0, 0.0);
+		frames[2] = cell + vec2(0.0, 1.0);
+		Weights = vec3(1.0 - f.x - f.y, f.x, f.y);
+	}
+	else {
+		frames[0] = cell + vec2(1.0, 1.0);
+		frames[1] = cell + vec2(1.0, 0.0);
+		frames[2] = cell + vec2(0.0, 1.0);
+		Weights = vec3(f.x + f.y - 1.0, 1.0 - f.y, 1.0 - f.x);
+	}
+
+	// project the quad onto each frame's view plane (orthographic, so it's exact per vertex)
+	for (int i = 0; i < 3; ++i) {
+		vec3 frameRight, frameUp;
+		viewAxes(octDecode(frames[i] / last), frameRight, frameUp);
+		FrameUV[i] = vec2(dot(offset, frameRight), dot(offset, frameUp)) * 0.5 + 0.5;
+		FrameOrigin[i] = frames[i];
+	}
+}
\ No newline at end of file
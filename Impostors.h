@@ -0,0 +1,411 @@
+#ifndef IMPOSTORS_H
+#define IMPOSTORS_H
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <glad/glad.h>
+#include <glm/glm/glm.hpp>
+#include <glm/glm/gtc/matrix_transform.hpp>
+#include <glm/glm/gtc/type_ptr.hpp>
+#include "Object.h"
+#include "Bounds.h"
+#include "GLState.h"
+#include "MaterialTable.h"
+#include "RingBuffer.h"
+#include "ShaderLOD.h"
+#include "ShaderProgram.h"
+
+/// <summary>
+/// Octahedral impostors: a model is rendered offscreen from FRAMES_PER_SIDE^2 directions spread over the sphere
+/// (an octahedral map of directions laid out as a grid), into an albedo atlas and a normal + depth atlas.
+/// Objects using the model that are small on screen are then drawn as one camera-facing quad each, blending the three
+/// captured views nearest to the direction they're seen from; all of one model's impostors are one instanced draw.
+/// Baking only needs a GL 3.3 context with framebuffer objects, so it works headless on a software renderer too.
+/// </summary>
+class Impostors
+{
+	public:
+		static const int FRAMES_PER_SIDE = 8;
+		static const int FRAME_SIZE = 64;		// texels per frame, per side
+		static const int FLOATS_PER_INSTANCE = 13;		// bounding sphere (4) and rotation (9)
+
+		struct Settings {
+			float switchPixels = (float)FRAME_SIZE;		// objects whose projected diameter is smaller are drawn as impostors (so a frame texel covers a pixel or more)
+			float hysteresis = 0.1f;					// they switch back once they're this much (as a fraction) bigger than that
+		};
+
+		struct Stats {
+			unsigned int impostorsDrawn = 0;
+			unsigned int drawCalls = 0;
+			size_t trianglesReplaced = 0;		// full-detail triangles of the objects drawn as impostors
+			size_t impostorTriangles = 0;		// two per impostor
+		};
+
+		Settings settings;
+
+	private:
+		struct Impostor {
+			const Model* model;
+			unsigned int albedo = 0, normalDepth = 0;		// atlases
+			size_t triangles = 0;
+			std::vector<float> instances;		// this frame's
+		};
+
+		ShaderProgram bakeShaderProgram;
+		ShaderProgram impostorShaderProgram;
+		unsigned int VAO, quadVBO;
+		unsigned int programID;		// the program the uniform locations below belong to (it changes when the shaders are hot reloaded)
+		int viewProjectionLocation, framesPerSideLocation;
+
+		std::vector<Impostor> impostors;
+		std::vector<unsigned char> usingImpostor;		// per object, as of the last frame
+		float bakeMilliseconds;
+		Stats frameStats;
+		Stats lastFrameStats;
+
+		/// <summary>
+		/// Inverse of the shader's octEncode(): a point of [0, 1]^2 to a direction (y up)
+		/// </summary>
+		static glm::vec3 octDecode(const glm::vec2& uv)
+		{
+			glm::vec2 p = uv * 2.0f - 1.0f;
+			glm::vec3 n(p.x, 1.0f - std::abs(p.x) - std::abs(p.y), p.y);
+			if (n.y < 0.0f) {
+				float x = (1.0f - std::abs(n.z)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+				float z = (1.0f - std::abs(n.x)) * (n.z >= 0.0f ? 1.0f : -1.0f);
+				n.x = x;
+				n.z = z;
+			}
+			return glm::normalize(n);
+		}
+
+		/// <summary>
+		/// Direction from the model toward the camera that captured a frame
+		/// </summary>
+		static glm::vec3 frameDirection(int x, int y)
+		{
+			return octDecode(glm::vec2((float)x, (float)y) / float(FRAMES_PER_SIDE - 1));
+		}
+
+		static glm::vec3 frameUp(const glm::vec3& direction)
+		{
+			return std::abs(direction.y) > 0.999f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);		// same as the shader's viewAxes()
+		}
+
+		/// <summary>
+		/// (Re)allocates an atlas, through the unit it's drawn from
+		/// </summary>
+		static void createAtlas(unsigned int& texture, unsigned int unit)
+		{
+			int size = FRAMES_PER_SIDE * FRAME_SIZE;
+			if (texture == 0)
+				glGenTextures(1, &texture);
+			GLState::get().bindTexture(unit, GL_TEXTURE_2D, texture);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 3);		// frames stay 8 texels wide, so mips don't blend neighboring frames together
+		}
+
+		/// <summary>
+		/// Spreads the colors (not the coverage) at the edges of each frame's silhouette out into the empty texels around it,
+		/// so filtering and mipmapping don't darken the edges with the empty texels' black
+		/// </summary>
+		static void dilate(std::vector<unsigned char>& albedo, std::vector<unsigned char>& normalDepth, int size, int passes)
+		{
+			std::vector<unsigned char> filled(size_t(size) * size);
+			for (size_t i = 0; i < filled.size(); ++i)
+				filled[i] = albedo[i * 4 + 3] > 0;
+
+			std::vector<unsigned char> next;
+			const int offsets[4][2] = { { 1, 0 }, { -1, 0 }, { 0, 1 }, { 0, -1 } };
+			for (int pass = 0; pass < passes; ++pass) {
+				next = filled;
+				for (int y = 0; y < size; ++y) {
+					for (int x = 0; x < size; ++x) {
+						size_t i = size_t(y) * size + x;
+						if (filled[i])
+							continue;
+						for (const auto& offset : offsets) {
+							int nx = x + offset[0], ny = y + offset[1];
+							if (nx < 0 || ny < 0 || nx >= size || ny >= size || nx / FRAME_SIZE != x / FRAME_SIZE || ny / FRAME_SIZE != y / FRAME_SIZE)
+								continue;		// stay inside the frame
+							size_t n = size_t(ny) * size + nx;
+							if (!filled[n])
+								continue;
+							for (int c = 0; c < 3; ++c)
+								albedo[i * 4 + c] = albedo[n * 4 + c];
+							for (int c = 0; c < 4; ++c)
+								normalDepth[i * 4 + c] = normalDepth[n * 4 + c];
+							next[i] = 1;
+							break;
+						}
+					}
+				}
+				filled.swap(next);
+			}
+		}
+
+		/// <summary>
+		/// Renders every frame of a model's impostor into its atlases
+		/// </summary>
+		void bake(Impostor& impostor)
+		{
+			const Model& model = *impostor.model;
+			const BoundingSphere& sphere = model.getBoundingSphere();
+			int size = FRAMES_PER_SIDE * FRAME_SIZE;
+
+			impostor.triangles = 0;
+			for (const Mesh& mesh : model.getMeshes())
+				impostor.triangles += mesh.indices.size() / 3;
+
+			createAtlas(impostor.albedo, IMPOSTOR_ALBEDO_UNIT);
+			createAtlas(impostor.normalDepth, IMPOSTOR_NORMAL_DEPTH_UNIT);
+
+			// whatever was bound before is put back afterwards
+			int previousFramebuffer = 0;
+			int viewport[4];
+			float clearColor[4];
+			glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+			glGetIntegerv(GL_VIEWPORT, viewport);
+			glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+
+			unsigned int framebuffer, depthBuffer;
+			glGenFramebuffers(1, &framebuffer);
+			glGenRenderbuffers(1, &depthBuffer);
+			glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+			glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+			glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, size, size);
+			glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, impostor.albedo, 0);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, impostor.normalDepth, 0);
+			const GLenum drawBuffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+			glDrawBuffers(2, drawBuffers);
+
+			if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+				std::cout << "ERROR: Impostor framebuffer is incomplete" << std::endl;
+			else if (model.isLoaded() && sphere.radius > 0.0f) {
+				glViewport(0, 0, size, size);
+				glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+				bakeShaderProgram.use();
+				MaterialTable::get().bind();		// baking can happen outside a frame, before the textures' layers were ever bound
+				bakeShaderProgram.setVec3("center", sphere.center);
+				bakeShaderProgram.setFloat("radius", sphere.radius);
+
+				// an orthographic view per frame that just fits the bounding sphere
+				glm::mat4 projection = glm::ortho(-sphere.radius, sphere.radius, -sphere.radius, sphere.radius, sphere.radius, 3.0f * sphere.radius);
+				for (int y = 0; y < FRAMES_PER_SIDE; ++y) {
+					for (int x = 0; x < FRAMES_PER_SIDE; ++x) {
+						glm::vec3 direction = frameDirection(x, y);
+						glm::mat4 view = glm::lookAt(sphere.center + direction * (2.0f * sphere.radius), sphere.center, frameUp(direction));
+						bakeShaderProgram.setUniformMatrix("viewProjection", projection * view);
+						bakeShaderProgram.setVec3("viewDir", direction);
+
+						glViewport(x * FRAME_SIZE, y * FRAME_SIZE, FRAME_SIZE, FRAME_SIZE);
+						for (const Mesh& mesh : model.getMeshes())
+							mesh.Draw();
+					}
+				}
+			}
+
+			glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+			glDeleteFramebuffers(1, &framebuffer);
+			glDeleteRenderbuffers(1, &depthBuffer);
+			glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+			glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+
+			// fill in around the silhouettes, then build the mipmaps
+			std::vector<unsigned char> albedo(size_t(size) * size * 4), normalDepth(size_t(size) * size * 4);
+			GLState::get().bindTexture(IMPOSTOR_ALBEDO_UNIT, GL_TEXTURE_2D, impostor.albedo);
+			glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, albedo.data());
+			GLState::get().bindTexture(IMPOSTOR_NORMAL_DEPTH_UNIT, GL_TEXTURE_2D, impostor.normalDepth);
+			glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, normalDepth.data());
+
+			dilate(albedo, normalDepth, size, 8);
+
+			GLState::get().bindTexture(IMPOSTOR_ALBEDO_UNIT, GL_TEXTURE_2D, impostor.albedo);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, size, size, GL_RGBA, GL_UNSIGNED_BYTE, albedo.data());
+			glGenerateMipmap(GL_TEXTURE_2D);
+			GLState::get().bindTexture(IMPOSTOR_NORMAL_DEPTH_UNIT, GL_TEXTURE_2D, impostor.normalDepth);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, size, size, GL_RGBA, GL_UNSIGNED_BYTE, normalDepth.data());
+			glGenerateMipmap(GL_TEXTURE_2D);
+		}
+
+		void fillBuffers(void)
+		{
+			// quad corners, drawn as a triangle strip; the vertex shader turns it to face the camera
+			const float corners[4 * 2] = { -1.0f, -1.0f,	1.0f, -1.0f,	-1.0f, 1.0f,	1.0f, 1.0f };
+
+			glGenVertexArrays(1, &VAO);
+			glGenBuffers(1, &quadVBO);
+
+			GLState::get().bindVertexArray(VAO);
+			GLState::get().bindBuffer(GL_ARRAY_BUFFER, quadVBO);
+			glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+
+			// corner	(layout = 0)
+			glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(float) * 2, (void*)0);
+			glEnableVertexAttribArray(0);
+		}
+
+	public:
+		/// <param name="bakeProgram">Program that renders the frames (ImpostorBakeVertexShader.vert and ImpostorBakeFragmentShader.frag)</param>
+		/// <param name="impostorProgram">Program that draws the impostors (ImpostorVertexShader.vert and ImpostorFragmentShader.frag)</param>
+		Impostors(const ShaderProgram& bakeProgram, const ShaderProgram& impostorProgram)
+			: bakeShaderProgram{ bakeProgram }, impostorShaderProgram{ impostorProgram }, programID{ 0 }, viewProjectionLocation{ -1 },
+			framesPerSideLocation{ -1 }, bakeMilliseconds{ 0.0f }
+		{
+			fillBuffers();
+		}
+
+		ShaderProgram& getShaderProgram(void)
+		{
+			return impostorShaderProgram;
+		}
+
+		/// <summary>
+		/// Bakes an impostor for a model (every object using the model can then be drawn as one)
+		/// </summary>
+		void add(const Model& model)
+		{
+			auto start = std::chrono::steady_clock::now();
+
+			Impostor impostor;
+			impostor.model = &model;
+			bake(impostor);
+			impostors.push_back(impostor);
+
+			bakeMilliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+		}
+
+		/// <summary>
+		/// Bakes every impostor again (after their models are reloaded)
+		/// </summary>
+		void rebake(void)
+		{
+			auto start = std::chrono::steady_clock::now();
+			for (Impostor& impostor : impostors)
+				bake(impostor);
+			bakeMilliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+		}
+
+		/// <summary>
+		/// Call at the start of every frame, before submit()
+		/// </summary>
+		/// <param name="objectCount">Number of objects submit() can be given indices for</param>
+		void beginFrame(size_t objectCount)
+		{
+			lastFrameStats = frameStats;
+			frameStats = Stats();
+			usingImpostor.resize(objectCount, 0);
+			for (Impostor& impostor : impostors)
+				impostor.instances.clear();
+		}
+
+		/// <summary>
+		/// Queues an object to be drawn as an impostor if it has one and is small enough on screen
+		/// </summary>
+		/// <param name="index">The object's index, for remembering which side of the switching size it was on</param>
+		/// <param name="projection">Perspective projection matrix</param>
+		/// <param name="viewportHeight">Viewport height in pixels</param>
+		/// <returns>Whether the object was queued (and shouldn't be drawn any other way this frame)</returns>
+		bool submit(const Object& object, size_t index, const glm::vec3& cameraPos, const glm::mat4& projection, float viewportHeight)
+		{
+			Impostor* impostor = nullptr;
+			for (Impostor& candidate : impostors) {
+				if (candidate.model == &object.getModel())
+					impostor = &candidate;
+			}
+			if (!impostor || !object.getModel().isLoaded() || index >= usingImpostor.size())
+				return false;
+
+			BoundingSphere sphere = object.getWorldSphere();
+			float diameter = ShaderLOD::projectedDiameter(sphere, cameraPos, projection, viewportHeight);
+			float limit = usingImpostor[index] ? settings.switchPixels * (1.0f + settings.hysteresis) : settings.switchPixels;
+			usingImpostor[index] = diameter < limit;
+			if (!usingImpostor[index])
+				return false;
+
+			glm::mat3 rotation(object.getMatrix());
+			for (int axis = 0; axis < 3; ++axis)
+				rotation[axis] = glm::normalize(rotation[axis]);		// the bounding sphere's radius already carries the scale
+
+			const float instance[FLOATS_PER_INSTANCE] = { sphere.center.x, sphere.center.y, sphere.center.z, sphere.radius,
+				rotation[0].x, rotation[0].y, rotation[0].z, rotation[1].x, rotation[1].y, rotation[1].z, rotation[2].x, rotation[2].y, rotation[2].z };
+			impostor->instances.insert(impostor->instances.end(), instance, instance + FLOATS_PER_INSTANCE);
+
+			++frameStats.impostorsDrawn;
+			frameStats.trianglesReplaced += impostor->triangles;
+			frameStats.impostorTriangles += 2;
+			return true;
+		}
+
+		/// <summary>
+		/// Draws every impostor queued this frame, one instanced draw per model
+		/// NOTE: FrameData must already be uploaded (the shaders light the impostors with the sun and face them toward viewPos)
+		/// </summary>
+		/// <param name="ring">The frame's ring, for the instance data</param>
+		/// <returns>Number of draw calls made</returns>
+		unsigned int draw(RingBuffer& ring, const glm::mat4& viewProjection)
+		{
+			impostorShaderProgram.use();
+			if (programID != impostorShaderProgram.ID) {
+				programID = impostorShaderProgram.ID;
+				viewProjectionLocation = glGetUniformLocation(programID, "viewProjection");
+				framesPerSideLocation = glGetUniformLocation(programID, "framesPerSide");
+			}
+			glUniformMatrix4fv(viewProjectionLocation, 1, GL_FALSE, glm::value_ptr(viewProjection));
+			glUniform1i(framesPerSideLocation, FRAMES_PER_SIDE);
+
+			unsigned int draws = 0;
+			GLState::get().bindVertexArray(VAO);
+			for (Impostor& impostor : impostors) {
+				size_t count = impostor.instances.size() / FLOATS_PER_INSTANCE;
+				if (count == 0)
+					continue;
+
+				RingBuffer::Allocation allocation = ring.allocate(impostor.instances.size() * sizeof(float), sizeof(float));
+				std::memcpy(allocation.data, impostor.instances.data(), impostor.instances.size() * sizeof(float));
+				ring.commit(allocation);
+				GLState::get().bindBuffer(GL_ARRAY_BUFFER, allocation.buffer);
+
+				// bounding sphere	(layout = 1), then the rotation's columns	(layout = 2, 3, 4), all per instance
+				const GLsizei stride = FLOATS_PER_INSTANCE * sizeof(float);
+				glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, stride, (void*)allocation.offset);
+				for (int axis = 0; axis < 3; ++axis)
+					glVertexAttribPointer(2 + axis, 3, GL_FLOAT, GL_FALSE, stride, (void*)(allocation.offset + (4 + axis * 3) * sizeof(float)));
+				for (int attribute = 1; attribute <= 4; ++attribute) {
+					glEnableVertexAttribArray(attribute);
+					glVertexAttribDivisor(attribute, 1);
+				}
+
+				GLState::get().bindTexture(IMPOSTOR_ALBEDO_UNIT, GL_TEXTURE_2D, impostor.albedo);
+				GLState::get().bindTexture(IMPOSTOR_NORMAL_DEPTH_UNIT, GL_TEXTURE_2D, impostor.normalDepth);
+				glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)count);
+				++draws;
+			}
+
+			frameStats.drawCalls += draws;
+			return draws;
+		}
+
+		float getBakeMilliseconds(void) const
+		{
+			return bakeMilliseconds;
+		}
+
+		const Stats& getLastFrameStats(void) const
+		{
+			return lastFrameStats;
+		}
+};
+
+#endif
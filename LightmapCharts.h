@@ -0,0 +1,274 @@
+#ifndef LIGHTMAP_CHARTS_H
+#define LIGHTMAP_CHARTS_H
+
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <array>
+#include <vector>
+#include <algorithm>
+#include <glm/glm/glm.hpp>
+#include "GeometryBuffer.h"
+#include "TextureAtlas.h"
+
+/// <summary>
+/// Gives a model's vertices their second set of texture coordinates (Vertex::LightmapCoords) at import: a layout where no two
+/// triangles share texels, which a lightmap needs and texture coordinates (which tile and mirror) usually aren't.
+/// Triangles are grouped into charts by which way they face (the axis their normal is closest to, and its sign) and by sharing
+/// an edge, each chart is projected flat along that axis, and the charts are packed into one square layout per model with the
+/// Skyline packer, at texelsPerUnit and with an empty gutter around each chart (Lightmaps fills it from the chart's edge, so
+/// bilinear filtering never reads a neighboring chart).
+/// A vertex used by several charts is copied for each of the others (appended to the mesh's vertices), and the full-detail
+/// indices are pointed at the copies. The GeometryLOD levels keep indexing the original vertices, so their triangles can stretch
+/// across a seam; they're only drawn far away, where that doesn't show.
+///
+/// Doesn't use OpenGL, so it's safe to call from the model import thread.
+/// </summary>
+class LightmapCharts
+{
+	public:
+		struct Settings {
+			float texelsPerUnit;	// layout texels per model unit (Lightmaps scales whole layouts up for objects scaled up)
+			int gutter;				// empty texels around each chart
+			int maxSize;			// largest side of a layout; charts are scaled down until they fit
+
+			Settings() : texelsPerUnit{ 4.0f }, gutter{ 2 }, maxSize{ 1024 } {}
+		};
+
+		struct Stats {
+			unsigned int charts = 0;
+			unsigned int seamVertices = 0;		// copies appended where charts meet
+			int size = 0;						// side of the layout in texels (0 if the model has no triangles)
+			float texelsPerUnit = 0.0f;			// what the charts were packed at (less than asked for if they had to be scaled down)
+		};
+
+	private:
+		struct MeshRef {
+			std::vector<Vertex>* vertices;
+			std::vector<unsigned int>* indices;
+		};
+
+		struct Chart {
+			size_t mesh;
+			std::vector<unsigned int> triangles;	// first index of each (in the mesh's indices)
+			int uAxis, vAxis;						// the position components it's projected onto
+			glm::vec2 min, max;						// of the projected positions, in model units
+			int width = 0, height = 0;				// block in texels, gutter included
+			int x = 0, y = 0;						// where the block went
+		};
+
+		Settings settings;
+		std::vector<MeshRef> meshes;
+
+		// which way a triangle faces: 0-5 for +X, -X, +Y, -Y, +Z, -Z
+		static int faceDirection(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c)
+		{
+			glm::vec3 normal = glm::cross(b - a, c - a);
+			glm::vec3 size = glm::abs(normal);
+			int axis = size.x >= size.y && size.x >= size.z ? 0 : size.y >= size.z ? 1 : 2;
+			return axis * 2 + (normal[axis] < 0.0f ? 1 : 0);
+		}
+
+		/// <summary>
+		/// Groups one mesh's triangles into charts: neighbors (sharing an edge by position) facing the same way go together
+		/// </summary>
+		void buildCharts(size_t mesh, std::vector<Chart>& charts) const
+		{
+			const std::vector<Vertex>& vertices = *meshes[mesh].vertices;
+			const std::vector<unsigned int>& indices = *meshes[mesh].indices;
+			size_t triangleCount = indices.size() / 3;
+
+			// vertices that differ only in normal or texture coordinates are the same corner
+			std::vector<unsigned int> welded(vertices.size());
+			std::map<std::array<float, 3>, unsigned int> positions;
+			for (size_t i = 0; i < vertices.size(); ++i) {
+				const glm::vec3& p = vertices[i].Position;
+				welded[i] = positions.insert({ { p.x, p.y, p.z }, (unsigned int)positions.size() }).first->second;
+			}
+
+			std::vector<int> direction(triangleCount);
+			for (size_t t = 0; t < triangleCount; ++t)
+				direction[t] = faceDirection(vertices[indices[t * 3]].Position, vertices[indices[t * 3 + 1]].Position, vertices[indices[t * 3 + 2]].Position);
+
+			// every edge with the triangles on it, sorted so the triangles sharing an edge are next to each other
+			std::vector<std::pair<uint64_t, unsigned int>> edges;		// (edge, triangle)
+			edges.reserve(indices.size());
+			for (size_t t = 0; t < triangleCount; ++t) {
+				for (int k = 0; k < 3; ++k) {
+					uint64_t a = welded[indices[t * 3 + k]], b = welded[indices[t * 3 + (k + 1) % 3]];
+					if (a != b)
+						edges.push_back({ std::min(a, b) << 32 | std::max(a, b), (unsigned int)t });
+				}
+			}
+			std::sort(edges.begin(), edges.end());
+
+			std::vector<std::vector<unsigned int>> neighbors(triangleCount);
+			for (size_t i = 0; i < edges.size();) {
+				size_t end = i + 1;
+				while (end < edges.size() && edges[end].first == edges[i].first)
+					++end;
+				for (size_t j = i; j < end; ++j) {
+					for (size_t k = i; k < end; ++k) {
+						if (j != k)
+							neighbors[edges[j].second].push_back(edges[k].second);
+					}
+				}
+				i = end;
+			}
+
+			// flood fill across shared edges
+			std::vector<bool> assigned(triangleCount, false);
+			std::vector<unsigned int> open;
+			for (size_t seed = 0; seed < triangleCount; ++seed) {
+				if (assigned[seed])
+					continue;
+
+				Chart chart;
+				chart.mesh = mesh;
+				int axis = direction[seed] / 2;
+				chart.uAxis = (axis + 1) % 3;
+				chart.vAxis = (axis + 2) % 3;
+
+				assigned[seed] = true;
+				open.assign(1, (unsigned int)seed);
+				while (!open.empty()) {
+					unsigned int t = open.back();
+					open.pop_back();
+					chart.triangles.push_back(t * 3);
+					for (unsigned int neighbor : neighbors[t]) {
+						if (!assigned[neighbor] && direction[neighbor] == direction[seed]) {
+							assigned[neighbor] = true;
+							open.push_back(neighbor);
+						}
+					}
+				}
+
+				chart.min = glm::vec2(INFINITY);
+				chart.max = glm::vec2(-INFINITY);
+				for (unsigned int first : chart.triangles) {
+					for (int k = 0; k < 3; ++k) {
+						const glm::vec3& p = vertices[indices[first + k]].Position;
+						chart.min = glm::min(chart.min, glm::vec2(p[chart.uAxis], p[chart.vAxis]));
+						chart.max = glm::max(chart.max, glm::vec2(p[chart.uAxis], p[chart.vAxis]));
+					}
+				}
+				charts.push_back(std::move(chart));
+			}
+		}
+
+		/// <summary>
+		/// Packs the charts' blocks (sized at texelsPerUnit) into the smallest square they fit in
+		/// </summary>
+		/// <returns>The square's side, or 0 if it would have to be bigger than maxSize</returns>
+		int pack(std::vector<Chart>& charts, float texelsPerUnit) const
+		{
+			size_t area = 0;
+			for (Chart& chart : charts) {
+				// one texel more than the chart covers, so its edges land on texel centers
+				chart.width = (int)std::ceil((chart.max.x - chart.min.x) * texelsPerUnit) + 1 + 2 * settings.gutter;
+				chart.height = (int)std::ceil((chart.max.y - chart.min.y) * texelsPerUnit) + 1 + 2 * settings.gutter;
+				area += size_t(chart.width) * chart.height;
+			}
+
+			std::vector<size_t> order(charts.size());
+			for (size_t i = 0; i < order.size(); ++i)
+				order[i] = i;
+			std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+				if (charts[a].height != charts[b].height)
+					return charts[a].height > charts[b].height;
+				return charts[a].width > charts[b].width;
+			});
+
+			// start from a square a bit bigger than the charts' area (skylines don't pack perfectly) and grow it until they fit
+			int size = std::max(1, (int)std::ceil(std::sqrt(double(area) * 1.2)));
+			for (; size <= settings.maxSize; size = std::max(size + 1, size * 17 / 16)) {
+				TextureAtlas::Skyline skyline(size, size);
+				bool fits = true;
+				for (size_t i = 0; i < order.size() && fits; ++i)
+					fits = skyline.insert(charts[order[i]].width, charts[order[i]].height, charts[order[i]].x, charts[order[i]].y);
+				if (fits)
+					return size;
+			}
+			return 0;
+		}
+
+	public:
+		LightmapCharts(const Settings& chartSettings = Settings()) : settings{ chartSettings }
+		{
+		}
+
+		/// <summary>
+		/// Adds a mesh of the model (unwrapped, with the others, by unwrap())
+		/// </summary>
+		void addMesh(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices)
+		{
+			meshes.push_back({ &vertices, &indices });
+		}
+
+		/// <summary>
+		/// Unwraps every mesh added into one layout, setting their vertices' LightmapCoords (in [0, 1] across the layout)
+		/// </summary>
+		Stats unwrap(void)
+		{
+			Stats stats;
+			std::vector<Chart> charts;
+			for (size_t i = 0; i < meshes.size(); ++i)
+				buildCharts(i, charts);
+			if (charts.empty())
+				return stats;
+
+			float texelsPerUnit = settings.texelsPerUnit;
+			int size = 0;
+			while ((size = pack(charts, texelsPerUnit)) == 0) {
+				texelsPerUnit *= 0.8f;		// too big for maxSize: lower the resolution until it fits
+				if (texelsPerUnit < settings.texelsPerUnit * 1e-4f) {
+					std::cout << "ERROR: Too many lightmap charts to fit in " << settings.maxSize << "x" << settings.maxSize << " texels" << std::endl;
+					return stats;
+				}
+			}
+
+			// a vertex keeps the coordinates of the first chart that uses it; other charts get a copy of it
+			std::vector<std::vector<int>> owner(meshes.size());
+			for (size_t i = 0; i < meshes.size(); ++i)
+				owner[i].assign(meshes[i].vertices->size(), -1);
+
+			for (size_t c = 0; c < charts.size(); ++c) {
+				const Chart& chart = charts[c];
+				std::vector<Vertex>& vertices = *meshes[chart.mesh].vertices;
+				std::vector<unsigned int>& indices = *meshes[chart.mesh].indices;
+				std::map<unsigned int, unsigned int> copies;		// original vertex -> this chart's copy
+
+				for (unsigned int first : chart.triangles) {
+					for (int k = 0; k < 3; ++k) {
+						unsigned int& index = indices[first + k];
+						if (owner[chart.mesh][index] == (int)c)
+							continue;
+						if (owner[chart.mesh][index] >= 0) {
+							auto copy = copies.find(index);
+							if (copy == copies.end()) {
+								copy = copies.insert({ index, (unsigned int)vertices.size() }).first;
+								vertices.push_back(vertices[index]);
+								++stats.seamVertices;
+							}
+							index = copy->second;
+						}
+						else
+							owner[chart.mesh][index] = (int)c;
+
+						const glm::vec3& p = vertices[index].Position;
+						glm::vec2 texel = glm::vec2(chart.x + settings.gutter + 0.5f, chart.y + settings.gutter + 0.5f)
+							+ (glm::vec2(p[chart.uAxis], p[chart.vAxis]) - chart.min) * texelsPerUnit;
+						vertices[index].LightmapCoords = texel / float(size);
+					}
+				}
+			}
+
+			stats.charts = (unsigned int)charts.size();
+			stats.size = size;
+			stats.texelsPerUnit = texelsPerUnit;
+			return stats;
+		}
+};
+
+#endif
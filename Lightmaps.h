@@ -0,0 +1,625 @@
+#ifndef LIGHTMAPS_H
+#define LIGHTMAPS_H
+
+#include <cmath>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm/glm.hpp>
+#include "GLState.h"
+#include "ShaderProgram.h"
+#include "Object.h"
+#include "Skybox.h"
+#include "TextureAtlas.h"
+#include "ThreadPool.h"
+#include "TriangleScene.h"
+
+/// <summary>
+/// Baked lighting for static objects: the sun (with soft shadows) and the sky, bounced off the scene a few times, path traced
+/// on the CPU into one lightmap texture that the LIGHTMAP shader variant reads instead of lighting them every frame.
+/// Each object gets a square of the lightmap for its model's LightmapCharts layout (scaled up by a whole number for objects scaled
+/// up, so texels stay about texelsPerUnit apart in the world), and its rect there goes into ObjectConstants.
+/// Every covered texel traces rays from its point on the surface in parallel (rows on the ThreadPool, against a TriangleScene):
+/// RGB is the diffuse light arriving there, sun and sky, already multiplied by the cosine (what the shader would multiply the
+/// diffuse color by), and A is how much of the sun is unblocked, which the shader uses to shadow specular highlights. Texels
+/// outside the charts are filled in from their neighbors afterwards, so bilinear filtering at a chart's edge stays in the chart.
+/// Sky light comes from the skybox's images (shrunk to SKY_FACE_SIZE texels a side, so a few samples average out), and what
+/// light bounces off a surface takes its color from its material's albedo.
+/// NOTE: Only objects that don't move belong in the bake; rebake whenever they (or their models, or the sun) change
+/// </summary>
+class Lightmaps
+{
+	public:
+		struct Settings {
+			float texelsPerUnit;	// wanted texel density in world units (objects get the nearest whole multiple of their layout's)
+			int maxSize;			// largest side of the lightmap; densities are lowered until every object fits
+			int samplesPerTexel;	// paths traced from each texel (each also samples the sun once)
+			int bounces;			// surfaces a path can light up after the first one it hits (0 = sky and direct sun only)
+			float skyIntensity;		// scale of the skybox's colors as light
+			float sunRadius;		// angular radius of the sun in degrees (how soft shadows are)
+			float rayOffset;		// rays start this far off a surface (world units), so they don't hit it
+
+			Settings() : texelsPerUnit{ 4.0f }, maxSize{ 2048 }, samplesPerTexel{ 64 }, bounces{ 2 }, skyIntensity{ 0.35f }, sunRadius{ 1.0f }, rayOffset{ 0.01f } {}
+		};
+
+		struct Stats {
+			unsigned int objects = 0;
+			int size = 0;						// side of the lightmap in texels
+			size_t texels = 0;					// covered by the objects' triangles (the rest are filled in from them)
+			unsigned long long rays = 0;
+			float bakeMilliseconds = 0.0f;
+		};
+
+		static const int SKY_FACE_SIZE = 16;
+
+		// two unit vectors that make an orthonormal basis with n (this and the two below are also used by VertexOcclusion)
+		static void basis(const glm::vec3& n, glm::vec3& tangent, glm::vec3& bitangent)
+		{
+			float sign = n.z >= 0.0f ? 1.0f : -1.0f;
+			float a = -1.0f / (sign + n.z);
+			float b = n.x * n.y * a;
+			tangent = glm::vec3(1.0f + sign * n.x * n.x * a, sign * b, -sign * n.x);
+			bitangent = glm::vec3(b, sign + n.y * n.y * a, -n.y);
+		}
+
+		// a direction around n, more likely the closer it is to n (so averaging what the rays find weights it by the cosine)
+		static glm::vec3 cosineDirection(const glm::vec3& n, float u, float v)
+		{
+			glm::vec3 tangent, bitangent;
+			basis(n, tangent, bitangent);
+			float radius = std::sqrt(u);
+			float angle = 6.2831853f * v;
+			return tangent * (radius * std::cos(angle)) + bitangent * (radius * std::sin(angle)) + n * std::sqrt(std::max(0.0f, 1.0f - u));
+		}
+
+		// a direction inside the cone of angles whose cosine is at least cosRadius around axis
+		static glm::vec3 coneDirection(const glm::vec3& axis, float cosRadius, float u, float v)
+		{
+			glm::vec3 tangent, bitangent;
+			basis(axis, tangent, bitangent);
+			float cosTheta = 1.0f - u * (1.0f - cosRadius);
+			float sinTheta = std::sqrt(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+			float angle = 6.2831853f * v;
+			return tangent * (sinTheta * std::cos(angle)) + bitangent * (sinTheta * std::sin(angle)) + axis * cosTheta;
+		}
+
+	private:
+		static const uint32_t FILE_MAGIC = 0x314D4C42;		// "BLM1"
+
+		// a texel's point on a surface, found by rasterizing the charts
+		struct Sample {
+			glm::vec3 position;
+			glm::vec3 normal;			// interpolated (what the lighting is for)
+			glm::vec3 faceNormal;		// of the triangle (what rays are offset along)
+			bool covered = false;
+		};
+
+		Settings settings;
+		int size;
+		std::vector<glm::vec4> rects;		// per object baked: offset (xy) and scale (zw) of its square, or zero if it didn't get one
+		std::vector<glm::vec4> texels;		// size * size, RGB light and A sun visibility
+		std::vector<glm::vec3> sky;			// 6 faces of SKY_FACE_SIZE * SKY_FACE_SIZE, in cube map face order
+		uint64_t fingerprint;				// of the objects, sun, sky, and settings the bake was made from
+		unsigned int texture;
+		Stats lastStats;
+
+		/// <summary>
+		/// FNV-1a over raw bytes
+		/// </summary>
+		static void hashBytes(uint64_t& hash, const void* data, size_t size)
+		{
+			const unsigned char* bytes = (const unsigned char*)data;
+			for (size_t i = 0; i < size; ++i) {
+				hash ^= bytes[i];
+				hash *= 0x100000001B3ull;
+			}
+		}
+
+		/// <summary>
+		/// Identifies everything a bake depends on, so a saved bake can be checked against the current scene
+		/// </summary>
+		uint64_t computeFingerprint(const std::vector<Object*>& objects, const glm::vec3& sunDirection, const glm::vec3& sunColor, const Settings& bakeSettings) const
+		{
+			uint64_t hash = 0xCBF29CE484222325ull;
+			hashBytes(hash, &bakeSettings, sizeof(bakeSettings));
+			hashBytes(hash, &sunDirection, sizeof(sunDirection));
+			hashBytes(hash, &sunColor, sizeof(sunColor));
+			hashBytes(hash, sky.data(), sky.size() * sizeof(glm::vec3));
+
+			size_t count = objects.size();
+			hashBytes(hash, &count, sizeof(count));
+			for (const Object* object : objects) {
+				hashBytes(hash, &object->getMatrix(), sizeof(glm::mat4));
+				if (!object->getModel().isLoaded())
+					continue;
+				for (const Mesh& mesh : object->getModel().getMeshes()) {
+					for (const Vertex& vertex : mesh.vertices) {
+						hashBytes(hash, &vertex.Position, sizeof(glm::vec3));
+						hashBytes(hash, &vertex.Normal, sizeof(glm::vec3));
+						hashBytes(hash, &vertex.LightmapCoords, sizeof(glm::vec2));
+					}
+					hashBytes(hash, mesh.indices.data(), mesh.indices.size() * sizeof(unsigned int));
+					hashBytes(hash, &mesh.material.albedo, sizeof(glm::vec3));
+				}
+			}
+			return hash;
+		}
+
+		/// <summary>
+		/// The sky's light arriving from a direction (picked from the faces the way OpenGL picks from a cube map)
+		/// </summary>
+		glm::vec3 skyRadiance(const glm::vec3& direction) const
+		{
+			if (sky.empty())
+				return glm::vec3(0.0f);
+
+			glm::vec3 a = glm::abs(direction);
+			int face;
+			float s, t, major;
+			if (a.x >= a.y && a.x >= a.z) {
+				face = direction.x > 0.0f ? 0 : 1;
+				major = a.x;
+				s = direction.x > 0.0f ? -direction.z : direction.z;
+				t = -direction.y;
+			}
+			else if (a.y >= a.z) {
+				face = direction.y > 0.0f ? 2 : 3;
+				major = a.y;
+				s = direction.x;
+				t = direction.y > 0.0f ? direction.z : -direction.z;
+			}
+			else {
+				face = direction.z > 0.0f ? 4 : 5;
+				major = a.z;
+				s = direction.z > 0.0f ? direction.x : -direction.x;
+				t = -direction.y;
+			}
+			int x = std::min(std::max((int)((s / major * 0.5f + 0.5f) * SKY_FACE_SIZE), 0), SKY_FACE_SIZE - 1);
+			int y = std::min(std::max((int)((t / major * 0.5f + 0.5f) * SKY_FACE_SIZE), 0), SKY_FACE_SIZE - 1);
+			return sky[(face * SKY_FACE_SIZE + y) * SKY_FACE_SIZE + x] * settings.skyIntensity;
+		}
+
+		/// <summary>
+		/// Gives every object a square big enough for its model's layout at (about) texelsPerUnit
+		/// </summary>
+		/// <returns>The lightmap's side</returns>
+		int placeObjects(const std::vector<Object*>& objects, std::vector<glm::ivec3>& squares) const		// (x, y, side) per object
+		{
+			float density = settings.texelsPerUnit;
+			while (true) {
+				squares.assign(objects.size(), glm::ivec3(0));
+				size_t area = 0;
+				for (size_t i = 0; i < objects.size(); ++i) {
+					const LightmapCharts::Stats& charts = objects[i]->getModel().getChartStats();
+					if (!objects[i]->getModel().isLoaded() || charts.size == 0)
+						continue;
+					const glm::mat4& matrix = objects[i]->getMatrix();
+					float scale = std::max(glm::length(glm::vec3(matrix[0])), std::max(glm::length(glm::vec3(matrix[1])), glm::length(glm::vec3(matrix[2]))));
+					int multiple = std::max(1, (int)std::round(density * scale / charts.texelsPerUnit));
+					squares[i].z = charts.size * multiple;
+					area += size_t(squares[i].z) * squares[i].z;
+				}
+
+				std::vector<size_t> order;
+				for (size_t i = 0; i < objects.size(); ++i) {
+					if (squares[i].z > 0)
+						order.push_back(i);
+				}
+				std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return squares[a].z > squares[b].z; });
+
+				for (int side = std::max(1, (int)std::ceil(std::sqrt(double(area)))); side <= settings.maxSize; side = std::max(side + 1, side * 17 / 16)) {
+					TextureAtlas::Skyline skyline(side, side);
+					bool fits = true;
+					for (size_t k = 0; k < order.size() && fits; ++k)
+						fits = skyline.insert(squares[order[k]].z, squares[order[k]].z, squares[order[k]].x, squares[order[k]].y);
+					if (fits)
+						return side;
+				}
+
+				// lower the density, until every object is down to its layout's own size
+				bool smallest = true;
+				for (size_t i = 0; i < objects.size(); ++i)
+					smallest &= squares[i].z == objects[i]->getModel().getChartStats().size;
+				if (smallest) {
+					std::cout << "ERROR: The objects' lightmap layouts don't fit in " << settings.maxSize << "x" << settings.maxSize << " texels" << std::endl;
+					squares.assign(objects.size(), glm::ivec3(0));
+					return 0;
+				}
+				density *= 0.8f;
+			}
+		}
+
+		/// <summary>
+		/// Finds each texel's point on a surface by rasterizing every object's charts into its square
+		/// </summary>
+		void rasterize(const std::vector<Object*>& objects, const std::vector<glm::ivec3>& squares, std::vector<Sample>& samples) const
+		{
+			samples.assign(size_t(size) * size, Sample());
+			for (size_t i = 0; i < objects.size(); ++i) {
+				if (squares[i].z == 0)
+					continue;
+
+				const glm::mat4& matrix = objects[i]->getMatrix();
+				glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(matrix)));
+				glm::vec2 origin(squares[i].x, squares[i].y);
+				float side = (float)squares[i].z;
+
+				for (const Mesh& mesh : objects[i]->getModel().getMeshes()) {
+					for (size_t k = 0; k + 2 < mesh.indices.size(); k += 3) {
+						const Vertex* corners[3] = { &mesh.vertices[mesh.indices[k]], &mesh.vertices[mesh.indices[k + 1]], &mesh.vertices[mesh.indices[k + 2]] };
+						glm::vec2 p[3];
+						for (int c = 0; c < 3; ++c)
+							p[c] = origin + corners[c]->LightmapCoords * side;
+						float area = (p[1].x - p[0].x) * (p[2].y - p[0].y) - (p[2].x - p[0].x) * (p[1].y - p[0].y);
+						if (std::fabs(area) < 1e-12f)
+							continue;
+
+						glm::vec3 world[3];
+						for (int c = 0; c < 3; ++c)
+							world[c] = glm::vec3(matrix * glm::vec4(corners[c]->Position, 1.0f));
+						glm::vec3 faceNormal = glm::cross(world[1] - world[0], world[2] - world[0]);
+						if (glm::length(faceNormal) <= 0.0f)
+							continue;
+						faceNormal = glm::normalize(faceNormal);
+
+						// texel centers inside the triangle (edges included, so neighboring triangles leave no gaps)
+						int minX = std::max(0, (int)std::floor(std::min(p[0].x, std::min(p[1].x, p[2].x))));
+						int maxX = std::min(size - 1, (int)std::ceil(std::max(p[0].x, std::max(p[1].x, p[2].x))));
+						int minY = std::max(0, (int)std::floor(std::min(p[0].y, std::min(p[1].y, p[2].y))));
+						int maxY = std::min(size - 1, (int)std::ceil(std::max(p[0].y, std::max(p[1].y, p[2].y))));
+						const float epsilon = 1e-4f;
+						for (int y = minY; y <= maxY; ++y) {
+							for (int x = minX; x <= maxX; ++x) {
+								glm::vec2 center(x + 0.5f, y + 0.5f);
+								float w1 = ((center.x - p[0].x) * (p[2].y - p[0].y) - (p[2].x - p[0].x) * (center.y - p[0].y)) / area;
+								float w2 = ((p[1].x - p[0].x) * (center.y - p[0].y) - (center.x - p[0].x) * (p[1].y - p[0].y)) / area;
+								float w0 = 1.0f - w1 - w2;
+								if (w0 < -epsilon || w1 < -epsilon || w2 < -epsilon)
+									continue;
+
+								Sample& sample = samples[size_t(y) * size + x];
+								if (sample.covered)
+									continue;
+								sample.covered = true;
+								sample.position = world[0] * w0 + world[1] * w1 + world[2] * w2;
+								glm::vec3 normal = normalMatrix * (corners[0]->Normal * w0 + corners[1]->Normal * w1 + corners[2]->Normal * w2);
+								sample.normal = glm::length(normal) > 0.0f ? glm::normalize(normal) : faceNormal;
+								sample.faceNormal = glm::dot(faceNormal, sample.normal) >= 0.0f ? faceNormal : -faceNormal;
+							}
+						}
+					}
+				}
+			}
+		}
+
+		/// <summary>
+		/// Path traces the light arriving at one texel's point
+		/// </summary>
+		/// <returns>RGB light and A sun visibility</returns>
+		glm::vec4 bakeTexel(const Sample& sample, size_t texel, const TriangleScene& scene, const std::vector<std::vector<glm::vec3>>& albedos,
+			const glm::vec3& sunDirection, const glm::vec3& sunColor, unsigned long long& rays) const
+		{
+			std::mt19937 random((unsigned int)texel);		// seeded per texel, so bakes are repeatable
+			std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+			float cosSunRadius = std::cos(glm::radians(settings.sunRadius));
+
+			glm::vec3 light(0.0f);
+			float sunVisible = 0.0f;
+			glm::vec3 origin = sample.position + sample.faceNormal * settings.rayOffset;
+
+			for (int s = 0; s < settings.samplesPerTexel; ++s) {
+				// the sun, straight from here
+				glm::vec3 toSun = coneDirection(sunDirection, cosSunRadius, unit(random), unit(random));
+				float cosine = glm::dot(sample.normal, toSun);
+				if (cosine > 0.0f) {
+					++rays;
+					if (!scene.occluded(origin, toSun, INFINITY)) {
+						light += sunColor * cosine;
+						sunVisible += 1.0f;
+					}
+				}
+
+				// then a path: sky where it escapes, and the sun wherever it bounces
+				glm::vec3 direction = cosineDirection(sample.normal, unit(random), unit(random));
+				if (glm::dot(direction, sample.faceNormal) <= 0.0f)
+					continue;		// below the surface (the interpolated normal leans away from the triangle's)
+				glm::vec3 throughput(1.0f);
+				glm::vec3 rayOrigin = origin;
+				for (int bounce = 0; bounce <= settings.bounces; ++bounce) {
+					TriangleScene::Hit hit;
+					++rays;
+					if (!scene.intersect(rayOrigin, direction, INFINITY, hit)) {
+						light += throughput * skyRadiance(direction);
+						break;
+					}
+
+					const TriangleScene::Triangle& triangle = scene.getTriangle(hit.triangle);
+					glm::vec3 normal = glm::normalize(glm::cross(triangle.edge1, triangle.edge2));
+					if (glm::dot(normal, direction) > 0.0f)
+						normal = -normal;		// lit from whichever side the path arrived on
+					throughput *= albedos[triangle.object][triangle.mesh];
+					rayOrigin = rayOrigin + direction * hit.distance + normal * settings.rayOffset;
+
+					toSun = coneDirection(sunDirection, cosSunRadius, unit(random), unit(random));
+					cosine = glm::dot(normal, toSun);
+					if (cosine > 0.0f) {
+						++rays;
+						if (!scene.occluded(rayOrigin, toSun, INFINITY))
+							light += throughput * sunColor * cosine;
+					}
+					direction = cosineDirection(normal, unit(random), unit(random));
+				}
+			}
+
+			float samples = (float)std::max(settings.samplesPerTexel, 1);
+			return glm::vec4(light / samples, sunVisible / samples);
+		}
+
+		/// <summary>
+		/// Fills the texels no triangle covers from their covered neighbors, a ring at a time (gutters and the space between squares)
+		/// </summary>
+		void dilate(std::vector<unsigned char>& filled, int passes)
+		{
+			std::vector<unsigned char> next;
+			for (int pass = 0; pass < passes; ++pass) {
+				next = filled;
+				bool changed = false;
+				for (int y = 0; y < size; ++y) {
+					for (int x = 0; x < size; ++x) {
+						size_t texel = size_t(y) * size + x;
+						if (filled[texel])
+							continue;
+
+						glm::vec4 sum(0.0f);
+						int count = 0;
+						for (int dy = -1; dy <= 1; ++dy) {
+							for (int dx = -1; dx <= 1; ++dx) {
+								int nx = x + dx, ny = y + dy;
+								if (nx < 0 || ny < 0 || nx >= size || ny >= size || !filled[size_t(ny) * size + nx])
+									continue;
+								sum += texels[size_t(ny) * size + nx];
+								++count;
+							}
+						}
+						if (count > 0) {
+							texels[texel] = sum / float(count);
+							next[texel] = 1;
+							changed = true;
+						}
+					}
+				}
+				filled.swap(next);
+				if (!changed)
+					break;
+			}
+		}
+
+		void upload(void)
+		{
+			if (texture == 0)
+				glGenTextures(1, &texture);
+			GLState::get().bindTexture(LIGHTMAP_UNIT, GL_TEXTURE_2D, texture);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, size, size, 0, GL_RGBA, GL_FLOAT, texels.data());
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);		// no mipmaps: lower levels would mix neighboring charts
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		}
+
+		void applyRects(const std::vector<Object*>& objects) const
+		{
+			for (size_t i = 0; i < objects.size(); ++i)
+				objects[i]->setLightmapRect(i < rects.size() ? rects[i] : glm::vec4(0.0f));
+		}
+
+	public:
+		/// <summary>
+		/// What to build VertexShader.vert/FragmentShader.frag with to get the variant that reads the lightmap
+		/// </summary>
+		static std::string defines(void)
+		{
+			return "#define LIGHTMAP 1\n";
+		}
+
+		Lightmaps() : size{ 0 }, fingerprint{ 0 }, texture{ 0 } {}
+
+		Lightmaps(const Lightmaps&) = delete;
+		Lightmaps& operator=(const Lightmaps&) = delete;
+
+		~Lightmaps()
+		{
+			if (texture != 0)
+				GLState::get().deleteTexture(texture);
+		}
+
+		/// <summary>
+		/// Reads the skybox's images and shrinks them, to light the bake with (without them, only the sun lights it)
+		/// </summary>
+		/// <returns>Whether every face was read</returns>
+		bool loadSky(const Skybox& skybox)
+		{
+			sky.assign(6 * SKY_FACE_SIZE * SKY_FACE_SIZE, glm::vec3(0.0f));
+			for (int face = 0; face < 6; ++face) {
+				ImageData image;
+				if (!Model::LoadImageData(skybox.getFacePath(face), image)) {
+					sky.clear();
+					return false;
+				}
+
+				// each texel of the face is the average of its block of the image
+				for (int y = 0; y < image.height; ++y) {
+					for (int x = 0; x < image.width; ++x) {
+						const unsigned char* pixel = &image.pixels[(size_t(y) * image.width + x) * image.nrChannels];
+						glm::vec3 color(pixel[0], pixel[image.nrChannels >= 3 ? 1 : 0], pixel[image.nrChannels >= 3 ? 2 : 0]);
+						int skyX = x * SKY_FACE_SIZE / image.width, skyY = y * SKY_FACE_SIZE / image.height;
+						sky[(face * SKY_FACE_SIZE + skyY) * SKY_FACE_SIZE + skyX] += color;
+					}
+				}
+				float pixelsPerTexel = float(image.width) * image.height / (SKY_FACE_SIZE * SKY_FACE_SIZE);
+				for (int i = 0; i < SKY_FACE_SIZE * SKY_FACE_SIZE; ++i)
+					sky[face * SKY_FACE_SIZE * SKY_FACE_SIZE + i] /= 255.0f * pixelsPerTexel;
+			}
+			return true;
+		}
+
+		/// <summary>
+		/// Bakes the lighting of every object, uploads the lightmap, and gives each object its rect in it
+		/// </summary>
+		/// <param name="objects">The static objects (ones whose models have no lightmap layout get no rect, and stay lit at runtime)</param>
+		/// <param name="sunDirection">Toward the sun</param>
+		void bake(const std::vector<Object*>& objects, const glm::vec3& sunDirection, const glm::vec3& sunColor, const Settings& bakeSettings = Settings())
+		{
+			auto start = std::chrono::steady_clock::now();
+			settings = bakeSettings;
+			fingerprint = computeFingerprint(objects, sunDirection, sunColor, settings);
+			glm::vec3 toSun = glm::normalize(sunDirection);
+
+			std::vector<glm::ivec3> squares;
+			size = placeObjects(objects, squares);
+			rects.assign(objects.size(), glm::vec4(0.0f));
+			for (size_t i = 0; i < objects.size(); ++i) {
+				if (squares[i].z > 0)
+					rects[i] = glm::vec4(squares[i].x, squares[i].y, squares[i].z, squares[i].z) / float(size);
+			}
+
+			Stats stats;
+			texels.assign(size_t(size) * size, glm::vec4(0.0f));
+			if (size > 0) {
+				std::vector<Sample> samples;
+				rasterize(objects, squares, samples);
+
+				TriangleScene scene;
+				scene.build(objects);
+				std::vector<std::vector<glm::vec3>> albedos(objects.size());
+				for (size_t i = 0; i < objects.size(); ++i) {
+					for (const Mesh& mesh : objects[i]->getModel().getMeshes())
+						albedos[i].push_back(mesh.material.albedo);
+				}
+
+				std::vector<unsigned long long> rowRays(size, 0);
+				ThreadPool::get().parallelFor(size, [&](size_t y) {
+					for (int x = 0; x < size; ++x) {
+						size_t texel = y * size + x;
+						if (samples[texel].covered)
+							texels[texel] = bakeTexel(samples[texel], texel, scene, albedos, toSun, sunColor, rowRays[y]);
+					}
+				});
+
+				std::vector<unsigned char> filled(samples.size());
+				for (size_t texel = 0; texel < samples.size(); ++texel) {
+					filled[texel] = samples[texel].covered;
+					stats.texels += filled[texel];
+				}
+				int gutters = 0;
+				for (size_t i = 0; i < objects.size(); ++i) {
+					const LightmapCharts::Stats& charts = objects[i]->getModel().getChartStats();
+					if (squares[i].z > 0)
+						gutters = std::max(gutters, 2 * squares[i].z / charts.size + 1);		// two layout texels of gutter, scaled up with the square
+				}
+				dilate(filled, gutters);
+
+				for (unsigned long long rays : rowRays)
+					stats.rays += rays;
+				upload();
+			}
+			applyRects(objects);
+
+			for (size_t i = 0; i < objects.size(); ++i)
+				stats.objects += squares[i].z > 0;
+			stats.size = size;
+			stats.bakeMilliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+			lastStats = stats;
+		}
+
+		/// <summary>
+		/// Writes the bake to a file, so later runs can load it instead of baking again
+		/// </summary>
+		bool save(const char* path) const
+		{
+			std::ofstream file(path, std::ios::binary);
+			if (!file) {
+				std::cout << "ERROR: Couldn't write lightmap file " << path << std::endl;
+				return false;
+			}
+
+			uint32_t header[3] = { FILE_MAGIC, (uint32_t)size, (uint32_t)rects.size() };
+			file.write((const char*)header, sizeof(header));
+			file.write((const char*)&fingerprint, sizeof(fingerprint));
+			file.write((const char*)rects.data(), rects.size() * sizeof(glm::vec4));
+			file.write((const char*)texels.data(), texels.size() * sizeof(glm::vec4));
+			return bool(file);
+		}
+
+		/// <summary>
+		/// Reads a bake written by save(), if it was made from the same objects, sun, sky, and settings, and uploads it
+		/// (call loadSky() first, same as for bake())
+		/// </summary>
+		/// <returns>False if the file is missing or out of date (bake again then)</returns>
+		bool load(const char* path, const std::vector<Object*>& objects, const glm::vec3& sunDirection, const glm::vec3& sunColor, const Settings& bakeSettings = Settings())
+		{
+			std::ifstream file(path, std::ios::binary);
+			if (!file)
+				return false;
+
+			uint32_t header[3];
+			uint64_t fileFingerprint;
+			if (!file.read((char*)header, sizeof(header)) || !file.read((char*)&fileFingerprint, sizeof(fileFingerprint)) || header[0] != FILE_MAGIC)
+				return false;
+			if (fileFingerprint != computeFingerprint(objects, sunDirection, sunColor, bakeSettings) || header[2] != objects.size())
+				return false;
+
+			std::vector<glm::vec4> fileRects(header[2]);
+			std::vector<glm::vec4> fileTexels(size_t(header[1]) * header[1]);
+			if (!file.read((char*)fileRects.data(), fileRects.size() * sizeof(glm::vec4)) || !file.read((char*)fileTexels.data(), fileTexels.size() * sizeof(glm::vec4)))
+				return false;
+
+			settings = bakeSettings;
+			size = (int)header[1];
+			rects = std::move(fileRects);
+			texels = std::move(fileTexels);
+			fingerprint = fileFingerprint;
+			lastStats = Stats();
+			if (size > 0)
+				upload();
+			applyRects(objects);
+			return true;
+		}
+
+		bool isBaked(void) const
+		{
+			return size > 0;
+		}
+
+		/// <summary>
+		/// Whether the bake still matches the objects (false once any of them, or their models, have changed)
+		/// </summary>
+		bool isUpToDate(const std::vector<Object*>& objects, const glm::vec3& sunDirection, const glm::vec3& sunColor) const
+		{
+			return isBaked() && computeFingerprint(objects, sunDirection, sunColor, settings) == fingerprint;
+		}
+
+		/// <summary>
+		/// Binds the lightmap to the unit the LIGHTMAP shader variant's lightmap sampler reads from
+		/// </summary>
+		void bind(void) const
+		{
+			if (texture != 0)
+				GLState::get().bindTexture(LIGHTMAP_UNIT, GL_TEXTURE_2D, texture);
+		}
+
+		/// <summary>
+		/// Stats from the last bake (all zeros if the lightmap was loaded from a file)
+		/// </summary>
+		const Stats& getLastBakeStats(void) const
+		{
+			return lastStats;
+		}
+};
+
+#endif
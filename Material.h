@@ -0,0 +1,46 @@
+#ifndef MATERIAL_H
+#define MATERIAL_H
+
+#include <glad/glad.h>
+#include <glm/glm/glm.hpp>
+#include "GeometryBuffer.h"
+
+/// <summary>
+/// A mesh's textures and .mtl constants, built once at import. The shaders don't read it from uniforms: it's copied into
+/// the MaterialTable (its textures into texture array layers), and drawing only has to tell the shader which entry to use.
+/// </summary>
+struct Material {
+	unsigned int diffuseMap = 0;	// texture IDs (0 if the material doesn't have that map)
+	unsigned int specularMap = 0;
+
+	glm::vec3 diffuseColor = glm::vec3(1.0f);		// Kd; used when there's no diffuse map
+	glm::vec3 specularColor = glm::vec3(0.0f);		// Ks; used when there's no specular map
+	float shininess = 32.0f;						// Ns
+	glm::vec3 albedo = glm::vec3(1.0f);				// average of the diffuse map (or Kd without one), for light bakes
+
+	// where each map is in its texture when that's an atlas (see TextureAtlas): offset (xy) and scale (zw) in texture coordinates,
+	// all zero for a map that's a whole texture
+	glm::vec4 diffuseRect = glm::vec4(0.0f);
+	glm::vec4 specularRect = glm::vec4(0.0f);
+	int atlasMipLevels = 0;		// mip levels an atlas keeps each texture to (TextureAtlas::Settings::mipLevels)
+
+	int index = 0;		// entry in the MaterialTable (assigned when a Mesh is made with the material)
+
+	bool sameAs(const Material& other) const
+	{
+		return diffuseMap == other.diffuseMap && specularMap == other.specularMap && diffuseColor == other.diffuseColor
+			&& specularColor == other.specularColor && shininess == other.shininess && diffuseRect == other.diffuseRect && specularRect == other.specularRect
+			&& atlasMipLevels == other.atlasMipLevels;
+	}
+
+	/// <summary>
+	/// Selects the material for draws that aren't instanced (instanced draws read the index from their instance buffer).
+	/// Nothing is bound and no uniforms are set, so switching materials costs one attribute value.
+	/// </summary>
+	void apply(void) const
+	{
+		glVertexAttribI1i(MATERIAL_INDEX_ATTRIB, index);
+	}
+};
+
+#endif
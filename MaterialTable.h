@@ -0,0 +1,354 @@
+#ifndef MATERIAL_TABLE_H
+#define MATERIAL_TABLE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+#include <glad/glad.h>
+#include "GLState.h"
+#include "ShaderProgram.h"
+#include "Material.h"
+
+/// <summary>
+/// Texture residency for materials. Every material texture is copied into a layer of a GL_TEXTURE_2D_ARRAY (one array per
+/// texture size, up to MATERIAL_TEXTURE_ARRAYS of them), and every material's constants and texture layers go in one texture
+/// buffer. The model shaders look a mesh's material up by the index in MATERIAL_INDEX_ATTRIB, so switching materials doesn't
+/// bind textures or set uniforms, and draws with different materials don't have to be split up.
+/// Once every array is taken, textures of another size are resampled to the size of the closest array.
+/// The 2D textures are kept as well (HierarchicalLOD reads them back to bake its atlases).
+/// There is only one GL context, so there is one instance: MaterialTable::get().
+/// </summary>
+class MaterialTable
+{
+	public:
+		// layout of one material's entry in the buffer, in vec4 texels
+		//   0: diffuse color, and the array its diffuse map is in (-1 if it has none)
+		//   1: specular color, and the array its specular map is in (-1 if it has none)
+		//   2: diffuse map's layer, specular map's layer, shininess, mip levels atlas textures are kept to
+		//   3: diffuse map's rect in its atlas: offset, scale (all zero if the map is a whole texture)
+		//   4: specular map's rect
+		static const int TEXELS_PER_MATERIAL = 5;
+
+	private:
+		struct TextureArray {
+			unsigned int texture = 0;
+			int width = 0, height = 0;
+			int levels = 1;
+			int capacity = 0;				// layers allocated
+			int layers = 0;					// layers handed out so far (freed ones are reused first)
+			std::vector<int> freeLayers;
+			bool mipmapsDirty = false;		// a layer changed since the mipmaps were last built
+		};
+
+		// where a texture's copy lives
+		struct Residence {
+			int array = -1;
+			int layer = 0;
+		};
+
+		TextureArray arrays[MATERIAL_TEXTURE_ARRAYS];
+		int arrayCount;
+		std::unordered_map<unsigned int, Residence> resident;		// by 2D texture ID
+		std::vector<Material> materials;
+		std::vector<unsigned char> used;		// per entry; unused entries are reused
+		std::vector<float> records;
+		unsigned int buffer, dataTexture;
+		bool recordsDirty;
+		int maxLayers;
+		std::vector<unsigned char> resampled;
+
+		MaterialTable() : arrayCount{ 0 }, recordsDirty{ true }, maxLayers{ 256 }
+		{
+			glGenBuffers(1, &buffer);
+			glGenTextures(1, &dataTexture);
+			glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+
+			GLState::get().bindBuffer(GL_TEXTURE_BUFFER, buffer);
+			GLState::get().bindTexture(MATERIAL_DATA_UNIT, GL_TEXTURE_BUFFER, dataTexture);
+			glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffer);
+
+			add(Material());		// entry 0: no maps, white (the value MATERIAL_INDEX_ATTRIB has until something sets it)
+		}
+
+		/// <summary>
+		/// Gives an array new storage with room for a number of layers (the old storage's contents are lost)
+		/// </summary>
+		void allocate(int index, int capacity)
+		{
+			TextureArray& array = arrays[index];
+			if (array.texture != 0)
+				GLState::get().deleteTexture(array.texture);
+			glGenTextures(1, &array.texture);
+			GLState::get().bindTexture(MATERIAL_TEXTURES_UNIT + index, GL_TEXTURE_2D_ARRAY, array.texture);
+
+			// same sampling as the 2D textures (see Model::TextureFromImage)
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, array.levels - 1);
+
+			for (int level = 0; level < array.levels; ++level)
+				glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGB8, std::max(array.width >> level, 1), std::max(array.height >> level, 1), capacity, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+			array.capacity = capacity;
+		}
+
+		/// <summary>
+		/// Doubles an array's layers, keeping the ones handed out (only happens while models are loading)
+		/// </summary>
+		/// <returns>Whether there's room for another layer now</returns>
+		bool grow(int index)
+		{
+			TextureArray& array = arrays[index];
+			if (array.capacity >= maxLayers) {
+				std::cout << "ERROR: MaterialTable: texture array " << array.width << "x" << array.height << " is full (" << maxLayers << " layers)" << std::endl;
+				return false;
+			}
+
+			std::vector<unsigned char> pixels(size_t(array.width) * array.height * 3 * array.capacity);
+			GLState::get().bindTexture(MATERIAL_TEXTURES_UNIT + index, GL_TEXTURE_2D_ARRAY, array.texture);
+			glPixelStorei(GL_PACK_ALIGNMENT, 1);
+			glGetTexImage(GL_TEXTURE_2D_ARRAY, 0, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+			glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+			int oldCapacity = array.capacity;
+			allocate(index, std::min(oldCapacity * 2, maxLayers));
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, array.width, array.height, oldCapacity, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+			array.mipmapsDirty = true;
+			return true;
+		}
+
+		/// <summary>
+		/// The array for textures of a size: the one of that size, a new one, or (once every array is taken) the closest one
+		/// </summary>
+		int findArray(int width, int height)
+		{
+			int closest = 0;
+			int closestDifference = -1;
+			for (int i = 0; i < arrayCount; ++i) {
+				if (arrays[i].width == width && arrays[i].height == height)
+					return i;
+				int difference = std::abs(arrays[i].width - width) + std::abs(arrays[i].height - height);
+				if (closestDifference < 0 || difference < closestDifference) {
+					closest = i;
+					closestDifference = difference;
+				}
+			}
+			if (arrayCount == MATERIAL_TEXTURE_ARRAYS)
+				return closest;
+
+			TextureArray& array = arrays[arrayCount];
+			array.width = width;
+			array.height = height;
+			array.levels = 1 + (int)std::floor(std::log2((float)std::max(width, height)));
+			allocate(arrayCount, 4);
+			return arrayCount++;
+		}
+
+		/// <summary>
+		/// Copies pixels into a layer, resampling them (nearest) if they aren't the array's size or aren't RGB or RGBA
+		/// </summary>
+		void upload(int index, int layer, int width, int height, int channels, const unsigned char* pixels)
+		{
+			TextureArray& array = arrays[index];
+			GLenum format = channels == 4 ? GL_RGBA : GL_RGB;
+
+			if (width != array.width || height != array.height || (channels != 3 && channels != 4)) {
+				resampled.resize(size_t(array.width) * array.height * 3);
+				for (int y = 0; y < array.height; ++y) {
+					for (int x = 0; x < array.width; ++x) {
+						const unsigned char* source = pixels + (size_t(y * height / array.height) * width + x * width / array.width) * channels;
+						unsigned char* destination = &resampled[(size_t(y) * array.width + x) * 3];
+						for (int c = 0; c < 3; ++c)
+							destination[c] = source[channels >= 3 ? c : 0];		// grey (and grey-alpha) to RGB
+					}
+				}
+				pixels = resampled.data();
+				format = GL_RGB;
+			}
+
+			GLState::get().bindTexture(MATERIAL_TEXTURES_UNIT + index, GL_TEXTURE_2D_ARRAY, array.texture);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, array.width, array.height, 1, format, GL_UNSIGNED_BYTE, pixels);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+			array.mipmapsDirty = true;
+		}
+
+		Residence findResidence(unsigned int texture) const
+		{
+			auto it = resident.find(texture);
+			return it != resident.end() ? it->second : Residence();
+		}
+
+		void writeRecords(void)
+		{
+			records.assign(materials.size() * TEXELS_PER_MATERIAL * 4, 0.0f);
+			for (size_t i = 0; i < materials.size(); ++i) {
+				if (!used[i])
+					continue;
+
+				const Material& material = materials[i];
+				Residence diffuse = findResidence(material.diffuseMap), specular = findResidence(material.specularMap);
+				float* record = &records[i * TEXELS_PER_MATERIAL * 4];
+				record[0] = material.diffuseColor.r;
+				record[1] = material.diffuseColor.g;
+				record[2] = material.diffuseColor.b;
+				record[3] = (float)diffuse.array;
+				record[4] = material.specularColor.r;
+				record[5] = material.specularColor.g;
+				record[6] = material.specularColor.b;
+				record[7] = (float)specular.array;
+				record[8] = (float)diffuse.layer;
+				record[9] = (float)specular.layer;
+				record[10] = material.shininess;
+				record[11] = (float)material.atlasMipLevels;
+				for (int c = 0; c < 4; ++c) {
+					record[12 + c] = material.diffuseRect[c];
+					record[16 + c] = material.specularRect[c];
+				}
+			}
+
+			GLState::get().bindBuffer(GL_TEXTURE_BUFFER, buffer);
+			glBufferData(GL_TEXTURE_BUFFER, records.size() * sizeof(float), records.data(), GL_STATIC_DRAW);
+			recordsDirty = false;
+		}
+
+	public:
+		static MaterialTable& get(void)
+		{
+			static MaterialTable table;
+			return table;
+		}
+
+		MaterialTable(const MaterialTable&) = delete;
+		MaterialTable& operator=(const MaterialTable&) = delete;
+
+		/// <summary>
+		/// Copies a texture's pixels into a texture array layer (into the same layer again if the texture already has one and its size didn't change)
+		/// </summary>
+		/// <param name="texture">The 2D texture the pixels were uploaded to; materials refer to the copy by its ID</param>
+		void addTexture(unsigned int texture, int width, int height, int channels, const unsigned char* pixels)
+		{
+			if (texture == 0 || !pixels || width <= 0 || height <= 0 || channels <= 0)
+				return;
+
+			int index = findArray(width, height);
+			auto it = resident.find(texture);
+			if (it != resident.end() && it->second.array != index) {
+				arrays[it->second.array].freeLayers.push_back(it->second.layer);		// moves to the array for its new size
+				resident.erase(it);
+				it = resident.end();
+			}
+
+			Residence residence;
+			if (it != resident.end())
+				residence = it->second;
+			else {
+				TextureArray& array = arrays[index];
+				residence.array = index;
+				if (!array.freeLayers.empty()) {
+					residence.layer = array.freeLayers.back();
+					array.freeLayers.pop_back();
+				}
+				else if (array.layers < array.capacity || grow(index))
+					residence.layer = array.layers++;
+				else
+					return;
+				resident[texture] = residence;
+				recordsDirty = true;
+			}
+
+			upload(residence.array, residence.layer, width, height, channels, pixels);
+		}
+
+		/// <summary>
+		/// Frees a texture's layer (call before deleting the 2D texture); entries of materials that use it are freed too,
+		/// since a new texture can get the same ID
+		/// </summary>
+		void releaseTexture(unsigned int texture)
+		{
+			auto it = resident.find(texture);
+			if (it == resident.end())
+				return;
+
+			arrays[it->second.array].freeLayers.push_back(it->second.layer);
+			resident.erase(it);
+			for (size_t i = 1; i < materials.size(); ++i) {
+				if (used[i] && (materials[i].diffuseMap == texture || materials[i].specularMap == texture))
+					used[i] = 0;
+			}
+			recordsDirty = true;
+		}
+
+		/// <summary>
+		/// Finds or adds the entry for a material (materials that are the same share one)
+		/// </summary>
+		/// <returns>The entry's index, for Material::index</returns>
+		int add(const Material& material)
+		{
+			int unused = -1;
+			for (size_t i = 0; i < materials.size(); ++i) {
+				if (used[i] && materials[i].sameAs(material))
+					return (int)i;
+				if (!used[i] && unused < 0)
+					unused = (int)i;
+			}
+
+			if (unused < 0) {
+				unused = (int)materials.size();
+				materials.emplace_back();
+				used.push_back(0);
+			}
+			materials[unused] = material;
+			materials[unused].index = unused;
+			used[unused] = 1;
+			recordsDirty = true;
+			return unused;
+		}
+
+		/// <summary>
+		/// Brings the GPU copies up to date (mipmaps, entries) and binds them to their units.
+		/// Call once per frame before drawing, and before drawing models outside the frame (e.g. baking impostors).
+		/// </summary>
+		void bind(void)
+		{
+			for (int i = 0; i < arrayCount; ++i) {
+				if (arrays[i].mipmapsDirty) {
+					GLState::get().bindTexture(MATERIAL_TEXTURES_UNIT + i, GL_TEXTURE_2D_ARRAY, arrays[i].texture);
+					glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+					arrays[i].mipmapsDirty = false;
+				}
+			}
+			if (recordsDirty)
+				writeRecords();
+
+			GLState::get().bindTexture(MATERIAL_DATA_UNIT, GL_TEXTURE_BUFFER, dataTexture);
+			for (int i = 0; i < arrayCount; ++i)
+				GLState::get().bindTexture(MATERIAL_TEXTURES_UNIT + i, GL_TEXTURE_2D_ARRAY, arrays[i].texture);
+		}
+
+		size_t getMaterialCount(void) const
+		{
+			return (size_t)std::count(used.begin(), used.end(), (unsigned char)1);
+		}
+
+		int getArrayCount(void) const
+		{
+			return arrayCount;
+		}
+
+		/// <summary>
+		/// Textures that have a layer
+		/// </summary>
+		size_t getTextureCount(void) const
+		{
+			return resident.size();
+		}
+};
+
+#endif
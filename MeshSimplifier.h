@@ -0,0 +1,523 @@
+#ifndef MESH_SIMPLIFIER_H
+#define MESH_SIMPLIFIER_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <glm/glm/glm.hpp>
+#include "GeometryBuffer.h"
+
+// a simplified version of a mesh, drawn with the full-detail mesh's vertices
+struct LODIndices {
+	std::vector<unsigned int> indices;
+	float error = 0.0f;		// roughly how far (in model units) the simplified surface strays from the original
+};
+
+/// <summary>
+/// Simplifies triangle meshes by collapsing edges in order of quadric error (Garland and Heckbert), always into one of the
+/// edge's existing positions, so a simplified mesh is just a new index list over the original vertices.
+/// Vertices that share a position but not their other attributes (UV seams, hard normal edges) move together: each one
+/// goes to the target's vertex it shares a triangle with, or else to one with the same texture coordinates. A collapse that
+/// would drag texture coordinates across a seam is never made, seams and open borders only collapse along themselves,
+/// and collapses that would flip a triangle over are skipped, so what's left keeps its UV layout and faces the same way.
+/// Differences in normals only add to a collapse's cost, since low-poly models have hard edges nearly everywhere.
+/// Doesn't use OpenGL, so it's safe to call from the model import thread.
+/// </summary>
+class MeshSimplifier
+{
+	private:
+		enum Kind : unsigned char {
+			MANIFOLD,		// can collapse into any neighbor
+			BORDER,			// on an open edge; only collapses along it
+			LOCKED			// more than two triangles on one of its edges; never moves
+		};
+
+		static const int MAX_LEVELS = 4;				// simplified levels, on top of full detail
+		static constexpr float BORDER_WEIGHT = 10.0f;	// how strongly borders and seams are held in place
+		static constexpr float NORMAL_WEIGHT = 2.0f;	// extra cost for collapsing vertices with differing normals
+		static constexpr float MIN_FLIP_COS = 0.5f;		// collapses that turn a triangle by more than 60 degrees are rejected
+		static constexpr float UV_EPSILON = 1e-5f;		// texture coordinates closer than this are the same
+
+		// sum of squared distances to a set of planes (weighted), as a symmetric 4x4 matrix
+		struct Quadric {
+			double a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+			double b0 = 0, b1 = 0, b2 = 0, c = 0;
+			double weight = 0;		// total area of the planes' triangles (borders don't count)
+
+			void addPlane(const glm::dvec3& normal, double distance, double planeWeight)
+			{
+				a00 += planeWeight * normal.x * normal.x;
+				a01 += planeWeight * normal.x * normal.y;
+				a02 += planeWeight * normal.x * normal.z;
+				a11 += planeWeight * normal.y * normal.y;
+				a12 += planeWeight * normal.y * normal.z;
+				a22 += planeWeight * normal.z * normal.z;
+				b0 += planeWeight * normal.x * distance;
+				b1 += planeWeight * normal.y * distance;
+				b2 += planeWeight * normal.z * distance;
+				c += planeWeight * distance * distance;
+			}
+
+			void add(const Quadric& other)
+			{
+				a00 += other.a00; a01 += other.a01; a02 += other.a02;
+				a11 += other.a11; a12 += other.a12; a22 += other.a22;
+				b0 += other.b0; b1 += other.b1; b2 += other.b2;
+				c += other.c;
+				weight += other.weight;
+			}
+
+			double evaluate(const glm::dvec3& p) const
+			{
+				double result = a00 * p.x * p.x + a11 * p.y * p.y + a22 * p.z * p.z
+					+ 2.0 * (a01 * p.x * p.y + a02 * p.x * p.z + a12 * p.y * p.z)
+					+ 2.0 * (b0 * p.x + b1 * p.y + b2 * p.z) + c;
+				return std::max(result, 0.0);
+			}
+		};
+
+		struct Collapse {
+			unsigned int from, to;		// positions (first vertex with each position)
+			float cost;					// squared error of the merged vertex
+		};
+
+		// what one collapse does to the vertices of the position it removes
+		struct WedgeMove {
+			unsigned int from, to;
+		};
+
+		static uint64_t edgeKey(unsigned int a, unsigned int b)
+		{
+			return (uint64_t(a) << 32) | b;
+		}
+
+		/// <summary>
+		/// Makes every vertex point at the first vertex with the same position, and links vertices with the same position into rings
+		/// </summary>
+		static void findWedges(const std::vector<Vertex>& vertices, std::vector<unsigned int>& remap, std::vector<unsigned int>& wedge)
+		{
+			std::unordered_map<uint64_t, std::vector<unsigned int>> buckets;
+			remap.resize(vertices.size());
+			wedge.resize(vertices.size());
+
+			for (unsigned int i = 0; i < vertices.size(); ++i) {
+				const glm::vec3& p = vertices[i].Position;
+				uint32_t bits[3];
+				std::memcpy(bits, &p, sizeof(bits));
+				uint64_t hash = (uint64_t(bits[0]) * 73856093u) ^ (uint64_t(bits[1]) * 19349663u) ^ (uint64_t(bits[2]) * 83492791u);
+
+				remap[i] = i;
+				wedge[i] = i;
+				std::vector<unsigned int>& bucket = buckets[hash];
+				for (unsigned int other : bucket) {
+					if (vertices[other].Position == p) {
+						remap[i] = remap[other];
+						wedge[i] = wedge[remap[i]];		// insert into the ring after its first vertex
+						wedge[remap[i]] = i;
+						break;
+					}
+				}
+				if (remap[i] == i)
+					bucket.push_back(i);
+			}
+		}
+
+		/// <summary>
+		/// Decides how each position is allowed to move, from which of its edges are open (have no triangle on the other side)
+		/// </summary>
+		static void classify(const std::vector<unsigned int>& indices, const std::vector<unsigned int>& remap, std::unordered_map<uint64_t, int>& positionEdges, std::vector<Kind>& kinds)
+		{
+			positionEdges.clear();
+			for (size_t i = 0; i < indices.size(); i += 3) {
+				for (int e = 0; e < 3; ++e)
+					++positionEdges[edgeKey(remap[indices[i + e]], remap[indices[i + (e + 1) % 3]])];
+			}
+
+			kinds.assign(remap.size(), MANIFOLD);
+			for (const auto& edge : positionEdges) {
+				unsigned int a = (unsigned int)(edge.first >> 32), b = (unsigned int)(edge.first & 0xFFFFFFFFu);
+				auto opposite = positionEdges.find(edgeKey(b, a));
+				Kind kind = opposite == positionEdges.end() ? BORDER : edge.second > 1 || opposite->second > 1 ? LOCKED : MANIFOLD;
+				kinds[a] = std::max(kinds[a], kind);
+				kinds[b] = std::max(kinds[b], kind);
+			}
+		}
+
+		/// <summary>
+		/// Whether one position can collapse into a neighbor, given the edge between them
+		/// </summary>
+		static bool canCollapse(unsigned int from, unsigned int to, const std::vector<Kind>& kinds, const std::unordered_map<uint64_t, int>& positionEdges)
+		{
+			switch (kinds[from]) {
+				case MANIFOLD:
+					return true;
+				case BORDER:
+					// only along the border (the edge has no triangle on one side)
+					return kinds[to] != MANIFOLD
+						&& (positionEdges.find(edgeKey(to, from)) == positionEdges.end() || positionEdges.find(edgeKey(from, to)) == positionEdges.end());
+				default:
+					return false;
+			}
+		}
+
+		/// <summary>
+		/// Works out where each vertex at position from goes when it collapses into position to
+		/// </summary>
+		/// <param name="normalPenalty">Set to the largest (1 - cos) between the normals of a moved vertex and its target</param>
+		/// <returns>False if some vertex has nowhere to go without dragging its texture coordinates across a seam</returns>
+		static bool mapWedges(unsigned int from, unsigned int to, const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices,
+			const std::vector<unsigned int>& remap, const std::vector<unsigned int>& triangleOffsets,
+			const std::vector<unsigned int>& triangleList, std::vector<WedgeMove>& moves, float& normalPenalty)
+		{
+			moves.clear();
+			normalPenalty = 0.0f;
+
+			// vertices that share a triangle with the target go to its vertex in that triangle
+			for (unsigned int t = triangleOffsets[from]; t < triangleOffsets[from + 1]; ++t) {
+				const unsigned int* triangle = &indices[triangleList[t] * 3];
+				unsigned int fromVertex = 0, toVertex = 0;
+				bool hasTo = false;
+				for (int k = 0; k < 3; ++k) {
+					if (remap[triangle[k]] == from)
+						fromVertex = triangle[k];
+					else if (remap[triangle[k]] == to) {
+						toVertex = triangle[k];
+						hasTo = true;
+					}
+				}
+
+				auto move = std::find_if(moves.begin(), moves.end(), [&](const WedgeMove& m) { return m.from == fromVertex; });
+				if (move == moves.end())
+					moves.push_back({ fromVertex, hasTo ? toVertex : fromVertex });
+				else if (hasTo && move->to == fromVertex)
+					move->to = toVertex;
+				else if (hasTo && move->to != toVertex)
+					return false;		// touches the target on both sides of a seam
+			}
+
+			// the rest (split off only by normals) follow a vertex with the same texture coordinates (the one with the closest normal, if there are several)
+			size_t touching = std::partition(moves.begin(), moves.end(), [](const WedgeMove& m) { return m.to != m.from; }) - moves.begin();
+			for (size_t i = touching; i < moves.size(); ++i) {
+				WedgeMove& move = moves[i];
+				float bestDot = -2.0f;
+				for (size_t j = 0; j < touching; ++j) {
+					glm::vec2 uvDifference = vertices[moves[j].from].TexCoords - vertices[move.from].TexCoords;
+					float normalDot = glm::dot(vertices[moves[j].to].Normal, vertices[move.from].Normal);
+					if (std::fabs(uvDifference.x) <= UV_EPSILON && std::fabs(uvDifference.y) <= UV_EPSILON && normalDot > bestDot) {
+						bestDot = normalDot;
+						move.to = moves[j].to;
+					}
+				}
+				if (move.to == move.from)
+					return false;
+			}
+
+			for (WedgeMove& move : moves) {
+				float normalDot = glm::dot(vertices[move.from].Normal, vertices[move.to].Normal);
+				normalPenalty = std::max(normalPenalty, 1.0f - std::min(std::max(normalDot, -1.0f), 1.0f));
+			}
+			return true;
+		}
+
+		/// <summary>
+		/// Whether moving every triangle corner at position from to position to keeps the triangles facing the way they did
+		/// (triangles that get removed by the collapse don't count)
+		/// </summary>
+		static bool keepsOrientation(unsigned int from, unsigned int to, const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices,
+			const std::vector<unsigned int>& remap, const std::vector<unsigned int>& triangleOffsets, const std::vector<unsigned int>& triangleList)
+		{
+			glm::vec3 target = vertices[to].Position;
+			for (unsigned int t = triangleOffsets[from]; t < triangleOffsets[from + 1]; ++t) {
+				unsigned int triangle = triangleList[t];
+				unsigned int p[3] = { remap[indices[triangle * 3]], remap[indices[triangle * 3 + 1]], remap[indices[triangle * 3 + 2]] };
+				if (p[0] == to || p[1] == to || p[2] == to)
+					continue;
+
+				glm::vec3 before[3], after[3];
+				for (int k = 0; k < 3; ++k) {
+					before[k] = vertices[p[k]].Position;
+					after[k] = p[k] == from ? target : before[k];
+				}
+				glm::vec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+				glm::vec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+				float lengths = glm::length(normalBefore) * glm::length(normalAfter);
+				if (lengths <= 0.0f || glm::dot(normalBefore, normalAfter) < MIN_FLIP_COS * lengths)
+					return false;
+			}
+			return true;
+		}
+
+		static float pointTriangleDistance(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c)
+		{
+			// closest point on the triangle, by which of its regions p projects into (Ericson, Real-Time Collision Detection 5.1.5)
+			glm::vec3 ab = b - a, ac = c - a, ap = p - a;
+			float d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+			if (d1 <= 0.0f && d2 <= 0.0f)
+				return glm::length(ap);
+
+			glm::vec3 bp = p - b;
+			float d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+			if (d3 >= 0.0f && d4 <= d3)
+				return glm::length(bp);
+
+			float vc = d1 * d4 - d3 * d2;
+			if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+				return glm::length(p - (a + ab * (d1 / (d1 - d3))));
+
+			glm::vec3 cp = p - c;
+			float d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+			if (d6 >= 0.0f && d5 <= d6)
+				return glm::length(cp);
+
+			float vb = d5 * d2 - d1 * d6;
+			if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+				return glm::length(p - (a + ac * (d2 / (d2 - d6))));
+
+			float va = d3 * d6 - d5 * d4;
+			if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+				return glm::length(p - (b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)))));
+
+			float denominator = 1.0f / (va + vb + vc);
+			return glm::length(p - (a + ab * (vb * denominator) + ac * (vc * denominator)));
+		}
+
+		/// <summary>
+		/// How far the removed position ends up from the triangles that replace the ones around it
+		/// </summary>
+		static float collapseDistance(unsigned int from, unsigned int to, const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices,
+			const std::vector<unsigned int>& remap, const std::vector<unsigned int>& triangleOffsets, const std::vector<unsigned int>& triangleList)
+		{
+			glm::vec3 point = vertices[from].Position;
+			float distance = INFINITY;
+			for (unsigned int t = triangleOffsets[from]; t < triangleOffsets[from + 1]; ++t) {
+				glm::vec3 corners[3];
+				bool removed = false;
+				for (int k = 0; k < 3; ++k) {
+					unsigned int position = remap[indices[triangleList[t] * 3 + k]];
+					removed |= position == to;
+					corners[k] = vertices[position == from ? to : position].Position;
+				}
+				if (!removed)
+					distance = std::min(distance, pointTriangleDistance(point, corners[0], corners[1], corners[2]));
+			}
+			return std::isinf(distance) ? glm::length(vertices[to].Position - point) : distance;
+		}
+
+		/// <summary>
+		/// Collapses edges until the mesh has at most each of targetIndexCounts indices in turn (largest first), keeping a copy at each,
+		/// or until no collapse is left that keeps its shape (the rest of the copies are then all the same)
+		/// </summary>
+		static std::vector<LODIndices> simplifyLevels(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& inputIndices, const std::vector<size_t>& targetIndexCounts)
+		{
+			std::vector<LODIndices> levels;
+			std::vector<unsigned int> indices = inputIndices;
+			indices.resize(indices.size() - indices.size() % 3);
+			if (vertices.empty()) {
+				levels.resize(targetIndexCounts.size());
+				return levels;
+			}
+
+			std::vector<unsigned int> remap, wedge;
+			findWedges(vertices, remap, wedge);
+
+			std::unordered_map<uint64_t, int> edges, positionEdges;
+			for (size_t i = 0; i < indices.size(); i += 3) {
+				for (int e = 0; e < 3; ++e)
+					++edges[edgeKey(indices[i + e], indices[i + (e + 1) % 3])];
+			}
+			std::vector<Kind> kinds;
+			classify(indices, remap, positionEdges, kinds);
+
+			// quadrics live on positions (remap targets), so every vertex at a position shares one
+			std::vector<Quadric> quadrics(vertices.size());
+			for (size_t i = 0; i < indices.size(); i += 3) {
+				unsigned int p[3] = { remap[indices[i]], remap[indices[i + 1]], remap[indices[i + 2]] };
+				glm::dvec3 v0 = glm::dvec3(vertices[p[0]].Position), v1 = glm::dvec3(vertices[p[1]].Position), v2 = glm::dvec3(vertices[p[2]].Position);
+				glm::dvec3 normal = glm::cross(v1 - v0, v2 - v0);
+				double doubleArea = glm::length(normal);
+				if (doubleArea <= 0.0)
+					continue;
+				normal /= doubleArea;
+
+				Quadric face;
+				face.addPlane(normal, -glm::dot(normal, v0), doubleArea * 0.5);
+				face.weight = doubleArea * 0.5;
+				for (unsigned int position : p)
+					quadrics[position].add(face);
+
+				// borders and UV seams (edges open with vertex indices) also get a plane through the edge, perpendicular to the triangle, to hold them in place
+				for (int e = 0; e < 3; ++e) {
+					unsigned int a = indices[i + e], b = indices[i + (e + 1) % 3];
+					if (edges.find(edgeKey(b, a)) != edges.end())
+						continue;
+					if (positionEdges.find(edgeKey(remap[b], remap[a])) != positionEdges.end()) {
+						bool sameUVA = false, sameUVB = false;		// only a hard normal edge, which is allowed to move
+						for (unsigned int v = wedge[a]; v != a; v = wedge[v])
+							sameUVA |= glm::length(vertices[v].TexCoords - vertices[a].TexCoords) <= UV_EPSILON;
+						for (unsigned int v = wedge[b]; v != b; v = wedge[v])
+							sameUVB |= glm::length(vertices[v].TexCoords - vertices[b].TexCoords) <= UV_EPSILON;
+						if (sameUVA && sameUVB)
+							continue;
+					}
+
+					glm::dvec3 edgeStart = glm::dvec3(vertices[remap[a]].Position), edgeEnd = glm::dvec3(vertices[remap[b]].Position);
+					glm::dvec3 edgeNormal = glm::cross(edgeEnd - edgeStart, normal);
+					double edgeLength = glm::length(edgeNormal);
+					if (edgeLength <= 0.0)
+						continue;
+					edgeNormal /= edgeLength;
+
+					Quadric border;
+					border.addPlane(edgeNormal, -glm::dot(edgeNormal, edgeStart), edgeLength * edgeLength * BORDER_WEIGHT);
+					quadrics[remap[a]].add(border);
+					quadrics[remap[b]].add(border);
+				}
+			}
+
+			std::vector<Collapse> collapses;
+			std::vector<unsigned int> triangleOffsets, triangleList, fill;
+			std::vector<WedgeMove> moves;
+			std::vector<unsigned char> touched;
+			std::vector<unsigned int> collapseTo(vertices.size());
+			std::vector<float> positionErrors(vertices.size(), 0.0f);		// how far the original surface collapsed into each position can be from it
+			float maxError = 0.0f;
+
+			while (levels.size() < targetIndexCounts.size()) {
+				if (indices.size() <= targetIndexCounts[levels.size()]) {
+					levels.push_back({ indices, maxError });
+					continue;
+				}
+
+				// triangles around each position
+				size_t triangleCount = indices.size() / 3;
+				triangleOffsets.assign(vertices.size() + 1, 0);
+				for (unsigned int index : indices)
+					++triangleOffsets[remap[index] + 1];
+				for (size_t v = 0; v < vertices.size(); ++v)
+					triangleOffsets[v + 1] += triangleOffsets[v];
+				triangleList.resize(indices.size());
+				fill.assign(triangleOffsets.begin(), triangleOffsets.end() - 1);
+				for (size_t i = 0; i < indices.size(); ++i)
+					triangleList[fill[remap[indices[i]]]++] = (unsigned int)(i / 3);
+
+				// every allowed collapse, cheapest first
+				collapses.clear();
+				for (size_t i = 0; i < indices.size(); i += 3) {
+					for (int e = 0; e < 3; ++e) {
+						unsigned int a = remap[indices[i + e]], b = remap[indices[i + (e + 1) % 3]];
+						for (int direction = 0; direction < 2; ++direction) {
+							unsigned int from = direction ? b : a, to = direction ? a : b;
+							float normalPenalty;
+							if (from == to || !canCollapse(from, to, kinds, positionEdges)
+								|| !mapWedges(from, to, vertices, indices, remap, triangleOffsets, triangleList, moves, normalPenalty))
+								continue;
+
+							Quadric merged = quadrics[from];
+							merged.add(quadrics[to]);
+							double cost = merged.evaluate(glm::dvec3(vertices[to].Position)) / std::max(merged.weight, 1e-12);
+							cost *= 1.0 + NORMAL_WEIGHT * normalPenalty;
+							collapses.push_back({ from, to, (float)cost });
+						}
+					}
+				}
+				std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) { return x.cost < y.cost; });
+
+				// take the cheapest collapses that don't touch each other's triangles, about half of what's still needed per pass
+				// (each collapse removes about two triangles), so costs get recomputed as the mesh changes
+				size_t goal = std::max<size_t>(1, (indices.size() - targetIndexCounts[levels.size()]) / 6 / 2 + 1);
+				size_t applied = 0;
+				touched.assign(vertices.size(), 0);
+				for (unsigned int v = 0; v < vertices.size(); ++v)
+					collapseTo[v] = v;
+
+				for (const Collapse& collapse : collapses) {
+					if (applied >= goal)
+						break;
+					unsigned int from = collapse.from, to = collapse.to;
+					if (touched[from] || touched[to])
+						continue;
+
+					float normalPenalty;
+					mapWedges(from, to, vertices, indices, remap, triangleOffsets, triangleList, moves, normalPenalty);
+					if (!keepsOrientation(from, to, vertices, indices, remap, triangleOffsets, triangleList))
+						continue;
+
+					for (const WedgeMove& move : moves)
+						collapseTo[move.from] = move.to;
+					quadrics[to].add(quadrics[from]);
+					positionErrors[to] = std::max(positionErrors[to], positionErrors[from] + collapseDistance(from, to, vertices, indices, remap, triangleOffsets, triangleList));
+					maxError = std::max(maxError, positionErrors[to]);
+					++applied;
+
+					// nothing else this pass may change the triangles around either position (their flip checks would be out of date)
+					for (unsigned int position : { from, to }) {
+						for (unsigned int t = triangleOffsets[position]; t < triangleOffsets[position + 1]; ++t) {
+							unsigned int triangle = triangleList[t];
+							for (int k = 0; k < 3; ++k)
+								touched[remap[indices[triangle * 3 + k]]] = 1;
+						}
+					}
+				}
+				if (applied == 0)
+					break;
+
+				// drop the triangles that collapsed away
+				size_t write = 0;
+				for (size_t i = 0; i < triangleCount; ++i) {
+					unsigned int a = collapseTo[indices[i * 3]], b = collapseTo[indices[i * 3 + 1]], c = collapseTo[indices[i * 3 + 2]];
+					if (remap[a] == remap[b] || remap[b] == remap[c] || remap[c] == remap[a])
+						continue;
+					indices[write++] = a;
+					indices[write++] = b;
+					indices[write++] = c;
+				}
+				indices.resize(write);
+				classify(indices, remap, positionEdges, kinds);
+			}
+
+			while (levels.size() < targetIndexCounts.size())
+				levels.push_back({ indices, maxError });
+			return levels;
+		}
+
+	public:
+		/// <summary>
+		/// Collapses edges until the mesh has at most targetIndexCount indices, or no collapse is left that keeps its shape
+		/// </summary>
+		/// <param name="error">Set to roughly how far the result strays from the original surface, in model units</param>
+		/// <returns>Indices into the same vertices</returns>
+		static std::vector<unsigned int> simplify(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices, size_t targetIndexCount, float& error)
+		{
+			LODIndices level = simplifyLevels(vertices, indices, std::vector<size_t>(1, targetIndexCount))[0];
+			error = level.error;
+			return level.indices;
+		}
+
+		/// <summary>
+		/// Builds up to MAX_LEVELS simplified versions of a mesh, each with about half the triangles of the one before
+		/// (in one simplification run), stopping early once simplifying stops paying off
+		/// </summary>
+		/// <returns>The levels, most detailed first (full detail isn't included)</returns>
+		static std::vector<LODIndices> buildLODs(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices)
+		{
+			std::vector<size_t> targets;
+			for (int level = 1; level <= MAX_LEVELS && (indices.size() >> level) / 3 >= 8; ++level)
+				targets.push_back((indices.size() >> level) / 3 * 3);
+
+			std::vector<LODIndices> levels = simplifyLevels(vertices, indices, targets);
+			size_t previousCount = indices.size();
+			for (size_t level = 0; level < levels.size(); ++level) {
+				if (levels[level].indices.empty() || levels[level].indices.size() > previousCount * 9 / 10) {
+					levels.resize(level);
+					break;
+				}
+				previousCount = levels[level].indices.size();
+			}
+			return levels;
+		}
+};
+
+#endif
@@ -2,6 +2,13 @@
 #define OBJECT_H
 
 #include "model.h"
+#include "Bounds.h"
+#include "RenderQueue.h"
+#include "SceneBVH.h"
+#include "OcclusionCuller.h"
+#include <map>
+#include <memory>
+#include <string>
 #include <glm/glm/glm.hpp>
 #include <glm/glm/gtc/type_ptr.hpp>
 
@@ -14,23 +21,252 @@ enum Axis {
 class Object
 {
 private:
-	Model model;
+	std::shared_ptr<Model> model;		// shared by every object made from the same file (so their meshes can be drawn instanced)
 	glm::mat4 matrix;
+	int constantIndex;		// this object's entry in ObjectConstants (assigned every frame)
+	SceneBVH* sceneIndex;	// kept up to date when the object moves (if set)
+	int sceneItem;
+	bool occluder;			// rasterized into the OcclusionCuller to hide what's behind it
+	int lodLevel;			// level of detail last picked by GeometryLOD (-1 when too small to draw)
+	bool immovable;			// never moves once placed, so StaticBatcher can merge it into world-space batches
+	glm::vec4 lightmapRect;	// where the model's charts went in the lightmap (offset, scale), or all zero without one
+	int occlusionOffset;	// where VertexOcclusion's buffer has this object's vertices, less the first one's place in the GeometryBuffer (-1 without)
+
+	/// <summary>
+	/// Returns the already loaded model for a path, or loads it (models stay alive as long as an object uses them)
+	/// </summary>
+	static std::shared_ptr<Model> loadShared(const char* path)
+	{
+		static std::map<std::string, std::weak_ptr<Model>> loaded;
+
+		std::shared_ptr<Model> shared = loaded[path].lock();
+		if (!shared) {
+			shared = std::make_shared<Model>(path);
+			shared->load();
+			loaded[path] = shared;
+		}
+		return shared;
+	}
 
 public:
 	Object(const char* path)
 	{
-		model = Model(path);
-		model.load();
+		model = loadShared(path);
 		matrix = glm::mat4(1.0f);
+		constantIndex = 0;
+		sceneIndex = nullptr;
+		sceneItem = -1;
+		occluder = false;
+		lodLevel = 0;
+		immovable = false;
+		lightmapRect = glm::vec4(0.0f);
+		occlusionOffset = -1;
 	}
 
-	void Draw(ShaderProgram& program)
+	/// <summary>
+	/// Makes an object from a model built in code (e.g. an HLOD proxy) instead of loaded from a file
+	/// </summary>
+	Object(std::shared_ptr<Model> sharedModel) : model{ sharedModel }
+	{
+		matrix = glm::mat4(1.0f);
+		constantIndex = 0;
+		sceneIndex = nullptr;
+		sceneItem = -1;
+		occluder = false;
+		lodLevel = 0;
+		immovable = false;
+		lightmapRect = glm::vec4(0.0f);
+		occlusionOffset = -1;
+	}
+
+	/// <summary>
+	/// Draws the model's meshes right away (instead of through a RenderQueue)
+	/// </summary>
+	/// <param name="meshVisible">One flag per mesh, from FrustumCuller (null draws every mesh)</param>
+	/// <param name="lod">Level of detail to draw the meshes at</param>
+	/// <returns>Number of draw calls made</returns>
+	unsigned int Draw(const ShaderProgram& program, const unsigned char* meshVisible = nullptr, int lod = 0)
 	{
+		if (!model->isLoaded())
+			return 0;
+
 		program.use();
-		program.setUniformMatrix("model", matrix);
+		glVertexAttribI1i(OBJECT_INDEX_ATTRIB, constantIndex);		// the matrices themselves were already uploaded by ObjectConstants
+
+		unsigned int draws = 0;
+		const std::vector<Mesh>& meshes = model->getMeshes();
+		for (size_t i = 0; i < meshes.size(); ++i) {
+			if (!meshVisible || meshVisible[i]) {
+				meshes[i].Draw(lod);
+				++draws;
+			}
+		}
+		return draws;
+	}
+
+	/// <summary>
+	/// Adds a draw packet for each of the model's meshes to the queue (drawn later, in sorted order)
+	/// </summary>
+	/// <param name="meshVisible">One flag per mesh, from FrustumCuller (null submits every mesh)</param>
+	/// <param name="lod">Level of detail to draw the meshes at</param>
+	void Submit(RenderQueue& queue, const ShaderProgram& program, const glm::vec3& cameraPos, const unsigned char* meshVisible = nullptr, int lod = 0) const
+	{
+		if (!model->isLoaded())
+			return;
 
-		model.Draw(program);
+		float depth = glm::length(getWorldSphere().center - cameraPos);
+		const std::vector<Mesh>& meshes = model->getMeshes();
+		for (size_t i = 0; i < meshes.size(); ++i) {
+			if (!meshVisible || meshVisible[i])
+				queue.submit(RenderQueue::OPAQUE_PASS, program, meshes[i], constantIndex, depth, lod);
+		}
+	}
+
+	/// <summary>
+	/// Adds the model's triangles to the occlusion culler's depth buffer (each mesh's coarsest level of detail, since
+	/// they're rasterized on the CPU)
+	/// </summary>
+	void SubmitOccluder(OcclusionCuller& culler) const
+	{
+		if (!model->isLoaded())
+			return;
+
+		for (const Mesh& mesh : model->getMeshes()) {
+			const std::vector<unsigned int>& indices = mesh.getCoarsestIndices();
+			if (!mesh.vertices.empty())
+				culler.addOccluder(&mesh.vertices[0].Position.x, sizeof(Vertex), indices.data(), indices.size(), matrix);
+		}
+	}
+
+	/// <summary>
+	/// Use for big objects that hide a lot behind them (their coarsest level of detail is what's rasterized on the CPU)
+	/// </summary>
+	void setOccluder(bool isOccluder)
+	{
+		occluder = isOccluder;
+	}
+
+	bool isOccluder(void) const
+	{
+		return occluder;
+	}
+
+	/// <summary>
+	/// Marks an object that won't move after it's placed (StaticBatcher draws it from merged, pre-transformed geometry)
+	/// </summary>
+	void setStatic(bool isStaticObject)
+	{
+		immovable = isStaticObject;
+	}
+
+	bool isStatic(void) const
+	{
+		return immovable;
+	}
+
+	/// <summary>
+	/// Set by Lightmaps once the object's lighting is baked (LightmapCharts' coordinates map into the rect)
+	/// </summary>
+	void setLightmapRect(const glm::vec4& rect)
+	{
+		lightmapRect = rect;
+	}
+
+	const glm::vec4& getLightmapRect(void) const
+	{
+		return lightmapRect;
+	}
+
+	bool hasLightmap(void) const
+	{
+		return lightmapRect.z > 0.0f;
+	}
+
+	/// <summary>
+	/// Set by VertexOcclusion once the object's vertices are baked, so draws outside the static batches read its occlusion
+	/// (the vertex shader adds the vertex's index in the GeometryBuffer to it)
+	/// </summary>
+	void setOcclusionOffset(int offset)
+	{
+		occlusionOffset = offset;
+	}
+
+	int getOcclusionOffset(void) const
+	{
+		return occlusionOffset;
+	}
+
+	int getLODLevel(void) const
+	{
+		return lodLevel;
+	}
+
+	void setLODLevel(int level)
+	{
+		lodLevel = level;
+	}
+
+	/// <summary>
+	/// NOTE: Shared with every other object made from the same file
+	/// </summary>
+	Model& getModel(void)
+	{
+		return *model;
+	}
+
+	const Model& getModel(void) const
+	{
+		return *model;
+	}
+
+	const glm::mat4& getMatrix(void) const
+	{
+		return matrix;
+	}
+
+	/// <summary>
+	/// Bounding box in world space
+	/// </summary>
+	AABB getWorldBounds(void) const
+	{
+		return transformAABB(model->getBounds(), matrix);
+	}
+
+	/// <summary>
+	/// Bounding sphere in world space
+	/// </summary>
+	BoundingSphere getWorldSphere(void) const
+	{
+		return transformSphere(model->getBoundingSphere(), matrix);
+	}
+
+	void setConstantIndex(int index)
+	{
+		constantIndex = index;
+	}
+
+	int getConstantIndex(void) const
+	{
+		return constantIndex;
+	}
+
+	/// <summary>
+	/// Puts the object in a scene index; from then on, transforming the object updates its entry there
+	/// </summary>
+	void setSceneIndex(SceneBVH* index, int item)
+	{
+		sceneIndex = index;
+		sceneItem = item;
+		updateSceneIndex();
+	}
+
+	/// <summary>
+	/// Call after anything else changes the object's world bounds (e.g. its model being reloaded)
+	/// </summary>
+	void updateSceneIndex(void)
+	{
+		if (sceneIndex)
+			sceneIndex->update(sceneItem, getWorldBounds());
 	}
 
 	/// <summary>
@@ -39,6 +275,7 @@ public:
 	void Translate(float x, float y, float z)
 	{
 		matrix = glm::translate(matrix, glm::vec3(x, y, z));
+		updateSceneIndex();
 	}
 
 	/// <summary>
@@ -61,6 +298,7 @@ public:
 		}
 
 		matrix = glm::rotate(matrix, glm::radians(degrees), vec);
+		updateSceneIndex();
 	}
 
 	/// <summary>
@@ -70,6 +308,7 @@ public:
 	void Scale(float x, float y, float z)
 	{
 		matrix = glm::scale(matrix, glm::vec3(x, y, z));
+		updateSceneIndex();
 	}
 };
 
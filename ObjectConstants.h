@@ -0,0 +1,159 @@
+#ifndef OBJECT_CONSTANTS_H
+#define OBJECT_CONSTANTS_H
+
+#include <iostream>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm/glm.hpp>
+#include "GLState.h"
+#include "RingBuffer.h"
+#include "ShaderProgram.h"
+#include "Object.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OBJECT_CONSTANTS_SSE
+#include <xmmintrin.h>
+#endif
+
+/// <summary>
+/// Per-object matrices (model-view-projection, model, and normal matrix), lightmap rect and occlusion offset, computed once per frame on the CPU for all
+/// objects in one batch and written into the frame's RingBuffer, which a texture buffer covers. The vertex shader reads an object's
+/// matrices with texelFetch using its object index attribute (see Mesh.h), instead of multiplying and inverting matrices for every vertex.
+/// </summary>
+class ObjectConstants
+{
+	public:
+		// layout of one object's entry in the buffer, in vec4 texels
+		static const int MVP_OFFSET = 0;		// 4 columns
+		static const int MODEL_OFFSET = 4;		// 4 columns
+		static const int NORMAL_OFFSET = 8;		// 3 columns (w unused, except the first one's: see OCCLUSION_OFFSET)
+		static const int OCCLUSION_OFFSET = 8;	// w: where the object's vertices are in VertexOcclusion's buffer, or -1 to read them from the vertices
+		static const int LIGHTMAP_OFFSET = 11;	// where the object's charts are in the lightmap: offset (xy) and scale (zw)
+		static const int TEXELS_PER_OBJECT = 12;
+
+	private:
+		unsigned int texture;
+		unsigned int buffer;			// the ring's buffer the texture covers
+		int maxTexels;					// GL_MAX_TEXTURE_BUFFER_SIZE
+
+		// out = a * b (column-major 4x4)
+		static void multiply(const float* a, const float* b, float* out)
+		{
+#ifdef OBJECT_CONSTANTS_SSE
+			__m128 a0 = _mm_loadu_ps(a), a1 = _mm_loadu_ps(a + 4), a2 = _mm_loadu_ps(a + 8), a3 = _mm_loadu_ps(a + 12);
+			for (int col = 0; col < 4; ++col) {
+				const float* bc = b + col * 4;
+				__m128 r = _mm_mul_ps(a0, _mm_set1_ps(bc[0]));
+				r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_set1_ps(bc[1])));
+				r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_set1_ps(bc[2])));
+				r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_set1_ps(bc[3])));
+				_mm_storeu_ps(out + col * 4, r);
+			}
+#else
+			for (int col = 0; col < 4; ++col) {
+				for (int row = 0; row < 4; ++row) {
+					out[col * 4 + row] = a[row] * b[col * 4] + a[4 + row] * b[col * 4 + 1]
+						+ a[8 + row] * b[col * 4 + 2] + a[12 + row] * b[col * 4 + 3];
+				}
+			}
+#endif
+		}
+
+		// out = transpose(inverse(mat3(model))), written as 3 vec4 columns
+		// the inverse-transpose of [c0 c1 c2] is [c1 x c2, c2 x c0, c0 x c1] / det, so no general inverse is needed
+		static void normalMatrix(const float* model, float* out)
+		{
+#ifdef OBJECT_CONSTANTS_SSE
+			__m128 c0 = _mm_loadu_ps(model), c1 = _mm_loadu_ps(model + 4), c2 = _mm_loadu_ps(model + 8);
+			__m128 n0 = cross(c1, c2), n1 = cross(c2, c0), n2 = cross(c0, c1);
+
+			__m128 d = _mm_mul_ps(c0, n0);		// det = dot(c0, c1 x c2)
+			float det = _mm_cvtss_f32(d) + _mm_cvtss_f32(_mm_shuffle_ps(d, d, _MM_SHUFFLE(1, 1, 1, 1))) + _mm_cvtss_f32(_mm_shuffle_ps(d, d, _MM_SHUFFLE(2, 2, 2, 2)));
+			__m128 invDet = _mm_set1_ps(det != 0.0f ? 1.0f / det : 0.0f);
+
+			_mm_storeu_ps(out, _mm_mul_ps(n0, invDet));
+			_mm_storeu_ps(out + 4, _mm_mul_ps(n1, invDet));
+			_mm_storeu_ps(out + 8, _mm_mul_ps(n2, invDet));
+#else
+			glm::vec3 c0(model[0], model[1], model[2]), c1(model[4], model[5], model[6]), c2(model[8], model[9], model[10]);
+			glm::vec3 n[3] = { glm::cross(c1, c2), glm::cross(c2, c0), glm::cross(c0, c1) };
+			float det = glm::dot(c0, n[0]);
+			float invDet = det != 0.0f ? 1.0f / det : 0.0f;
+			for (int i = 0; i < 3; ++i) {
+				out[i * 4] = n[i].x * invDet;
+				out[i * 4 + 1] = n[i].y * invDet;
+				out[i * 4 + 2] = n[i].z * invDet;
+				out[i * 4 + 3] = 0.0f;
+			}
+#endif
+		}
+
+#ifdef OBJECT_CONSTANTS_SSE
+		static __m128 cross(__m128 a, __m128 b)
+		{
+			__m128 aYZX = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+			__m128 bYZX = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+			__m128 r = _mm_sub_ps(_mm_mul_ps(a, bYZX), _mm_mul_ps(aYZX, b));
+			return _mm_shuffle_ps(r, r, _MM_SHUFFLE(3, 0, 2, 1));
+		}
+#endif
+
+	public:
+		ObjectConstants() : buffer{ 0 }, maxTexels{ 0 }
+		{
+			glGenTextures(1, &texture);
+			glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+		}
+
+		/// <summary>
+		/// Computes every object's matrices straight into the ring, and gives each object its index into the buffer
+		/// </summary>
+		void update(RingBuffer& ring, const std::vector<Object*>& objects, const glm::mat4& view, const glm::mat4& projection)
+		{
+			const size_t stride = TEXELS_PER_OBJECT * 4;
+
+			// aligned to a whole entry, so the allocation starts at an object index of the texture buffer
+			RingBuffer::Allocation allocation = ring.allocate(objects.size() * stride * sizeof(float), stride * sizeof(float));
+			float* entries = (float*)allocation.data;
+			int firstIndex = (int)(allocation.offset / (stride * sizeof(float)));
+
+			glm::mat4 viewProjection = projection * view;		// shared by every object, so only done once
+			const float* vp = &viewProjection[0].x;
+
+			for (size_t i = 0; i < objects.size(); ++i) {
+				const float* model = &objects[i]->getMatrix()[0].x;
+				float* entry = entries + i * stride;
+
+				multiply(vp, model, entry + MVP_OFFSET * 4);
+				for (int j = 0; j < 16; ++j)
+					entry[MODEL_OFFSET * 4 + j] = model[j];
+				normalMatrix(model, entry + NORMAL_OFFSET * 4);
+				entry[OCCLUSION_OFFSET * 4 + 3] = (float)objects[i]->getOcclusionOffset();		// exact up to 2^24 vertices
+				const glm::vec4& lightmapRect = objects[i]->getLightmapRect();
+				for (int j = 0; j < 4; ++j)
+					entry[LIGHTMAP_OFFSET * 4 + j] = lightmapRect[j];
+
+				objects[i]->setConstantIndex(firstIndex + (int)i);
+			}
+			ring.commit(allocation);
+
+			// the texture covers the whole ring, and has to follow it when it grows into a new buffer
+			if (allocation.buffer != 0 && allocation.buffer != buffer) {
+				buffer = allocation.buffer;
+				if (ring.getSize() / 16 > (size_t)maxTexels)
+					std::cout << "ERROR: The ring buffer is bigger than a texture buffer can be (" << maxTexels << " texels)" << std::endl;
+				GLState::get().bindTexture(OBJECT_DATA_UNIT, GL_TEXTURE_BUFFER, texture);
+				glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffer);
+			}
+		}
+
+		/// <summary>
+		/// Binds the buffer to the unit the vertex shader's objectData sampler reads from
+		/// </summary>
+		void bind(void) const
+		{
+			GLState::get().bindTexture(OBJECT_DATA_UNIT, GL_TEXTURE_BUFFER, texture);
+		}
+};
+
+#endif
@@ -0,0 +1,327 @@
+#ifndef OCCLUSION_CULLER_H
+#define OCCLUSION_CULLER_H
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <glm/glm/glm.hpp>
+#include "Bounds.h"
+#include "ThreadPool.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OCCLUSION_CULLER_SSE
+#include <emmintrin.h>
+#endif
+
+/// <summary>
+/// CPU occlusion culling: big occluders (e.g. houses and terrain) are rasterized into a small depth buffer,
+/// then the world-space boxes of other objects are tested against it before they're submitted for drawing.
+/// The buffer is split into 8x8 tiles; each row of tiles is rasterized on a ThreadPool worker (four pixels at a time with SSE),
+/// and each tile keeps its farthest depth so most tests are answered without looking at single pixels.
+/// Doesn't use OpenGL at all, so it can run (and be tested) without a window.
+/// </summary>
+class OcclusionCuller
+{
+	public:
+		static const int TILE_SIZE = 8;
+
+		struct Stats {
+			unsigned int occluderTriangles = 0;
+			unsigned int tested = 0;		// boxes tested
+			unsigned int occluded = 0;		// of those, how many were hidden
+			unsigned int drawsTested = 0;	// draws (meshes) belonging to the tested boxes
+			unsigned int drawsRejected = 0;	// draws (meshes) belonging to the hidden boxes
+		};
+
+	private:
+		// a triangle after projection: pixel coordinates and depth in [0, 1]
+		struct ScreenTriangle {
+			glm::vec3 v[3];
+			int minY, maxY;		// rows covered (inclusive)
+		};
+
+		int width, height;			// in pixels (multiples of TILE_SIZE)
+		int tilesX, tilesY;
+		std::vector<float> depth;			// row-major, 1 = far plane
+		std::vector<float> tileMaxDepth;	// farthest depth in each tile
+		std::vector<ScreenTriangle> triangles;
+		glm::mat4 viewProjection;
+		Stats frameStats;
+		Stats lastFrameStats;
+
+		/// <summary>
+		/// Clips a clip-space triangle against the near plane (anything else is handled by clamping to the screen)
+		/// and adds the resulting one or two triangles in screen space
+		/// </summary>
+		void addClipTriangle(const glm::vec4 clip[3])
+		{
+			// distance from the near plane (z = -w): inside when >= 0
+			glm::vec4 polygon[4];
+			int count = 0;
+			for (int i = 0; i < 3; ++i) {
+				const glm::vec4& a = clip[i];
+				const glm::vec4& b = clip[(i + 1) % 3];
+				float da = a.z + a.w, db = b.z + b.w;
+				if (da >= 0.0f)
+					polygon[count++] = a;
+				if ((da >= 0.0f) != (db >= 0.0f))
+					polygon[count++] = a + (b - a) * (da / (da - db));
+			}
+			if (count < 3)
+				return;
+
+			glm::vec3 screen[4];
+			for (int i = 0; i < count; ++i) {
+				float invW = 1.0f / std::max(polygon[i].w, 1e-6f);
+				screen[i].x = (polygon[i].x * invW * 0.5f + 0.5f) * width;
+				screen[i].y = (polygon[i].y * invW * 0.5f + 0.5f) * height;
+				screen[i].z = std::min(std::max(polygon[i].z * invW * 0.5f + 0.5f, 0.0f), 1.0f);
+			}
+
+			for (int i = 1; i + 1 < count; ++i) {
+				ScreenTriangle triangle;
+				triangle.v[0] = screen[0];
+				triangle.v[1] = screen[i];
+				triangle.v[2] = screen[i + 1];
+
+				float minY = std::min(triangle.v[0].y, std::min(triangle.v[1].y, triangle.v[2].y));
+				float maxY = std::max(triangle.v[0].y, std::max(triangle.v[1].y, triangle.v[2].y));
+				triangle.minY = std::max(int(std::ceil(minY - 0.5f)), 0);
+				triangle.maxY = std::min(int(std::floor(maxY - 0.5f)), height - 1);
+				if (triangle.minY <= triangle.maxY)
+					triangles.push_back(triangle);
+			}
+			++frameStats.occluderTriangles;
+		}
+
+		/// <summary>
+		/// Rasterizes one triangle into rows [rowBegin, rowEnd), keeping the nearest depth (pixel centers are sampled,
+		/// so the occluder's coverage isn't overestimated)
+		/// </summary>
+		void rasterize(const ScreenTriangle& triangle, int rowBegin, int rowEnd)
+		{
+			glm::vec3 a = triangle.v[0], b = triangle.v[1], c = triangle.v[2];
+			float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+			if (std::fabs(area) < 1e-8f)
+				return;
+			if (area < 0.0f) {		// either winding is fine; flip so the edge functions are positive inside
+				std::swap(b, c);
+				area = -area;
+			}
+
+			// edge functions E(x, y) = A * x + B * y + C, and depth as a plane over the screen
+			float edgeA[3] = { a.y - b.y, b.y - c.y, c.y - a.y };
+			float edgeB[3] = { b.x - a.x, c.x - b.x, a.x - c.x };
+			float edgeC[3] = { a.x * b.y - a.y * b.x, b.x * c.y - b.y * c.x, c.x * a.y - c.y * a.x };
+			float depthA = ((b.z - a.z) * (c.y - a.y) - (c.z - a.z) * (b.y - a.y)) / area;
+			float depthB = ((c.z - a.z) * (b.x - a.x) - (b.z - a.z) * (c.x - a.x)) / area;
+			float depthC = a.z - depthA * a.x - depthB * a.y;
+
+			int minX = std::max(int(std::ceil(std::min(a.x, std::min(b.x, c.x)) - 0.5f)), 0);
+			int maxX = std::min(int(std::floor(std::max(a.x, std::max(b.x, c.x)) - 0.5f)), width - 1);
+			int minY = std::max(triangle.minY, rowBegin);
+			int maxY = std::min(triangle.maxY, rowEnd - 1);
+			if (minX > maxX)
+				return;
+			minX &= ~3;		// whole groups of four pixels
+
+			for (int y = minY; y <= maxY; ++y) {
+				float py = y + 0.5f;
+				float* row = &depth[size_t(y) * width];
+
+#ifdef OCCLUSION_CULLER_SSE
+				__m128 offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+				__m128 rowEdge[3], stepEdge[3];
+				for (int e = 0; e < 3; ++e) {
+					rowEdge[e] = _mm_set1_ps(edgeB[e] * py + edgeC[e]);
+					stepEdge[e] = _mm_set1_ps(edgeA[e]);
+				}
+				__m128 rowDepth = _mm_set1_ps(depthB * py + depthC);
+				__m128 stepDepth = _mm_set1_ps(depthA);
+
+				for (int x = minX; x <= maxX; x += 4) {
+					__m128 px = _mm_add_ps(_mm_set1_ps(float(x)), offsets);
+					__m128 e0 = _mm_add_ps(_mm_mul_ps(stepEdge[0], px), rowEdge[0]);
+					__m128 e1 = _mm_add_ps(_mm_mul_ps(stepEdge[1], px), rowEdge[1]);
+					__m128 e2 = _mm_add_ps(_mm_mul_ps(stepEdge[2], px), rowEdge[2]);
+					__m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, _mm_setzero_ps()), _mm_cmpge_ps(e1, _mm_setzero_ps())), _mm_cmpge_ps(e2, _mm_setzero_ps()));
+					if (_mm_movemask_ps(inside) == 0)
+						continue;
+
+					__m128 z = _mm_add_ps(_mm_mul_ps(stepDepth, px), rowDepth);
+					__m128 current = _mm_loadu_ps(row + x);
+					__m128 write = _mm_and_ps(inside, _mm_cmplt_ps(z, current));
+					_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(write, z), _mm_andnot_ps(write, current)));
+				}
+#else
+				for (int x = minX; x <= maxX + 3 && x < width; ++x) {
+					float px = x + 0.5f;
+					bool inside = true;
+					for (int e = 0; e < 3; ++e)
+						inside = inside && edgeA[e] * px + edgeB[e] * py + edgeC[e] >= 0.0f;
+					float z = depthA * px + depthB * py + depthC;
+					if (inside && z < row[x])
+						row[x] = z;
+				}
+#endif
+			}
+		}
+
+		void updateTileMaxDepth(int tileY)
+		{
+			for (int tileX = 0; tileX < tilesX; ++tileX) {
+				float farthest = 0.0f;
+				for (int y = tileY * TILE_SIZE; y < (tileY + 1) * TILE_SIZE; ++y) {
+					const float* row = &depth[size_t(y) * width + tileX * TILE_SIZE];
+					for (int x = 0; x < TILE_SIZE; ++x)
+						farthest = std::max(farthest, row[x]);
+				}
+				tileMaxDepth[size_t(tileY) * tilesX + tileX] = farthest;
+			}
+		}
+
+	public:
+		/// <param name="bufferWidth">Depth buffer width in pixels (rounded up to a multiple of TILE_SIZE)</param>
+		/// <param name="bufferHeight">Depth buffer height in pixels (rounded up to a multiple of TILE_SIZE)</param>
+		OcclusionCuller(int bufferWidth = 256, int bufferHeight = 192) : viewProjection{ 1.0f }
+		{
+			tilesX = (bufferWidth + TILE_SIZE - 1) / TILE_SIZE;
+			tilesY = (bufferHeight + TILE_SIZE - 1) / TILE_SIZE;
+			width = tilesX * TILE_SIZE;
+			height = tilesY * TILE_SIZE;
+			depth.assign(size_t(width) * height, 1.0f);
+			tileMaxDepth.assign(size_t(tilesX) * tilesY, 1.0f);
+		}
+
+		/// <summary>
+		/// Starts a new frame: clears the buffer and forgets last frame's occluders
+		/// </summary>
+		void begin(const glm::mat4& argViewProjection)
+		{
+			viewProjection = argViewProjection;
+			triangles.clear();
+			lastFrameStats = frameStats;
+			frameStats = Stats();
+		}
+
+		/// <summary>
+		/// Queues an occluder's triangles (positions are read with the given stride, so an array of Vertex works directly)
+		/// </summary>
+		/// <param name="positions">First vertex position (3 floats)</param>
+		/// <param name="stride">Bytes from one position to the next</param>
+		/// <param name="model">Model matrix of the occluder</param>
+		void addOccluder(const float* positions, size_t stride, const unsigned int* indices, size_t indexCount, const glm::mat4& model)
+		{
+			glm::mat4 modelViewProjection = viewProjection * model;
+			const char* base = (const char*)positions;
+			for (size_t i = 0; i + 2 < indexCount; i += 3) {
+				glm::vec4 clip[3];
+				for (int j = 0; j < 3; ++j) {
+					const float* p = (const float*)(base + indices[i + j] * stride);
+					clip[j] = modelViewProjection * glm::vec4(p[0], p[1], p[2], 1.0f);
+				}
+				addClipTriangle(clip);
+			}
+		}
+
+		/// <summary>
+		/// Rasterizes every queued occluder (rows of tiles are spread over the thread pool). Call before testing.
+		/// </summary>
+		void rasterize(void)
+		{
+			ThreadPool::get().parallelFor(tilesY, [this](size_t tileY) {
+				int rowBegin = int(tileY) * TILE_SIZE, rowEnd = rowBegin + TILE_SIZE;
+				std::fill(depth.begin() + size_t(rowBegin) * width, depth.begin() + size_t(rowEnd) * width, 1.0f);
+				for (const ScreenTriangle& triangle : triangles) {
+					if (triangle.maxY >= rowBegin && triangle.minY < rowEnd)
+						rasterize(triangle, rowBegin, rowEnd);
+				}
+				updateTileMaxDepth(int(tileY));
+			});
+		}
+
+		/// <summary>
+		/// Whether any part of a world-space box might be visible past the occluders (boxes crossing the near plane always are)
+		/// </summary>
+		/// <param name="draws">Number of draws the box stands for (only used for the stats)</param>
+		bool isVisible(const AABB& box, unsigned int draws = 1)
+		{
+			++frameStats.tested;
+			frameStats.drawsTested += draws;
+			if (box.empty())
+				return true;
+
+			// screen rectangle and nearest depth of the box's corners
+			float minX = INFINITY, minY = INFINITY, maxX = -INFINITY, maxY = -INFINITY, nearest = INFINITY;
+			for (int i = 0; i < 8; ++i) {
+				glm::vec3 corner((i & 1) ? box.max.x : box.min.x, (i & 2) ? box.max.y : box.min.y, (i & 4) ? box.max.z : box.min.z);
+				glm::vec4 clip = viewProjection * glm::vec4(corner, 1.0f);
+				if (clip.z < -clip.w || clip.w <= 1e-6f)
+					return true;		// in front of the near plane, so it can't be proven hidden
+
+				float invW = 1.0f / clip.w;
+				float x = (clip.x * invW * 0.5f + 0.5f) * width;
+				float y = (clip.y * invW * 0.5f + 0.5f) * height;
+				minX = std::min(minX, x);
+				maxX = std::max(maxX, x);
+				minY = std::min(minY, y);
+				maxY = std::max(maxY, y);
+				nearest = std::min(nearest, clip.z * invW * 0.5f + 0.5f);
+			}
+
+			int x0 = std::max(int(std::floor(minX)), 0), x1 = std::min(int(std::ceil(maxX)), width - 1);
+			int y0 = std::max(int(std::floor(minY)), 0), y1 = std::min(int(std::ceil(maxY)), height - 1);
+			if (x0 > x1 || y0 > y1)
+				return true;		// off screen; that's frustum culling's job, so don't count it as occluded
+
+			for (int tileY = y0 / TILE_SIZE; tileY <= y1 / TILE_SIZE; ++tileY) {
+				for (int tileX = x0 / TILE_SIZE; tileX <= x1 / TILE_SIZE; ++tileX) {
+					if (tileMaxDepth[size_t(tileY) * tilesX + tileX] < nearest)
+						continue;		// everything in the tile is nearer than the box
+
+					// check just the pixels of the tile that the box covers
+					int px0 = std::max(x0, tileX * TILE_SIZE), px1 = std::min(x1, tileX * TILE_SIZE + TILE_SIZE - 1);
+					int py0 = std::max(y0, tileY * TILE_SIZE), py1 = std::min(y1, tileY * TILE_SIZE + TILE_SIZE - 1);
+					for (int y = py0; y <= py1; ++y) {
+						const float* row = &depth[size_t(y) * width];
+						for (int x = px0; x <= px1; ++x) {
+							if (row[x] >= nearest)
+								return true;
+						}
+					}
+				}
+			}
+
+			++frameStats.occluded;
+			frameStats.drawsRejected += draws;
+			return false;
+		}
+
+		int getWidth(void) const
+		{
+			return width;
+		}
+
+		int getHeight(void) const
+		{
+			return height;
+		}
+
+		/// <summary>
+		/// Depth at a pixel of the buffer (for debugging and tests)
+		/// </summary>
+		float getDepth(int x, int y) const
+		{
+			return depth[size_t(y) * width + x];
+		}
+
+		/// <summary>
+		/// Counts for the frame before the current one (begin() moves the current counts here)
+		/// </summary>
+		const Stats& getLastFrameStats(void) const
+		{
+			return lastFrameStats;
+		}
+};
+
+#endif
@@ -0,0 +1,296 @@
+#ifndef OCCLUSION_QUERIES_H
+#define OCCLUSION_QUERIES_H
+
+#include <chrono>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm/glm.hpp>
+#include <glm/glm/gtc/type_ptr.hpp>
+#include "Bounds.h"
+#include "GLState.h"
+#include "Object.h"
+#include "ShaderProgram.h"
+
+/// <summary>
+/// Occlusion culling on the GPU with GL_ANY_SAMPLES_PASSED queries against objects' bounding boxes, in the style of CHC++
+/// (coherent hierarchical culling): results are never waited for on the CPU, and each frame reuses the last visibility that came back.
+/// Every frame:
+///  - beginFrame() reads whichever results have arrived, without stalling.
+///  - Objects last seen as visible are drawn normally. They're only queried again every VISIBLE_QUERY_INTERVAL frames
+///    (staggered, so they don't all come due together), since visible objects usually stay visible.
+///  - After they're drawn, issueQueries() draws the boxes of the objects last seen as hidden (plus the visible ones that are due)
+///    against the depth buffer, all in one batch with color and depth writes off.
+///  - The hidden objects are then drawn under conditional rendering on their new queries, so the GPU throws their draws away
+///    if the box still can't be seen, and nothing pops in late when one comes into view.
+/// </summary>
+class OcclusionQueries
+{
+	public:
+		struct Stats {
+			unsigned int queriesIssued = 0;
+			unsigned int resultsRead = 0;
+			unsigned int hiddenObjects = 0;			// drawn under conditional rendering, since their last query found them hidden
+			unsigned int conditionalDraws = 0;		// draw calls made under conditional rendering
+			unsigned int drawsSaved = 0;			// conditional draws that the GPU skipped (known once their query's result comes back)
+			float averageLatencyFrames = 0.0f;		// from issuing a query to finding its result available, over the results read
+			float averageLatencyMilliseconds = 0.0f;
+		};
+
+		static const unsigned int VISIBLE_QUERY_INTERVAL = 8;
+
+	private:
+		struct PendingQuery {
+			unsigned int query;
+			size_t object;
+			unsigned long long frame;
+			std::chrono::steady_clock::time_point issued;
+			unsigned int conditionalDraws;		// drawn under conditional rendering on this query
+		};
+
+		struct ObjectState {
+			bool visible = true;					// as of the newest result (objects start out assumed visible)
+			unsigned long long resultFrame = 0;		// frame the newest result was issued in
+			unsigned long long nextQueryFrame = 0;	// when a visible object gets checked again
+			unsigned int pendingQueries = 0;
+			int currentQuery = -1;					// index in pending of the query issued for it this frame, or -1
+		};
+
+		ShaderProgram boxShaderProgram;
+		unsigned int VAO, VBO, EBO;
+		unsigned int programID;		// the program the uniform locations below belong to (it changes when the shaders are hot reloaded)
+		int viewProjectionLocation, boxMinLocation, boxMaxLocation;
+
+		std::vector<ObjectState> states;
+		std::vector<PendingQuery> pending;		// in the order they were issued
+		std::vector<unsigned int> freeQueries;
+		unsigned long long frame;
+		bool conditionalActive;
+
+		Stats frameStats;
+		Stats lastFrameStats;
+
+		void fillBuffers(void)
+		{
+			// unit cube; the vertex shader stretches it over each box
+			const float vertices[8 * 3] = {
+				0.0f, 0.0f, 0.0f,	1.0f, 0.0f, 0.0f,	1.0f, 1.0f, 0.0f,	0.0f, 1.0f, 0.0f,
+				0.0f, 0.0f, 1.0f,	1.0f, 0.0f, 1.0f,	1.0f, 1.0f, 1.0f,	0.0f, 1.0f, 1.0f
+			};
+			const unsigned int indices[36] = {
+				0, 2, 1,	0, 3, 2,		// -z
+				4, 5, 6,	4, 6, 7,		// +z
+				0, 4, 7,	0, 7, 3,		// -x
+				1, 2, 6,	1, 6, 5,		// +x
+				0, 1, 5,	0, 5, 4,		// -y
+				3, 7, 6,	3, 6, 2			// +y
+			};
+
+			glGenVertexArrays(1, &VAO);
+			glGenBuffers(1, &VBO);
+			glGenBuffers(1, &EBO);
+
+			GLState::get().bindVertexArray(VAO);
+			GLState::get().bindBuffer(GL_ARRAY_BUFFER, VBO);
+			glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+			GLState::get().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+
+			// position data	(layout = 0)
+			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 3, (void*)0);
+			glEnableVertexAttribArray(0);
+		}
+
+		/// <summary>
+		/// Records a query's result for its object, unless a newer result has already been recorded
+		/// </summary>
+		void applyResult(const PendingQuery& entry, bool visible)
+		{
+			ObjectState& state = states[entry.object];
+			--state.pendingQueries;
+			if (!visible)
+				frameStats.drawsSaved += entry.conditionalDraws;
+
+			if (entry.frame < state.resultFrame)
+				return;
+			state.resultFrame = entry.frame;
+			if (visible)
+				state.nextQueryFrame = frame + VISIBLE_QUERY_INTERVAL + entry.object % VISIBLE_QUERY_INTERVAL;		// spread out over the interval
+			state.visible = visible;
+		}
+
+	public:
+		/// <param name="prog">Shader program for drawing boxes (BoundingBoxVertexShader.vert and BoundingBoxFragmentShader.frag)</param>
+		OcclusionQueries(const ShaderProgram& prog)
+			: boxShaderProgram{ prog }, programID{ 0 }, viewProjectionLocation{ -1 }, boxMinLocation{ -1 }, boxMaxLocation{ -1 }, frame{ 0 }, conditionalActive{ false }
+		{
+			fillBuffers();
+		}
+
+		ShaderProgram& getShaderProgram(void)
+		{
+			return boxShaderProgram;
+		}
+
+		/// <summary>
+		/// Call at the start of every frame, before isHidden(). Picks up the results that have arrived since the last frame
+		/// (without waiting for the rest), and the counts for the frame that just finished become available through getLastFrameStats().
+		/// </summary>
+		/// <param name="objectCount">Number of objects that will be passed to issueQueries()</param>
+		void beginFrame(size_t objectCount)
+		{
+			lastFrameStats = frameStats;
+			frameStats = Stats();
+			++frame;
+			states.resize(objectCount);
+			for (ObjectState& state : states)
+				state.currentQuery = -1;
+
+			// queries finish in the order they were issued, so stop at the first one that isn't done yet
+			auto now = std::chrono::steady_clock::now();
+			float latencyFrames = 0.0f, latencyMilliseconds = 0.0f;
+			size_t done = 0;
+			for (; done < pending.size(); ++done) {
+				const PendingQuery& entry = pending[done];
+				GLuint available = GL_FALSE;
+				glGetQueryObjectuiv(entry.query, GL_QUERY_RESULT_AVAILABLE, &available);
+				if (!available)
+					break;
+
+				GLuint samplesPassed = GL_FALSE;
+				glGetQueryObjectuiv(entry.query, GL_QUERY_RESULT, &samplesPassed);
+				if (entry.object < states.size())
+					applyResult(entry, samplesPassed != GL_FALSE);
+				freeQueries.push_back(entry.query);
+
+				latencyFrames += float(frame - entry.frame);
+				latencyMilliseconds += std::chrono::duration<float, std::milli>(now - entry.issued).count();
+				++frameStats.resultsRead;
+			}
+			pending.erase(pending.begin(), pending.begin() + done);
+
+			if (frameStats.resultsRead > 0) {
+				frameStats.averageLatencyFrames = latencyFrames / frameStats.resultsRead;
+				frameStats.averageLatencyMilliseconds = latencyMilliseconds / frameStats.resultsRead;
+			}
+		}
+
+		/// <summary>
+		/// Whether the object's newest result found it hidden (draw it after issueQueries(), under conditional rendering)
+		/// </summary>
+		bool isHidden(size_t object) const
+		{
+			return object < states.size() && !states[object].visible;
+		}
+
+		/// <summary>
+		/// Tests the boxes of the objects last seen as hidden, and of the visible objects that are due for another check,
+		/// against what has been drawn so far. Call after drawing the visible objects.
+		/// </summary>
+		/// <param name="candidates">One flag per object, 0 for objects that are already culled (e.g. outside the frustum)</param>
+		/// <param name="nearPlane">Distance to the near plane; boxes closer than that to the camera are always visible</param>
+		void issueQueries(const std::vector<Object*>& objects, const unsigned char* candidates, const glm::mat4& viewProjection, const glm::vec3& cameraPos, float nearPlane)
+		{
+			boxShaderProgram.use();
+			if (programID != boxShaderProgram.ID) {
+				programID = boxShaderProgram.ID;
+				viewProjectionLocation = glGetUniformLocation(programID, "viewProjection");
+				boxMinLocation = glGetUniformLocation(programID, "boxMin");
+				boxMaxLocation = glGetUniformLocation(programID, "boxMax");
+			}
+			glUniformMatrix4fv(viewProjectionLocation, 1, GL_FALSE, glm::value_ptr(viewProjection));
+
+			// boxes only test against the depth buffer; they don't change it or show up
+			GLState::get().bindVertexArray(VAO);
+			GLState::get().setEnabled(GL_CULL_FACE, false);
+			GLState::get().depthMask(false);
+			glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+
+			for (size_t i = 0; i < objects.size() && i < states.size(); ++i) {
+				ObjectState& state = states[i];
+				if (!candidates[i] || !objects[i]->getModel().isLoaded())
+					continue;
+				if (state.visible && (state.pendingQueries > 0 || frame < state.nextQueryFrame))
+					continue;		// assumed to still be visible
+
+				// grown a little, so surfaces lying on the box (like a flat ground plane) don't hide it
+				AABB box = objects[i]->getWorldBounds();
+				glm::vec3 margin = (box.max - box.min) * 0.01f + 0.01f;
+				box.min -= margin;
+				box.max += margin;
+
+				// the box is clipped by the near plane when the camera is (almost) inside it, so it can't be tested
+				glm::vec3 nearMin = box.min - nearPlane, nearMax = box.max + nearPlane;
+				if (cameraPos.x > nearMin.x && cameraPos.y > nearMin.y && cameraPos.z > nearMin.z && cameraPos.x < nearMax.x && cameraPos.y < nearMax.y && cameraPos.z < nearMax.z) {
+					if (!state.visible)
+						state.nextQueryFrame = frame + VISIBLE_QUERY_INTERVAL;
+					state.visible = true;
+					state.resultFrame = frame;
+					continue;
+				}
+
+				unsigned int query;
+				if (freeQueries.empty())
+					glGenQueries(1, &query);
+				else {
+					query = freeQueries.back();
+					freeQueries.pop_back();
+				}
+
+				glUniform3fv(boxMinLocation, 1, glm::value_ptr(box.min));
+				glUniform3fv(boxMaxLocation, 1, glm::value_ptr(box.max));
+				glBeginQuery(GL_ANY_SAMPLES_PASSED, query);
+				glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+				glEndQuery(GL_ANY_SAMPLES_PASSED);
+
+				pending.push_back({ query, i, frame, std::chrono::steady_clock::now(), 0 });
+				state.currentQuery = (int)pending.size() - 1;
+				++state.pendingQueries;
+				++frameStats.queriesIssued;
+			}
+
+			glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+			GLState::get().depthMask(true);
+		}
+
+		/// <summary>
+		/// Makes the following draws depend on the object's query from this frame (the GPU waits for the result itself,
+		/// the CPU never does). Draws aren't conditional if the object wasn't queried this frame.
+		/// </summary>
+		void beginConditionalRender(size_t object)
+		{
+			conditionalActive = object < states.size() && states[object].currentQuery >= 0;
+			if (conditionalActive)
+				glBeginConditionalRender(pending[states[object].currentQuery].query, GL_QUERY_WAIT);
+			++frameStats.hiddenObjects;
+		}
+
+		/// <param name="draws">Number of draw calls made since beginConditionalRender()</param>
+		void endConditionalRender(size_t object, unsigned int draws)
+		{
+			if (!conditionalActive)
+				return;
+			glEndConditionalRender();
+			conditionalActive = false;
+			pending[states[object].currentQuery].conditionalDraws += draws;
+			frameStats.conditionalDraws += draws;
+		}
+
+		/// <summary>
+		/// Forgets every result, so all objects are assumed visible again (e.g. after turning this culling off and back on)
+		/// </summary>
+		void reset(void)
+		{
+			for (ObjectState& state : states)
+				state = ObjectState();
+			for (const PendingQuery& entry : pending)
+				freeQueries.push_back(entry.query);		// reusing a query for a new glBeginQuery discards its old result
+			pending.clear();
+		}
+
+		const Stats& getLastFrameStats(void) const
+		{
+			return lastFrameStats;
+		}
+};
+
+#endif
@@ -0,0 +1,156 @@
+#ifndef PASS_TIMERS_H
+#define PASS_TIMERS_H
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+#include <glad/glad.h>
+
+/// <summary>
+/// Times each pass of a frame on the GPU (GL_TIME_ELAPSED queries around it) and on the CPU (issuing its commands), so a pass
+/// like the depth pre-pass can be turned on and off and the cost compared against what it saves in the passes after it.
+/// GPU results are never waited for: beginFrame() reads a frame's queries once they've all come back (usually a couple of
+/// frames later), the same way OcclusionQueries reads its results. Times are smoothed over roughly the last 1 / SMOOTHING frames,
+/// and a pass that wasn't drawn in a frame counts as taking no time.
+/// Passes can't be nested (only one GL_TIME_ELAPSED query can be active at a time).
+/// </summary>
+class PassTimers
+{
+	public:
+		enum Pass {
+			DEPTH_PREPASS = 0,		// depth only, before the lit pass
+			OPAQUE_PASS = 1,		// static batches and the render queue
+			IMPOSTOR_PASS = 2,
+			OCCLUSION_PASS = 3,		// occlusion query boxes, and the objects drawn under conditional rendering
+			SKYBOX_PASS = 4,
+			SHADOW_CASCADE_0 = 5,		// each sun shadow cascade rendered this frame (see CascadedShadows.h), 0 is the nearest
+			SHADOW_CASCADE_1 = 6,
+			SHADOW_CASCADE_2 = 7,
+			SHADOW_CASCADE_3 = 8,
+			NUM_PASSES = 9
+		};
+
+		struct Stats {
+			float gpuMilliseconds[NUM_PASSES] = {};
+			float cpuMilliseconds[NUM_PASSES] = {};
+			float latencyFrames = 0.0f;		// how far behind the GPU times are
+		};
+
+		static constexpr float SMOOTHING = 0.05f;
+
+	private:
+		struct FrameQueries {
+			unsigned int queries[NUM_PASSES];		// 0 for passes that weren't drawn
+			float cpuMilliseconds[NUM_PASSES];
+			unsigned int last;		// the query issued last, or 0 if nothing was timed
+			unsigned long long frame;
+		};
+
+		std::vector<FrameQueries> pending;		// in the order they were issued
+		std::vector<unsigned int> freeQueries;
+		FrameQueries current;
+		int activePass;				// between begin() and end(), or -1
+		std::chrono::steady_clock::time_point passStart;
+		unsigned long long frame;
+		Stats stats;
+
+		void resetCurrent(void)
+		{
+			for (int pass = 0; pass < NUM_PASSES; ++pass) {
+				current.queries[pass] = 0;
+				current.cpuMilliseconds[pass] = 0.0f;
+			}
+			current.last = 0;
+			current.frame = frame;
+		}
+
+	public:
+		PassTimers() : activePass{ -1 }, frame{ 0 }
+		{
+			resetCurrent();
+		}
+
+		/// <summary>
+		/// Call at the start of every frame, before the first pass: picks up the GPU times that have come back since the last frame
+		/// </summary>
+		void beginFrame(void)
+		{
+			pending.push_back(current);
+			++frame;
+			resetCurrent();
+
+			// queries finish in the order they were issued, so stop at the first frame that isn't done yet
+			size_t done = 0;
+			for (; done < pending.size(); ++done) {
+				const FrameQueries& entry = pending[done];
+				if (entry.last != 0) {
+					GLuint available = GL_FALSE;
+					glGetQueryObjectuiv(entry.last, GL_QUERY_RESULT_AVAILABLE, &available);
+					if (!available)
+						break;
+				}
+
+				for (int pass = 0; pass < NUM_PASSES; ++pass) {
+					float gpuMilliseconds = 0.0f;
+					if (entry.queries[pass] != 0) {
+						GLuint64 nanoseconds = 0;
+						glGetQueryObjectui64v(entry.queries[pass], GL_QUERY_RESULT, &nanoseconds);
+						gpuMilliseconds = float(nanoseconds) / 1000000.0f;
+						freeQueries.push_back(entry.queries[pass]);
+					}
+					stats.gpuMilliseconds[pass] += (gpuMilliseconds - stats.gpuMilliseconds[pass]) * SMOOTHING;
+					stats.cpuMilliseconds[pass] += (entry.cpuMilliseconds[pass] - stats.cpuMilliseconds[pass]) * SMOOTHING;
+				}
+				stats.latencyFrames = float(frame - entry.frame);
+			}
+			pending.erase(pending.begin(), pending.begin() + done);
+		}
+
+		void begin(Pass pass)
+		{
+			if (activePass >= 0) {
+				std::cout << "ERROR: PassTimers::begin() called before the previous pass ended" << std::endl;
+				return;
+			}
+
+			unsigned int query;
+			if (freeQueries.empty())
+				glGenQueries(1, &query);
+			else {
+				query = freeQueries.back();
+				freeQueries.pop_back();
+			}
+			if (current.queries[pass] != 0)
+				freeQueries.push_back(current.queries[pass]);		// timed twice in one frame: only the second counts
+
+			glBeginQuery(GL_TIME_ELAPSED, query);
+			current.queries[pass] = query;
+			current.last = query;		// passes aren't always issued in the order they're numbered
+			activePass = pass;
+			passStart = std::chrono::steady_clock::now();
+		}
+
+		void end(void)
+		{
+			if (activePass < 0)
+				return;
+
+			glEndQuery(GL_TIME_ELAPSED);
+			current.cpuMilliseconds[activePass] = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - passStart).count();
+			activePass = -1;
+		}
+
+		static const char* getName(Pass pass)
+		{
+			static const char* const names[NUM_PASSES] = { "depth pre-pass", "opaque", "impostors", "occlusion queries", "skybox",
+				"shadow cascade 0", "shadow cascade 1", "shadow cascade 2", "shadow cascade 3" };
+			return names[pass];
+		}
+
+		const Stats& getStats(void) const
+		{
+			return stats;
+		}
+};
+
+#endif
@@ -0,0 +1,349 @@
+#ifndef POTENTIALLY_VISIBLE_SET_H
+#define POTENTIALLY_VISIBLE_SET_H
+
+#include <cmath>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <vector>
+#include <glm/glm/glm.hpp>
+#include "Bounds.h"
+#include "Object.h"
+#include "ThreadPool.h"
+#include "TriangleScene.h"
+
+/// <summary>
+/// Precomputed visibility for static scenes: the region the camera can be in is divided into cells on the X/Z plane, and for
+/// each cell a bitset records which objects can be seen from anywhere in it (looking in any direction).
+/// At runtime, finding the camera's cell and reading its bits replaces culling for every object that can't be seen from there.
+/// Visibility is found by casting rays against the objects' triangles from sample points in each cell (cells are baked in
+/// parallel), so it's sampled rather than exact: tiny gaps between occluders can be missed, and more rays make that less likely.
+/// NOTE: Only objects that don't move belong in the bake; rebake whenever they (or their models) change
+/// </summary>
+class PotentiallyVisibleSet
+{
+	public:
+		struct Settings {
+			float cellSize;			// cells are square, this long on each side
+			int pointsPerCell;		// where rays are cast from (the cell's center and corners, then random points)
+			int raysPerPoint;		// in every direction, to find whatever is in view
+			int raysPerObject;		// from each point at random spots on each object not seen yet, so small objects aren't missed
+
+			Settings() : cellSize{ 1.0f }, pointsPerCell{ 8 }, raysPerPoint{ 1024 }, raysPerObject{ 32 } {}
+		};
+
+		struct Stats {
+			unsigned int cells = 0;
+			unsigned int objects = 0;
+			float averageVisible = 0.0f;	// objects per cell
+			unsigned long long rays = 0;
+			float bakeMilliseconds = 0.0f;
+		};
+
+	private:
+		static const uint32_t FILE_MAGIC = 0x31535650;		// "PVS1"
+
+		AABB region;
+		Settings settings;
+		int cellsX, cellsZ;
+		size_t objectCount;
+		size_t wordsPerCell;
+		std::vector<uint64_t> bits;		// wordsPerCell words per cell, one bit per object
+		uint64_t fingerprint;			// of the objects, region, and settings the bake was made from
+		Stats lastStats;
+
+		/// <summary>
+		/// FNV-1a over raw bytes
+		/// </summary>
+		static void hashBytes(uint64_t& hash, const void* data, size_t size)
+		{
+			const unsigned char* bytes = (const unsigned char*)data;
+			for (size_t i = 0; i < size; ++i) {
+				hash ^= bytes[i];
+				hash *= 0x100000001B3ull;
+			}
+		}
+
+		/// <summary>
+		/// Identifies everything a bake depends on, so a saved bake can be checked against the current scene
+		/// </summary>
+		static uint64_t computeFingerprint(const std::vector<Object*>& objects, const AABB& region, const Settings& settings)
+		{
+			uint64_t hash = 0xCBF29CE484222325ull;
+			hashBytes(hash, &region, sizeof(region));
+			hashBytes(hash, &settings, sizeof(settings));
+
+			size_t count = objects.size();
+			hashBytes(hash, &count, sizeof(count));
+			for (const Object* object : objects) {
+				hashBytes(hash, &object->getMatrix(), sizeof(glm::mat4));
+				if (!object->getModel().isLoaded())
+					continue;
+				for (const Mesh& mesh : object->getModel().getMeshes()) {
+					for (const Vertex& vertex : mesh.vertices)
+						hashBytes(hash, &vertex.Position, sizeof(glm::vec3));
+					hashBytes(hash, mesh.indices.data(), mesh.indices.size() * sizeof(unsigned int));
+				}
+			}
+			return hash;
+		}
+
+		AABB getCellBounds(int cell) const
+		{
+			int x = cell % cellsX, z = cell / cellsX;
+			AABB box;
+			box.min = glm::vec3(region.min.x + x * settings.cellSize, region.min.y, region.min.z + z * settings.cellSize);
+			box.max = glm::vec3(std::min(box.min.x + settings.cellSize, region.max.x), region.max.y, std::min(box.min.z + settings.cellSize, region.max.z));
+			return box;
+		}
+
+		/// <summary>
+		/// Finds what can be seen from one cell; visible gets a flag per object. Returns the number of rays cast.
+		/// </summary>
+		unsigned long long bakeCell(int cell, const std::vector<Object*>& objects, const TriangleScene& scene, const std::vector<std::vector<float>>& areaSums,
+			std::vector<unsigned char>& visible) const
+		{
+			AABB cellBox = getCellBounds(cell);
+			std::mt19937 random((unsigned int)cell);		// seeded per cell, so bakes are repeatable
+			std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+			unsigned long long rays = 0;
+
+			// the camera can be inside an object's bounds (it's visible then, whatever the rays find), and objects without
+			// triangles to cast rays at are always kept
+			visible.assign(objects.size(), 0);
+			for (size_t i = 0; i < objects.size(); ++i) {
+				AABB bounds = objects[i]->getWorldBounds();
+				bool inside = !bounds.empty() && bounds.min.x <= cellBox.max.x && bounds.max.x >= cellBox.min.x && bounds.min.y <= cellBox.max.y
+					&& bounds.max.y >= cellBox.min.y && bounds.min.z <= cellBox.max.z && bounds.max.z >= cellBox.min.z;
+				if (inside || scene.getFirstTriangle(i + 1) == scene.getFirstTriangle(i))
+					visible[i] = 1;
+			}
+
+			const glm::vec3 corners[4] = { glm::vec3(0.01f, 0.5f, 0.01f), glm::vec3(0.99f, 0.5f, 0.01f), glm::vec3(0.01f, 0.5f, 0.99f), glm::vec3(0.99f, 0.5f, 0.99f) };
+			for (int p = 0; p < settings.pointsPerCell; ++p) {
+				glm::vec3 t;
+				if (p == 0)
+					t = glm::vec3(0.5f);
+				else if (p <= 4)
+					t = corners[p - 1];
+				else
+					t = glm::vec3(unit(random), unit(random), unit(random));
+				glm::vec3 point = cellBox.min + (cellBox.max - cellBox.min) * t;
+
+				// whatever is hit first in every direction
+				for (int r = 0; r < settings.raysPerPoint; ++r) {
+					float z = 1.0f - 2.0f * unit(random);
+					float angle = 6.2831853f * unit(random);
+					float radius = std::sqrt(std::max(0.0f, 1.0f - z * z));
+					TriangleScene::Hit hit;
+					if (scene.intersect(point, glm::vec3(radius * std::cos(angle), z, radius * std::sin(angle)), INFINITY, hit))
+						visible[scene.getTriangle(hit.triangle).object] = 1;
+				}
+				rays += settings.raysPerPoint;
+
+				// then aim at random points on the objects that haven't been seen yet (picking triangles by area)
+				for (size_t i = 0; i < objects.size(); ++i) {
+					const std::vector<float>& sums = areaSums[i];
+					if (visible[i] || sums.empty() || sums.back() <= 0.0f)
+						continue;
+
+					size_t first = scene.getFirstTriangle(i);
+					for (int r = 0; r < settings.raysPerObject && !visible[i]; ++r, ++rays) {
+						size_t k = std::lower_bound(sums.begin(), sums.end(), unit(random) * sums.back()) - sums.begin();
+						const TriangleScene::Triangle& triangle = scene.getTriangle((int)(first + std::min(k, sums.size() - 1)));
+						float u = unit(random), v = unit(random);
+						if (u + v > 1.0f) {
+							u = 1.0f - u;
+							v = 1.0f - v;
+						}
+						glm::vec3 target = triangle.v0 + triangle.edge1 * u + triangle.edge2 * v;
+
+						// the target is seen if nothing else is in the way (hitting the object anywhere first counts too)
+						TriangleScene::Hit hit;
+						if (!scene.intersect(point, target - point, 1.001f, hit) || scene.getTriangle(hit.triangle).object == (int)i)
+							visible[i] = 1;
+					}
+				}
+			}
+			return rays;
+		}
+
+	public:
+		PotentiallyVisibleSet() : cellsX{ 0 }, cellsZ{ 0 }, objectCount{ 0 }, wordsPerCell{ 0 }, fingerprint{ 0 } {}
+
+		/// <summary>
+		/// Bakes visibility for every cell of a region
+		/// </summary>
+		/// <param name="objects">The static objects (object i gets bit i)</param>
+		/// <param name="cameraRegion">Everywhere the camera can be; cells divide it along X and Z, and rays start anywhere along its height</param>
+		void bake(const std::vector<Object*>& objects, const AABB& cameraRegion, const Settings& bakeSettings = Settings())
+		{
+			auto start = std::chrono::steady_clock::now();
+
+			region = cameraRegion;
+			settings = bakeSettings;
+			cellsX = std::max(1, (int)std::ceil((region.max.x - region.min.x) / settings.cellSize));
+			cellsZ = std::max(1, (int)std::ceil((region.max.z - region.min.z) / settings.cellSize));
+			objectCount = objects.size();
+			wordsPerCell = (objectCount + 63) / 64;
+			bits.assign((size_t)cellsX * cellsZ * wordsPerCell, 0);
+			fingerprint = computeFingerprint(objects, region, settings);
+
+			TriangleScene scene;
+			scene.build(objects);
+
+			// running totals of each object's triangle areas, for picking random points on its surface
+			std::vector<std::vector<float>> areaSums(objects.size());
+			for (size_t i = 0; i < objects.size(); ++i) {
+				float sum = 0.0f;
+				for (size_t k = scene.getFirstTriangle(i); k < scene.getFirstTriangle(i + 1); ++k) {
+					const TriangleScene::Triangle& triangle = scene.getTriangle((int)k);
+					sum += 0.5f * glm::length(glm::cross(triangle.edge1, triangle.edge2));
+					areaSums[i].push_back(sum);
+				}
+			}
+
+			int cellCount = cellsX * cellsZ;
+			std::vector<unsigned long long> cellRays(cellCount, 0);
+			ThreadPool::get().parallelFor(cellCount, [&](size_t cell) {
+				std::vector<unsigned char> visible;
+				cellRays[cell] = bakeCell((int)cell, objects, scene, areaSums, visible);
+
+				uint64_t* cellBits = &bits[cell * wordsPerCell];		// each cell's words are only written by its own task
+				for (size_t i = 0; i < visible.size(); ++i) {
+					if (visible[i])
+						cellBits[i / 64] |= uint64_t(1) << (i % 64);
+				}
+			});
+
+			Stats stats;
+			stats.cells = (unsigned int)cellCount;
+			stats.objects = (unsigned int)objectCount;
+			unsigned long long totalVisible = 0;
+			for (int cell = 0; cell < cellCount; ++cell) {
+				stats.rays += cellRays[cell];
+				for (size_t i = 0; i < objectCount; ++i)
+					totalVisible += isVisible(cell, i);
+			}
+			stats.averageVisible = cellCount > 0 ? float(totalVisible) / cellCount : 0.0f;
+			stats.bakeMilliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+			lastStats = stats;
+		}
+
+		/// <summary>
+		/// Writes the bake to a file, so later runs can load it instead of baking again
+		/// </summary>
+		bool save(const char* path) const
+		{
+			std::ofstream file(path, std::ios::binary);
+			if (!file) {
+				std::cout << "ERROR: Couldn't write PVS file " << path << std::endl;
+				return false;
+			}
+
+			uint32_t header[4] = { FILE_MAGIC, (uint32_t)cellsX, (uint32_t)cellsZ, (uint32_t)objectCount };
+			file.write((const char*)header, sizeof(header));
+			file.write((const char*)&fingerprint, sizeof(fingerprint));
+			file.write((const char*)bits.data(), bits.size() * sizeof(uint64_t));
+			return bool(file);
+		}
+
+		/// <summary>
+		/// Reads a bake written by save(), if it was made from the same objects, region, and settings
+		/// </summary>
+		/// <returns>False if the file is missing or out of date (bake again then)</returns>
+		bool load(const char* path, const std::vector<Object*>& objects, const AABB& cameraRegion, const Settings& bakeSettings = Settings())
+		{
+			std::ifstream file(path, std::ios::binary);
+			if (!file)
+				return false;
+
+			uint32_t header[4];
+			uint64_t fileFingerprint;
+			if (!file.read((char*)header, sizeof(header)) || !file.read((char*)&fileFingerprint, sizeof(fileFingerprint)) || header[0] != FILE_MAGIC)
+				return false;
+			if (fileFingerprint != computeFingerprint(objects, cameraRegion, bakeSettings) || header[3] != objects.size())
+				return false;
+
+			size_t words = (size_t)header[1] * header[2] * ((header[3] + 63) / 64);
+			std::vector<uint64_t> fileBits(words);
+			if (!file.read((char*)fileBits.data(), words * sizeof(uint64_t)))
+				return false;
+
+			region = cameraRegion;
+			settings = bakeSettings;
+			cellsX = (int)header[1];
+			cellsZ = (int)header[2];
+			objectCount = header[3];
+			wordsPerCell = (objectCount + 63) / 64;
+			bits = std::move(fileBits);
+			fingerprint = fileFingerprint;
+			lastStats = Stats();
+			return true;
+		}
+
+		bool isBaked(void) const
+		{
+			return !bits.empty();
+		}
+
+		/// <summary>
+		/// Whether the bake still matches the objects (false once any of them, or their models, have changed)
+		/// </summary>
+		bool isUpToDate(const std::vector<Object*>& objects) const
+		{
+			return isBaked() && computeFingerprint(objects, region, settings) == fingerprint;
+		}
+
+		/// <summary>
+		/// Finds the cell containing a position
+		/// </summary>
+		/// <returns>The cell, or -1 if the position is outside the baked region (nothing can be ruled out there)</returns>
+		int findCell(const glm::vec3& position) const
+		{
+			const float tolerance = 0.001f;
+			if (!isBaked() || position.x < region.min.x - tolerance || position.x > region.max.x + tolerance || position.y < region.min.y - tolerance
+				|| position.y > region.max.y + tolerance || position.z < region.min.z - tolerance || position.z > region.max.z + tolerance)
+				return -1;
+
+			int x = std::min(std::max((int)((position.x - region.min.x) / settings.cellSize), 0), cellsX - 1);
+			int z = std::min(std::max((int)((position.z - region.min.z) / settings.cellSize), 0), cellsZ - 1);
+			return z * cellsX + x;
+		}
+
+		/// <param name="object">Index in the vector the bake was made from (objects added after that are always visible)</param>
+		bool isVisible(int cell, size_t object) const
+		{
+			if (cell < 0 || object >= objectCount)
+				return true;
+			return (bits[cell * wordsPerCell + object / 64] >> (object % 64)) & 1;
+		}
+
+		/// <summary>
+		/// Expands a cell's bits into one flag per object (for FrustumCuller::cull)
+		/// </summary>
+		void getVisibleObjects(int cell, size_t objects, std::vector<unsigned char>& visible) const
+		{
+			visible.resize(objects);
+			for (size_t i = 0; i < objects; ++i)
+				visible[i] = isVisible(cell, i);
+		}
+
+		int getCellCount(void) const
+		{
+			return cellsX * cellsZ;
+		}
+
+		/// <summary>
+		/// Stats from the last bake (all zeros if the set was loaded from a file)
+		/// </summary>
+		const Stats& getLastBakeStats(void) const
+		{
+			return lastStats;
+		}
+};
+
+#endif
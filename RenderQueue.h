@@ -0,0 +1,393 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <glad/glad.h>
+#include "ShaderProgram.h"
+#include "mesh.h"
+#include "GLState.h"
+#include "GLExtensions.h"
+#include "RingBuffer.h"
+
+// one mesh draw, submitted to a RenderQueue
+struct DrawPacket {
+	const Mesh* mesh;
+	int lod;				// which of the mesh's levels of detail to draw
+	const ShaderProgram* program;
+	int objectIndex;		// entry in ObjectConstants
+};
+
+/// <summary>
+/// Collects draw packets from every object, sorts them by a packed 64-bit key, and draws them in that order so that
+/// objects sharing a program, material, or mesh are drawn together (with opaque geometry front to back for early-Z).
+///
+/// Key layout, most significant bits first:
+///   pass (4) | program (8) | material (16) | mesh (16) | depth (20)
+/// Programs are keyed by the order the queue first saw them in (a handful of them, so they never collide), materials by their
+/// MaterialTable entry, and meshes by their place in the GeometryBuffer, so a collision only costs an extra state change.
+///
+/// Packets for the same mesh (at the same level of detail) with the same program end up next to each other after sorting (objects made from the same
+/// file share their meshes), so each such run is drawn with one glDrawElementsInstanced call. The runs' object and material
+/// indices are written together into the frame's RingBuffer, which the vertex shader reads as per-instance attributes.
+///
+/// When the context has glMultiDrawElementsIndirect (GL 4.3), every run becomes a command in an indirect buffer instead
+/// in the ring (its base instance selects its indices), and each stretch of runs sharing a program is one API call: materials
+/// are looked up in the MaterialTable by the per-instance index, so they don't split the stretch.
+///
+/// executeDepth() draws the same batches (and indirect commands) beforehand with one depth-only program, for a depth pre-pass.
+/// </summary>
+class RenderQueue
+{
+	public:
+		enum Pass {
+			OPAQUE_PASS = 0,
+			TRANSPARENT_PASS = 1		// sorted back to front
+		};
+
+		struct Stats {
+			unsigned int packets = 0;
+			unsigned int programChanges = 0;
+			unsigned int materialChanges = 0;
+			unsigned int drawCalls = 0;			// draw API calls (a multi-draw counts once)
+			unsigned int instancedDraws = 0;	// draw calls that drew more than one object
+			unsigned int indirectCommands = 0;	// commands issued through multi-draw indirect
+			unsigned int depthDrawCalls = 0;	// draw API calls made by executeDepth()
+		};
+
+		bool instancing = true;		// when false, every packet is drawn with its own draw call
+		bool indirect = true;		// use multi-draw indirect when the context supports it
+
+	private:
+		static const int DEPTH_BITS = 20;
+		static const int MESH_BITS = 16;
+		static const int MATERIAL_BITS = 16;
+		static const int PROGRAM_BITS = 8;
+
+		// consecutive sorted packets that are drawn with one call
+		struct Batch {
+			const DrawPacket* packet;		// first packet (they all share its program and mesh)
+			size_t firstInstance;			// into instances
+			int count;
+		};
+
+		std::vector<DrawPacket> packets;
+		std::vector<Batch> batches;
+		std::vector<InstanceIndices> instances;		// object and material index of every packet, in batch order
+		unsigned int instanceBuffer;	// the ring's buffer this frame's instances were written to
+		size_t instanceOffset;			// where in it, in InstanceIndices
+		RingBuffer::Allocation commands;	// this frame's indirect commands, one per batch (when drawing with multi-draw indirect)
+		bool multiDraw;
+		bool prepared;					// whether batches, instances, and commands are up to date with the sorted packets
+		std::vector<uint64_t> keys, keysScratch;		// (key, packet index) are sorted together: the index sits in a separate array
+		std::vector<uint32_t> order, orderScratch;
+		std::vector<unsigned int> programIDs;		// GL names of the programs submitted so far; a program's place here is its key
+		float nearPlane, farPlane;
+		Stats stats;		// this frame's, until execute() finishes
+		Stats lastStats;
+
+		uint32_t quantizeDepth(float depth) const
+		{
+			float t = (depth - nearPlane) / (farPlane - nearPlane);
+			t = std::min(std::max(t, 0.0f), 1.0f);
+			return uint32_t(t * float((1u << DEPTH_BITS) - 1));
+		}
+
+		static uint64_t materialKey(const Material& material)
+		{
+			// a switch only sets an attribute now, but keeping a material's draws together still keeps its textures in cache
+			return uint64_t(material.index) & ((1u << MATERIAL_BITS) - 1);
+		}
+
+		/// <summary>
+		/// A small number per program, handed out in the order they're first submitted (GL names are too far apart to fit the key)
+		/// </summary>
+		uint64_t programKey(const ShaderProgram& program)
+		{
+			for (size_t i = 0; i < programIDs.size(); ++i) {
+				if (programIDs[i] == program.ID)
+					return i;
+			}
+			programIDs.push_back(program.ID);
+			return (programIDs.size() - 1) & ((1u << PROGRAM_BITS) - 1);
+		}
+
+		static uint64_t meshKey(const Mesh& mesh, int lod)
+		{
+			// every live mesh (and each of its levels of detail) starts at a different index in the GeometryBuffer
+			uint32_t hash = uint32_t(mesh.getGeometry(lod).firstIndex) * 0x9E3779B1u;
+			return (hash >> 16) & ((1u << MESH_BITS) - 1);
+		}
+
+		/// <summary>
+		/// LSD radix sort (8 bits per pass) of keys, carrying the packet order along; passes where every key has the same byte are skipped
+		/// </summary>
+		void radixSort(void)
+		{
+			size_t n = keys.size();
+			keysScratch.resize(n);
+			orderScratch.resize(n);
+
+			for (int shift = 0; shift < 64; shift += 8) {
+				size_t counts[256] = {};
+				for (size_t i = 0; i < n; ++i)
+					++counts[(keys[i] >> shift) & 0xFF];
+				if (counts[(keys[0] >> shift) & 0xFF] == n)
+					continue;		// all keys share this byte; order is unchanged
+
+				size_t offsets[256];
+				size_t sum = 0;
+				for (int b = 0; b < 256; ++b) {
+					offsets[b] = sum;
+					sum += counts[b];
+				}
+				for (size_t i = 0; i < n; ++i) {
+					size_t dst = offsets[(keys[i] >> shift) & 0xFF]++;
+					keysScratch[dst] = keys[i];
+					orderScratch[dst] = order[i];
+				}
+				keys.swap(keysScratch);
+				order.swap(orderScratch);
+			}
+		}
+
+		/// <summary>
+		/// Switches program and material for a packet, if they differ from the current ones
+		/// </summary>
+		static void applyState(const DrawPacket& packet, const ShaderProgram*& program, const Material*& material, Stats& stats)
+		{
+			if (packet.program != program) {
+				program = packet.program;
+				program->use();
+				++stats.programChanges;
+			}
+			if (!material || packet.mesh->material.index != material->index) {
+				material = &packet.mesh->material;
+				material->apply();
+				++stats.materialChanges;
+			}
+		}
+
+		/// <summary>
+		/// One draw call per batch (GL 3.3)
+		/// </summary>
+		void executeDirect(void)
+		{
+			const ShaderProgram* program = nullptr;
+			const Material* material = nullptr;
+
+			for (const Batch& batch : batches) {
+				const DrawPacket& packet = *batch.packet;
+				applyState(packet, program, material, stats);
+
+				if (batch.count == 1) {
+					glVertexAttribI1i(OBJECT_INDEX_ATTRIB, packet.objectIndex);
+					packet.mesh->DrawGeometry(packet.lod);
+				}
+				else {
+					packet.mesh->DrawInstanced(instanceBuffer, instanceOffset + batch.firstInstance, batch.count, packet.lod);
+					++stats.instancedDraws;
+				}
+				++stats.drawCalls;
+			}
+		}
+
+		/// <summary>
+		/// Draws each stretch of batches that share a program with one glMultiDrawElementsIndirect call (GL 4.3)
+		/// </summary>
+		void executeIndirect(void)
+		{
+			if (batches.empty())
+				return;
+
+			for (const Batch& batch : batches) {
+				if (batch.count > 1)
+					++stats.instancedDraws;
+			}
+			GLState::get().bindBuffer(GL_DRAW_INDIRECT_BUFFER, commands.buffer);
+			GeometryBuffer::get().bindInstanceBuffer(instanceBuffer, 0);
+
+			const ShaderProgram* program = nullptr;
+			const Material* material = nullptr;
+
+			size_t first = 0;
+			while (first < batches.size()) {
+				applyState(*batches[first].packet, program, material, stats);
+
+				size_t last = first + 1;
+				while (last < batches.size() && batches[last].packet->program == program)
+					++last;
+
+				GLExtensions::get().multiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)(commands.offset + first * sizeof(DrawElementsIndirectCommand)), (GLsizei)(last - first), 0);
+				++stats.drawCalls;
+				stats.indirectCommands += (unsigned int)(last - first);
+				first = last;
+			}
+		}
+
+		/// <summary>
+		/// Groups the sorted packets into batches, and writes their instance indices (and indirect commands) into the frame's ring,
+		/// once for however many passes draw them
+		/// </summary>
+		void prepare(RingBuffer& ring)
+		{
+			if (prepared)
+				return;
+			prepared = true;
+
+			batches.clear();
+			instances.clear();
+			for (uint32_t index : order) {
+				const DrawPacket& packet = packets[index];
+				if (instancing && !batches.empty()) {
+					Batch& last = batches.back();
+					if (last.packet->mesh == packet.mesh && last.packet->lod == packet.lod && last.packet->program == packet.program) {
+						++last.count;
+						instances.push_back({ packet.objectIndex, packet.mesh->material.index });
+						continue;
+					}
+				}
+				batches.push_back({ &packet, instances.size(), 1 });
+				instances.push_back({ packet.objectIndex, packet.mesh->material.index });
+			}
+
+			multiDraw = indirect && GLExtensions::get().hasMultiDrawIndirect();
+
+			// every instanced draw reads its indices from its own range of one allocation, written once per frame
+			// (indirect draws always read them from there, even for a single instance)
+			if (batches.size() < instances.size() || (multiDraw && !instances.empty())) {
+				RingBuffer::Allocation allocation = ring.allocate(instances.size() * sizeof(InstanceIndices), sizeof(InstanceIndices));
+				std::memcpy(allocation.data, instances.data(), instances.size() * sizeof(InstanceIndices));
+				ring.commit(allocation);
+				instanceBuffer = allocation.buffer;
+				instanceOffset = allocation.offset / sizeof(InstanceIndices);
+			}
+
+			// every batch as an indirect command
+			if (multiDraw && !batches.empty()) {
+				commands = ring.allocate(batches.size() * sizeof(DrawElementsIndirectCommand), sizeof(unsigned int));
+				DrawElementsIndirectCommand* command = (DrawElementsIndirectCommand*)commands.data;
+				for (size_t i = 0; i < batches.size(); ++i) {
+					const GeometryRange& geometry = batches[i].packet->mesh->getGeometry(batches[i].packet->lod);
+					command[i].count = (unsigned int)geometry.indexCount;
+					command[i].instanceCount = (unsigned int)batches[i].count;
+					command[i].firstIndex = (unsigned int)geometry.firstIndex;
+					command[i].baseVertex = (int)geometry.baseVertex;
+					command[i].baseInstance = (unsigned int)(instanceOffset + batches[i].firstInstance);		// offsets the per-instance index attributes
+				}
+				ring.commit(commands);
+			}
+		}
+
+	public:
+		RenderQueue() : instanceBuffer{ 0 }, instanceOffset{ 0 }, multiDraw{ false }, prepared{ false }, nearPlane{ 0.1f }, farPlane{ 100.0f }
+		{
+		}
+
+		/// <summary>
+		/// Range used to quantize depths into the key (should match the projection's near and far planes)
+		/// </summary>
+		void setDepthRange(float nearDepth, float farDepth)
+		{
+			nearPlane = nearDepth;
+			farPlane = farDepth;
+		}
+
+		void clear(void)
+		{
+			packets.clear();
+			keys.clear();
+			order.clear();
+			prepared = false;
+			stats = Stats();
+			if (programIDs.size() >= (1u << PROGRAM_BITS))
+				programIDs.clear();		// hot reloads keep making new programs, so start over (between frames, where keys don't have to agree)
+		}
+
+		/// <param name="depth">Distance from the camera</param>
+		/// <param name="lod">Which of the mesh's levels of detail to draw</param>
+		void submit(Pass pass, const ShaderProgram& program, const Mesh& mesh, int objectIndex, float depth, int lod = 0)
+		{
+			uint32_t depthBits = quantizeDepth(depth);
+			if (pass == TRANSPARENT_PASS)
+				depthBits = ((1u << DEPTH_BITS) - 1) - depthBits;		// back to front
+
+			uint64_t key = uint64_t(pass) << (PROGRAM_BITS + MATERIAL_BITS + MESH_BITS + DEPTH_BITS);
+			key |= programKey(program) << (MATERIAL_BITS + MESH_BITS + DEPTH_BITS);
+			key |= materialKey(mesh.material) << (MESH_BITS + DEPTH_BITS);
+			key |= meshKey(mesh, lod) << DEPTH_BITS;
+			key |= depthBits;
+
+			order.push_back((uint32_t)packets.size());
+			keys.push_back(key);
+			packets.push_back({ &mesh, lod, &program, objectIndex });
+		}
+
+		void sort(void)
+		{
+			if (!keys.empty())
+				radixSort();
+			prepared = false;
+		}
+
+		/// <summary>
+		/// Draws every packet's geometry with one program and no material changes, for a depth pre-pass: sets nothing but the program,
+		/// so select GeometryBuffer::POSITION_STREAM and turn color writes off around it. Call after sort(), before execute().
+		/// </summary>
+		/// <param name="ring">The frame's ring, for the instance indices and indirect commands (execute() reuses them)</param>
+		/// <param name="depthProgram">Writes nothing but depth (DepthVertexShader.vert and DepthFragmentShader.frag)</param>
+		void executeDepth(RingBuffer& ring, const ShaderProgram& depthProgram)
+		{
+			prepare(ring);
+			if (batches.empty())
+				return;
+			depthProgram.use();
+
+			if (multiDraw) {
+				// nothing changes between batches, so the whole queue is one call
+				GLState::get().bindBuffer(GL_DRAW_INDIRECT_BUFFER, commands.buffer);
+				GeometryBuffer::get().bindInstanceBuffer(instanceBuffer, 0);
+				GLExtensions::get().multiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)commands.offset, (GLsizei)batches.size(), 0);
+				++stats.depthDrawCalls;
+				return;
+			}
+
+			for (const Batch& batch : batches) {
+				const DrawPacket& packet = *batch.packet;
+				if (batch.count == 1) {
+					glVertexAttribI1i(OBJECT_INDEX_ATTRIB, packet.objectIndex);
+					packet.mesh->DrawGeometry(packet.lod);
+				}
+				else
+					packet.mesh->DrawInstanced(instanceBuffer, instanceOffset + batch.firstInstance, batch.count, packet.lod);
+				++stats.depthDrawCalls;
+			}
+		}
+
+		/// <summary>
+		/// Draws every packet in sorted order, only changing program and material when they differ from the previous packet,
+		/// and drawing runs of the same mesh instanced (through multi-draw indirect when available)
+		/// </summary>
+		/// <param name="ring">The frame's ring, for the instance indices and indirect commands</param>
+		void execute(RingBuffer& ring)
+		{
+			prepare(ring);
+			stats.packets = (unsigned int)packets.size();
+
+			if (multiDraw)
+				executeIndirect();
+			else
+				executeDirect();
+
+			lastStats = stats;
+		}
+
+		const Stats& getLastStats(void) const
+		{
+			return lastStats;
+		}
+};
+
+#endif
@@ -0,0 +1,231 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <vector>
+#include <glad/glad.h>
+#include "GLState.h"
+#include "GLExtensions.h"
+
+/// <summary>
+/// One GL buffer that all per-frame dynamic data (object matrices, instance data, indirect commands, uniform blocks) is
+/// bump-allocated from. It's split into FRAMES regions used in turn, and a fence is placed after each frame's commands;
+/// a region is only written again once the fence of the frame that last used it has signaled, so the CPU never overwrites
+/// data the GPU is still reading and never stalls inside the driver (as glBufferSubData into a buffer in use can).
+///
+/// With GL 4.4 (or ARB_buffer_storage) the buffer is mapped once, persistently and coherently, and an allocation is just
+/// a pointer into it. On GL 3.3 each allocation is mapped with glMapBufferRange(GL_MAP_UNSYNCHRONIZED_BIT) instead and
+/// unmapped by commit() (the fences are what make skipping the driver's synchronization safe).
+///
+/// There is one ring for the whole frame: call beginFrame() before the first allocation and endFrame() after the last draw.
+/// </summary>
+class RingBuffer
+{
+	public:
+		static const int FRAMES = 3;		// regions: the CPU can be writing one frame while the GPU is still reading the two before it
+
+		struct Allocation {
+			unsigned int buffer = 0;		// bind this (it changes when the ring grows)
+			size_t offset = 0;				// from the start of the buffer, in bytes
+			size_t size = 0;
+			void* data = nullptr;			// write the data here, then commit()
+		};
+
+		struct Stats {
+			unsigned int allocations = 0;
+			size_t bytesAllocated = 0;
+			unsigned int fenceWaits = 0;		// frames that had to wait for the GPU to finish with their region
+			float fenceWaitMilliseconds = 0.0f;
+			unsigned int grows = 0;				// times the buffer was too small and was replaced with a bigger one
+		};
+
+	private:
+		unsigned int buffer;
+		size_t regionSize;					// in bytes
+		int region;							// the one being written this frame
+		size_t offset;						// first free byte in the region
+		unsigned char* mapped;				// the whole buffer, if it's persistently mapped
+		bool persistent;
+		GLsync fences[FRAMES];
+		std::vector<unsigned int> retired;	// buffers replaced this frame, still used by the frame's draws
+		size_t uniformAlignment;
+		Stats frameStats;
+		Stats lastFrameStats;
+
+		void create(size_t bytesPerFrame)
+		{
+			if (buffer != 0)
+				retired.push_back(buffer);		// deleted at the end of the frame (the frame's draws may still refer to it by name)
+
+			regionSize = bytesPerFrame;
+			glGenBuffers(1, &buffer);
+			GLState::get().bindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+			if (persistent) {
+				const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+				GLExtensions::get().bufferStorage(GL_COPY_WRITE_BUFFER, regionSize * FRAMES, NULL, flags);
+				mapped = (unsigned char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, regionSize * FRAMES, flags);
+				if (!mapped)
+					std::cout << "ERROR: Couldn't map the ring buffer" << std::endl;
+			}
+			else
+				glBufferData(GL_COPY_WRITE_BUFFER, regionSize * FRAMES, NULL, GL_STREAM_DRAW);
+
+			// a new buffer hasn't been used by the GPU at all
+			for (GLsync& fence : fences) {
+				if (fence) {
+					glDeleteSync(fence);
+					fence = 0;
+				}
+			}
+			offset = 0;
+		}
+
+		void release(unsigned int old)
+		{
+			if (persistent) {
+				GLState::get().bindBuffer(GL_COPY_WRITE_BUFFER, old);
+				glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+			}
+			GLState::get().deleteBuffer(old);
+		}
+
+	public:
+		/// <param name="bytesPerFrame">Starting size of each region (the ring grows if a frame needs more)</param>
+		/// <param name="persistentMapping">Use a persistently mapped buffer when the context supports it (false forces the GL 3.3 path)</param>
+		RingBuffer(size_t bytesPerFrame = 1 << 20, bool persistentMapping = true) : buffer{ 0 }, regionSize{ 0 }, region{ 0 }, offset{ 0 }, mapped{ nullptr }
+		{
+			persistent = persistentMapping && GLExtensions::get().hasBufferStorage();
+			for (GLsync& fence : fences)
+				fence = 0;
+
+			GLint alignment = 256;
+			glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+			uniformAlignment = (size_t)alignment;
+
+			create(bytesPerFrame);
+		}
+
+		/// <summary>
+		/// Moves on to the next region, first waiting for the GPU to finish the frame that last used it
+		/// </summary>
+		void beginFrame(void)
+		{
+			lastFrameStats = frameStats;
+			frameStats = Stats();
+
+			region = (region + 1) % FRAMES;
+			offset = 0;
+
+			GLsync& fence = fences[region];
+			if (!fence)
+				return;
+			if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+				auto start = std::chrono::steady_clock::now();
+				GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);		// 1 s, in ns
+				while (result == GL_TIMEOUT_EXPIRED)
+					result = glClientWaitSync(fence, 0, 1000000000);
+				if (result == GL_WAIT_FAILED)
+					std::cout << "ERROR: Waiting on a ring buffer fence failed" << std::endl;
+
+				++frameStats.fenceWaits;
+				frameStats.fenceWaitMilliseconds += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+			}
+			glDeleteSync(fence);
+			fence = 0;
+		}
+
+		/// <summary>
+		/// Places the fence that protects this frame's region (call after the frame's last draw that reads from the ring)
+		/// </summary>
+		void endFrame(void)
+		{
+			fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+			for (unsigned int old : retired)
+				release(old);
+			retired.clear();
+		}
+
+		/// <summary>
+		/// Reserves space in this frame's region. The data is read by the GPU this frame only, so it has to be written again every frame.
+		/// NOTE: On GL 3.3 the space stays mapped until commit(), and only one allocation can be mapped at a time
+		/// </summary>
+		/// <param name="alignment">The offset (from the start of the buffer) is a multiple of this; it doesn't have to be a power of two</param>
+		Allocation allocate(size_t bytes, size_t alignment = 16)
+		{
+			Allocation allocation;
+			if (bytes == 0)
+				return allocation;
+
+			size_t base = region * regionSize;
+			size_t start = (base + offset + alignment - 1) / alignment * alignment - base;
+			if (start + bytes > regionSize) {
+				// the frame needs more than a region: switch to a bigger buffer (the data already written this frame stays in the old one)
+				size_t needed = bytes + alignment;
+				create(std::max(regionSize * 2, needed * 2));
+				++frameStats.grows;
+
+				base = region * regionSize;
+				start = (base + alignment - 1) / alignment * alignment - base;
+			}
+			offset = start + bytes;
+
+			allocation.buffer = buffer;
+			allocation.offset = base + start;
+			allocation.size = bytes;
+			if (persistent)
+				allocation.data = mapped + allocation.offset;
+			else {
+				GLState::get().bindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+				allocation.data = glMapBufferRange(GL_COPY_WRITE_BUFFER, allocation.offset, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+			}
+
+			++frameStats.allocations;
+			frameStats.bytesAllocated += bytes;
+			return allocation;
+		}
+
+		/// <summary>
+		/// Call once an allocation's data is written (and before drawing with it)
+		/// </summary>
+		void commit(const Allocation& allocation)
+		{
+			if (persistent || !allocation.data)
+				return;		// coherent mapping: the writes are already visible to the GPU
+			GLState::get().bindBuffer(GL_COPY_WRITE_BUFFER, allocation.buffer);
+			glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+		}
+
+		/// <summary>
+		/// Alignment that allocations bound with glBindBufferRange(GL_UNIFORM_BUFFER, ...) need
+		/// </summary>
+		size_t getUniformAlignment(void) const
+		{
+			return uniformAlignment;
+		}
+
+		/// <summary>
+		/// Size of the whole buffer (all regions), in bytes
+		/// </summary>
+		size_t getSize(void) const
+		{
+			return regionSize * FRAMES;
+		}
+
+		bool isPersistent(void) const
+		{
+			return persistent;
+		}
+
+		/// <summary>
+		/// Allocations and fence waits of the last whole frame
+		/// </summary>
+		const Stats& getLastFrameStats(void) const
+		{
+			return lastFrameStats;
+		}
+};
+
+#endif
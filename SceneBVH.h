@@ -0,0 +1,662 @@
+#ifndef SCENE_BVH_H
+#define SCENE_BVH_H
+
+#include <cmath>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <glm/glm/glm.hpp>
+#include "Bounds.h"
+
+/// <summary>
+/// Bounding volume hierarchy over world-space boxes (one leaf per item, e.g. per Object), for culling and spatial queries
+/// that cost roughly log(n) instead of n.
+/// build() makes a good tree from scratch with a binned surface area heuristic (large subtrees are built on separate threads);
+/// after that, items can be inserted, removed, and moved without a rebuild.
+/// Items are identified by the ints passed to build() or insert() (their index in the caller's own array).
+/// Queries only read the tree, so several threads can run them at once (as long as nothing modifies it meanwhile), except
+/// queryFrustum(), which walks with a stack kept in the tree so the per-frame cull doesn't allocate. The other queries take
+/// an optional stack from the caller, for callers that query often from several threads.
+/// </summary>
+class SceneBVH
+{
+	public:
+		static constexpr int NULL_NODE = -1;		// constexpr, so it can be passed by reference (e.g. to vector::assign)
+
+		struct Stats {
+			unsigned int nodesVisited = 0;		// by queries since the last resetStats()
+		};
+
+		struct Node {
+			AABB bounds;
+			int parent = NULL_NODE;
+			int left = NULL_NODE;		// both children are NULL_NODE for a leaf
+			int right = NULL_NODE;
+			int item = -1;				// leaves only
+
+			bool isLeaf(void) const
+			{
+				return left == NULL_NODE;
+			}
+		};
+
+	private:
+		static const int NUM_BINS = 16;
+		static const size_t PARALLEL_THRESHOLD = 4096;		// subtrees with fewer items than this are built on the current thread
+
+		std::vector<Node> nodes;
+		std::vector<int> freeNodes;
+		std::vector<int> itemLeaves;	// item -> its leaf node (NULL_NODE if it isn't in the tree)
+		int root;
+		mutable std::atomic<unsigned int> nodesVisited;		// counted locally by each query and added at the end, so queries can run in parallel
+		mutable std::vector<std::pair<int, int>> frustumStack;		// queryFrustum()'s (node, planes still to test as a bit mask)
+
+		static float surfaceArea(const AABB& box)
+		{
+			if (box.empty())
+				return 0.0f;
+			glm::vec3 size = box.max - box.min;
+			return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+		}
+
+		static AABB combine(const AABB& a, const AABB& b)
+		{
+			AABB result = a;
+			result.expand(b);
+			return result;
+		}
+
+		static bool overlaps(const AABB& a, const AABB& b)
+		{
+			return a.min.x <= b.max.x && a.max.x >= b.min.x && a.min.y <= b.max.y && a.max.y >= b.min.y && a.min.z <= b.max.z && a.max.z >= b.min.z;
+		}
+
+		static bool encloses(const AABB& outer, const AABB& inner)
+		{
+			return outer.min.x <= inner.min.x && outer.min.y <= inner.min.y && outer.min.z <= inner.min.z
+				&& outer.max.x >= inner.max.x && outer.max.y >= inner.max.y && outer.max.z >= inner.max.z;
+		}
+
+		/// <summary>
+		/// Slab test; returns the distance along the ray where it enters the box, or INFINITY if it misses
+		/// </summary>
+		static float rayDistance(const AABB& box, const glm::vec3& origin, const glm::vec3& inverseDirection, float maxDistance)
+		{
+			glm::vec3 t0 = (box.min - origin) * inverseDirection;
+			glm::vec3 t1 = (box.max - origin) * inverseDirection;
+			glm::vec3 tNear = glm::min(t0, t1), tFar = glm::max(t0, t1);
+			float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+			float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxDistance));
+			return enter <= exit ? enter : INFINITY;
+		}
+
+		int allocateNode(void)
+		{
+			if (!freeNodes.empty()) {
+				int node = freeNodes.back();
+				freeNodes.pop_back();
+				nodes[node] = Node();
+				return node;
+			}
+			nodes.push_back(Node());
+			return (int)nodes.size() - 1;
+		}
+
+		void freeNode(int node)
+		{
+			nodes[node] = Node();
+			freeNodes.push_back(node);
+		}
+
+		/// <summary>
+		/// Recomputes the bounds of a node and every node above it
+		/// </summary>
+		void refitUpwards(int node)
+		{
+			while (node != NULL_NODE) {
+				Node& n = nodes[node];
+				n.bounds = combine(nodes[n.left].bounds, nodes[n.right].bounds);
+				node = n.parent;
+			}
+		}
+
+		/// <summary>
+		/// Builds the subtree for items[0, count) into nodes[node, node + 2 * count - 1), in depth-first order
+		/// (the left child of a node is the next node, and the right child follows the whole left subtree,
+		/// so each subtree's nodes are known in advance and subtrees can be built in parallel)
+		/// </summary>
+		void buildRange(int node, int parent, int* items, size_t count, const AABB* boxes, const glm::vec3* centroids, int threadDepth)
+		{
+			Node& n = nodes[node];
+			n.parent = parent;
+
+			if (count == 1) {
+				n.item = items[0];
+				n.bounds = boxes[items[0]];
+				itemLeaves[items[0]] = node;
+				return;
+			}
+
+			AABB centroidBounds;
+			for (size_t i = 0; i < count; ++i)
+				centroidBounds.expand(centroids[items[i]]);
+
+			// bin the centroids along each axis and find the cheapest split: cost = area(left) * count(left) + area(right) * count(right)
+			int bestAxis = -1, bestSplit = 0;
+			float bestCost = INFINITY;
+			for (int axis = 0; axis < 3; ++axis) {
+				float minC = centroidBounds.min[axis], extent = centroidBounds.max[axis] - minC;
+				if (extent <= 0.0f)
+					continue;
+				float scale = NUM_BINS / extent;
+
+				AABB binBounds[NUM_BINS];
+				size_t binCounts[NUM_BINS] = {};
+				for (size_t i = 0; i < count; ++i) {
+					int bin = std::min(int((centroids[items[i]][axis] - minC) * scale), NUM_BINS - 1);
+					++binCounts[bin];
+					binBounds[bin].expand(boxes[items[i]]);
+				}
+
+				// sweep from the right, then from the left
+				float rightCost[NUM_BINS];
+				AABB accumulated;
+				size_t accumulatedCount = 0;
+				for (int bin = NUM_BINS - 1; bin > 0; --bin) {
+					accumulated.expand(binBounds[bin]);
+					accumulatedCount += binCounts[bin];
+					rightCost[bin] = surfaceArea(accumulated) * accumulatedCount;
+				}
+				accumulated = AABB();
+				accumulatedCount = 0;
+				for (int bin = 0; bin < NUM_BINS - 1; ++bin) {
+					accumulated.expand(binBounds[bin]);
+					accumulatedCount += binCounts[bin];
+					float cost = surfaceArea(accumulated) * accumulatedCount + rightCost[bin + 1];
+					if (accumulatedCount > 0 && accumulatedCount < count && cost < bestCost) {
+						bestCost = cost;
+						bestAxis = axis;
+						bestSplit = bin;
+					}
+				}
+			}
+
+			size_t leftCount;
+			if (bestAxis < 0)
+				leftCount = count / 2;		// every centroid is in the same place; any split is as good as another
+			else {
+				float minC = centroidBounds.min[bestAxis];
+				float scale = NUM_BINS / (centroidBounds.max[bestAxis] - minC);
+				int* middle = std::partition(items, items + count, [&](int item) {
+					return std::min(int((centroids[item][bestAxis] - minC) * scale), NUM_BINS - 1) <= bestSplit;
+				});
+				leftCount = size_t(middle - items);
+			}
+
+			int leftNode = node + 1;
+			int rightNode = node + 2 * (int)leftCount;
+			n.left = leftNode;
+			n.right = rightNode;
+
+			if (threadDepth > 0 && count >= PARALLEL_THRESHOLD) {
+				std::thread leftThread(&SceneBVH::buildRange, this, leftNode, node, items, leftCount, boxes, centroids, threadDepth - 1);
+				buildRange(rightNode, node, items + leftCount, count - leftCount, boxes, centroids, threadDepth - 1);
+				leftThread.join();
+			}
+			else {
+				buildRange(leftNode, node, items, leftCount, boxes, centroids, 0);
+				buildRange(rightNode, node, items + leftCount, count - leftCount, boxes, centroids, 0);
+			}
+
+			nodes[node].bounds = combine(nodes[leftNode].bounds, nodes[rightNode].bounds);
+		}
+
+		/// <summary>
+		/// Finds the node that a new leaf should become the sibling of, walking down towards the cheapest place by surface area
+		/// </summary>
+		int findSibling(const AABB& box) const
+		{
+			int node = root;
+			while (!nodes[node].isLeaf()) {
+				const Node& n = nodes[node];
+				float area = surfaceArea(n.bounds);
+				float combinedArea = surfaceArea(combine(n.bounds, box));
+
+				float cost = 2.0f * combinedArea;					// new parent here
+				float inheritance = 2.0f * (combinedArea - area);	// every node below here grows by at least this much
+
+				float childCost[2];
+				int children[2] = { n.left, n.right };
+				for (int i = 0; i < 2; ++i) {
+					const Node& child = nodes[children[i]];
+					float grown = surfaceArea(combine(child.bounds, box));
+					childCost[i] = (child.isLeaf() ? grown : grown - surfaceArea(child.bounds)) + inheritance;
+				}
+
+				if (cost < childCost[0] && cost < childCost[1])
+					break;
+				node = childCost[0] < childCost[1] ? n.left : n.right;
+			}
+			return node;
+		}
+
+		void insertLeaf(int leaf)
+		{
+			if (root == NULL_NODE) {
+				root = leaf;
+				nodes[leaf].parent = NULL_NODE;
+				return;
+			}
+
+			int sibling = findSibling(nodes[leaf].bounds);
+			int oldParent = nodes[sibling].parent;
+			int newParent = allocateNode();		// may reallocate nodes, so no references are held across it
+
+			nodes[newParent].parent = oldParent;
+			nodes[newParent].left = sibling;
+			nodes[newParent].right = leaf;
+			nodes[sibling].parent = newParent;
+			nodes[leaf].parent = newParent;
+
+			if (oldParent == NULL_NODE)
+				root = newParent;
+			else if (nodes[oldParent].left == sibling)
+				nodes[oldParent].left = newParent;
+			else
+				nodes[oldParent].right = newParent;
+
+			refitUpwards(newParent);
+		}
+
+		void removeLeaf(int leaf)
+		{
+			if (leaf == root) {
+				root = NULL_NODE;
+				return;
+			}
+
+			int parent = nodes[leaf].parent;
+			int grandparent = nodes[parent].parent;
+			int sibling = nodes[parent].left == leaf ? nodes[parent].right : nodes[parent].left;
+
+			// the sibling takes the parent's place
+			nodes[sibling].parent = grandparent;
+			if (grandparent == NULL_NODE)
+				root = sibling;
+			else {
+				if (nodes[grandparent].left == parent)
+					nodes[grandparent].left = sibling;
+				else
+					nodes[grandparent].right = sibling;
+				refitUpwards(grandparent);
+			}
+			freeNode(parent);
+		}
+
+	public:
+		SceneBVH() : root{ NULL_NODE }, nodesVisited{ 0 } {}
+
+		/// <summary>
+		/// Replaces the tree with one built from scratch (item i has bounds boxes[i])
+		/// </summary>
+		void build(const std::vector<AABB>& boxes)
+		{
+			size_t count = boxes.size();
+			nodes.assign(count > 0 ? 2 * count - 1 : 0, Node());
+			freeNodes.clear();
+			itemLeaves.assign(count, NULL_NODE);
+			root = count > 0 ? 0 : NULL_NODE;
+			if (count == 0)
+				return;
+
+			std::vector<int> items(count);
+			std::vector<glm::vec3> centroids(count);
+			for (size_t i = 0; i < count; ++i) {
+				items[i] = (int)i;
+				centroids[i] = boxes[i].empty() ? glm::vec3(0.0f) : boxes[i].center();
+			}
+
+			// one level of splitting per doubling of the thread count
+			int threadDepth = 0;
+			for (unsigned int threads = std::thread::hardware_concurrency(); threads > 1; threads /= 2)
+				++threadDepth;
+
+			buildRange(0, NULL_NODE, items.data(), count, boxes.data(), centroids.data(), threadDepth);
+		}
+
+		/// <summary>
+		/// Adds an item (ids don't have to be contiguous, but the lookup table grows to the largest one)
+		/// </summary>
+		void insert(int item, const AABB& box)
+		{
+			if (item >= (int)itemLeaves.size())
+				itemLeaves.resize(item + 1, NULL_NODE);
+			if (itemLeaves[item] != NULL_NODE)
+				remove(item);
+
+			int leaf = allocateNode();
+			nodes[leaf].bounds = box;
+			nodes[leaf].item = item;
+			itemLeaves[item] = leaf;
+			insertLeaf(leaf);
+		}
+
+		void remove(int item)
+		{
+			if (item < 0 || item >= (int)itemLeaves.size() || itemLeaves[item] == NULL_NODE)
+				return;
+
+			int leaf = itemLeaves[item];
+			removeLeaf(leaf);
+			freeNode(leaf);
+			itemLeaves[item] = NULL_NODE;
+		}
+
+		/// <summary>
+		/// Moves an item. Small moves just grow or shrink the boxes above it (refit); if the new box doesn't overlap
+		/// the old one, the item is reinserted where it fits best instead, so the tree doesn't degrade.
+		/// </summary>
+		void update(int item, const AABB& box)
+		{
+			if (item < 0 || item >= (int)itemLeaves.size() || itemLeaves[item] == NULL_NODE) {
+				insert(item, box);
+				return;
+			}
+
+			int leaf = itemLeaves[item];
+			if (overlaps(nodes[leaf].bounds, box) || box.empty() || nodes[leaf].bounds.empty()) {
+				bool changed = !encloses(box, nodes[leaf].bounds) || !encloses(nodes[leaf].bounds, box);
+				nodes[leaf].bounds = box;
+				if (changed && nodes[leaf].parent != NULL_NODE)
+					refitUpwards(nodes[leaf].parent);
+			}
+			else {
+				removeLeaf(leaf);
+				nodes[leaf].bounds = box;
+				nodes[leaf].parent = NULL_NODE;
+				insertLeaf(leaf);
+			}
+		}
+
+		/// <summary>
+		/// Appends every item whose box is at least partly inside the frustum.
+		/// Subtrees entirely inside a plane stop testing against it, and subtrees inside all six are taken without any tests.
+		/// Only one thread at a time may run it.
+		/// </summary>
+		void queryFrustum(const Frustum& frustum, std::vector<int>& items) const
+		{
+			if (root == NULL_NODE)
+				return;
+
+			unsigned int visited = 0;
+			std::vector<std::pair<int, int>>& stack = frustumStack;
+			stack.clear();
+			stack.push_back({ root, 0x3F });
+			while (!stack.empty()) {
+				int node = stack.back().first;
+				int mask = stack.back().second;
+				stack.pop_back();
+				++visited;
+
+				const Node& n = nodes[node];
+				if (n.bounds.empty())
+					continue;
+
+				if (mask != 0) {
+					glm::vec3 center = n.bounds.center(), extents = n.bounds.extents();
+					bool outside = false;
+					for (int p = 0; p < 6 && !outside; ++p) {
+						if (!(mask & (1 << p)))
+							continue;
+						const glm::vec4& plane = frustum.planes[p];
+						float d = glm::dot(glm::vec3(plane), center) + plane.w;
+						float r = glm::dot(glm::abs(glm::vec3(plane)), extents);
+						if (d + r < 0.0f)
+							outside = true;
+						else if (d - r >= 0.0f)
+							mask &= ~(1 << p);		// entirely in front of this plane, and so is everything below
+					}
+					if (outside)
+						continue;
+				}
+
+				if (n.isLeaf())
+					items.push_back(n.item);
+				else {
+					stack.push_back({ n.right, mask });
+					stack.push_back({ n.left, mask });
+				}
+			}
+			nodesVisited += visited;
+		}
+
+		/// <summary>
+		/// Appends every item whose box overlaps the given box
+		/// </summary>
+		void queryAABB(const AABB& box, std::vector<int>& items) const
+		{
+			std::vector<int> stack;
+			stack.reserve(64);
+			queryAABB(box, items, stack);
+		}
+
+		/// <summary>
+		/// Appends every item whose box overlaps the given box
+		/// </summary>
+		/// <param name="stack">Scratch space for the walk, kept by the caller between queries</param>
+		void queryAABB(const AABB& box, std::vector<int>& items, std::vector<int>& stack) const
+		{
+			if (root == NULL_NODE || box.empty())
+				return;
+
+			unsigned int visited = 0;
+			stack.clear();
+			stack.push_back(root);
+			while (!stack.empty()) {
+				const Node& n = nodes[stack.back()];
+				stack.pop_back();
+				++visited;
+
+				if (n.bounds.empty() || !overlaps(n.bounds, box))
+					continue;
+				if (n.isLeaf())
+					items.push_back(n.item);
+				else {
+					stack.push_back(n.right);
+					stack.push_back(n.left);
+				}
+			}
+			nodesVisited += visited;
+		}
+
+		/// <summary>
+		/// Appends every item whose box overlaps the sphere
+		/// </summary>
+		void querySphere(const BoundingSphere& sphere, std::vector<int>& items) const
+		{
+			std::vector<int> stack;
+			stack.reserve(64);
+			querySphere(sphere, items, stack);
+		}
+
+		/// <summary>
+		/// Appends every item whose box overlaps the sphere
+		/// </summary>
+		/// <param name="stack">Scratch space for the walk, kept by the caller between queries</param>
+		void querySphere(const BoundingSphere& sphere, std::vector<int>& items, std::vector<int>& stack) const
+		{
+			if (root == NULL_NODE)
+				return;
+
+			float radiusSquared = sphere.radius * sphere.radius;
+			unsigned int visited = 0;
+			stack.clear();
+			stack.push_back(root);
+			while (!stack.empty()) {
+				const Node& n = nodes[stack.back()];
+				stack.pop_back();
+				++visited;
+
+				if (n.bounds.empty())
+					continue;
+				glm::vec3 closest = glm::clamp(sphere.center, n.bounds.min, n.bounds.max);
+				glm::vec3 offset = closest - sphere.center;
+				if (glm::dot(offset, offset) > radiusSquared)
+					continue;
+
+				if (n.isLeaf())
+					items.push_back(n.item);
+				else {
+					stack.push_back(n.right);
+					stack.push_back(n.left);
+				}
+			}
+			nodesVisited += visited;
+		}
+
+		/// <summary>
+		/// Finds the item whose box the ray enters first
+		/// </summary>
+		/// <param name="direction">Doesn't have to be normalized; distances are in multiples of its length</param>
+		/// <param name="distance">Set to the distance along the ray to the hit</param>
+		/// <returns>The item hit, or -1</returns>
+		int raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, float& distance) const
+		{
+			return raycast(origin, direction, maxDistance, distance, [](int, float boxDistance, float) { return boxDistance; });
+		}
+
+		/// <summary>
+		/// Finds the closest item that the ray hits, where hitItem(item, boxDistance, closest) decides whether the ray really hits
+		/// an item whose box it enters (e.g. by testing the item's triangles), returning the distance to the hit, or INFINITY if
+		/// the ray misses it or only hits it further away than closest
+		/// </summary>
+		/// <param name="direction">Doesn't have to be normalized; distances are in multiples of its length</param>
+		/// <param name="distance">Set to the distance along the ray to the hit</param>
+		/// <param name="anyHit">Stop at the first hit found instead of looking for the closest (enough to tell whether something is in the way)</param>
+		/// <returns>The item hit, or -1</returns>
+		template <typename HitItem>
+		int raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, float& distance, HitItem hitItem, bool anyHit = false) const
+		{
+			std::vector<std::pair<int, float>> stack;
+			stack.reserve(64);
+			return raycast(origin, direction, maxDistance, distance, hitItem, anyHit, stack);
+		}
+
+		/// <summary>
+		/// raycast() above, walking with a stack of (node, distance to its box) that the caller keeps between rays
+		/// </summary>
+		template <typename HitItem>
+		int raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, float& distance, HitItem hitItem, bool anyHit, std::vector<std::pair<int, float>>& stack) const
+		{
+			distance = maxDistance;
+			if (root == NULL_NODE)
+				return -1;
+
+			glm::vec3 inverseDirection = 1.0f / direction;
+			int hit = -1;
+			unsigned int visited = 0;
+
+			stack.clear();
+			float rootDistance = nodes[root].bounds.empty() ? INFINITY : rayDistance(nodes[root].bounds, origin, inverseDirection, distance);
+			if (rootDistance != INFINITY)
+				stack.push_back({ root, rootDistance });
+
+			while (!stack.empty()) {
+				int node = stack.back().first;
+				float nodeDistance = stack.back().second;
+				stack.pop_back();
+				++visited;
+				if (nodeDistance > distance)
+					continue;		// something closer was hit since this was pushed
+
+				const Node& n = nodes[node];
+				if (n.isLeaf()) {
+					float itemDistance = hitItem(n.item, nodeDistance, distance);
+					if (itemDistance != INFINITY && itemDistance <= distance) {
+						hit = n.item;
+						distance = itemDistance;
+						if (anyHit)
+							break;
+					}
+					continue;
+				}
+
+				// visit the nearer child first, so farther subtrees can be skipped
+				float leftDistance = nodes[n.left].bounds.empty() ? INFINITY : rayDistance(nodes[n.left].bounds, origin, inverseDirection, distance);
+				float rightDistance = nodes[n.right].bounds.empty() ? INFINITY : rayDistance(nodes[n.right].bounds, origin, inverseDirection, distance);
+				if (leftDistance < rightDistance) {
+					if (rightDistance != INFINITY)
+						stack.push_back({ n.right, rightDistance });
+					stack.push_back({ n.left, leftDistance });
+				}
+				else {
+					if (leftDistance != INFINITY)
+						stack.push_back({ n.left, leftDistance });
+					if (rightDistance != INFINITY)
+						stack.push_back({ n.right, rightDistance });
+				}
+			}
+			nodesVisited += visited;
+			return hit;
+		}
+
+		/// <summary>
+		/// Bounds of an item as the tree last saw it
+		/// </summary>
+		const AABB& getBounds(int item) const
+		{
+			return nodes[itemLeaves[item]].bounds;
+		}
+
+		bool contains(int item) const
+		{
+			return item >= 0 && item < (int)itemLeaves.size() && itemLeaves[item] != NULL_NODE;
+		}
+
+		/// <summary>
+		/// Number of levels on the longest path from the root to a leaf (for checking tree quality)
+		/// </summary>
+		int getHeight(void) const
+		{
+			if (root == NULL_NODE)
+				return 0;
+
+			// up from every leaf, so there's no stack to keep
+			int height = 0;
+			for (int leaf : itemLeaves) {
+				int levels = 0;
+				for (int node = leaf; node != NULL_NODE; node = nodes[node].parent)
+					++levels;
+				height = std::max(height, levels);
+			}
+			return height;
+		}
+
+		/// <summary>
+		/// The root node, or NULL_NODE if the tree is empty (for walking the tree, e.g. to convert it into another layout)
+		/// </summary>
+		int getRoot(void) const
+		{
+			return root;
+		}
+
+		const Node& getNode(int node) const
+		{
+			return nodes[node];
+		}
+
+		void resetStats(void)
+		{
+			nodesVisited = 0;
+		}
+
+		Stats getStats(void) const
+		{
+			Stats stats;
+			stats.nodesVisited = nodesVisited;
+			return stats;
+		}
+};
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef SHADER_LOD_H
+#define SHADER_LOD_H
+
+#include <cmath>
+#include <string>
+#include <algorithm>
+#include <glm/glm/glm.hpp>
+#include "ShaderProgram.h"
+#include "Object.h"
+#include "Bounds.h"
+
+/// <summary>
+/// Picks a cheaper lighting variant of the model shader for objects that are small on screen.
+/// All variants are built from VertexShader.vert/FragmentShader.frag with a different SHADER_LOD define.
+/// </summary>
+class ShaderLOD
+{
+	public:
+		enum Level {
+			FULL = 0,			// per-pixel Phong
+			PER_VERTEX = 1,		// lighting factors computed per vertex, two texture fetches per fragment
+			DIFFUSE_ONLY = 2,	// per-vertex diffuse, one texture fetch per fragment, no specular
+			NUM_LEVELS = 3
+		};
+
+		// thresholds on an object's projected diameter, in pixels
+		struct Settings {
+			float perVertexBelow = 200.0f;
+			float diffuseOnlyBelow = 60.0f;
+		};
+
+		struct Stats {
+			unsigned int objects[NUM_LEVELS] = {};
+			float pixels[NUM_LEVELS] = {};		// estimated screen coverage of the objects drawn with each level
+		};
+
+		Settings settings;
+
+	private:
+		ShaderProgram* programs[NUM_LEVELS];
+		Stats frameStats;
+		Stats lastFrameStats;
+
+	public:
+		static std::string defines(Level level)
+		{
+			return "#define SHADER_LOD " + std::to_string((int)level) + "\n";
+		}
+
+		ShaderLOD(ShaderProgram& full, ShaderProgram& perVertex, ShaderProgram& diffuseOnly)
+		{
+			programs[FULL] = &full;
+			programs[PER_VERTEX] = &perVertex;
+			programs[DIFFUSE_ONLY] = &diffuseOnly;
+		}
+
+		/// <summary>
+		/// Diameter in pixels of a world-space sphere on screen (using the sphere's distance from the camera)
+		/// </summary>
+		/// <param name="projection">Perspective projection matrix</param>
+		/// <param name="viewportHeight">Viewport height in pixels</param>
+		static float projectedDiameter(const BoundingSphere& sphere, const glm::vec3& cameraPos, const glm::mat4& projection, float viewportHeight)
+		{
+			float distance = glm::length(sphere.center - cameraPos);
+			if (distance <= sphere.radius)
+				return INFINITY;		// camera is inside the bounds
+			return sphere.radius / distance * projection[1][1] * viewportHeight;	// projection[1][1] = 1 / tan(fovy / 2)
+		}
+
+		Level selectLevel(float diameter) const
+		{
+			if (diameter < settings.diffuseOnlyBelow)
+				return DIFFUSE_ONLY;
+			if (diameter < settings.perVertexBelow)
+				return PER_VERTEX;
+			return FULL;
+		}
+
+		/// <summary>
+		/// Returns the program to draw an object with, and records it in this frame's stats
+		/// </summary>
+		ShaderProgram& select(const Object& object, const glm::vec3& cameraPos, const glm::mat4& projection, float viewportWidth, float viewportHeight)
+		{
+			float diameter = projectedDiameter(object.getWorldSphere(), cameraPos, projection, viewportHeight);
+			Level level = selectLevel(diameter);
+
+			float area = std::isinf(diameter) ? viewportWidth * viewportHeight : 0.785398f * diameter * diameter;	// pi / 4 * d^2
+			++frameStats.objects[level];
+			frameStats.pixels[level] += std::min(area, viewportWidth * viewportHeight);
+
+			return *programs[level];
+		}
+
+		ShaderProgram& getProgram(Level level)
+		{
+			return *programs[level];
+		}
+
+		void beginFrame(void)
+		{
+			lastFrameStats = frameStats;
+			frameStats = Stats();
+		}
+
+		const Stats& getLastFrameStats(void) const
+		{
+			return lastFrameStats;
+		}
+};
+
+#endif
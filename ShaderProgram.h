@@ -5,6 +5,7 @@
 #include <string>
 #include <iostream>
 #include <glad/glad.h>
+#include "GLState.h"
 
 class ShaderFile
 {
@@ -15,23 +16,31 @@ class ShaderFile
 
 	public:
 
-		ShaderFile(const std::string& path, const std::string& type) : shaderType{ type }
+		/// <param name="defines">Extra lines (e.g. "#define SHADER_LOD 1\n") inserted right after the #version line, for building variants of one source file</param>
+		ShaderFile(const std::string& path, const std::string& type, const std::string& defines = "") : shaderType{ type }
 		{
 			std::string line;
 			fileStream.open(path);
 			if (fileStream.is_open()) {
-				while (std::getline(fileStream, line))
+				while (std::getline(fileStream, line)) {
 					shaderSrc += line + '\n';
+					if (shaderSrc.size() == line.size() + 1)	// #version has to stay the first line
+						shaderSrc += defines;
+				}
 			}
 			fileStream.close();
 			if (shaderSrc.empty())
 				std::cout << "ERROR: " + type + " shader source not loaded" << std::endl;
 		}
 
-		const char** getSource(void) const
+		const char* getSource(void) const
 		{
-			const char* cStr = shaderSrc.c_str();
-			return &cStr;
+			return shaderSrc.c_str();
+		}
+
+		bool empty(void) const
+		{
+			return shaderSrc.empty();
 		}
 
 		std::string getType(void) const
@@ -40,23 +49,106 @@ class ShaderFile
 		}
 };
 
+// texture units that the model shaders' samplers are assigned to (done once when a program is built, not per draw)
+enum TextureUnit {
+	OBJECT_DATA_UNIT = 2,	// objectData (per-object matrices, see ObjectConstants.h)
+	IMPOSTOR_ALBEDO_UNIT = 3,			// impostorAlbedo (see Impostors.h)
+	IMPOSTOR_NORMAL_DEPTH_UNIT = 4,		// impostorNormalDepth
+	MATERIAL_DATA_UNIT = 5,				// materialData (every material's constants and texture layers, see MaterialTable.h)
+	MATERIAL_TEXTURES_UNIT = 6,			// materialTextures0, and the next units for materialTextures1 and on (one texture array per texture size)
+	LIGHT_DATA_UNIT = 10,				// lightData (point and spot lights, see ClusteredLights.h)
+	LIGHT_GRID_UNIT = 11,				// lightGrid (each cluster's lights)
+	SHADOW_MAP_UNIT = 12,				// shadowMap (the sun's shadow cascades, see CascadedShadows.h)
+	LIGHTMAP_UNIT = 13,					// lightmap (baked lighting of the static objects, see Lightmaps.h)
+	VERTEX_OCCLUSION_UNIT = 14			// vertexOcclusion (the static objects' baked occlusion per vertex, see VertexOcclusion.h)
+};
+
+// texture arrays that material textures are packed into, one per texture size (the shaders declare this many materialTextures samplers)
+const int MATERIAL_TEXTURE_ARRAYS = 4;
+
+// uniform buffer binding points shared by every program that declares the block
+enum UniformBlockBinding {
+	FRAME_DATA_BINDING = 0,		// FrameData (sun light and camera position, see FrameData.h)
+	LIGHT_CLUSTERS_BINDING = 1,	// LightClusters (how to find a fragment's cluster, see ClusteredLights.h)
+	SHADOW_DATA_BINDING = 2		// ShadowCascades (each shadow cascade's matrix and extent, see CascadedShadows.h)
+};
+
 class ShaderProgram
 {
-	public:
-		unsigned int ID;
+	private:
+		/// <summary>
+		/// Looks up the uniforms that get set on every draw, and points the samplers at their texture units
+		/// (uniforms are part of the program's state, so this only has to happen once per program)
+		/// </summary>
+		void resolveUniforms(void)
+		{
+			if (ID == 0)
+				return;
 
-		ShaderProgram(const ShaderFile& vertexShaderFile, const ShaderFile& fragmentShaderFile)
+			use();
+			int loc = glGetUniformLocation(ID, "objectData");
+			if (loc >= 0)
+				glUniform1i(loc, OBJECT_DATA_UNIT);
+			loc = glGetUniformLocation(ID, "impostorAlbedo");
+			if (loc >= 0)
+				glUniform1i(loc, IMPOSTOR_ALBEDO_UNIT);
+			loc = glGetUniformLocation(ID, "impostorNormalDepth");
+			if (loc >= 0)
+				glUniform1i(loc, IMPOSTOR_NORMAL_DEPTH_UNIT);
+			loc = glGetUniformLocation(ID, "materialData");
+			if (loc >= 0)
+				glUniform1i(loc, MATERIAL_DATA_UNIT);
+			for (int i = 0; i < MATERIAL_TEXTURE_ARRAYS; ++i) {
+				loc = glGetUniformLocation(ID, ("materialTextures" + std::to_string(i)).c_str());
+				if (loc >= 0)
+					glUniform1i(loc, MATERIAL_TEXTURES_UNIT + i);
+			}
+			loc = glGetUniformLocation(ID, "lightData");
+			if (loc >= 0)
+				glUniform1i(loc, LIGHT_DATA_UNIT);
+			loc = glGetUniformLocation(ID, "lightGrid");
+			if (loc >= 0)
+				glUniform1i(loc, LIGHT_GRID_UNIT);
+			loc = glGetUniformLocation(ID, "shadowMap");
+			if (loc >= 0)
+				glUniform1i(loc, SHADOW_MAP_UNIT);
+			loc = glGetUniformLocation(ID, "lightmap");
+			if (loc >= 0)
+				glUniform1i(loc, LIGHTMAP_UNIT);
+			loc = glGetUniformLocation(ID, "vertexOcclusion");
+			if (loc >= 0)
+				glUniform1i(loc, VERTEX_OCCLUSION_UNIT);
+
+			unsigned int block = glGetUniformBlockIndex(ID, "FrameData");
+			if (block != GL_INVALID_INDEX)
+				glUniformBlockBinding(ID, block, FRAME_DATA_BINDING);
+			block = glGetUniformBlockIndex(ID, "LightClusters");
+			if (block != GL_INVALID_INDEX)
+				glUniformBlockBinding(ID, block, LIGHT_CLUSTERS_BINDING);
+			block = glGetUniformBlockIndex(ID, "ShadowCascades");
+			if (block != GL_INVALID_INDEX)
+				glUniformBlockBinding(ID, block, SHADOW_DATA_BINDING);
+		}
+
+		/// <summary>
+		/// Compiles and links a program from the two shader files
+		/// </summary>
+		/// <returns>Program ID, or 0 if compilation or linking failed</returns>
+		static unsigned int compile(const ShaderFile& vertexShaderFile, const ShaderFile& fragmentShaderFile)
 		{
 			unsigned int vertexShader, fragmentShader, shaderProgram;
 			int success;
+			bool failed = false;
 			char infoLog[512];
 
 			shaderProgram = glCreateProgram();
 			vertexShader = glCreateShader(GL_VERTEX_SHADER);
 			fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
 
-			glShaderSource(vertexShader, 1, vertexShaderFile.getSource(), NULL);
-			glShaderSource(fragmentShader, 1, fragmentShaderFile.getSource(), NULL);
+			const char* vertexSrc = vertexShaderFile.getSource();
+			const char* fragmentSrc = fragmentShaderFile.getSource();
+			glShaderSource(vertexShader, 1, &vertexSrc, NULL);
+			glShaderSource(fragmentShader, 1, &fragmentSrc, NULL);
 
 			// Vertex Shader compilation
 			glCompileShader(vertexShader);
@@ -65,7 +157,7 @@ class ShaderProgram
 			if (!success) {
 				glGetShaderInfoLog(vertexShader, 512, NULL, infoLog);
 				std::cout << "ERROR: Vertex Shader Compilation failed\n" << infoLog << std::endl;
-				ID = 0;
+				failed = true;
 			}
 			// if it did succeed, attach it to the shader program
 			glAttachShader(shaderProgram, vertexShader);
@@ -76,7 +168,7 @@ class ShaderProgram
 			if (!success) {
 				glGetShaderInfoLog(fragmentShader, 512, NULL, infoLog);
 				std::cout << "ERROR: Fragment Shader Compilation failed\n" << infoLog << std::endl;
-				ID = 0;
+				failed = true;
 			}
 			glAttachShader(shaderProgram, fragmentShader);
 
@@ -86,19 +178,51 @@ class ShaderProgram
 			if (!success) {
 				glGetProgramInfoLog(shaderProgram, 512, NULL, infoLog);
 				std::cout << "ERROR: Shader program link failed\n" << infoLog << std::endl;
-				ID = 0;
+				failed = true;
 			}
 
 			// delete shaders; no longer need them
 			glDeleteShader(vertexShader);
 			glDeleteShader(fragmentShader);
 
-			ID = shaderProgram;
+			if (failed) {
+				glDeleteProgram(shaderProgram);
+				return 0;
+			}
+			return shaderProgram;
+		}
+
+	public:
+		unsigned int ID;
+
+		ShaderProgram(const ShaderFile& vertexShaderFile, const ShaderFile& fragmentShaderFile)
+		{
+			ID = compile(vertexShaderFile, fragmentShaderFile);
+			resolveUniforms();
+		}
+
+		/// <summary>
+		/// Recompiles the program from new sources; the old program is only replaced if the new one compiles and links
+		/// NOTE: uniforms set on the old program are lost, so set them again afterwards
+		/// </summary>
+		/// <returns>Whether the program was replaced</returns>
+		bool reload(const ShaderFile& vertexShaderFile, const ShaderFile& fragmentShaderFile)
+		{
+			unsigned int newID = compile(vertexShaderFile, fragmentShaderFile);
+			if (newID == 0) {
+				std::cout << "ERROR: Shader reload failed; keeping previous program" << std::endl;
+				return false;
+			}
+
+			GLState::get().deleteProgram(ID);
+			ID = newID;
+			resolveUniforms();
+			return true;
 		}
 
 		void use(void) const
 		{
-			glUseProgram(ID);
+			GLState::get().useProgram(ID);		// skipped if this program is already in use
 		}
 
 		void setUniformMatrix(const char* name, const glm::mat4& matrix) const
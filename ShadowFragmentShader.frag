@@ -0,0 +1,7 @@
+#version 330 core
+
+// sun shadow cascades: only depth is written (the framebuffer has no color attachment)
+
+void main()
+{
+}
\ No newline at end of file
@@ -0,0 +1,19 @@
+#version 330 core
+
+// sun shadow cascades: positions only (GeometryBuffer::POSITION_STREAM), from the sun (see CascadedShadows.h)
+
+layout (location = 0) in vec3 aPos;
+layout (location = 3) in int aObjectIndex;		// set as a constant for each caster
+
+// per-object matrices, computed once per frame on the CPU (see ObjectConstants.h for the layout)
+uniform samplerBuffer objectData;
+
+uniform mat4 lightViewProjection;	// orthographic, covering the cascade being rendered
+
+void main()
+{
+	int base = aObjectIndex * 12;
+	mat4 model = mat4(texelFetch(objectData, base + 4), texelFetch(objectData, base + 5), texelFetch(objectData, base + 6), texelFetch(objectData, base + 7));
+
+	gl_Position = lightViewProjection * model * vec4(aPos, 1.0);
+}
\ No newline at end of file
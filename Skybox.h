@@ -7,6 +7,7 @@
 #include <iostream>
 #include "stb_image.h"
 #include "ShaderProgram.h"
+#include "GLState.h"
 #include <glm/glm/glm.hpp>
 
 class Skybox
@@ -66,8 +67,8 @@ class Skybox
 			glGenVertexArrays(1, &VAO);
 			glGenBuffers(1, &VBO);
 
-			glBindVertexArray(VAO);
-			glBindBuffer(GL_ARRAY_BUFFER, VBO);
+			GLState::get().bindVertexArray(VAO);
+			GLState::get().bindBuffer(GL_ARRAY_BUFFER, VBO);
 			glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), skyboxVertices, GL_STATIC_DRAW);
 
 			// position data	(layout = 0)
@@ -78,14 +79,14 @@ class Skybox
 		void genTextures(void)
 		{
 			glGenTextures(1, &texSkybox);
-			glBindTexture(GL_TEXTURE_CUBE_MAP, texSkybox);
+			GLState::get().bindTexture(0, GL_TEXTURE_CUBE_MAP, texSkybox);
 
 			int width, height, nrChannels;
 			for (int i = 0; i < texturePaths.size(); ++i) {
 
 				unsigned int texture;
 				glGenTextures(1, &texture);
-				glBindTexture(GL_TEXTURE_2D, texture);
+				GLState::get().bindTexture(0, GL_TEXTURE_2D, texture);
 
 				unsigned char* data = stbi_load((skyboxDirectory + '/' + texturePaths[i]).c_str(), &width, &height, &nrChannels, 0);
 
@@ -126,7 +127,7 @@ class Skybox
 		/// <param name="dir">Directory that the skybox texture files are in</param>
 		/// <param name="prog">Shader program</param>
 		Skybox(const std::string& fileExt, const std::string& dir, const ShaderProgram& prog)
-			: fileExtension{ fileExt }, skyboxDirectory{ dir }, skyboxShaderProgram{ prog }
+			: skyboxDirectory{ dir }, fileExtension{ fileExt }, skyboxShaderProgram{ prog }
 		{
 			texturePaths = {
 				"right" + fileExt,		// ex: right.bmp
@@ -141,6 +142,19 @@ class Skybox
 			genTextures();
 		}
 
+		/// <summary>
+		/// Path to one face's image, in cube map face order (+X, -X, +Y, -Y, +Z, -Z)
+		/// </summary>
+		std::string getFacePath(int face) const
+		{
+			return skyboxDirectory + '/' + texturePaths[face];
+		}
+
+		ShaderProgram& getShaderProgram(void)
+		{
+			return skyboxShaderProgram;
+		}
+
 		/// <summary>
 		/// NOTE: Draw the skybox last, after all other objects have been drawn
 		/// </summary>
@@ -148,7 +162,7 @@ class Skybox
 		/// <param name="projection">Projection matrix</param>
 		void Draw(const glm::mat4& view, const glm::mat4& projection)
 		{
-			glDepthFunc(GL_LEQUAL);		// depth buffer will be filled with values of 1.0, so set to <= to make sure the skybox's fragments pass the depth test
+			GLState::get().depthFunc(GL_LEQUAL);		// depth buffer will be filled with values of 1.0, so set to <= to make sure the skybox's fragments pass the depth test
 			
 			skyboxShaderProgram.use();
 
@@ -156,12 +170,9 @@ class Skybox
 			skyboxShaderProgram.setUniformMatrix("view", skyboxViewMat);
 			skyboxShaderProgram.setUniformMatrix("projection", projection);
 
-			glActiveTexture(GL_TEXTURE0);		// set the skybox texture and bind the VAO before drawing
-			glBindTexture(GL_TEXTURE_CUBE_MAP, texSkybox);
-			glBindVertexArray(VAO);
+			GLState::get().bindTexture(0, GL_TEXTURE_CUBE_MAP, texSkybox);		// set the skybox texture and bind the VAO before drawing
+			GLState::get().bindVertexArray(VAO);
 			glDrawArrays(GL_TRIANGLES, 0, 36);
-
-			glDepthFunc(GL_LESS);		// set it back to just < for the depth test
 		}
 };
 
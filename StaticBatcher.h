@@ -0,0 +1,225 @@
+#ifndef STATIC_BATCHER_H
+#define STATIC_BATCHER_H
+
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm/glm.hpp>
+#include "Object.h"
+#include "mesh.h"
+#include "GeometryBuffer.h"
+#include "VertexOcclusion.h"
+
+/// <summary>
+/// Static batching: the meshes of every object flagged static are transformed into world space once and merged into one
+/// batch per material, so static world geometry is drawn with about one draw call per material instead of one per mesh.
+/// Each batch remembers which part of its indices came from which object's mesh, so culling still works per mesh:
+/// the visible parts are drawn with one glMultiDrawElementsBaseVertex call (parts next to each other are merged first).
+/// Batches are drawn at full detail with one program, so batched objects don't get GeometryLOD levels or ShaderLOD variants.
+/// Since the batches have their own copy of every vertex, the copies also get each object's baked occlusion (see VertexOcclusion.h).
+/// </summary>
+class StaticBatcher
+{
+	public:
+		struct Stats {
+			unsigned int batches = 0;			// batches with anything on screen
+			unsigned int drawCalls = 0;
+			unsigned int meshesDrawn = 0;		// source meshes drawn through the batches
+			unsigned int parts = 0;				// contiguous index ranges they were drawn as
+		};
+
+	private:
+		// one object's mesh, inside a batch
+		struct Section {
+			size_t object;			// index in the vector passed to build()
+			size_t mesh;
+			size_t firstIndex;		// relative to the batch's first index
+			size_t indexCount;
+		};
+
+		struct Batch {
+			Mesh mesh;							// world space; owns the batch's part of the GeometryBuffer
+			std::vector<Section> sections;		// in object order, so neighboring objects' parts merge
+		};
+
+		std::vector<Batch> batches;
+		Object world;		// identity matrix: the batches' entry in ObjectConstants
+		size_t objectsBatched;
+		size_t meshesBatched;
+		float buildMilliseconds;
+		std::vector<GLsizei> counts;		// visible parts of the batch being drawn
+		std::vector<size_t> firstIndices;
+		Stats lastStats;
+
+		void release(void)
+		{
+			for (Batch& batch : batches)
+				batch.mesh.release();
+			batches.clear();
+		}
+
+	public:
+		StaticBatcher() : world{ std::make_shared<Model>() }, objectsBatched{ 0 }, meshesBatched{ 0 }, buildMilliseconds{ 0.0f }
+		{
+		}
+
+		/// <summary>
+		/// Merges the static objects' meshes into batches, replacing any batches from before
+		/// NOTE: Build again after a static object's model is reloaded (or if it moves after all), and after lightmaps or occlusion are baked
+		/// </summary>
+		/// <param name="occlusion">Baked for the same objects, or null to leave the vertices open</param>
+		void build(const std::vector<Object*>& objects, const VertexOcclusion* occlusion = nullptr)
+		{
+			auto start = std::chrono::steady_clock::now();
+			release();
+			objectsBatched = 0;
+			meshesBatched = 0;
+
+			// group the meshes by material, keeping object order inside each group
+			std::vector<std::vector<std::pair<size_t, size_t>>> groups;		// (object, mesh)
+			std::vector<const Mesh*> groupMeshes;		// first mesh of each group, for its material and textures
+			for (size_t i = 0; i < objects.size(); ++i) {
+				if (!objects[i]->isStatic() || !objects[i]->getModel().isLoaded())
+					continue;
+				++objectsBatched;
+
+				const std::vector<Mesh>& meshes = objects[i]->getModel().getMeshes();
+				for (size_t j = 0; j < meshes.size(); ++j) {
+					size_t group = 0;
+					while (group < groupMeshes.size() && !groupMeshes[group]->material.sameAs(meshes[j].material))
+						++group;
+					if (group == groupMeshes.size()) {
+						groups.emplace_back();
+						groupMeshes.push_back(&meshes[j]);
+					}
+					groups[group].push_back({ i, j });
+					++meshesBatched;
+				}
+			}
+
+			// pre-transform each group's vertices and merge them (lightmap coordinates too, into the objects' rects, so the
+			// batches' own rect is the whole lightmap), with each object's own baked occlusion
+			bool lightmapped = false;
+			for (size_t group = 0; group < groups.size(); ++group) {
+				std::vector<Vertex> vertices;
+				std::vector<unsigned int> indices;
+				std::vector<Section> sections;
+
+				for (const std::pair<size_t, size_t>& source : groups[group]) {
+					const glm::mat4& matrix = objects[source.first]->getMatrix();
+					glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(matrix)));
+					const Mesh& mesh = objects[source.first]->getModel().getMeshes()[source.second];
+					const glm::vec4& lightmapRect = objects[source.first]->getLightmapRect();
+					lightmapped |= objects[source.first]->hasLightmap();
+					const unsigned char* baked = occlusion ? occlusion->get(source.first, source.second, mesh.vertices.size()) : nullptr;
+
+					unsigned int firstVertex = (unsigned int)vertices.size();
+					for (size_t k = 0; k < mesh.vertices.size(); ++k) {
+						const Vertex& vertex = mesh.vertices[k];
+						Vertex transformed = vertex;
+						transformed.Position = glm::vec3(matrix * glm::vec4(vertex.Position, 1.0f));
+						transformed.Normal = glm::normalize(normalMatrix * vertex.Normal);
+						transformed.LightmapCoords = glm::vec2(lightmapRect.x, lightmapRect.y) + vertex.LightmapCoords * glm::vec2(lightmapRect.z, lightmapRect.w);
+						if (baked) {
+							transformed.Occlusion[0] = baked[k * 2];
+							transformed.Occlusion[1] = baked[k * 2 + 1];
+						}
+						vertices.push_back(transformed);
+					}
+
+					sections.push_back({ source.first, source.second, indices.size(), mesh.indices.size() });
+					for (unsigned int index : mesh.indices)
+						indices.push_back(firstVertex + index);
+				}
+
+				const Mesh& first = *groupMeshes[group];
+				batches.push_back({ Mesh(vertices, indices, first.textures, first.material), std::move(sections) });
+			}
+			world.setLightmapRect(lightmapped ? glm::vec4(0.0f, 0.0f, 1.0f, 1.0f) : glm::vec4(0.0f));
+
+			buildMilliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+		}
+
+		/// <summary>
+		/// Draws the visible parts of every batch (after ObjectConstants has given getWorldObject() its index)
+		/// </summary>
+		/// <param name="meshVisible">Per object passed to build(): its mesh flags from FrustumCuller, or null if it isn't drawn through the batches this frame</param>
+		/// <returns>Number of draw calls made</returns>
+		unsigned int draw(const ShaderProgram& program, const std::vector<const unsigned char*>& meshVisible)
+		{
+			Stats stats;
+			bool programInUse = false;
+
+			for (const Batch& batch : batches) {
+				counts.clear();
+				firstIndices.clear();
+				for (const Section& section : batch.sections) {
+					const unsigned char* visible = section.object < meshVisible.size() ? meshVisible[section.object] : nullptr;
+					if (!visible || !visible[section.mesh] || section.indexCount == 0)
+						continue;
+
+					++stats.meshesDrawn;
+					if (!counts.empty() && firstIndices.back() + counts.back() == section.firstIndex)
+						counts.back() += (GLsizei)section.indexCount;		// right after the previous part
+					else {
+						counts.push_back((GLsizei)section.indexCount);
+						firstIndices.push_back(section.firstIndex);
+					}
+				}
+				if (counts.empty())
+					continue;
+
+				if (!programInUse) {
+					program.use();
+					glVertexAttribI1i(OBJECT_INDEX_ATTRIB, world.getConstantIndex());
+					programInUse = true;
+				}
+				batch.mesh.material.apply();
+				GeometryBuffer::get().drawParts(batch.mesh.getGeometry(), counts, firstIndices);
+
+				++stats.batches;
+				++stats.drawCalls;
+				stats.parts += (unsigned int)counts.size();
+			}
+
+			lastStats = stats;
+			return stats.drawCalls;
+		}
+
+		/// <summary>
+		/// An object with an identity matrix (and no model) that stands for the batches in ObjectConstants;
+		/// pass it to ObjectConstants::update() along with the other objects on frames the batches are drawn
+		/// </summary>
+		Object& getWorldObject(void)
+		{
+			return world;
+		}
+
+		size_t getBatchCount(void) const
+		{
+			return batches.size();
+		}
+
+		size_t getObjectsBatched(void) const
+		{
+			return objectsBatched;
+		}
+
+		size_t getMeshesBatched(void) const
+		{
+			return meshesBatched;
+		}
+
+		float getBuildMilliseconds(void) const
+		{
+			return buildMilliseconds;
+		}
+
+		const Stats& getLastStats(void) const
+		{
+			return lastStats;
+		}
+};
+
+#endif
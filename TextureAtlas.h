@@ -0,0 +1,297 @@
+#ifndef TEXTURE_ATLAS_H
+#define TEXTURE_ATLAS_H
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <glm/glm/glm.hpp>
+
+// decoded image, kept on the CPU until it is uploaded to a texture object
+struct ImageData {
+	std::string path;		// path relative to the model's directory (same as Texture::path)
+	int width = 0;
+	int height = 0;
+	int nrChannels = 0;
+	std::vector<unsigned char> pixels;
+};
+
+// where a texture went in an atlas
+struct AtlasPlacement {
+	int atlas = -1;			// index of the atlas, or -1 if the texture was left as it is
+	int blockX = 0, blockY = 0;				// the texture's block in the atlas, gutter and alignment padding included (in texels)
+	int blockWidth = 0, blockHeight = 0;
+	glm::vec4 rect = glm::vec4(0.0f);		// the texture itself in atlas texture coordinates: offset (xy) and scale (zw)
+};
+
+/// <summary>
+/// Packs small textures into shared atlases at import (skyline bottom-left packing, largest first), so a model's little
+/// textures cost one texture (one MaterialTable layer) instead of one each. Materials keep sampling their own texture
+/// through its rect: the shaders wrap texture coordinates inside it, so tiling still works.
+///
+/// Every texture gets a block: the texture plus a gutter of wrapped texels on every side (what bilinear filtering at the
+/// edge reads, same as GL_REPEAT would give), padded to a multiple of 2^mipLevels texels with more wrapped texels. Blocks
+/// start on multiples of that too, and so do the atlas's sides, so down to level mipLevels every level halves exactly and
+/// every mip texel comes from a single block; the shaders keep atlas textures to those levels.
+///
+/// Doesn't use OpenGL, so it's safe to call from the model import thread.
+/// </summary>
+class TextureAtlas
+{
+	public:
+		struct Settings {
+			int maxTextureSize;		// textures with both sides at most this big are packed
+			int maxAtlasSize;
+			int gutter;				// wrapped texels around each texture
+			int mipLevels;			// mip levels that stay inside a block (blocks are aligned to 2^mipLevels texels)
+			float minOccupancy;		// an atlas has to be at least this full (in texture texels) to be worth it
+
+			Settings() : maxTextureSize{ 512 }, maxAtlasSize{ 2048 }, gutter{ 4 }, mipLevels{ 5 }, minOccupancy{ 0.5f } {}
+		};
+
+		struct Stats {
+			unsigned int texturesPacked = 0;
+			unsigned int atlases = 0;
+			size_t texelsPacked = 0;		// the textures' own texels
+			size_t atlasTexels = 0;
+
+			// textures that no longer need their own texture object
+			unsigned int texturesEliminated(void) const
+			{
+				return texturesPacked - atlases;
+			}
+
+			float occupancy(void) const
+			{
+				return atlasTexels > 0 ? float(texelsPacked) / float(atlasTexels) : 0.0f;
+			}
+
+			void add(const Stats& other)
+			{
+				texturesPacked += other.texturesPacked;
+				atlases += other.atlases;
+				texelsPacked += other.texelsPacked;
+				atlasTexels += other.atlasTexels;
+			}
+		};
+
+		// skyline: the top edge of everything placed so far, as horizontal segments from left to right
+		struct Segment {
+			int x, y, width;
+		};
+
+		// bottom-left rect packer (also used for LightmapCharts' charts)
+		class Skyline
+		{
+			private:
+				int width, height;
+				std::vector<Segment> segments;
+
+				// lowest y a rect starting at segment i can go without overlapping anything, or -1 if it doesn't fit there
+				int fitAt(size_t i, int rectWidth, int rectHeight) const
+				{
+					int x = segments[i].x;
+					if (x + rectWidth > width)
+						return -1;
+					int y = 0;
+					for (size_t j = i; j < segments.size() && segments[j].x < x + rectWidth; ++j)
+						y = std::max(y, segments[j].y);
+					return y + rectHeight <= height ? y : -1;
+				}
+
+			public:
+				Skyline(int binWidth, int binHeight) : width{ binWidth }, height{ binHeight }
+				{
+					segments.push_back({ 0, 0, binWidth });
+				}
+
+				// height of the tallest thing placed
+				int getTop(void) const
+				{
+					int top = 0;
+					for (const Segment& segment : segments)
+						top = std::max(top, segment.y);
+					return top;
+				}
+
+				/// <returns>Whether the rect fit (x and y are set to where it went)</returns>
+				bool insert(int rectWidth, int rectHeight, int& x, int& y)
+				{
+					size_t best = segments.size();
+					int bestY = 0;
+					for (size_t i = 0; i < segments.size(); ++i) {
+						int fit = fitAt(i, rectWidth, rectHeight);
+						if (fit >= 0 && (best == segments.size() || fit < bestY)) {		// lowest, then leftmost
+							best = i;
+							bestY = fit;
+						}
+					}
+					if (best == segments.size())
+						return false;
+
+					x = segments[best].x;
+					y = bestY;
+
+					// the rect's top replaces the segments under it
+					Segment top = { x, y + rectHeight, rectWidth };
+					size_t end = best;
+					while (end < segments.size() && segments[end].x + segments[end].width <= x + rectWidth)
+						++end;
+					if (end < segments.size() && segments[end].x < x + rectWidth) {
+						int cut = x + rectWidth - segments[end].x;
+						segments[end].x += cut;
+						segments[end].width -= cut;
+					}
+					segments.erase(segments.begin() + best, segments.begin() + end);
+					segments.insert(segments.begin() + best, top);
+
+					// merge neighbors at the same height
+					for (size_t i = 0; i + 1 < segments.size();) {
+						if (segments[i].y == segments[i + 1].y) {
+							segments[i].width += segments[i + 1].width;
+							segments.erase(segments.begin() + i + 1);
+						}
+						else
+							++i;
+					}
+					return true;
+				}
+		};
+
+	private:
+		static int alignUp(int value, int alignment)
+		{
+			return (value + alignment - 1) / alignment * alignment;
+		}
+
+		/// <summary>
+		/// Packs blocks into a bin of a size, in the given order
+		/// </summary>
+		/// <returns>Whether all of them fit</returns>
+		static bool packAll(const std::vector<int>& order, std::vector<AtlasPlacement>& placements, int width, int height)
+		{
+			Skyline skyline(width, height);
+			for (int i : order) {
+				if (!skyline.insert(placements[i].blockWidth, placements[i].blockHeight, placements[i].blockX, placements[i].blockY))
+					return false;
+			}
+			return true;
+		}
+
+	public:
+		/// <summary>
+		/// Copies an image into a block, filling the gutter and padding around it by wrapping (converted to RGB)
+		/// </summary>
+		/// <param name="destination">RGB pixels, destinationWidth wide</param>
+		static void copyBlock(const ImageData& image, const AtlasPlacement& placement, int gutter, unsigned char* destination, int destinationWidth, int originX, int originY)
+		{
+			for (int y = 0; y < placement.blockHeight; ++y) {
+				int sourceY = ((y - gutter) % image.height + image.height) % image.height;
+				for (int x = 0; x < placement.blockWidth; ++x) {
+					int sourceX = ((x - gutter) % image.width + image.width) % image.width;
+					const unsigned char* source = &image.pixels[(size_t(sourceY) * image.width + sourceX) * image.nrChannels];
+					unsigned char* texel = &destination[(size_t(originY + y) * destinationWidth + originX + x) * 3];
+					for (int c = 0; c < 3; ++c)
+						texel[c] = source[image.nrChannels >= 3 ? c : 0];		// grey (and grey-alpha) to RGB
+				}
+			}
+		}
+
+		/// <summary>
+		/// Packs the small textures among images into as few atlases as it can
+		/// </summary>
+		/// <param name="placements">Set to one entry per image (atlas -1 for the ones left alone)</param>
+		/// <param name="stats">Added to</param>
+		/// <returns>The atlases (RGB), named "atlas0", "atlas1", ...</returns>
+		static std::vector<ImageData> pack(const std::vector<ImageData>& images, std::vector<AtlasPlacement>& placements, Stats& stats, const Settings& settings = Settings())
+		{
+			std::vector<ImageData> atlases;
+			placements.assign(images.size(), AtlasPlacement());
+			int alignment = 1 << settings.mipLevels;
+
+			std::vector<int> remaining;
+			for (size_t i = 0; i < images.size(); ++i) {
+				const ImageData& image = images[i];
+				if (image.pixels.empty() || image.width > settings.maxTextureSize || image.height > settings.maxTextureSize)
+					continue;
+				placements[i].blockWidth = alignUp(image.width + 2 * settings.gutter, alignment);
+				placements[i].blockHeight = alignUp(image.height + 2 * settings.gutter, alignment);
+				if (placements[i].blockWidth <= settings.maxAtlasSize && placements[i].blockHeight <= settings.maxAtlasSize)
+					remaining.push_back((int)i);
+			}
+
+			// largest first (by height, then width), which is what keeps a skyline flat
+			std::sort(remaining.begin(), remaining.end(), [&](int a, int b) {
+				if (placements[a].blockHeight != placements[b].blockHeight)
+					return placements[a].blockHeight > placements[b].blockHeight;
+				return placements[a].blockWidth > placements[b].blockWidth;
+			});
+
+			while (remaining.size() > 1) {
+				// everything that fits in one atlas of the largest size
+				std::vector<int> members, rest;
+				Skyline full(settings.maxAtlasSize, settings.maxAtlasSize);
+				for (int i : remaining) {
+					if (full.insert(placements[i].blockWidth, placements[i].blockHeight, placements[i].blockX, placements[i].blockY))
+						members.push_back(i);
+					else
+						rest.push_back(i);
+				}
+
+				// then the smallest atlas that holds them: for each width, as tall as packing at that width needs
+				int bestWidth = settings.maxAtlasSize, bestHeight = settings.maxAtlasSize;
+				for (int width = alignment; width <= settings.maxAtlasSize; width += alignment) {
+					Skyline skyline(width, settings.maxAtlasSize);
+					bool fits = true;
+					for (size_t m = 0; m < members.size() && fits; ++m) {
+						AtlasPlacement& placement = placements[members[m]];
+						fits = skyline.insert(placement.blockWidth, placement.blockHeight, placement.blockX, placement.blockY);
+					}
+					if (!fits)
+						continue;
+
+					int height = alignUp(skyline.getTop(), alignment);
+					size_t area = size_t(width) * height, bestArea = size_t(bestWidth) * bestHeight;
+					if (area < bestArea || (area == bestArea && std::abs(width - height) < std::abs(bestWidth - bestHeight))) {
+						bestWidth = width;
+						bestHeight = height;
+					}
+				}
+				packAll(members, placements, bestWidth, bestHeight);
+
+				size_t texels = 0;
+				for (int i : members)
+					texels += size_t(images[i].width) * images[i].height;
+				if (members.size() < 2 || float(texels) < settings.minOccupancy * bestWidth * bestHeight) {
+					// not worth an atlas: leave the largest alone and try again with the rest
+					remaining.erase(std::find(remaining.begin(), remaining.end(), members.front()));
+					continue;
+				}
+
+				ImageData atlas;
+				atlas.path = "atlas" + std::to_string(atlases.size());
+				atlas.width = bestWidth;
+				atlas.height = bestHeight;
+				atlas.nrChannels = 3;
+				atlas.pixels.assign(size_t(bestWidth) * bestHeight * 3, 0);
+				for (int i : members) {
+					AtlasPlacement& placement = placements[i];
+					placement.atlas = (int)atlases.size();
+					placement.rect = glm::vec4(float(placement.blockX + settings.gutter) / bestWidth, float(placement.blockY + settings.gutter) / bestHeight,
+						float(images[i].width) / bestWidth, float(images[i].height) / bestHeight);
+					copyBlock(images[i], placement, settings.gutter, atlas.pixels.data(), bestWidth, placement.blockX, placement.blockY);
+				}
+				atlases.push_back(std::move(atlas));
+
+				stats.texturesPacked += (unsigned int)members.size();
+				++stats.atlases;
+				stats.texelsPacked += texels;
+				stats.atlasTexels += size_t(bestWidth) * bestHeight;
+				remaining = rest;
+			}
+
+			return atlases;
+		}
+};
+
+#endif
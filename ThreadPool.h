@@ -0,0 +1,140 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// <summary>
+/// Worker threads that stay alive for the whole program, for splitting per-frame CPU work (culling, baking) across cores
+/// without paying for thread creation every time. There is one shared instance: ThreadPool::get().
+/// </summary>
+class ThreadPool
+{
+	private:
+		std::vector<std::thread> workers;
+		std::mutex mutex;
+		std::condition_variable wake;		// a job was posted (or the pool is stopping)
+		std::condition_variable finished;	// the last worker left the current job
+
+		const std::function<void(size_t)>* job;
+		size_t jobCount;
+		std::atomic<size_t> nextIndex;
+		unsigned int activeWorkers;
+		unsigned long long generation;		// bumped for every job, so workers don't run the same one twice
+		bool stopping;
+
+		static bool& isWorkerThread(void)
+		{
+			thread_local bool worker = false;
+			return worker;
+		}
+
+		/// <summary>
+		/// Claims and runs indices of the current job until there are none left
+		/// </summary>
+		void runJob(const std::function<void(size_t)>& body, size_t count)
+		{
+			for (size_t i = nextIndex++; i < count; i = nextIndex++)
+				body(i);
+		}
+
+		void workerLoop(void)
+		{
+			isWorkerThread() = true;
+			unsigned long long seen = 0;
+			while (true) {
+				const std::function<void(size_t)>* body;
+				size_t count;
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					wake.wait(lock, [&] { return stopping || generation != seen; });
+					if (stopping)
+						return;
+					seen = generation;
+					if (!job)
+						continue;		// woke up after the job had already been finished by the others
+					body = job;
+					count = jobCount;
+					++activeWorkers;
+				}
+
+				runJob(*body, count);
+
+				std::lock_guard<std::mutex> lock(mutex);
+				if (--activeWorkers == 0)
+					finished.notify_all();
+			}
+		}
+
+		ThreadPool() : job{ nullptr }, jobCount{ 0 }, nextIndex{ 0 }, activeWorkers{ 0 }, generation{ 0 }, stopping{ false }
+		{
+			unsigned int threads = std::thread::hardware_concurrency();
+			for (unsigned int i = 1; i < threads; ++i)		// the calling thread works too
+				workers.emplace_back(&ThreadPool::workerLoop, this);
+		}
+
+	public:
+		static ThreadPool& get(void)
+		{
+			static ThreadPool pool;
+			return pool;
+		}
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		~ThreadPool()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stopping = true;
+			}
+			wake.notify_all();
+			for (std::thread& worker : workers)
+				worker.join();
+		}
+
+		/// <summary>
+		/// Number of threads that work on a parallelFor (the workers plus the calling thread)
+		/// </summary>
+		unsigned int size(void) const
+		{
+			return (unsigned int)workers.size() + 1;
+		}
+
+		/// <summary>
+		/// Calls body(i) for every i in [0, count), spread over the pool, and returns once they've all finished.
+		/// Indices are handed out one at a time, so each one should be a decent chunk of work.
+		/// NOTE: Only one parallelFor runs at a time; calls from inside a body (or from other threads) run serially instead.
+		/// </summary>
+		void parallelFor(size_t count, const std::function<void(size_t)>& body)
+		{
+			std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
+			if (count <= 1 || workers.empty() || isWorkerThread() || !lock.owns_lock() || job != nullptr) {
+				if (lock.owns_lock())
+					lock.unlock();
+				for (size_t i = 0; i < count; ++i)
+					body(i);
+				return;
+			}
+
+			job = &body;
+			jobCount = count;
+			nextIndex = 0;
+			++generation;
+			lock.unlock();
+			wake.notify_all();
+
+			runJob(body, count);
+
+			lock.lock();
+			finished.wait(lock, [&] { return activeWorkers == 0; });
+			job = nullptr;
+		}
+};
+
+#endif
@@ -0,0 +1,369 @@
+#ifndef TRIANGLE_SCENE_H
+#define TRIANGLE_SCENE_H
+
+#include <cmath>
+#include <climits>
+#include <vector>
+#include <glm/glm/glm.hpp>
+#include "Bounds.h"
+#include "Object.h"
+#include "SceneBVH.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TRIANGLE_SCENE_SSE
+#include <xmmintrin.h>
+#endif
+
+/// <summary>
+/// Every triangle of a set of objects in world space, in a SceneBVH, for casting rays against the real geometry on the CPU
+/// (visibility and lighting bakes). Rays can be cast from several threads at once.
+/// Rays don't walk the SceneBVH itself: build() collapses it into a 4-wide tree, whose nodes keep their four children's boxes
+/// side by side so one ray is tested against all four with SSE, and rays are traced with a fixed-size stack instead of a
+/// vector per ray. Bakes cast millions of rays, so both matter.
+/// </summary>
+class TriangleScene
+{
+	public:
+		struct Triangle {
+			glm::vec3 v0;
+			glm::vec3 edge1;	// v1 - v0
+			glm::vec3 edge2;	// v2 - v0
+			int object;			// index in the vector passed to build()
+			int mesh;			// index in the object's model
+			int primitive;		// which triangle of the mesh (its indices start at 3 * primitive)
+		};
+
+		struct Hit {
+			int triangle = -1;
+			float distance = INFINITY;
+			float u = 0.0f, v = 0.0f;		// barycentric weights of the triangle's second and third vertices
+		};
+
+	private:
+		// four children's boxes, one float per child in each array (empty slots have min > max)
+		struct WideNode {
+			float minX[4], minY[4], minZ[4];
+			float maxX[4], maxY[4], maxZ[4];
+			int children[4];		// another WideNode, ~triangle (so triangles are negative), or EMPTY_CHILD
+		};
+
+		static const int EMPTY_CHILD = INT_MIN;
+		static const int STACK_SIZE = 256;		// each level pushes at most 3 nodes, so this holds any tree up to 85 levels deep
+
+		std::vector<Triangle> triangles;
+		std::vector<size_t> objectTriangles;	// where each object's triangles start (with the total at the end)
+		SceneBVH bvh;
+		std::vector<WideNode> wideNodes;		// empty if the SceneBVH was too deep for the stack (rays walk the SceneBVH then)
+
+		/// <summary>
+		/// Möller-Trumbore ray/triangle test; returns the distance along the ray to the hit, or INFINITY if it misses
+		/// (or hits further away than maxDistance)
+		/// </summary>
+		static float intersectTriangle(const Triangle& triangle, const glm::vec3& origin, const glm::vec3& direction, float maxDistance, float& u, float& v)
+		{
+			glm::vec3 p = glm::cross(direction, triangle.edge2);
+			float determinant = glm::dot(triangle.edge1, p);
+			if (std::fabs(determinant) < 1e-12f)
+				return INFINITY;		// parallel to the triangle
+
+			float inverseDeterminant = 1.0f / determinant;
+			glm::vec3 t = origin - triangle.v0;
+			u = glm::dot(t, p) * inverseDeterminant;
+			if (u < 0.0f || u > 1.0f)
+				return INFINITY;
+
+			glm::vec3 q = glm::cross(t, triangle.edge1);
+			v = glm::dot(direction, q) * inverseDeterminant;
+			if (v < 0.0f || u + v > 1.0f)
+				return INFINITY;
+
+			float distance = glm::dot(triangle.edge2, q) * inverseDeterminant;
+			return distance > 0.0f && distance <= maxDistance ? distance : INFINITY;
+		}
+
+		/// <summary>
+		/// Turns the SceneBVH subtree under a node into wide nodes: the node's two children are opened up (largest box first)
+		/// until there are four, and each of those that isn't a leaf becomes a wide node of its own
+		/// </summary>
+		/// <returns>The wide node's index</returns>
+		int collapse(int node, int depth, int& maxDepth)
+		{
+			maxDepth = std::max(maxDepth, depth);
+			const SceneBVH::Node& n = bvh.getNode(node);
+
+			int gathered[4] = { node };
+			int count = 1;
+			if (!n.isLeaf()) {
+				gathered[0] = n.left;
+				gathered[1] = n.right;
+				count = 2;
+			}
+			while (count < 4) {
+				int largest = -1;
+				float largestArea = -1.0f;
+				for (int i = 0; i < count; ++i) {
+					const SceneBVH::Node& child = bvh.getNode(gathered[i]);
+					glm::vec3 size = child.bounds.empty() ? glm::vec3(0.0f) : child.bounds.max - child.bounds.min;
+					float area = size.x * size.y + size.y * size.z + size.z * size.x;
+					if (!child.isLeaf() && area > largestArea) {
+						largest = i;
+						largestArea = area;
+					}
+				}
+				if (largest < 0)
+					break;
+				const SceneBVH::Node& opened = bvh.getNode(gathered[largest]);
+				gathered[largest] = opened.left;
+				gathered[count++] = opened.right;
+			}
+
+			int index = (int)wideNodes.size();
+			wideNodes.push_back(WideNode());
+			for (int i = 0; i < 4; ++i) {
+				const SceneBVH::Node* child = i < count ? &bvh.getNode(gathered[i]) : nullptr;
+				int entry = EMPTY_CHILD;
+				if (child && !child->bounds.empty())
+					entry = child->isLeaf() ? ~child->item : collapse(gathered[i], depth + 1, maxDepth);
+
+				WideNode& wide = wideNodes[index];		// collapse() may have moved it
+				wide.children[i] = entry;
+				AABB box = entry != EMPTY_CHILD ? child->bounds : AABB();
+				wide.minX[i] = box.min.x;
+				wide.minY[i] = box.min.y;
+				wide.minZ[i] = box.min.z;
+				wide.maxX[i] = box.max.x;
+				wide.maxY[i] = box.max.y;
+				wide.maxZ[i] = box.max.z;
+			}
+			return index;
+		}
+
+		/// <summary>
+		/// Tests a ray against a wide node's four boxes
+		/// </summary>
+		/// <param name="distances">Set to the distance to each box the ray enters</param>
+		/// <returns>Bit i is set if the ray enters child i's box within maxDistance</returns>
+		static int intersectBoxes(const WideNode& node, const glm::vec3& origin, const glm::vec3& inverseDirection, float maxDistance, float* distances)
+		{
+#ifdef TRIANGLE_SCENE_SSE
+			__m128 originX = _mm_set1_ps(origin.x), originY = _mm_set1_ps(origin.y), originZ = _mm_set1_ps(origin.z);
+			__m128 inverseX = _mm_set1_ps(inverseDirection.x), inverseY = _mm_set1_ps(inverseDirection.y), inverseZ = _mm_set1_ps(inverseDirection.z);
+			__m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minX), originX), inverseX);
+			__m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxX), originX), inverseX);
+			__m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minY), originY), inverseY);
+			__m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxY), originY), inverseY);
+			__m128 t0z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minZ), originZ), inverseZ);
+			__m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxZ), originZ), inverseZ);
+
+			__m128 enter = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)), _mm_max_ps(_mm_min_ps(t0z, t1z), _mm_setzero_ps()));
+			__m128 exit = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)), _mm_min_ps(_mm_max_ps(t0z, t1z), _mm_set1_ps(maxDistance)));
+			_mm_storeu_ps(distances, enter);
+			return _mm_movemask_ps(_mm_cmple_ps(enter, exit));
+#else
+			int mask = 0;
+			for (int i = 0; i < 4; ++i) {
+				float t0x = (node.minX[i] - origin.x) * inverseDirection.x, t1x = (node.maxX[i] - origin.x) * inverseDirection.x;
+				float t0y = (node.minY[i] - origin.y) * inverseDirection.y, t1y = (node.maxY[i] - origin.y) * inverseDirection.y;
+				float t0z = (node.minZ[i] - origin.z) * inverseDirection.z, t1z = (node.maxZ[i] - origin.z) * inverseDirection.z;
+				float enter = std::max(std::max(std::min(t0x, t1x), std::min(t0y, t1y)), std::max(std::min(t0z, t1z), 0.0f));
+				float exit = std::min(std::min(std::max(t0x, t1x), std::max(t0y, t1y)), std::min(std::max(t0z, t1z), maxDistance));
+				distances[i] = enter;
+				if (enter <= exit)
+					mask |= 1 << i;
+			}
+			return mask;
+#endif
+		}
+
+		/// <summary>
+		/// Walks the wide nodes: children are visited nearest first, and triangles are tested as soon as their box is entered
+		/// </summary>
+		/// <returns>The triangle hit, or -1</returns>
+		int traceWide(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, bool anyHit, float& distance, float& u, float& v) const
+		{
+			struct Entry {
+				int node;
+				float distance;		// to its box
+			};
+			Entry stack[STACK_SIZE];
+			int size = 0;
+			stack[size++] = { 0, 0.0f };
+
+			glm::vec3 inverseDirection = 1.0f / direction;
+			distance = maxDistance;
+			int hit = -1;
+
+			while (size > 0) {
+				Entry entry = stack[--size];
+				if (entry.distance > distance)
+					continue;		// something closer was hit since this was pushed
+
+				const WideNode& node = wideNodes[entry.node];
+				float boxDistances[4];
+				int mask = intersectBoxes(node, origin, inverseDirection, distance, boxDistances);
+
+				// the children the ray enters, nearest first
+				int order[4];
+				int count = 0;
+				for (int i = 0; i < 4; ++i) {
+					if (!(mask & (1 << i)) || node.children[i] == EMPTY_CHILD)
+						continue;
+					int j = count++;
+					for (; j > 0 && boxDistances[order[j - 1]] > boxDistances[i]; --j)
+						order[j] = order[j - 1];
+					order[j] = i;
+				}
+
+				for (int k = 0; k < count; ++k) {
+					int child = node.children[order[k]];
+					if (child >= 0 || boxDistances[order[k]] > distance)
+						continue;
+					float triangleU, triangleV;
+					float triangleDistance = intersectTriangle(triangles[~child], origin, direction, distance, triangleU, triangleV);
+					if (triangleDistance != INFINITY && triangleDistance <= distance) {
+						hit = ~child;
+						distance = triangleDistance;
+						u = triangleU;
+						v = triangleV;
+						if (anyHit)
+							return hit;
+					}
+				}
+
+				// farthest first, so the nearest is popped next
+				for (int k = count - 1; k >= 0; --k) {
+					int child = node.children[order[k]];
+					if (child >= 0 && boxDistances[order[k]] <= distance)
+						stack[size++] = { child, boxDistances[order[k]] };
+				}
+			}
+			return hit;
+		}
+
+	public:
+		/// <summary>
+		/// Collects and indexes the triangles of every object with a loaded model
+		/// </summary>
+		void build(const std::vector<Object*>& objects)
+		{
+			triangles.clear();
+			objectTriangles.clear();
+			std::vector<AABB> boxes;
+
+			for (size_t i = 0; i < objects.size(); ++i) {
+				objectTriangles.push_back(triangles.size());
+				if (!objects[i]->getModel().isLoaded())
+					continue;
+
+				const glm::mat4& matrix = objects[i]->getMatrix();
+				const std::vector<Mesh>& meshes = objects[i]->getModel().getMeshes();
+				for (size_t j = 0; j < meshes.size(); ++j) {
+					const std::vector<Vertex>& vertices = meshes[j].vertices;
+					const std::vector<unsigned int>& indices = meshes[j].indices;
+					for (size_t k = 0; k + 2 < indices.size(); k += 3) {
+						glm::vec3 a = glm::vec3(matrix * glm::vec4(vertices[indices[k]].Position, 1.0f));
+						glm::vec3 b = glm::vec3(matrix * glm::vec4(vertices[indices[k + 1]].Position, 1.0f));
+						glm::vec3 c = glm::vec3(matrix * glm::vec4(vertices[indices[k + 2]].Position, 1.0f));
+
+						Triangle triangle;
+						triangle.v0 = a;
+						triangle.edge1 = b - a;
+						triangle.edge2 = c - a;
+						triangle.object = (int)i;
+						triangle.mesh = (int)j;
+						triangle.primitive = (int)(k / 3);
+						triangles.push_back(triangle);
+
+						AABB box;
+						box.expand(a);
+						box.expand(b);
+						box.expand(c);
+						boxes.push_back(box);
+					}
+				}
+			}
+			objectTriangles.push_back(triangles.size());
+
+			bvh.build(boxes);
+
+			wideNodes.clear();
+			if (bvh.getRoot() != SceneBVH::NULL_NODE) {
+				int maxDepth = 0;
+				collapse(bvh.getRoot(), 1, maxDepth);
+				if (3 * maxDepth + 1 > STACK_SIZE)
+					wideNodes.clear();		// rare (the tree is built with SAH); rays just walk the SceneBVH instead
+			}
+		}
+
+		/// <summary>
+		/// Finds the closest triangle along a ray
+		/// </summary>
+		/// <param name="direction">Doesn't have to be normalized; distances are in multiples of its length</param>
+		/// <returns>Whether anything was hit</returns>
+		bool intersect(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, Hit& hit) const
+		{
+			float u = 0.0f, v = 0.0f, distance;
+			int triangle;
+			if (!wideNodes.empty())
+				triangle = traceWide(origin, direction, maxDistance, false, distance, u, v);
+			else {
+				static thread_local std::vector<std::pair<int, float>> stack;		// rays are cast from the bakes' worker threads
+				triangle = bvh.raycast(origin, direction, maxDistance, distance, [&](int item, float, float closest) {
+					float itemU = 0.0f, itemV = 0.0f;
+					float itemDistance = intersectTriangle(triangles[item], origin, direction, closest, itemU, itemV);
+					if (itemDistance <= closest) {
+						u = itemU;
+						v = itemV;
+					}
+					return itemDistance;
+				}, false, stack);
+			}
+
+			hit = Hit();
+			if (triangle < 0)
+				return false;
+			hit.triangle = triangle;
+			hit.distance = distance;
+			hit.u = u;
+			hit.v = v;
+			return true;
+		}
+
+		/// <summary>
+		/// Whether any triangle is in the way within maxDistance along a ray (cheaper than intersect(), since any hit will do)
+		/// </summary>
+		bool occluded(const glm::vec3& origin, const glm::vec3& direction, float maxDistance) const
+		{
+			float distance;
+			if (!wideNodes.empty()) {
+				float u, v;
+				return traceWide(origin, direction, maxDistance, true, distance, u, v) >= 0;
+			}
+			static thread_local std::vector<std::pair<int, float>> stack;
+			return bvh.raycast(origin, direction, maxDistance, distance, [&](int item, float, float closest) {
+				float u, v;
+				return intersectTriangle(triangles[item], origin, direction, closest, u, v);
+			}, true, stack) >= 0;
+		}
+
+		const Triangle& getTriangle(int triangle) const
+		{
+			return triangles[triangle];
+		}
+
+		size_t getTriangleCount(void) const
+		{
+			return triangles.size();
+		}
+
+		/// <summary>
+		/// An object's triangles are [getFirstTriangle(object), getFirstTriangle(object + 1))
+		/// </summary>
+		/// <param name="object">Index in the vector passed to build() (or the number of objects, for the end of the last one)</param>
+		size_t getFirstTriangle(size_t object) const
+		{
+			return objectTriangles[object];
+		}
+};
+
+#endif
@@ -0,0 +1,259 @@
+#ifndef VERTEX_OCCLUSION_H
+#define VERTEX_OCCLUSION_H
+
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm/glm.hpp>
+#include "GLState.h"
+#include "ShaderProgram.h"
+#include "Object.h"
+#include "Lightmaps.h"
+#include "ThreadPool.h"
+#include "TriangleScene.h"
+
+/// <summary>
+/// Baked ambient occlusion and sun visibility per vertex of the static objects: a cheaper stand-in for Lightmaps (no unwrap,
+/// no lightmap, no extra shader variant) that still keeps the flat ambient term out of corners and from under things.
+/// Every vertex casts rays on the CPU (chunks of vertices on the ThreadPool, against a TriangleScene of the static objects):
+/// cosine-weighted ones over its hemisphere that count as blocked if they hit anything within settings.distance, and ones
+/// toward the sun (spread over its disc) that count as blocked if they hit anything at all. The two shares are stored as
+/// bytes in Vertex::Occlusion, which the shaders use to scale the ambient term and in place of the shadow map past the last
+/// cascade (or with shadows off), for no per-pixel cost beyond interpolating them.
+/// Occlusion depends on where an object is, so it's kept per object rather than in the (shared) model, and reaches the GPU
+/// two ways: through the static batches' world-space copies of the vertices (pass it to StaticBatcher::build()), and for
+/// static objects drawn outside the batches (hidden by their last occlusion query, or with batching off), through a texture
+/// buffer of every baked object's bytes that the vertex shader reads in place of the model's (shared, open) ones. Each
+/// object's run of it is placed so that its offset (in ObjectConstants) plus gl_VertexID, which counts from the start of
+/// the GeometryBuffer, lands on the vertex's bytes; runs start past the highest vertex baked, so no offset is negative.
+/// NOTE: Bake again whenever the static objects (or their models, or the sun) change, then rebuild the batches
+/// </summary>
+class VertexOcclusion
+{
+	public:
+		struct Settings {
+			int samplesPerVertex;	// rays over the hemisphere, and again toward the sun
+			float distance;			// how far away (world units) something can be and still occlude ambient light
+			float sunRadius;		// angular radius of the sun in degrees (how soft the visibility is)
+			float rayOffset;		// rays start this far off the vertex along its normal (world units), so they don't hit its own triangles
+
+			Settings() : samplesPerVertex{ 64 }, distance{ 3.0f }, sunRadius{ 1.0f }, rayOffset{ 0.01f } {}
+		};
+
+		struct Stats {
+			unsigned int objects = 0;
+			size_t vertices = 0;
+			unsigned long long rays = 0;
+			float bakeMilliseconds = 0.0f;
+		};
+
+	private:
+		static const size_t VERTICES_PER_JOB = 256;		// handed to the ThreadPool at a time
+
+		// a run of one mesh's vertices
+		struct Job {
+			size_t object;
+			size_t mesh;
+			size_t first;
+			size_t count;
+		};
+
+		Settings settings;
+		std::vector<std::vector<std::vector<unsigned char>>> occlusion;		// per object, per mesh: 2 per vertex (none if it wasn't baked)
+		Stats lastStats;
+		unsigned int buffer;		// the texture buffer's data, for draws outside the static batches
+		unsigned int texture;
+		std::vector<unsigned char> stream;		// reused by upload()
+
+		/// <summary>
+		/// Casts one vertex's rays
+		/// </summary>
+		/// <param name="result">Where its two bytes go</param>
+		void bakeVertex(const glm::vec3& position, const glm::vec3& normal, size_t seed, const TriangleScene& scene, const glm::vec3& sunDirection,
+			unsigned char* result, unsigned long long& rays) const
+		{
+			std::mt19937 random((unsigned int)seed);		// seeded per vertex, so bakes are repeatable
+			std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+			float cosSunRadius = std::cos(glm::radians(settings.sunRadius));
+			glm::vec3 origin = position + normal * settings.rayOffset;
+			int samples = std::max(settings.samplesPerVertex, 1);
+
+			int skyBlocked = 0;
+			for (int s = 0; s < samples; ++s) {
+				++rays;
+				if (scene.occluded(origin, Lightmaps::cosineDirection(normal, unit(random), unit(random)), settings.distance))
+					++skyBlocked;
+			}
+
+			int sunBlocked = samples;		// facing away from the sun, it's all blocked
+			if (glm::dot(normal, sunDirection) > 0.0f) {
+				sunBlocked = 0;
+				for (int s = 0; s < samples; ++s) {
+					++rays;
+					if (scene.occluded(origin, Lightmaps::coneDirection(sunDirection, cosSunRadius, unit(random), unit(random)), INFINITY))
+						++sunBlocked;
+				}
+			}
+
+			result[0] = (unsigned char)(skyBlocked * 255 / samples);
+			result[1] = (unsigned char)(sunBlocked * 255 / samples);
+		}
+
+		/// <summary>
+		/// Lays the baked objects' bytes out in the texture buffer, and gives each object its offset into it
+		/// </summary>
+		void upload(const std::vector<Object*>& objects)
+		{
+			// every baked object's run covers its meshes' vertices in the GeometryBuffer, from its first to past its last
+			std::vector<size_t> firstVertices(objects.size(), 0), endVertices(objects.size(), 0);
+			size_t start = 0;
+			for (size_t i = 0; i < objects.size(); ++i) {
+				const std::vector<Mesh>& meshes = objects[i]->getModel().getMeshes();
+				firstVertices[i] = SIZE_MAX;
+				for (size_t j = 0; j < meshes.size(); ++j) {
+					const GeometryRange& range = meshes[j].getGeometry();
+					if (get(i, j, range.vertexCount)) {
+						firstVertices[i] = std::min(firstVertices[i], range.baseVertex);
+						endVertices[i] = std::max(endVertices[i], range.baseVertex + range.vertexCount);
+					}
+				}
+				start = std::max(start, endVertices[i]);
+			}
+
+			stream.clear();
+			for (size_t i = 0; i < objects.size(); ++i) {
+				if (firstVertices[i] == SIZE_MAX) {
+					objects[i]->setOcclusionOffset(-1);
+					continue;
+				}
+				size_t runStart = start + stream.size() / 2;
+				objects[i]->setOcclusionOffset((int)(runStart - firstVertices[i]));
+				stream.resize(stream.size() + (endVertices[i] - firstVertices[i]) * 2, 0);
+
+				const std::vector<Mesh>& meshes = objects[i]->getModel().getMeshes();
+				for (size_t j = 0; j < meshes.size(); ++j) {
+					const GeometryRange& range = meshes[j].getGeometry();
+					const unsigned char* baked = get(i, j, range.vertexCount);
+					if (baked)
+						std::copy(baked, baked + range.vertexCount * 2, stream.begin() + (runStart - start + range.baseVertex - firstVertices[i]) * 2);
+				}
+			}
+
+			if (texture == 0) {
+				glGenBuffers(1, &buffer);
+				glGenTextures(1, &texture);
+				GLState::get().bindBuffer(GL_TEXTURE_BUFFER, buffer);
+				GLState::get().bindTexture(VERTEX_OCCLUSION_UNIT, GL_TEXTURE_BUFFER, texture);
+				glTexBuffer(GL_TEXTURE_BUFFER, GL_RG8, buffer);
+			}
+			int maxTexels = 0;
+			glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+			if (start + stream.size() / 2 > (size_t)maxTexels)
+				std::cout << "ERROR: The baked occlusion is bigger than a texture buffer can be (" << maxTexels << " texels)" << std::endl;
+
+			// the part before the first run is never read, so it's left unset
+			GLState::get().bindBuffer(GL_TEXTURE_BUFFER, buffer);
+			glBufferData(GL_TEXTURE_BUFFER, start * 2 + stream.size(), NULL, GL_STATIC_DRAW);
+			if (!stream.empty())
+				glBufferSubData(GL_TEXTURE_BUFFER, start * 2, stream.size(), stream.data());
+		}
+
+	public:
+		VertexOcclusion() : buffer{ 0 }, texture{ 0 }
+		{
+		}
+
+		/// <summary>
+		/// Bakes every static object's vertices, against all of the static objects, and uploads them for draws outside the static batches
+		/// </summary>
+		/// <param name="objects">The objects that will be passed to StaticBatcher::build() (ones that aren't static are skipped, and don't occlude)</param>
+		/// <param name="sunDirection">Toward the sun</param>
+		void bake(const std::vector<Object*>& objects, const glm::vec3& sunDirection, const Settings& bakeSettings = Settings())
+		{
+			auto start = std::chrono::steady_clock::now();
+			settings = bakeSettings;
+			glm::vec3 toSun = glm::normalize(sunDirection);
+
+			std::vector<Object*> staticObjects;
+			for (Object* object : objects) {
+				if (object->isStatic() && object->getModel().isLoaded())
+					staticObjects.push_back(object);
+			}
+			TriangleScene scene;
+			scene.build(staticObjects);
+
+			Stats stats;
+			std::vector<Job> jobs;
+			occlusion.assign(objects.size(), std::vector<std::vector<unsigned char>>());
+			for (size_t i = 0; i < objects.size(); ++i) {
+				if (!objects[i]->isStatic() || !objects[i]->getModel().isLoaded())
+					continue;
+				++stats.objects;
+
+				const std::vector<Mesh>& meshes = objects[i]->getModel().getMeshes();
+				occlusion[i].resize(meshes.size());
+				for (size_t j = 0; j < meshes.size(); ++j) {
+					size_t count = meshes[j].vertices.size();
+					occlusion[i][j].assign(count * 2, 0);
+					for (size_t first = 0; first < count; first += VERTICES_PER_JOB)
+						jobs.push_back({ i, j, first, std::min(count - first, (size_t)VERTICES_PER_JOB) });
+					stats.vertices += count;
+				}
+			}
+
+			std::vector<unsigned long long> jobRays(jobs.size(), 0);
+			ThreadPool::get().parallelFor(jobs.size(), [&](size_t index) {
+				const Job& job = jobs[index];
+				const glm::mat4& matrix = objects[job.object]->getMatrix();
+				glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(matrix)));
+				const std::vector<Vertex>& vertices = objects[job.object]->getModel().getMeshes()[job.mesh].vertices;
+				unsigned char* result = occlusion[job.object][job.mesh].data();
+
+				for (size_t k = job.first; k < job.first + job.count; ++k) {
+					glm::vec3 position = glm::vec3(matrix * glm::vec4(vertices[k].Position, 1.0f));
+					glm::vec3 normal = glm::normalize(normalMatrix * vertices[k].Normal);
+					bakeVertex(position, normal, index * VERTICES_PER_JOB + (k - job.first), scene, toSun, result + k * 2, jobRays[index]);
+				}
+			});
+
+			for (unsigned long long rays : jobRays)
+				stats.rays += rays;
+			upload(objects);
+			stats.bakeMilliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+			lastStats = stats;
+		}
+
+		/// <summary>
+		/// One mesh's baked occlusion, 2 bytes per vertex in Vertex::Occlusion's order
+		/// </summary>
+		/// <param name="object">Index in the vector that was baked</param>
+		/// <param name="vertexCount">How many vertices the mesh has now</param>
+		/// <returns>Null if the mesh wasn't baked, or has changed since (its model was reloaded)</returns>
+		const unsigned char* get(size_t object, size_t mesh, size_t vertexCount) const
+		{
+			if (object >= occlusion.size() || mesh >= occlusion[object].size() || occlusion[object][mesh].size() != vertexCount * 2)
+				return nullptr;
+			return occlusion[object][mesh].data();
+		}
+
+		/// <summary>
+		/// Binds the texture buffer to the unit the vertex shader's vertexOcclusion sampler reads from
+		/// </summary>
+		void bind(void) const
+		{
+			if (texture != 0)
+				GLState::get().bindTexture(VERTEX_OCCLUSION_UNIT, GL_TEXTURE_BUFFER, texture);
+		}
+
+		const Stats& getLastBakeStats(void) const
+		{
+			return lastStats;
+		}
+};
+
+#endif
@@ -1,21 +1,92 @@
 #version 330 core
 
+// 0 = per-pixel lighting, 1 = per-vertex lighting, 2 = per-vertex diffuse only (see ShaderLOD.h)
+#ifndef SHADER_LOD
+#define SHADER_LOD 0
+#endif
+
+// 1 = the sun and sky are read from the baked lightmap (static objects at full detail, see Lightmaps.h)
+#ifndef LIGHTMAP
+#define LIGHTMAP 0
+#endif
+
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
+layout (location = 3) in int aObjectIndex;		// per instance when drawn instanced (see Mesh::DrawInstanced)
+layout (location = 4) in int aMaterialIndex;	// entry in MaterialTable; also per instance when drawn instanced
+#if LIGHTMAP
+layout (location = 5) in vec2 aLightmapCoords;	// in the model's charts (see LightmapCharts.h)
+#endif
+layout (location = 6) in vec2 aOcclusion;		// baked share of the sky and the sun that's blocked (see VertexOcclusion.h)
 
 out vec2 TexCoords;
+flat out int MaterialIndex;
 out vec3 FragPos;
 out vec3 Normal;
+out vec2 Occlusion;
+#if LIGHTMAP
+out vec2 LightmapCoords;
+#endif
+
+// per-object matrices, computed once per frame on the CPU (see ObjectConstants.h for the layout)
+uniform samplerBuffer objectData;
+
+// the static objects' baked occlusion, for their draws outside the static batches (see VertexOcclusion.h)
+uniform samplerBuffer vertexOcclusion;
+
+invariant gl_Position;		// same depths as DepthVertexShader.vert, for drawing after a depth pre-pass
+
+#if SHADER_LOD > 0
+out vec2 Lighting;		// diffuse and specular factors, computed here instead of per fragment
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+struct SunLight 
+{
+	vec3 position;
+	float ambientIntensity;
+	vec3 ambientColor;
+	vec3 diffuse;
+	vec3 specular;
+	int shininess;
+};
+
+layout (std140) uniform FrameData		// must match FragmentShader.frag and FrameData.h
+{
+	SunLight sunlight;
+	vec3 viewPos;
+};
+#endif
 
 void main()
 {
-	gl_Position = projection * view * model * vec4(aPos, 1.0);
+	int base = aObjectIndex * 12;
+	mat4 mvp = mat4(texelFetch(objectData, base), texelFetch(objectData, base + 1), texelFetch(objectData, base + 2), texelFetch(objectData, base + 3));
+	mat4 model = mat4(texelFetch(objectData, base + 4), texelFetch(objectData, base + 5), texelFetch(objectData, base + 6), texelFetch(objectData, base + 7));
+	mat3 normalMatrix = mat3(texelFetch(objectData, base + 8).xyz, texelFetch(objectData, base + 9).xyz, texelFetch(objectData, base + 10).xyz);
+
+	gl_Position = mvp * vec4(aPos, 1.0);
 	TexCoords = aTexCoords;
+	MaterialIndex = aMaterialIndex;
 	FragPos = (model * vec4(aPos, 1.0)).xyz;	// only need to put the fragment position in world space before passing to fragment shader
-	Normal = mat3(transpose(inverse(model))) * aNormal;		// multiplies normal by a normal matrix to account for non-uniform scaling
+	Normal = normalMatrix * aNormal;		// normal matrix accounts for non-uniform scaling
+	float occlusionOffset = texelFetch(objectData, base + 8).w;		// gl_VertexID counts from the start of the GeometryBuffer
+	Occlusion = occlusionOffset >= 0.0 ? texelFetch(vertexOcclusion, int(occlusionOffset) + gl_VertexID).xy : aOcclusion;
+
+#if LIGHTMAP
+	vec4 lightmapRect = texelFetch(objectData, base + 11);		// where the object's charts are in the lightmap
+	LightmapCoords = lightmapRect.xy + aLightmapCoords * lightmapRect.zw;
+#endif
+
+#if SHADER_LOD > 0
+	vec3 normal = normalize(Normal);
+	vec3 lightDir = normalize(sunlight.position);
+	Lighting.x = max(dot(normal, lightDir), 0.0);
+#if SHADER_LOD == 1
+	vec3 reflectDir = reflect(-lightDir, normal);
+	vec3 viewDir = normalize(viewPos - FragPos);
+	Lighting.y = pow(max(dot(viewDir, reflectDir), 0.0), sunlight.shininess);
+#else
+	Lighting.y = 0.0;
+#endif
+#endif
 }
\ No newline at end of file
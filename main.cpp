@@ -6,11 +6,36 @@
 #include <glm/glm/glm.hpp>
 #include <glm/glm/gtc/type_ptr.hpp>
 #include <cmath>
+#include <algorithm>
+#include <random>
 
 #include "ShaderProgram.h"
 #include "model.h"
 #include "Object.h"
 #include "Skybox.h"
+#include "HotReload.h"
+#include "GLState.h"
+#include "GLExtensions.h"
+#include "RingBuffer.h"
+#include "MaterialTable.h"
+#include "ObjectConstants.h"
+#include "FrameData.h"
+#include "ShaderLOD.h"
+#include "GeometryLOD.h"
+#include "RenderQueue.h"
+#include "FrustumCuller.h"
+#include "SceneBVH.h"
+#include "OcclusionCuller.h"
+#include "PotentiallyVisibleSet.h"
+#include "OcclusionQueries.h"
+#include "HierarchicalLOD.h"
+#include "StaticBatcher.h"
+#include "Impostors.h"
+#include "PassTimers.h"
+#include "ClusteredLights.h"
+#include "CascadedShadows.h"
+#include "Lightmaps.h"
+#include "VertexOcclusion.h"
 
 enum CameraType {
 	FIRST_PERSON,
@@ -22,17 +47,31 @@ const int WINDOW_HEIGHT = 600;
 const float MOVEMENT_SPEED = 4.0f;
 const float GROUND_Y = 1.6f;
 const float PLAYER_HEIGHT = 1.4f;
+const float NEAR_PLANE = 0.1f;
+const float FAR_PLANE = 100.0f;
 const float X_BOUND_LEFT = -2.5f;
 const float X_BOUND_RIGHT = 18.5f;
 const float Z_BOUND_LEFT = -6.5f;
 const float Z_BOUND_RIGHT = 14.5f;
 const CameraType camType = FIRST_PERSON;
+const char* const PVS_FILE = "scene.pvs";		// visibility baked for the walkable area, reused until the scene changes
+const char* const LIGHTMAP_FILE = "scene.lightmap";	// lighting baked for the static objects, reused until the scene changes
+const int POINT_LIGHT_COUNT = 2048;			// small colored lights scattered over the scene (every eighth one a spot light)
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
 void processInput(GLFWwindow* window);
-void initLight(const ShaderProgram& program);
+void initLight(RingBuffer& ring, FrameDataBuffer& frameData);
+void placeLights(std::vector<Light>& lights);
 void enforceBounds(glm::vec3& position);
+void bakeVisibility(PotentiallyVisibleSet& pvs, const std::vector<Object*>& objects, const AABB& region);
+void bakeLightmaps(Lightmaps& lightmaps, const std::vector<Object*>& objects);
+void bakeVertexOcclusion(VertexOcclusion& vertexOcclusion, const std::vector<Object*>& objects);
+const ShaderProgram& selectProgram(ShaderLOD& shaderLOD, const ShaderProgram& lightmappedShaderProgram, const Object& object, const glm::mat4& projection);
+void buildProxies(HierarchicalLOD& hlod, const std::vector<Object*>& scenery, std::vector<Object*>& objects, SceneBVH& sceneIndex);
+void buildStaticBatches(StaticBatcher& staticBatcher, const std::vector<Object*>& objects, const VertexOcclusion& vertexOcclusion);
+void printFrameStats(const RingBuffer& ring, const ShaderLOD& shaderLOD, const GeometryLOD& geometryLOD, const HierarchicalLOD& hlod, const StaticBatcher& staticBatcher, const Impostors& impostors, const RenderQueue& renderQueue, const FrustumCuller& frustumCuller, const OcclusionCuller& occlusionCuller, const OcclusionQueries& occlusionQueries, const PassTimers& passTimers, const ClusteredLights& clusteredLights, const CascadedShadows& cascadedShadows);
 
 // camera information
 /*
@@ -60,17 +99,51 @@ bool firstMouse = true;
 float deltaTime = 0.0f;	
 float lastFrame = 0.0f;
 
-// where the sunlight is coming from
+// per-frame rendering counters get printed once a second while this is on (toggled with F1)
+bool showStats = false;
+float lastStatsTime = 0.0f;
+
+// objects hidden behind others are found with hardware occlusion queries while this is on (toggled with F2)
+bool useOcclusionQueries = true;
+
+// static objects are drawn from merged world-space batches while this is on (toggled with F3)
+bool useStaticBatching = true;
+
+// distant objects that have an impostor are drawn as one while this is on (toggled with F4)
+bool useImpostors = true;
+
+// depth is laid down by a cheap depth-only pass before the lit pass while this is on, so each pixel is lit about once (toggled with F5)
+bool useDepthPrepass = true;
+
+// the point and spot lights are on while this is on (toggled with F6); the sun always is
+bool usePointLights = true;
+
+// the sun casts shadows while this is on (toggled with F7)
+bool useShadows = true;
+
+// static objects read the sun and sky from their baked lightmaps while this is on (toggled with F8)
+bool useLightmaps = true;
+
+// where the sunlight is coming from, and its color (the lightmaps are baked with both)
 const glm::vec3 sunlightPos(-50.0f, 100.0f, 50.0f);
+const glm::vec3 sunlightDiffuse(1.0f, 1.0f, 1.0f);
 
 int main()
 {
 	glfwInit();
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
-	GLFWwindow* window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "OpenGLProject", NULL, NULL);
+	// try for 4.3 (multi-draw indirect), but everything also runs on 3.3
+	const int contextVersions[][2] = { { 4, 3 }, { 3, 3 } };
+	GLFWwindow* window = NULL;
+	for (const auto& version : contextVersions) {
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, version[0]);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, version[1]);
+		glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
+		window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "OpenGLProject", NULL, NULL);
+		if (window != NULL)
+			break;
+	}
 	if (window == NULL) {
 		std::cout << "Failed to create GLFW window" << std::endl;
 		glfwTerminate();
@@ -82,23 +155,52 @@ int main()
 	// set callback functions
 	glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
 	glfwSetCursorPosCallback(window, mouse_callback);
+	glfwSetKeyCallback(window, key_callback);
 
 	// must initialize GLAD before using gl functions
 	if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
 		std::cout << "Failed to initialize GLAD" << std::endl;
 		return -1;
 	}
+	GLExtensions::get().load((GLADloadproc)glfwGetProcAddress);		// whatever the context supports beyond 3.3
 
 	glViewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
 
 	// enable depth testing
-	glEnable(GL_DEPTH_TEST);
+	GLState::get().setEnabled(GL_DEPTH_TEST, true);
+	GLState::get().depthFunc(GL_LEQUAL);		// <= works for both the models and the skybox, so it never has to change mid-frame
 
-	// create model shader program
+	// create model shader program, plus cheaper lighting variants for objects that are small on screen
 	ShaderFile vertexShaderFile("VertexShader.vert", "vertex");
 	ShaderFile fragmentShaderFile("FragmentShader.frag", "fragment");
 	ShaderProgram shaderProgram(vertexShaderFile, fragmentShaderFile);
 
+	vertexShaderFile = ShaderFile("VertexShader.vert", "vertex", ShaderLOD::defines(ShaderLOD::PER_VERTEX));
+	fragmentShaderFile = ShaderFile("FragmentShader.frag", "fragment", ShaderLOD::defines(ShaderLOD::PER_VERTEX));
+	ShaderProgram perVertexShaderProgram(vertexShaderFile, fragmentShaderFile);
+
+	vertexShaderFile = ShaderFile("VertexShader.vert", "vertex", ShaderLOD::defines(ShaderLOD::DIFFUSE_ONLY));
+	fragmentShaderFile = ShaderFile("FragmentShader.frag", "fragment", ShaderLOD::defines(ShaderLOD::DIFFUSE_ONLY));
+	ShaderProgram diffuseOnlyShaderProgram(vertexShaderFile, fragmentShaderFile);
+
+	ShaderLOD shaderLOD(shaderProgram, perVertexShaderProgram, diffuseOnlyShaderProgram);
+
+	// and a variant for static objects whose lighting is baked, which reads the sun and sky from their lightmaps
+	vertexShaderFile = ShaderFile("VertexShader.vert", "vertex", Lightmaps::defines());
+	fragmentShaderFile = ShaderFile("FragmentShader.frag", "fragment", Lightmaps::defines());
+	ShaderProgram lightmappedShaderProgram(vertexShaderFile, fragmentShaderFile);
+
+	// create depth pre-pass shader program (positions only, writes nothing but depth)
+	vertexShaderFile = ShaderFile("DepthVertexShader.vert", "vertex");
+	fragmentShaderFile = ShaderFile("DepthFragmentShader.frag", "fragment");
+	ShaderProgram depthShaderProgram(vertexShaderFile, fragmentShaderFile);
+
+	// create shadow map shader program (positions only, from the sun)
+	vertexShaderFile = ShaderFile("ShadowVertexShader.vert", "vertex");
+	fragmentShaderFile = ShaderFile("ShadowFragmentShader.frag", "fragment");
+	ShaderProgram shadowShaderProgram(vertexShaderFile, fragmentShaderFile);
+	GeometryLOD geometryLOD;		// picks how simplified each object's meshes are, and skips objects too small to see
+
 	// create lightbulb shader program
 	/*vertexShaderFile = ShaderFile("LightbulbVertexShader.vert", "vertex");
 	fragmentShaderFile = ShaderFile("LightbulbFragmentShader.frag", "fragment");
@@ -114,6 +216,21 @@ int main()
 	// stbi_set_flip_vertically_on_load(true);
 
 	Skybox skybox(".bmp", "Skybox Textures", skyboxShaderProgram);
+
+	// create shader program for the bounding boxes drawn by occlusion queries
+	vertexShaderFile = ShaderFile("BoundingBoxVertexShader.vert", "vertex");
+	fragmentShaderFile = ShaderFile("BoundingBoxFragmentShader.frag", "fragment");
+	ShaderProgram boundingBoxShaderProgram(vertexShaderFile, fragmentShaderFile);
+
+	// create shader programs for baking impostors and drawing them
+	vertexShaderFile = ShaderFile("ImpostorBakeVertexShader.vert", "vertex");
+	fragmentShaderFile = ShaderFile("ImpostorBakeFragmentShader.frag", "fragment");
+	ShaderProgram impostorBakeShaderProgram(vertexShaderFile, fragmentShaderFile);
+
+	vertexShaderFile = ShaderFile("ImpostorVertexShader.vert", "vertex");
+	fragmentShaderFile = ShaderFile("ImpostorFragmentShader.frag", "fragment");
+	ShaderProgram impostorShaderProgram(vertexShaderFile, fragmentShaderFile);
+
 	Object house("Textured Models/House2/House2.obj");
 	Object grass("Textured Models/grassground/grassground.obj");
 	Object tree1("Textured Models/Tree/Tree.obj");
@@ -130,11 +247,98 @@ int main()
 	tree2.Translate(13.0f, GROUND_Y, -1.0f);
 	//lightbulb1.Translate(sunlightPos.x, sunlightPos.y, sunlightPos.z);
 
+	// the objects drawn each frame are the scenery followed by the HLOD proxies that stand in for distant groups of it
+	std::vector<Object*> scenery = { &house, &grass, &tree1, &tree2 };
+	std::vector<Object*> objects;
+	HierarchicalLOD hlod;
+	StaticBatcher staticBatcher;		// draws the static objects from world-space geometry merged per material
+	RingBuffer ring;					// every frame's dynamic data (matrices, instances, uniform blocks) is allocated from here
+	ObjectConstants objectConstants;	// per-object matrices, computed on the CPU once per frame
+	FrameDataBuffer frameData;			// light and camera uniforms shared by every model program
+	RenderQueue renderQueue;			// objects submit their meshes here, and they're drawn sorted by state and depth
+	FrustumCuller frustumCuller;		// decides which objects and meshes are on screen
+	SceneBVH sceneIndex;				// objects' world bounds, for culling and spatial queries (objects keep it updated when they move)
+	OcclusionCuller occlusionCuller;	// hides objects behind the occluders (on the CPU, before anything is submitted)
+	OcclusionQueries occlusionQueries(boundingBoxShaderProgram);		// hides objects behind anything that was drawn (on the GPU, a frame behind)
+	Impostors impostors(impostorBakeShaderProgram, impostorShaderProgram);	// draws distant trees as camera-facing quads
+	PassTimers passTimers;				// how long each pass takes on the GPU and CPU
+	ClusteredLights clusteredLights;	// bins the point and spot lights into clusters of the view frustum every frame
+	std::vector<Light> pointLights;
+	const std::vector<Light> noLights;
+	placeLights(pointLights);
+	CascadedShadows cascadedShadows(shadowShaderProgram);		// the sun's shadows, with the far cascades cached between frames
+	std::vector<size_t> hiddenObjects;	// drawn under conditional rendering, since their last occlusion query found them hidden
+	PotentiallyVisibleSet pvs;			// which objects can be seen from each part of the walkable area
+	Lightmaps lightmaps;				// the sun and sky light on the static objects, path traced once
+	VertexOcclusion vertexOcclusion;	// the static objects' ambient occlusion and sun visibility per vertex, for when lightmaps are off
+	std::vector<unsigned char> potentiallyVisible;		// per scenery object
+	std::vector<unsigned char> objectDrawn;				// per object: potentially visible, and not replaced by (or, for proxies, replacing) an HLOD cluster
+	int pvsCell = -2;					// the camera's cell the last time potentiallyVisible was filled in (-1 is outside the area)
+	std::vector<unsigned char> objectVisible;
+	std::vector<Object*> visibleObjects;
+	std::vector<const unsigned char*> batchedMeshes;	// per object: the meshes drawn through staticBatcher (null if it isn't)
+
+	house.setOccluder(true);
+	for (Object* object : scenery)
+		object->setStatic(true);		// placed once above, and never moved
+
+	// small textures were packed into atlases when the models were imported (objects made from the same file share a model, so count each once)
+	TextureAtlas::Stats atlasStats;
+	std::vector<const Model*> packedModels;
+	for (const Object* object : scenery) {
+		if (std::find(packedModels.begin(), packedModels.end(), &object->getModel()) == packedModels.end()) {
+			packedModels.push_back(&object->getModel());
+			atlasStats.add(object->getModel().getAtlasStats());
+		}
+	}
+	std::cout << "Packed " << atlasStats.texturesPacked << " textures into " << atlasStats.atlases << " atlases (" << atlasStats.texturesEliminated()
+		<< " textures eliminated, " << int(atlasStats.occupancy() * 100.0f + 0.5f) << "% occupied)" << std::endl;
+
+	// baked before the static batches are built, since they copy each object's place in the lightmap into their vertices
+	lightmaps.loadSky(skybox);
+	if (!lightmaps.load(LIGHTMAP_FILE, scenery, sunlightPos, sunlightDiffuse))
+		bakeLightmaps(lightmaps, scenery);
+
+	buildProxies(hlod, scenery, objects, sceneIndex);
+	bakeVertexOcclusion(vertexOcclusion, objects);
+	buildStaticBatches(staticBatcher, objects, vertexOcclusion);
+	impostors.add(tree1.getModel());		// shared by both trees
+	std::cout << "Baked tree impostor in " << impostors.getBakeMilliseconds() << " ms" << std::endl;
+	std::vector<AABB> objectBounds;
+	for (const Object* object : objects)
+		objectBounds.push_back(object->getWorldBounds());
+	sceneIndex.build(objectBounds);
+	for (size_t i = 0; i < objects.size(); ++i)
+		objects[i]->setSceneIndex(&sceneIndex, (int)i);
+
+	// the camera stays at eye height inside the bounds (unless it's flying, and then it leaves the baked area)
+	AABB walkableRegion;
+	walkableRegion.min = glm::vec3(X_BOUND_LEFT, GROUND_Y + PLAYER_HEIGHT, Z_BOUND_LEFT);
+	walkableRegion.max = glm::vec3(X_BOUND_RIGHT, GROUND_Y + PLAYER_HEIGHT, Z_BOUND_RIGHT);
+	if (!pvs.load(PVS_FILE, scenery, walkableRegion))
+		bakeVisibility(pvs, scenery, walkableRegion);
+
 	// create projection matrix for the models (doesn't need to be updated every frame)
-	shaderProgram.use();
 	glm::mat4 projection = glm::mat4(1.0f);
-	projection = glm::perspective(glm::radians(45.0f), float(1.0 * WINDOW_WIDTH / WINDOW_HEIGHT), 0.1f, 100.0f);
-	shaderProgram.setUniformMatrix("projection", projection);
+	projection = glm::perspective(glm::radians(45.0f), float(1.0 * WINDOW_WIDTH / WINDOW_HEIGHT), NEAR_PLANE, FAR_PLANE);
+	renderQueue.setDepthRange(NEAR_PLANE, FAR_PLANE);
+
+	// reload shaders, models, and textures when they're edited on disk
+	AssetReloader reloader;
+	reloader.watchShader(shaderProgram, "VertexShader.vert", "FragmentShader.frag");
+	reloader.watchShader(perVertexShaderProgram, "VertexShader.vert", "FragmentShader.frag", ShaderLOD::defines(ShaderLOD::PER_VERTEX));
+	reloader.watchShader(diffuseOnlyShaderProgram, "VertexShader.vert", "FragmentShader.frag", ShaderLOD::defines(ShaderLOD::DIFFUSE_ONLY));
+	reloader.watchShader(lightmappedShaderProgram, "VertexShader.vert", "FragmentShader.frag", Lightmaps::defines());
+	reloader.watchShader(depthShaderProgram, "DepthVertexShader.vert", "DepthFragmentShader.frag");
+	reloader.watchShader(shadowShaderProgram, "ShadowVertexShader.vert", "ShadowFragmentShader.frag");
+	reloader.watchShader(skybox.getShaderProgram(), "SkyboxVertexShader.vert", "SkyboxFragmentShader.frag");
+	reloader.watchShader(occlusionQueries.getShaderProgram(), "BoundingBoxVertexShader.vert", "BoundingBoxFragmentShader.frag");
+	reloader.watchShader(impostors.getShaderProgram(), "ImpostorVertexShader.vert", "ImpostorFragmentShader.frag");
+	reloader.watchModel(house.getModel());
+	reloader.watchModel(grass.getModel());
+	reloader.watchModel(tree1.getModel());
+	reloader.watchModel(tree2.getModel());
+	reloader.start();
 
 	while (!glfwWindowShouldClose(window)) {
 
@@ -144,34 +348,176 @@ int main()
 
 		processInput(window);
 
-		glClear(GL_DEPTH_BUFFER_BIT);
+		GLState::get().beginFrame();
+		ring.beginFrame();		// waits if the GPU is still reading the region this frame is about to write
+		shaderLOD.beginFrame();
+		geometryLOD.beginFrame();
+		passTimers.beginFrame();
+		if (showStats && currentFrame - lastStatsTime >= 1.0f) {
+			lastStatsTime = currentFrame;
+			printFrameStats(ring, shaderLOD, geometryLOD, hlod, staticBatcher, impostors, renderQueue, frustumCuller, occlusionCuller, occlusionQueries, passTimers, clusteredLights, cascadedShadows);
+		}
+		impostors.beginFrame(objects.size());
+		if (useOcclusionQueries)
+			occlusionQueries.beginFrame(objects.size());		// picks up whichever query results have come back
+		else
+			occlusionQueries.reset();
+
+		if (reloader.applyPending() > 0) {		// swap in any reloaded assets at the frame boundary
+			for (Object* object : scenery)
+				object->updateSceneIndex();		// a reloaded model can have different bounds
+			if (!lightmaps.isUpToDate(scenery, sunlightPos, sunlightDiffuse))
+				bakeLightmaps(lightmaps, scenery);		// a reloaded model is unwrapped again, so its old texels are in the wrong places
+			buildProxies(hlod, scenery, objects, sceneIndex);
+			bakeVertexOcclusion(vertexOcclusion, objects);		// cheap enough to redo on every reload
+			buildStaticBatches(staticBatcher, objects, vertexOcclusion);
+			impostors.rebake();
+			cascadedShadows.invalidate();		// the cached cascades have the old static geometry in them
+			occlusionQueries.reset();		// the proxies' object indices can mean different proxies now
+			if (!pvs.isUpToDate(scenery)) {
+				bakeVisibility(pvs, scenery, walkableRegion);
+				pvsCell = -2;
+			}
+		}
 
-		shaderProgram.use();
+		glClear(GL_DEPTH_BUFFER_BIT);
 
-		// create view matrix for the models
+		// create view matrix for the models, and compute the matrices of every object that's on screen with it
 		glm::mat4 view = glm::mat4(1.0f);
 		view = glm::lookAt(cameraPos, cameraPos + cameraFront, glm::vec3(0.0f, 1.0f, 0.0f));
-		shaderProgram.setUniformMatrix("view", view);
+		if (pvs.findCell(cameraPos) != pvsCell) {
+			pvsCell = pvs.findCell(cameraPos);
+			pvs.getVisibleObjects(pvsCell, scenery.size(), potentiallyVisible);
+		}
+		hlod.select(cameraPos, projection, WINDOW_HEIGHT, potentiallyVisible.data(), objectDrawn);
+		frustumCuller.cull(objects, projection * view, &sceneIndex, objectDrawn.data());
+
+		// rasterize the occluders that are on screen, then drop whatever is hidden behind them
+		occlusionCuller.begin(projection * view);
+		for (size_t i = 0; i < objects.size(); ++i) {
+			if (frustumCuller.isVisible(i) && objects[i]->isOccluder())
+				objects[i]->SubmitOccluder(occlusionCuller);
+		}
+		occlusionCuller.rasterize();
+
+		objectVisible.assign(objects.size(), 0);
+		visibleObjects.clear();
+		for (size_t i = 0; i < objects.size(); ++i) {
+			if (!frustumCuller.isVisible(i))
+				continue;
+			if (useImpostors && impostors.submit(*objects[i], i, cameraPos, projection, WINDOW_HEIGHT))
+				continue;		// drawn as a quad after the queue instead
+			if (geometryLOD.select(*objects[i], cameraPos, projection, WINDOW_HEIGHT) == GeometryLOD::CULLED)
+				continue;
+
+			const unsigned char* meshVisible = frustumCuller.getMeshVisibility(i);
+			unsigned int draws = 0;
+			for (size_t j = 0; j < objects[i]->getModel().getMeshes().size(); ++j)
+				draws += meshVisible[j];
+
+			if (occlusionCuller.isVisible(objects[i]->getWorldBounds(), draws)) {
+				objectVisible[i] = 1;
+				visibleObjects.push_back(objects[i]);
+			}
+		}
+		if (useStaticBatching)
+			visibleObjects.push_back(&staticBatcher.getWorldObject());		// the batches are already in world space
+		if (useShadows) {
+			// the scenery casts shadows as itself wherever it is (even where HLOD proxies or impostors are drawn for it), so it all needs matrices
+			for (size_t i = 0; i < scenery.size(); ++i) {
+				if (!objectVisible[i])
+					visibleObjects.push_back(objects[i]);
+			}
+		}
+		objectConstants.update(ring, visibleObjects, view, projection);
+		objectConstants.bind();
+		MaterialTable::get().bind();		// every material's constants and textures, for the whole frame
 
 		// set light properties
-		initLight(shaderProgram);
+		initLight(ring, frameData);
+		clusteredLights.update(ring, usePointLights ? pointLights : noLights, view, projection, NEAR_PLANE, FAR_PLANE, WINDOW_WIDTH, WINDOW_HEIGHT);
+		clusteredLights.bind();
+
+		// render the shadow cascades that are due (the near ones, and at most one cached far one)
+		if (useShadows)
+			cascadedShadows.update(ring, scenery, sunlightPos, view, projection, NEAR_PLANE, passTimers);
+		else
+			cascadedShadows.disable(ring);
+		cascadedShadows.bind();
+		lightmaps.bind();
+		vertexOcclusion.bind();		// for the static objects drawn outside the batches
 
 		// set view and projection matrices for lightbulb
 		//lightbulbShaderProgram.use();
 		//lightbulbShaderProgram.setUniformMatrix("view", view);
 		//lightbulbShaderProgram.setUniformMatrix("projection", projection);
 
-		house.Draw(shaderProgram);
-		grass.Draw(shaderProgram);
-		tree1.Draw(shaderProgram);
-		tree2.Draw(shaderProgram);
+		// each object is drawn with a lighting variant and level of detail that depend on how big it is on screen (or with its lightmap)
+		// (objects that the occlusion queries last found hidden wait until everything else has been drawn)
+		// (static objects are drawn at full detail from the static batches instead)
+		renderQueue.clear();
+		hiddenObjects.clear();
+		batchedMeshes.assign(objects.size(), nullptr);
+		for (size_t i = 0; i < objects.size(); ++i) {
+			if (!objectVisible[i])
+				continue;
+			if (useOcclusionQueries && occlusionQueries.isHidden(i))
+				hiddenObjects.push_back(i);
+			else if (useStaticBatching && objects[i]->isStatic())
+				batchedMeshes[i] = frustumCuller.getMeshVisibility(i);
+			else
+				objects[i]->Submit(renderQueue, selectProgram(shaderLOD, lightmappedShaderProgram, *objects[i], projection), cameraPos, frustumCuller.getMeshVisibility(i), objects[i]->getLODLevel());
+		}
+		renderQueue.sort();
+
+		// the same geometry with a depth-only program and positions only first, so the lit pass after it only shades the nearest
+		// surface at each pixel (its depth writes are off: GL_LEQUAL passes exactly the fragments that wrote the depth that's there)
+		if (useDepthPrepass) {
+			passTimers.begin(PassTimers::DEPTH_PREPASS);
+			GeometryBuffer::get().useStream(GeometryBuffer::POSITION_STREAM);
+			glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+			if (useStaticBatching)
+				staticBatcher.draw(depthShaderProgram, batchedMeshes);
+			renderQueue.executeDepth(ring, depthShaderProgram);
+			glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+			GeometryBuffer::get().useStream(GeometryBuffer::FULL_STREAM);
+			GLState::get().depthMask(false);
+			passTimers.end();
+		}
+
+		passTimers.begin(PassTimers::OPAQUE_PASS);
+		if (useStaticBatching)
+			staticBatcher.draw(useLightmaps && staticBatcher.getWorldObject().hasLightmap() ? lightmappedShaderProgram : shaderProgram, batchedMeshes);		// first, since big static geometry hides a lot of what's queued
+		renderQueue.execute(ring);
+		GLState::get().depthMask(true);		// nothing after this was in the pre-pass
+		passTimers.end();
+
+		passTimers.begin(PassTimers::IMPOSTOR_PASS);
+		impostors.draw(ring, projection * view);
+		passTimers.end();
+
+		// test the boxes of the hidden objects against what was just drawn, and only let the GPU draw the ones that show
+		if (useOcclusionQueries) {
+			passTimers.begin(PassTimers::OCCLUSION_PASS);
+			occlusionQueries.issueQueries(objects, objectVisible.data(), projection * view, cameraPos, NEAR_PLANE);
+			for (size_t i : hiddenObjects) {
+				occlusionQueries.beginConditionalRender(i);
+				unsigned int draws = objects[i]->Draw(selectProgram(shaderLOD, lightmappedShaderProgram, *objects[i], projection), frustumCuller.getMeshVisibility(i), objects[i]->getLODLevel());
+				occlusionQueries.endConditionalRender(i, draws);
+			}
+			passTimers.end();
+		}
 		//lightbulb1.Draw(lightbulbShaderProgram);
+		passTimers.begin(PassTimers::SKYBOX_PASS);
 		skybox.Draw(view, projection);		// skybox drawn last
+		passTimers.end();
+		ring.endFrame();
 
 		glfwSwapBuffers(window);
 		glfwPollEvents();
 	}
 
+	reloader.stop();
 	glfwTerminate();
 	return 0;
 }
@@ -276,15 +622,248 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos)
 	cameraFront.z = sin(glm::radians(yaw)) * cos(glm::radians(pitch));
 }
 
-void initLight(const ShaderProgram& program)
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)	// used for toggles (processInput() is for held keys)
+{
+	if (action != GLFW_PRESS)
+		return;
+
+	if (key == GLFW_KEY_F1)
+		showStats = !showStats;
+
+	if (key == GLFW_KEY_F2) {
+		useOcclusionQueries = !useOcclusionQueries;
+		std::cout << "Occlusion queries " << (useOcclusionQueries ? "on" : "off") << std::endl;
+	}
+
+	if (key == GLFW_KEY_F3) {
+		useStaticBatching = !useStaticBatching;
+		std::cout << "Static batching " << (useStaticBatching ? "on" : "off") << std::endl;
+	}
+
+	if (key == GLFW_KEY_F4) {
+		useImpostors = !useImpostors;
+		std::cout << "Impostors " << (useImpostors ? "on" : "off") << std::endl;
+	}
+
+	if (key == GLFW_KEY_F5) {
+		useDepthPrepass = !useDepthPrepass;
+		std::cout << "Depth pre-pass " << (useDepthPrepass ? "on" : "off") << std::endl;
+	}
+
+	if (key == GLFW_KEY_F6) {
+		usePointLights = !usePointLights;
+		std::cout << "Point lights " << (usePointLights ? "on" : "off") << std::endl;
+	}
+
+	if (key == GLFW_KEY_F7) {
+		useShadows = !useShadows;
+		std::cout << "Shadows " << (useShadows ? "on" : "off") << std::endl;
+	}
+
+	if (key == GLFW_KEY_F8) {
+		useLightmaps = !useLightmaps;
+		std::cout << "Lightmaps " << (useLightmaps ? "on" : "off") << std::endl;
+	}
+}
+
+void bakeVisibility(PotentiallyVisibleSet& pvs, const std::vector<Object*>& objects, const AABB& region)
+{
+	pvs.bake(objects, region);
+	const PotentiallyVisibleSet::Stats& stats = pvs.getLastBakeStats();
+	std::cout << "Baked visibility for " << stats.cells << " cells in " << stats.bakeMilliseconds << " ms (" << stats.rays << " rays); "
+		<< stats.averageVisible << " of " << stats.objects << " objects visible per cell on average" << std::endl;
+	pvs.save(PVS_FILE);
+}
+
+void bakeLightmaps(Lightmaps& lightmaps, const std::vector<Object*>& objects)
+{
+	lightmaps.bake(objects, sunlightPos, sunlightDiffuse);
+	const Lightmaps::Stats& stats = lightmaps.getLastBakeStats();
+	std::cout << "Baked lightmaps for " << stats.objects << " objects in " << stats.bakeMilliseconds << " ms (" << stats.size << "x" << stats.size << " texels, "
+		<< stats.texels << " on surfaces, " << stats.rays << " rays)" << std::endl;
+	lightmaps.save(LIGHTMAP_FILE);
+}
+
+/// <summary>
+/// The program to draw an object with: the lightmapped variant if its lighting is baked (and lightmaps are on), or else the
+/// ShaderLOD variant for its size on screen
+/// </summary>
+const ShaderProgram& selectProgram(ShaderLOD& shaderLOD, const ShaderProgram& lightmappedShaderProgram, const Object& object, const glm::mat4& projection)
+{
+	if (useLightmaps && object.hasLightmap())
+		return lightmappedShaderProgram;
+	return shaderLOD.select(object, cameraPos, projection, WINDOW_WIDTH, WINDOW_HEIGHT);
+}
+
+/// <summary>
+/// Rebuilds the HLOD proxies from the scenery, and puts the objects to draw back together (the scenery, then the proxies)
+/// </summary>
+void buildProxies(HierarchicalLOD& hlod, const std::vector<Object*>& scenery, std::vector<Object*>& objects, SceneBVH& sceneIndex)
+{
+	for (size_t i = scenery.size(); i < objects.size(); ++i)
+		sceneIndex.remove((int)i);		// the old proxies are about to be deleted
+
+	hlod.build(scenery);
+	objects = scenery;
+	objects.insert(objects.end(), hlod.getProxies().begin(), hlod.getProxies().end());
+	for (size_t i = scenery.size(); i < objects.size(); ++i)
+		objects[i]->setSceneIndex(&sceneIndex, (int)i);
+
+	std::cout << "Built " << hlod.getProxies().size() << " HLOD proxies in " << hlod.getBuildMilliseconds() << " ms" << std::endl;
+}
+
+void bakeVertexOcclusion(VertexOcclusion& vertexOcclusion, const std::vector<Object*>& objects)
+{
+	vertexOcclusion.bake(objects, sunlightPos);
+	const VertexOcclusion::Stats& stats = vertexOcclusion.getLastBakeStats();
+	std::cout << "Baked occlusion for " << stats.vertices << " vertices of " << stats.objects << " static objects in " << stats.bakeMilliseconds << " ms ("
+		<< stats.rays << " rays)" << std::endl;
+}
+
+/// <summary>
+/// Rebuilds the static batches (after the static objects' models change), with the vertex occlusion baked for them
+/// </summary>
+void buildStaticBatches(StaticBatcher& staticBatcher, const std::vector<Object*>& objects, const VertexOcclusion& vertexOcclusion)
 {
-	program.setVec3("sunlight.position", sunlightPos);
-	program.setVec3("sunlight.diffuse", glm::vec3(1.0f, 1.0f, 1.0f));
-	program.setFloat("sunlight.ambientIntensity", 0.2f);
-	program.setVec3("sunlight.ambientColor", glm::vec3(1.0f, 1.0f, 1.0f));
-	program.setVec3("sunlight.specular", glm::vec3(1.0f, 1.0f, 1.0f));
-	program.setInt("sunlight.shininess", 4);
-	program.setVec3("viewPos", cameraPos);
+	staticBatcher.build(objects, &vertexOcclusion);
+	std::cout << "Batched " << staticBatcher.getMeshesBatched() << " meshes of " << staticBatcher.getObjectsBatched() << " static objects into "
+		<< staticBatcher.getBatchCount() << " batches in " << staticBatcher.getBuildMilliseconds() << " ms" << std::endl;
+}
+
+void printFrameStats(const RingBuffer& ring, const ShaderLOD& shaderLOD, const GeometryLOD& geometryLOD, const HierarchicalLOD& hlod, const StaticBatcher& staticBatcher, const Impostors& impostors, const RenderQueue& renderQueue, const FrustumCuller& frustumCuller, const OcclusionCuller& occlusionCuller, const OcclusionQueries& occlusionQueries, const PassTimers& passTimers, const ClusteredLights& clusteredLights, const CascadedShadows& cascadedShadows)
+{
+	// GPU time of each pass (a few frames behind), then the CPU time spent issuing it
+	const PassTimers::Stats& passStats = passTimers.getStats();
+	float gpuTotal = 0.0f;
+	std::cout << "Pass times (GPU / CPU ms):";
+	for (int pass = 0; pass < PassTimers::NUM_PASSES; ++pass) {
+		std::cout << (pass == 0 ? " " : ", ") << PassTimers::getName((PassTimers::Pass)pass) << " " << passStats.gpuMilliseconds[pass] << " / " << passStats.cpuMilliseconds[pass];
+		gpuTotal += passStats.gpuMilliseconds[pass];
+	}
+	std::cout << "; " << gpuTotal << " ms on the GPU in total (depth pre-pass " << (useDepthPrepass ? "on" : "off") << ")" << std::endl;
+
+	const GLState::Stats& glStats = GLState::get().getLastFrameStats();
+	std::cout << "GL state changes: " << glStats.issued << " issued, " << glStats.elided << " elided" << std::endl;
+
+	const RingBuffer::Stats& ringStats = ring.getLastFrameStats();
+	std::cout << "Ring buffer (" << (ring.isPersistent() ? "persistently mapped" : "mapped per allocation") << ", " << ring.getSize() / 1024 << " KB): "
+		<< ringStats.bytesAllocated / 1024 << " KB in " << ringStats.allocations << " allocations; " << ringStats.fenceWaits << " fence waits ("
+		<< ringStats.fenceWaitMilliseconds << " ms)" << std::endl;
+
+	const MaterialTable& materials = MaterialTable::get();
+	std::cout << "Materials: " << materials.getMaterialCount() << " in the table, " << materials.getTextureCount() << " textures in "
+		<< materials.getArrayCount() << " texture arrays" << std::endl;
+
+	const ClusteredLights::Stats& lightStats = clusteredLights.getLastStats();
+	std::cout << "Clustered lights: " << lightStats.visibleLights << " of " << lightStats.lights << " lights in view, binned into " << lightStats.occupiedClusters
+		<< " of " << ClusteredLights::CLUSTER_COUNT << " clusters (" << lightStats.lightIndices << " entries, at most " << lightStats.maxClusterLights
+		<< " lights in one) in " << lightStats.binMilliseconds << " ms" << std::endl;
+
+	if (useShadows) {
+		const CascadedShadows::Stats& shadowStats = cascadedShadows.getLastStats();
+		std::cout << "Shadows: " << shadowStats.cascadesRendered << " of " << cascadedShadows.getSettings().cascadeCount << " cascades rendered ("
+			<< shadowStats.cascadesCached << " cached, " << shadowStats.cascadesWaiting << " waiting), " << shadowStats.castersDrawn << " casters in "
+			<< shadowStats.drawCalls << " draw calls" << std::endl;
+	}
+
+	const FrustumCuller::Stats& cullStats = frustumCuller.getLastStats();
+	std::cout << "Frustum culling: " << cullStats.objectsVisible << " objects visible, " << cullStats.objectsCulled << " culled (" << cullStats.objectsCulledByPVS << " by the PVS or HLOD); "
+		<< cullStats.meshesVisible << " meshes visible, " << cullStats.meshesCulled << " culled; " << cullStats.nodesVisited << " scene index nodes visited" << std::endl;
+
+	const OcclusionCuller::Stats& occlusionStats = occlusionCuller.getLastFrameStats();
+	float rejected = occlusionStats.drawsTested > 0 ? 100.0f * occlusionStats.drawsRejected / occlusionStats.drawsTested : 0.0f;
+	std::cout << "Occlusion culling: " << occlusionStats.occluderTriangles << " occluder triangles, " << occlusionStats.occluded << " of " << occlusionStats.tested
+		<< " objects hidden, " << rejected << "% of draws rejected" << std::endl;
+
+	if (useOcclusionQueries) {
+		const OcclusionQueries::Stats& queryStats = occlusionQueries.getLastFrameStats();
+		std::cout << "Occlusion queries: " << queryStats.queriesIssued << " issued, " << queryStats.resultsRead << " read after " << queryStats.averageLatencyFrames
+			<< " frames (" << queryStats.averageLatencyMilliseconds << " ms) on average; " << queryStats.hiddenObjects << " hidden objects, "
+			<< queryStats.drawsSaved << " of their draws saved" << std::endl;
+	}
+
+	const HierarchicalLOD::Stats& hlodStats = hlod.getLastStats();
+	std::cout << "HLOD: " << hlodStats.proxiesDrawn << " of " << hlodStats.clusters << " clusters drawn as proxies, replacing " << hlodStats.objectsReplaced << " objects ("
+		<< hlodStats.meshesReplaced << " meshes, " << hlodStats.trianglesReplaced << " triangles) with " << hlodStats.proxyTriangles << " triangles" << std::endl;
+
+	if (useStaticBatching) {
+		const StaticBatcher::Stats& batchStats = staticBatcher.getLastStats();
+		std::cout << "Static batching: " << batchStats.meshesDrawn << " meshes drawn in " << batchStats.drawCalls << " draw calls from "
+			<< batchStats.batches << " of " << staticBatcher.getBatchCount() << " batches (" << batchStats.parts << " index ranges)" << std::endl;
+	}
+
+	if (useImpostors) {
+		const Impostors::Stats& impostorStats = impostors.getLastFrameStats();
+		std::cout << "Impostors: " << impostorStats.impostorsDrawn << " objects drawn as impostors in " << impostorStats.drawCalls << " draw calls, "
+			<< impostorStats.impostorTriangles << " triangles instead of " << impostorStats.trianglesReplaced << std::endl;
+	}
+
+	const RenderQueue::Stats& queueStats = renderQueue.getLastStats();
+	std::cout << "Render queue: " << queueStats.packets << " meshes in " << queueStats.drawCalls << " draw calls (" << queueStats.instancedDraws << " instanced";
+	if (queueStats.indirectCommands > 0)
+		std::cout << ", " << queueStats.indirectCommands << " multi-draw indirect commands";
+	std::cout << "), " << queueStats.programChanges << " program changes, " << queueStats.materialChanges << " material changes";
+	if (queueStats.depthDrawCalls > 0)
+		std::cout << "; " << queueStats.depthDrawCalls << " depth pre-pass draw calls";
+	std::cout << std::endl;
+
+	// fraction of the objects' estimated screen coverage that was shaded with a cheaper variant than full per-pixel lighting
+	const ShaderLOD::Stats& lodStats = shaderLOD.getLastFrameStats();
+	float totalPixels = lodStats.pixels[ShaderLOD::FULL] + lodStats.pixels[ShaderLOD::PER_VERTEX] + lodStats.pixels[ShaderLOD::DIFFUSE_ONLY];
+	float cheaperPixels = lodStats.pixels[ShaderLOD::PER_VERTEX] + lodStats.pixels[ShaderLOD::DIFFUSE_ONLY];
+	std::cout << "Shader LOD: " << lodStats.objects[ShaderLOD::FULL] << " full, " << lodStats.objects[ShaderLOD::PER_VERTEX] << " per-vertex, "
+		<< lodStats.objects[ShaderLOD::DIFFUSE_ONLY] << " diffuse-only objects; "
+		<< (totalPixels > 0.0f ? 100.0f * cheaperPixels / totalPixels : 0.0f) << "% of object pixels used a cheaper variant" << std::endl;
+
+	const GeometryLOD::Stats& meshLODStats = geometryLOD.getLastFrameStats();
+	std::cout << "Mesh LOD: objects per level";
+	for (int level = 0; level < GeometryLOD::MAX_LEVELS; ++level)
+		std::cout << (level == 0 ? " " : "/") << meshLODStats.objects[level];
+	std::cout << ", " << meshLODStats.culled << " too small to draw, " << meshLODStats.switches << " switched; "
+		<< meshLODStats.triangles << " of " << meshLODStats.fullTriangles << " full-detail triangles" << std::endl;
+}
+
+void initLight(RingBuffer& ring, FrameDataBuffer& frameData)
+{
+	FrameData data;
+	data.sunPosition = sunlightPos;
+	data.sunDiffuse = sunlightDiffuse;
+	data.sunAmbientIntensity = 0.2f;
+	data.sunAmbientColor = glm::vec3(1.0f, 1.0f, 1.0f);
+	data.sunSpecular = glm::vec3(1.0f, 1.0f, 1.0f);
+	data.sunShininess = 4;
+	data.viewPos = cameraPos;
+	frameData.update(ring, data);
+}
+
+/// <summary>
+/// Scatters POINT_LIGHT_COUNT small lights of random colors over the scene, from the ground up to about the height of the trees
+/// </summary>
+void placeLights(std::vector<Light>& lights)
+{
+	std::mt19937 random(1);		// same lights every run
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+	lights.clear();
+	for (int i = 0; i < POINT_LIGHT_COUNT; ++i) {
+		Light light;
+		light.position = glm::vec3(X_BOUND_LEFT - 4.0f + (X_BOUND_RIGHT - X_BOUND_LEFT + 8.0f) * unit(random), GROUND_Y + 0.2f + 3.0f * unit(random),
+			Z_BOUND_LEFT - 4.0f + (Z_BOUND_RIGHT - Z_BOUND_LEFT + 8.0f) * unit(random));
+		light.range = 1.0f + 1.5f * unit(random);
+
+		// a saturated color: one channel full, one off, one in between
+		glm::vec3 color(1.0f, unit(random), 0.0f);
+		int rotate = i % 3;
+		light.color = 1.5f * glm::vec3(color[rotate], color[(rotate + 1) % 3], color[(rotate + 2) % 3]);
+
+		if (i % 8 == 0) {		// pointing down at the ground
+			light.range *= 2.0f;
+			light.direction = glm::vec3(0.0f, -1.0f, 0.0f);
+			light.spotCosInner = std::cos(glm::radians(20.0f));
+			light.spotCosOuter = std::cos(glm::radians(30.0f));
+		}
+		lights.push_back(light);
+	}
 }
 
 void enforceBounds(glm::vec3& position)
@@ -6,12 +6,12 @@
 #include <vector>
 #include <glad/glad.h>
 #include "ShaderProgram.h"
-
-struct Vertex {
-	glm::vec3 Position;
-	glm::vec3 Normal;
-	glm::vec2 TexCoords;
-};
+#include "GLState.h"
+#include "Material.h"
+#include "MaterialTable.h"
+#include "GeometryBuffer.h"
+#include "Bounds.h"
+#include "MeshSimplifier.h"
 
 struct Texture {
 	unsigned int id;
@@ -19,66 +19,121 @@ struct Texture {
 	std::string path;
 };
 
+// one level of detail of a mesh
+struct MeshLOD {
+	GeometryRange geometry;		// level 0 owns the mesh's vertices; the others only have indices
+	float error = 0.0f;			// roughly how far (in model units) this level strays from full detail
+};
+
 class Mesh {
 	private:
-		unsigned int VAO, VBO, EBO;		// each mesh should have its own vertex array, vertex buffer, and element buffer objects
+		std::vector<MeshLOD> lods;	// where each level lives in the shared GeometryBuffer, full detail first
+		std::vector<unsigned int> coarsestIndices;	// the last level's indices, kept on the CPU for occlusion culling (empty without levels)
+		AABB bounds;				// model space
+		BoundingSphere sphere;		// model space, centered on the box
 	
 	public:
 		std::vector<Vertex> vertices;
 		std::vector<unsigned int> indices;
 		std::vector<Texture> textures;
+		Material material;		// built from textures and the .mtl constants; its entry in MaterialTable is what the shaders read
 
-		Mesh(std::vector<Vertex> argVertices, std::vector<unsigned int> argIndices, std::vector<Texture> argTextures) : vertices{ argVertices }, indices{ argIndices }, textures{ argTextures }
+		/// <param name="lodIndices">Simplified versions of the mesh (from MeshSimplifier::buildLODs()), most detailed first</param>
+		Mesh(std::vector<Vertex> argVertices, std::vector<unsigned int> argIndices, std::vector<Texture> argTextures, const Material& argMaterial,
+			const std::vector<LODIndices>& lodIndices = std::vector<LODIndices>())
+			: vertices{ argVertices }, indices{ argIndices }, textures{ argTextures }, material{ argMaterial }
 		{
-			glGenBuffers(1, &VBO);
-			glGenBuffers(1, &EBO);
-			glGenVertexArrays(1, &VAO);
+			material.index = MaterialTable::get().add(material);
 
-			glBindVertexArray(VAO);
+			MeshLOD full;
+			full.geometry = GeometryBuffer::get().add(vertices, indices);
+			lods.push_back(full);
+			for (const LODIndices& level : lodIndices) {
+				MeshLOD lod;
+				lod.geometry = GeometryBuffer::get().addIndices(full.geometry, level.indices);
+				lod.error = level.error;
+				lods.push_back(lod);
+			}
+			if (!lodIndices.empty())
+				coarsestIndices = lodIndices.back().indices;
 
-			glBindBuffer(GL_ARRAY_BUFFER, VBO);
-			glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+			for (const Vertex& vertex : vertices)
+				bounds.expand(vertex.Position);
+			sphere.center = bounds.center();
+			for (const Vertex& vertex : vertices)
+				sphere.radius = std::max(sphere.radius, glm::length(vertex.Position - sphere.center));	// usually tighter than the box's corners
+		}
 
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-			glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+		void Draw(size_t lod = 0) const
+		{
+			material.apply();	// just selects the material's entry in MaterialTable; nothing is bound
+			DrawGeometry(lod);
+		}
 
-			// position data	(layout = 0)
-			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);	// using sizeof(Vertex) for the stride
-			glEnableVertexAttribArray(0);
+		/// <summary>
+		/// Draws the mesh without touching its material (for callers that have already applied it)
+		/// </summary>
+		void DrawGeometry(size_t lod = 0) const
+		{
+			GeometryBuffer::get().draw(getGeometry(lod));
+		}
 
-			// normal data	(layout = 1)
-			glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
-			glEnableVertexAttribArray(1);
+		/// <summary>
+		/// Draws several copies of the mesh in one call (each instance's material index comes from the instance buffer)
+		/// </summary>
+		/// <param name="instanceBuffer">Buffer of InstanceIndices, one per instance</param>
+		/// <param name="firstInstance">Index in the buffer of the first instance's entry</param>
+		/// <param name="count">Number of instances</param>
+		void DrawInstanced(unsigned int instanceBuffer, size_t firstInstance, int count, size_t lod = 0) const
+		{
+			GeometryBuffer::get().drawInstanced(getGeometry(lod), instanceBuffer, firstInstance, count);
+		}
 
-			// texture coordinate data	 (layout = 2)
-			glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
-			glEnableVertexAttribArray(2);
+		const AABB& getBounds(void) const
+		{
+			return bounds;
 		}
 
-		void Draw(const ShaderProgram& program) const
+		const BoundingSphere& getBoundingSphere(void) const
 		{
-			unsigned int diffuseNr = 1;
-			unsigned int specularNr = 1;
-			for (int i = 0; i < textures.size(); ++i) {
-				glActiveTexture(GL_TEXTURE0 + i);	// activate texture unit before binding
-				std::string name = textures[i].type;
-				std::string number;
-				if (name == "texture_diffuse")
-					number = std::to_string(diffuseNr++);
-				else if (name == "texture_specular")
-					number = std::to_string(specularNr++);
-
-				program.setInt((name + number).c_str(), i);		// set sampler2D uniform to the corresponding texture unit
-				glBindTexture(GL_TEXTURE_2D, textures[i].id);	// bind the texture before drawing (done for each texture)
-			}
-			glActiveTexture(GL_TEXTURE0);	// set texture unit back to default
-
-			// draw mesh
-			glBindVertexArray(VAO);
-			glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-			
-			// unbind vertex array
-			glBindVertexArray(0);
+			return sphere;
+		}
+
+		/// <summary>
+		/// Where a level of detail lives in the GeometryBuffer (levels past the mesh's coarsest give its coarsest)
+		/// </summary>
+		const GeometryRange& getGeometry(size_t lod = 0) const
+		{
+			return lods[std::min(lod, lods.size() - 1)].geometry;
+		}
+
+		/// <summary>
+		/// Indices of the coarsest level of detail (the full indices if the mesh has no simpler levels), for rasterizing the
+		/// mesh on the CPU
+		/// </summary>
+		const std::vector<unsigned int>& getCoarsestIndices(void) const
+		{
+			return coarsestIndices.empty() ? indices : coarsestIndices;
+		}
+
+		size_t getLODCount(void) const
+		{
+			return lods.size();
+		}
+
+		float getLODError(size_t lod) const
+		{
+			return lods[std::min(lod, lods.size() - 1)].error;
+		}
+
+		/// <summary>
+		/// Frees the mesh's part of the geometry buffer (meshes get copied around in vectors, so this isn't done in a destructor)
+		/// </summary>
+		void release(void)
+		{
+			for (const MeshLOD& lod : lods)
+				GeometryBuffer::get().remove(lod.geometry);
+			lods.assign(1, MeshLOD());
 		}
 };
 
@@ -2,10 +2,42 @@
 #define MODEL_H
 
 #include "mesh.h"
+#include "Bounds.h"
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 #include "stb_image.h"
+#include "TextureAtlas.h"
+#include "LightmapCharts.h"
+
+// CPU-side mesh, produced by Model::import() and turned into a Mesh by Model::upload()
+struct MeshData {
+	std::vector<Vertex> vertices;
+	std::vector<unsigned int> indices;
+	std::vector<Texture> textures;		// only type and path are filled in; ids are assigned on upload
+	Material material;					// constants from the .mtl file (and atlas rects); texture maps are assigned on upload
+	std::vector<LODIndices> lods;		// simplified versions of the mesh, most detailed first (built with MeshSimplifier)
+};
+
+// a texture that was packed into one of a model's atlases
+struct AtlasMember {
+	std::string path;			// the texture's own path
+	std::string atlasPath;		// the atlas's ImageData::path
+	int width = 0, height = 0;
+	int gutter = 0;
+	AtlasPlacement placement;
+};
+
+// everything needed to build a Model, without touching OpenGL (so it can be built on any thread)
+struct ModelData {
+	bool valid = false;
+	std::string directory;
+	std::vector<MeshData> meshes;
+	std::vector<ImageData> images;		// one entry per unique texture path (packed textures are replaced by their atlases)
+	std::vector<AtlasMember> atlasMembers;
+	TextureAtlas::Stats atlasStats;
+	LightmapCharts::Stats chartStats;	// the second UV set every mesh was unwrapped into
+};
 
 class Model
 {
@@ -15,40 +47,33 @@ class Model
 		std::vector<Mesh> meshes;
 		std::string directory;
 		std::vector<Texture> textures_loaded;	// stores textures that have already been loaded in (optimization to avoid loading the same textures repeatedly)
-
-		void loadModel(std::string path)
-		{
-			Assimp::Importer importer;
-			const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
-			
-			if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
-				std::cout << "ERROR: Assimp: " << importer.GetErrorString() << std::endl;
-				return;
-			}
-			directory = path.substr(0, path.find_last_of('/'));
-
-			processNode(scene->mRootNode, scene);
-		}
-
-		void processNode(aiNode* node, const aiScene* scene)
+		AABB bounds;				// model space
+		BoundingSphere sphere;		// model space, centered on the box
+		std::vector<float> lodErrors;	// per level of detail, the largest error of any mesh at that level
+		std::vector<AtlasMember> atlasMembers;
+		TextureAtlas::Stats atlasStats;
+		LightmapCharts::Stats chartStats;
+
+		static void processNode(aiNode* node, const aiScene* scene, ModelData& data)
 		{
 			// process this node's meshes
 			for (unsigned int i = 0; i < node->mNumMeshes; ++i) {
 				aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];	// scene's mMeshes array contains all the meshes in the scene
-				meshes.push_back(processMesh(mesh, scene));
+				data.meshes.push_back(processMesh(mesh, scene, data));
 			}
 
 			// then process each of the node's children
 			for (unsigned int i = 0; i < node->mNumChildren; ++i) {
-				processNode(node->mChildren[i], scene);
+				processNode(node->mChildren[i], scene, data);
 			}
 		}
 
-		Mesh processMesh(aiMesh* mesh, const aiScene* scene)
+		static MeshData processMesh(aiMesh* mesh, const aiScene* scene, ModelData& data)
 		{
-			std::vector<Vertex> vertices;
-			std::vector<unsigned int> indices;
-			std::vector<Texture> textures;
+			MeshData meshData;
+			std::vector<Vertex>& vertices = meshData.vertices;
+			std::vector<unsigned int>& indices = meshData.indices;
+			std::vector<Texture>& textures = meshData.textures;
 
 			// process vertices (Position, Normal, and TexCoords)
 			for (unsigned int i = 0; i < mesh->mNumVertices; ++i) {
@@ -76,6 +101,8 @@ class Model
 				}
 				else
 					vertex.TexCoords = glm::vec2(0.0f, 0.0f);
+				vertex.LightmapCoords = glm::vec2(0.0f, 0.0f);		// set once the whole model is unwrapped
+				vertex.Occlusion[0] = vertex.Occlusion[1] = 0;		// open until a VertexOcclusion bake says otherwise (per object, so it lives outside the shared model)
 
 				vertices.push_back(vertex);
 			}
@@ -87,58 +114,176 @@ class Model
 					indices.push_back(face.mIndices[j]);
 			}
 
+			// levels of detail (the expensive part of importing, which is why it happens here, off the render thread)
+			meshData.lods = MeshSimplifier::buildLODs(vertices, indices);
+
 			// process materials (textures in our case)
 			if (mesh->mMaterialIndex >= 0) {	// if this mesh has a material
 				aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];		// scene's mMaterials array contains all of its materials; mesh only contains its index for its material
-				
+
 				// put all the textures (diffuse and specular) into the textures vector (which will be passed to our mesh object)
 				// diffuse textures
-				std::vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
-				textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());	
+				std::vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse", data);
+				textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
 
 				// specular textures
-				std::vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
+				std::vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular", data);
 				textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
+
+				// constants (Kd, Ks, Ns)
+				aiColor3D color;
+				if (material->Get(AI_MATKEY_COLOR_DIFFUSE, color) == aiReturn_SUCCESS)
+					meshData.material.diffuseColor = glm::vec3(color.r, color.g, color.b);
+				if (material->Get(AI_MATKEY_COLOR_SPECULAR, color) == aiReturn_SUCCESS)
+					meshData.material.specularColor = glm::vec3(color.r, color.g, color.b);
+				float shininess;
+				if (material->Get(AI_MATKEY_SHININESS, shininess) == aiReturn_SUCCESS)
+					meshData.material.shininess = shininess;
 			}
 
-			return Mesh(vertices, indices, textures);
+			return meshData;
 
 		}
 
-		std::vector<Texture> loadMaterialTextures(aiMaterial* mat, aiTextureType type, std::string typeName)
+		static std::vector<Texture> loadMaterialTextures(aiMaterial* mat, aiTextureType type, std::string typeName, ModelData& data)
 		{
 			std::vector<Texture> textures;
 			for (unsigned int i = 0; i < mat->GetTextureCount(type); ++i) {
 				aiString str;
 				mat->GetTexture(type, i, &str);		// get the texture's file path
 
+				Texture texture;
+				texture.id = 0;		// assigned in upload()
+				texture.type = typeName;
+				texture.path = str.C_Str();		// texture's path is stored to check if it has already been loaded in or not
+				textures.push_back(texture);
+
 				bool skip = false;
-				for (unsigned int j = 0; j < textures_loaded.size(); ++j) {
-					if (std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0) {
-						textures.push_back(textures_loaded[j]);		// if this texture was already loaded, just push back the already-loaded texture, instead of loading it again
-						skip = true;
-						break;		
+				for (unsigned int j = 0; j < data.images.size(); ++j) {
+					if (std::strcmp(data.images[j].path.data(), str.C_Str()) == 0) {
+						skip = true;		// if this image was already decoded, don't decode it again
+						break;
 					}
 				}
 
-				if (!skip) {	// make and load a new texture
-					Texture texture;
-					texture.id = TextureFromFile(str.C_Str(), directory);	// get an ID for the texture after loading it in with stb_image.h
-					texture.type = typeName;
-					texture.path = str.C_Str();		// texture's path is stored to check if it has already been loaded in or not
-					textures.push_back(texture);
-					textures_loaded.push_back(texture);
+				if (!skip) {	// decode a new image with stb_image.h
+					ImageData image;
+					image.path = str.C_Str();
+					LoadImageData(data.directory + '/' + image.path, image);
+					data.images.push_back(std::move(image));
 				}
 			}
 
 			return textures;
 		}
 
-		unsigned int TextureFromFile(std::string path, std::string directory)
+		/// <summary>
+		/// Sets each material's albedo to the average of its diffuse map (before the maps are packed into atlases)
+		/// </summary>
+		static void averageDiffuseMaps(ModelData& data)
 		{
-			unsigned int texture;
-			glGenTextures(1, &texture);
-			glBindTexture(GL_TEXTURE_2D, texture);
+			for (MeshData& mesh : data.meshes) {
+				mesh.material.albedo = mesh.material.diffuseColor;
+				for (const Texture& texture : mesh.textures) {
+					if (texture.type != "texture_diffuse")
+						continue;
+
+					for (const ImageData& image : data.images) {
+						if (image.path != texture.path || image.pixels.empty())
+							continue;
+						glm::dvec3 sum(0.0);
+						size_t texels = size_t(image.width) * image.height;
+						for (size_t i = 0; i < texels; ++i) {
+							const unsigned char* texel = &image.pixels[i * image.nrChannels];
+							sum += glm::dvec3(texel[0], texel[image.nrChannels >= 3 ? 1 : 0], texel[image.nrChannels >= 3 ? 2 : 0]);
+						}
+						mesh.material.albedo = glm::vec3(sum / (255.0 * double(texels)));
+						break;
+					}
+					break;		// same rule as upload(): the first diffuse map is the one the shaders sample
+				}
+			}
+		}
+
+		/// <summary>
+		/// Packs the small textures into atlases (see TextureAtlas) and points the meshes' maps at their rects
+		/// </summary>
+		static void packTextures(ModelData& data, const TextureAtlas::Settings& settings)
+		{
+			std::vector<AtlasPlacement> placements;
+			std::vector<ImageData> atlases = TextureAtlas::pack(data.images, placements, data.atlasStats, settings);
+			if (atlases.empty())
+				return;
+
+			for (MeshData& mesh : data.meshes) {
+				bool diffuseSeen = false, specularSeen = false;
+				for (Texture& texture : mesh.textures) {
+					size_t image = 0;
+					while (image < data.images.size() && data.images[image].path != texture.path)
+						++image;
+					const AtlasPlacement* placement = image < data.images.size() && placements[image].atlas >= 0 ? &placements[image] : nullptr;
+
+					// same rule as upload(): the first map of each type is the one the shaders sample
+					if (texture.type == "texture_diffuse" && !diffuseSeen) {
+						diffuseSeen = true;
+						if (placement)
+							mesh.material.diffuseRect = placement->rect;
+					}
+					else if (texture.type == "texture_specular" && !specularSeen) {
+						specularSeen = true;
+						if (placement)
+							mesh.material.specularRect = placement->rect;
+					}
+					if (placement) {
+						texture.path = atlases[placement->atlas].path;
+						mesh.material.atlasMipLevels = settings.mipLevels;
+					}
+				}
+			}
+
+			std::vector<ImageData> images;
+			for (size_t i = 0; i < data.images.size(); ++i) {
+				const AtlasPlacement& placement = placements[i];
+				if (placement.atlas >= 0)
+					data.atlasMembers.push_back({ data.images[i].path, atlases[placement.atlas].path, data.images[i].width, data.images[i].height, settings.gutter, placement });
+				else
+					images.push_back(std::move(data.images[i]));
+			}
+			for (ImageData& atlas : atlases)
+				images.push_back(std::move(atlas));
+			data.images = std::move(images);
+		}
+
+		/// <summary>
+		/// Copies a changed texture into its block of an atlas (it has to be the same size as before)
+		/// </summary>
+		static void updateAtlas(unsigned int texture, const AtlasMember& member, const ImageData& image)
+		{
+			const AtlasPlacement& placement = member.placement;
+			std::vector<unsigned char> block(size_t(placement.blockWidth) * placement.blockHeight * 3);
+			TextureAtlas::copyBlock(image, placement, member.gutter, block.data(), placement.blockWidth, 0, 0);
+
+			GLState::get().bindTexture(0, GL_TEXTURE_2D, texture);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, placement.blockX, placement.blockY, placement.blockWidth, placement.blockHeight, GL_RGB, GL_UNSIGNED_BYTE, block.data());
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+			glGenerateMipmap(GL_TEXTURE_2D);
+
+			// MaterialTable copies whole textures, so it gets the whole atlas back
+			ImageData atlas;
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &atlas.width);
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &atlas.height);
+			atlas.nrChannels = 3;
+			atlas.pixels.resize(size_t(atlas.width) * atlas.height * 3);
+			glPixelStorei(GL_PACK_ALIGNMENT, 1);
+			glGetTexImage(GL_TEXTURE_2D, 0, GL_RGB, GL_UNSIGNED_BYTE, atlas.pixels.data());
+			glPixelStorei(GL_PACK_ALIGNMENT, 4);
+			MaterialTable::get().addTexture(texture, atlas.width, atlas.height, atlas.nrChannels, atlas.pixels.data());
+		}
+
+		static void TextureFromImage(unsigned int texture, const ImageData& image)
+		{
+			GLState::get().bindTexture(0, GL_TEXTURE_2D, texture);
 
 			// texture wrapping and filtering options
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);	// repeat texture for wrapping
@@ -146,40 +291,200 @@ class Model
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);		// linear interpolation between mipmaps; linear interpolation within texture
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);	// linear interpolation within texture
 
-			int width, height, nrChannels;
-			unsigned char* data = stbi_load((directory + '/' + path).c_str(), &width, &height, &nrChannels, 0);
-			
-			GLenum format;
-			if (nrChannels == 3)
+			GLenum format = GL_RGB;
+			if (image.nrChannels == 3)
 				format = GL_RGB;
-			else if (nrChannels == 4)
+			else if (image.nrChannels == 4)
 				format = GL_RGBA;
-			
-			//std::cout << nrChannels << std::endl;
-			if (data) {
-				glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, format, GL_UNSIGNED_BYTE, data);		// texture image has RGBA, but we only read in RGB values
+
+			//std::cout << image.nrChannels << std::endl;
+			if (!image.pixels.empty()) {
+				glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, image.pixels.data());		// texture image has RGBA, but we only read in RGB values
 				glGenerateMipmap(GL_TEXTURE_2D);
 			}
-			else
-				std::cout << "ERROR: stbi_load failed to load texture" << std::endl;
-			 
-			stbi_image_free(data);
 
-			return texture;
+			// what the model shaders actually sample (the 2D texture is what HierarchicalLOD reads back)
+			MaterialTable::get().addTexture(texture, image.width, image.height, image.nrChannels, image.pixels.empty() ? nullptr : image.pixels.data());
 		}
 
-	public:
+		void releaseGL(void)
+		{
+			for (Mesh& mesh : meshes)
+				mesh.release();
+			meshes.clear();
+
+			for (const Texture& texture : textures_loaded) {
+				MaterialTable::get().releaseTexture(texture.id);
+				GLState::get().deleteTexture(texture.id);
+			}
+			textures_loaded.clear();
+		}
 
-		Model() 
+	public:
+		// what reloadTexture() did with a changed image
+		enum TextureReload {
+			TEXTURE_UNUSED = 0,		// the model doesn't use it
+			TEXTURE_RELOADED,		// re-uploaded in place
+			NEEDS_IMPORT			// it no longer fits its atlas block, so the model has to be imported again (off the GL thread)
+		};
+
+		Model()
 		{
 			is_loaded = false;
 		}
 
-		Model(const char* argPath) : path{ argPath } 
+		Model(const char* argPath) : path{ argPath }
 		{
 			is_loaded = false;
 		}
 
+		/// <summary>
+		/// Decodes an image file into CPU memory. Doesn't use OpenGL, so it's safe to call from any thread.
+		/// </summary>
+		/// <param name="file">Full path to the image</param>
+		/// <param name="image">Filled in with the decoded pixels (path is left untouched)</param>
+		/// <returns>Whether the image was decoded</returns>
+		static bool LoadImageData(const std::string& file, ImageData& image)
+		{
+			unsigned char* pixels = stbi_load(file.c_str(), &image.width, &image.height, &image.nrChannels, 0);
+			if (!pixels) {
+				std::cout << "ERROR: stbi_load failed to load texture" << std::endl;
+				image.pixels.clear();
+				return false;
+			}
+
+			image.pixels.assign(pixels, pixels + size_t(image.width) * image.height * image.nrChannels);
+			stbi_image_free(pixels);
+			return true;
+		}
+
+		/// <summary>
+		/// Reads a model file and decodes its textures without using OpenGL (safe to call from any thread).
+		/// Pass the result to upload() on the thread that owns the GL context.
+		/// </summary>
+		/// <param name="atlasSettings">Which textures are packed into atlases, and how</param>
+		/// <param name="chartSettings">How the meshes are unwrapped for lightmaps</param>
+		static ModelData import(const std::string& path, const TextureAtlas::Settings& atlasSettings = TextureAtlas::Settings(),
+			const LightmapCharts::Settings& chartSettings = LightmapCharts::Settings())
+		{
+			ModelData data;
+
+			Assimp::Importer importer;
+			const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_JoinIdenticalVertices);		// shared vertices are what the simplifier collapses
+
+			if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
+				std::cout << "ERROR: Assimp: " << importer.GetErrorString() << std::endl;
+				return data;
+			}
+			data.directory = path.substr(0, path.find_last_of('/'));
+
+			processNode(scene->mRootNode, scene, data);
+			averageDiffuseMaps(data);
+			packTextures(data, atlasSettings);
+
+			// after the levels of detail are built, so the vertices copied along chart seams don't reach the simplifier
+			LightmapCharts charts(chartSettings);
+			for (MeshData& mesh : data.meshes)
+				charts.addMesh(mesh.vertices, mesh.indices);
+			data.chartStats = charts.unwrap();
+			data.valid = true;
+			return data;
+		}
+
+		/// <summary>
+		/// Creates the GL buffers and textures for imported data, replacing whatever this model held before
+		/// </summary>
+		void upload(const ModelData& data)
+		{
+			if (!data.valid)
+				return;
+
+			releaseGL();
+			directory = data.directory;
+			atlasMembers = data.atlasMembers;
+			atlasStats = data.atlasStats;
+			chartStats = data.chartStats;
+
+			for (const ImageData& image : data.images) {
+				Texture texture;
+				glGenTextures(1, &texture.id);	// get an ID for the texture before filling it with the decoded image
+				TextureFromImage(texture.id, image);
+				texture.path = image.path;
+				textures_loaded.push_back(texture);
+			}
+
+			for (const MeshData& meshData : data.meshes) {
+				std::vector<Texture> textures = meshData.textures;
+				Material material = meshData.material;
+				for (Texture& texture : textures) {
+					for (const Texture& loaded : textures_loaded) {
+						if (loaded.path == texture.path) {
+							texture.id = loaded.id;
+							break;
+						}
+					}
+
+					// the shaders only sample one map of each type
+					if (texture.type == "texture_diffuse" && material.diffuseMap == 0)
+						material.diffuseMap = texture.id;
+					else if (texture.type == "texture_specular" && material.specularMap == 0)
+						material.specularMap = texture.id;
+				}
+				meshes.push_back(Mesh(meshData.vertices, meshData.indices, textures, material, meshData.lods));
+			}
+
+			// a model's level is as coarse as its meshes go (meshes with fewer levels stay at their coarsest)
+			lodErrors.clear();
+			for (const Mesh& mesh : meshes)
+				lodErrors.resize(std::max(lodErrors.size(), mesh.getLODCount()), 0.0f);
+			for (size_t lod = 0; lod < lodErrors.size(); ++lod) {
+				for (const Mesh& mesh : meshes)
+					lodErrors[lod] = std::max(lodErrors[lod], mesh.getLODError(lod));
+			}
+
+			bounds = AABB();
+			for (const Mesh& mesh : meshes)
+				bounds.expand(mesh.getBounds());
+			sphere = BoundingSphere();
+			sphere.center = bounds.center();
+			for (const Mesh& mesh : meshes) {
+				for (const Vertex& vertex : mesh.vertices)
+					sphere.radius = std::max(sphere.radius, glm::length(vertex.Position - sphere.center));
+			}
+
+			is_loaded = true;
+		}
+
+		/// <summary>
+		/// Re-uploads a texture in place (its texture object keeps the same ID, so meshes don't need updating).
+		/// A texture packed into an atlas is copied into its block, unless its size changed: then nothing is touched, and the
+		/// caller should import the model again (which packs its atlases again) and upload() the result.
+		/// </summary>
+		TextureReload reloadTexture(const ImageData& image)
+		{
+			for (const AtlasMember& member : atlasMembers) {
+				if (member.path != image.path)
+					continue;
+
+				if (image.width != member.width || image.height != member.height || image.pixels.empty())
+					return NEEDS_IMPORT;
+				for (const Texture& texture : textures_loaded) {
+					if (texture.path == member.atlasPath) {
+						updateAtlas(texture.id, member, image);
+						return TEXTURE_RELOADED;
+					}
+				}
+			}
+
+			for (const Texture& texture : textures_loaded) {
+				if (texture.path == image.path) {
+					TextureFromImage(texture.id, image);
+					return TEXTURE_RELOADED;
+				}
+			}
+			return TEXTURE_UNUSED;
+		}
+
 		void load(void)
 		{
 			if (path.empty()) {
@@ -187,20 +492,76 @@ class Model
 				return;
 			}
 
-			else {
-				loadModel(path);
-				is_loaded = true;
-			}
+			else
+				upload(import(path));
+		}
+
+		const std::string& getPath(void) const
+		{
+			return path;
+		}
+
+		/// <summary>
+		/// How the model's textures were packed into atlases at import
+		/// </summary>
+		const TextureAtlas::Stats& getAtlasStats(void) const
+		{
+			return atlasStats;
+		}
+
+		/// <summary>
+		/// How the meshes were unwrapped into a lightmap layout at import (size is 0 if they weren't)
+		/// </summary>
+		const LightmapCharts::Stats& getChartStats(void) const
+		{
+			return chartStats;
+		}
+
+		const std::vector<Mesh>& getMeshes(void) const
+		{
+			return meshes;
+		}
+
+		bool isLoaded(void) const
+		{
+			return is_loaded;
+		}
+
+		const AABB& getBounds(void) const
+		{
+			return bounds;
+		}
+
+		const BoundingSphere& getBoundingSphere(void) const
+		{
+			return sphere;
+		}
+
+		/// <summary>
+		/// Number of levels of detail, including full detail (at least 1 once loaded)
+		/// </summary>
+		size_t getLODCount(void) const
+		{
+			return lodErrors.size();
+		}
+
+		/// <summary>
+		/// Roughly how far (in model units) any mesh strays from full detail when drawn at a level
+		/// </summary>
+		float getLODError(size_t lod) const
+		{
+			return lod < lodErrors.size() ? lodErrors[lod] : lodErrors.empty() ? 0.0f : lodErrors.back();
 		}
 
 		void Draw(const ShaderProgram& program)
 		{
 			if (is_loaded) {
+				program.use();
 				for (const Mesh& mesh : meshes)
-					mesh.Draw(program);
+					mesh.Draw();
 			}
 
-			else 
+			else
 				std::cout << "ERROR: Model not loaded" << std::endl;
 		}
 };
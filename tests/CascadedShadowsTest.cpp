@@ -0,0 +1,214 @@
+// CascadedShadows on whatever GL the machine has: which cascades a frame renders and which it keeps, that the shadows don't
+// change while the camera slides sideways by steps that aren't whole texels (the cascades' centers are snapped to texels),
+// that shadow edges are filtered (PCF) rather than stepped, and what each cascade costs, timed by PassTimers.
+
+#include <cstring>
+#include "TestSupport.h"
+#include "CascadedShadows.h"
+#include "ClusteredLights.h"
+#include "FrameData.h"
+#include "ObjectConstants.h"
+#include "ShaderLOD.h"
+
+const int WIDTH = 256, HEIGHT = 256;
+const float NEAR_PLANE = 0.1f, FAR_PLANE = 100.0f;
+const int SETTLE_FRAMES = 4;		// enough for every cached cascade to have been rendered once
+const int SLIDE_FRAMES = 20;
+const float SLIDE_STEP = 0.013f;	// not a whole number of texels of any cascade
+
+/// <summary>
+/// A lit scene and everything a frame needs; the shadows can be placed for a different view than the one drawn
+/// </summary>
+struct ShadowScene {
+	ShaderProgram& program;
+	std::vector<Object*> objects;
+	RingBuffer ring;
+	ObjectConstants objectConstants;
+	FrameDataBuffer frameData;
+	ClusteredLights clusteredLights;
+	CascadedShadows& cascadedShadows;
+	PassTimers passTimers;
+	std::vector<Light> noLights;
+	glm::vec3 sunDirection = glm::normalize(glm::vec3(1.0f, 2.0f, 0.0f));
+	glm::mat4 projection = glm::perspective(glm::radians(45.0f), float(WIDTH) / HEIGHT, NEAR_PLANE, FAR_PLANE);
+
+	ShadowScene(ShaderProgram& lit, CascadedShadows& shadows) : program{ lit }, cascadedShadows{ shadows } {}
+
+	const CascadedShadows::Stats& drawFrame(const glm::mat4& shadowView, const glm::mat4& view, std::vector<unsigned char>* pixels = nullptr)
+	{
+		GLState::get().beginFrame();
+		ring.beginFrame();
+		passTimers.beginFrame();
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+		objectConstants.update(ring, objects, view, projection);
+		objectConstants.bind();
+		MaterialTable::get().bind();
+		FrameData data = FrameData();
+		data.sunPosition = sunDirection;
+		data.sunAmbientIntensity = 0.2f;
+		data.sunAmbientColor = glm::vec3(1.0f);
+		data.sunDiffuse = glm::vec3(1.0f);
+		data.viewPos = glm::vec3(glm::inverse(view)[3]);
+		frameData.update(ring, data);
+		clusteredLights.update(ring, noLights, view, projection, NEAR_PLANE, FAR_PLANE, WIDTH, HEIGHT);
+		clusteredLights.bind();
+		cascadedShadows.update(ring, objects, sunDirection, shadowView, projection, NEAR_PLANE, passTimers);
+		cascadedShadows.bind();
+
+		for (Object* object : objects)
+			object->Draw(program);
+		if (pixels)
+			glReadPixels(0, 0, WIDTH, HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, pixels->data());
+		ring.endFrame();
+		return cascadedShadows.getLastStats();
+	}
+};
+
+bool statsAre(const CascadedShadows::Stats& stats, unsigned int rendered, unsigned int cached, unsigned int waiting)
+{
+	return stats.cascadesRendered == rendered && stats.cascadesCached == cached && stats.cascadesWaiting == waiting;
+}
+
+/// <summary>
+/// Cascades 0 and 1 every frame, 2 and 3 only when they're out of date, at most one of those a frame
+/// </summary>
+void testCaching(ShadowScene& scene, const glm::mat4& view)
+{
+	CHECK(statsAre(scene.drawFrame(view, view), 3, 0, 1));
+	CHECK(statsAre(scene.drawFrame(view, view), 3, 1, 0));
+	CHECK(statsAre(scene.drawFrame(view, view), 2, 2, 0));
+	CHECK(statsAre(scene.drawFrame(glm::translate(view, glm::vec3(-0.5f, 0.0f, 0.0f)), view), 2, 2, 0));		// still inside their margins
+
+	scene.cascadedShadows.invalidate();
+	CHECK(statsAre(scene.drawFrame(view, view), 3, 0, 1));
+	CHECK(statsAre(scene.drawFrame(view, view), 3, 1, 0));
+
+	glm::vec3 sun = scene.sunDirection;
+	scene.sunDirection = glm::normalize(glm::vec3(1.0f, 2.0f, 0.2f));
+	CHECK(statsAre(scene.drawFrame(view, view), 3, 0, 1));
+	scene.sunDirection = sun;
+	scene.drawFrame(view, view);
+
+	CHECK(statsAre(scene.drawFrame(glm::translate(view, glm::vec3(-30.0f, 0.0f, 0.0f)), view), 3, 0, 1));		// far out of them
+	for (int i = 0; i < SETTLE_FRAMES; ++i)
+		scene.drawFrame(view, view);
+	CHECK(statsAre(scene.cascadedShadows.getLastStats(), 2, 2, 0));
+}
+
+/// <summary>
+/// The shadows are placed for a camera sliding sideways in steps that aren't whole texels, while the picture is drawn from a still one
+/// (sliding sideways doesn't change which cascade a point falls in): every frame must match the first
+/// </summary>
+void testSnapping(ShadowScene& scene, const glm::mat4& view)
+{
+	std::vector<unsigned char> first(WIDTH * HEIGHT * 4), pixels(WIDTH * HEIGHT * 4);
+	for (int i = 0; i < SETTLE_FRAMES; ++i)
+		scene.drawFrame(view, view, &first);
+
+	unsigned int changedFrames = 0, changedPixels = 0;
+	for (int frame = 1; frame <= SLIDE_FRAMES; ++frame) {
+		scene.drawFrame(glm::translate(view, glm::vec3(-SLIDE_STEP * frame, 0.0f, 0.0f)), view, &pixels);
+		unsigned int changed = 0;
+		for (size_t i = 0; i < pixels.size(); i += 4)
+			changed += std::memcmp(&pixels[i], &first[i], 3) != 0;
+		changedFrames += changed > 0;
+		changedPixels += changed;
+	}
+	std::printf("camera slid %.3f units in %d frames: %u frames and %u pixels changed\n", SLIDE_STEP * SLIDE_FRAMES, SLIDE_FRAMES, changedFrames, changedPixels);
+	CHECK(changedFrames == 0);
+}
+
+/// <summary>
+/// Looking straight down at a pillar's shadow on the ground: across its edge the ground goes from shadowed to lit over several
+/// pixels, in small steps
+/// </summary>
+void testFiltering(ShadowScene& scene)
+{
+	glm::mat4 view = glm::lookAt(glm::vec3(-2.0f, 5.0f, 20.0f), glm::vec3(-2.0f, 0.0f, 20.0f), glm::vec3(0.0f, 0.0f, -1.0f));
+	std::vector<unsigned char> pixels(WIDTH * HEIGHT * 4);
+	for (int i = 0; i < SETTLE_FRAMES; ++i)
+		scene.drawFrame(view, view, &pixels);
+
+	// the row through the pillar, going from its shadow (-x, to the left) out into the sun; the ground is green, the pillar red
+	const unsigned char* row = &pixels[size_t(HEIGHT / 2) * WIDTH * 4];
+	int shadowed = 255, lit = 0;
+	for (int x = 0; x < WIDTH; ++x) {
+		if (row[x * 4 + 1] > row[x * 4]) {
+			shadowed = std::min(shadowed, (int)row[x * 4 + 1]);
+			lit = std::max(lit, (int)row[x * 4 + 1]);
+		}
+	}
+	int penumbra = 0, largestStep = 0;
+	for (int x = 1; x < WIDTH; ++x) {
+		if (row[x * 4 + 1] <= row[x * 4] || row[(x - 1) * 4 + 1] <= row[(x - 1) * 4])
+			continue;		// the pillar
+		int green = row[x * 4 + 1];
+		penumbra += green > shadowed + 2 && green < lit - 2;
+		largestStep = std::max(largestStep, std::abs(green - (int)row[(x - 1) * 4 + 1]));
+	}
+	std::printf("shadow edge: ground %d shadowed, %d lit, %d pixels in between, largest step %d\n", shadowed, lit, penumbra, largestStep);
+
+	CHECK(lit - shadowed > 40);		// there is a shadow
+	CHECK(penumbra >= 6);			// 3x3 taps spread the edge over about three texels (one filtered tap leaves about one)
+	CHECK(largestStep < (lit - shadowed) / 4);
+}
+
+int main(void)
+{
+	HeadlessContext context;
+	if (!context.create(WIDTH, HEIGHT))
+		return TEST_SKIPPED;
+
+	std::string defines = ShaderLOD::defines(ShaderLOD::FULL);
+	ShaderProgram program(ShaderFile(REPO_DIR "VertexShader.vert", "vertex", defines), ShaderFile(REPO_DIR "FragmentShader.frag", "fragment", defines));
+	ShaderProgram shadowProgram(ShaderFile(REPO_DIR "ShadowVertexShader.vert", "vertex"), ShaderFile(REPO_DIR "ShadowFragmentShader.frag", "fragment"));
+
+	// static ground and pillars, and a crate that moves (only the near cascades draw it)
+	std::shared_ptr<Model> ground = uploadModel(groundMesh(60.0f, 0.0f, 8, glm::vec3(0.3f, 0.6f, 0.2f)));
+	std::shared_ptr<Model> pillar = uploadModel(boxMesh(glm::vec3(-0.5f, 0.0f, -0.5f), glm::vec3(0.5f, 3.0f, 0.5f), glm::vec3(0.8f, 0.1f, 0.1f)));
+	std::shared_ptr<Model> crate = uploadModel(boxMesh(glm::vec3(-0.5f, 0.0f, -0.5f), glm::vec3(0.5f, 1.0f, 0.5f), glm::vec3(0.8f, 0.1f, 0.1f)));
+	std::vector<std::unique_ptr<Object>> owned;
+	owned.emplace_back(new Object(ground));
+	for (int i = 0; i < 8; ++i) {
+		owned.emplace_back(new Object(pillar));
+		owned.back()->Translate(i % 2 ? 3.0f : -3.0f, 0.0f, -4.0f - i * 5.0f);
+	}
+	owned.emplace_back(new Object(pillar));		// under the camera looking down, behind the other one
+	owned.back()->Translate(0.0f, 0.0f, 20.0f);
+	for (std::unique_ptr<Object>& object : owned)
+		object->setStatic(true);
+	owned.emplace_back(new Object(crate));
+	owned.back()->Translate(1.0f, 0.0f, -3.0f);
+
+	CascadedShadows::Settings settings;
+	settings.resolution = 256;		// texels a few pixels wide in the view looking down, so the filtering shows
+	CascadedShadows cascadedShadows(shadowProgram, settings);
+	ShadowScene scene(program, cascadedShadows);
+	for (std::unique_ptr<Object>& object : owned)
+		scene.objects.push_back(object.get());
+	context.bindFramebuffer();
+	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 2.0f, 0.0f), glm::vec3(0.0f, 1.0f, -4.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	testCaching(scene, view);
+	testSnapping(scene, view);
+	testFiltering(scene);
+
+	// each cascade is its own pass; the cached ones only cost something in the frames that render them
+	for (int i = 0; i < 60; ++i)
+		scene.drawFrame(view, view);
+	glFinish();
+	scene.drawFrame(view, view);
+	const PassTimers::Stats& times = scene.passTimers.getStats();
+	std::printf("%-18s %8s %8s\n", "", "GPU ms", "CPU ms");
+	for (int i = 0; i < CascadedShadows::MAX_CASCADES; ++i) {
+		PassTimers::Pass pass = (PassTimers::Pass)(PassTimers::SHADOW_CASCADE_0 + i);
+		std::printf("%-18s %8.3f %8.3f\n", PassTimers::getName(pass), times.gpuMilliseconds[pass], times.cpuMilliseconds[pass]);
+	}
+	CHECK(times.cpuMilliseconds[PassTimers::SHADOW_CASCADE_0] > 0.0f && times.cpuMilliseconds[PassTimers::SHADOW_CASCADE_1] > 0.0f);
+	CHECK(times.cpuMilliseconds[PassTimers::SHADOW_CASCADE_3] < times.cpuMilliseconds[PassTimers::SHADOW_CASCADE_1]);
+
+	CHECK(glGetError() == GL_NO_ERROR);
+	return testResult();
+}
@@ -0,0 +1,193 @@
+// Steady-state frames must not allocate in the draw path: Material::apply() binds what was resolved at import, the frustum
+// culler (and the SceneBVH it queries), render queue, static batches and per-frame constants reuse their storage, and
+// Mesh::Draw() / Object::Draw() only issue GL calls.
+// operator new is replaced with one that counts the allocations the main thread makes while a frame is being drawn, and
+// the camera goes around the scene once first, so every buffer has grown to what the views need, then the same orbit is counted.
+
+#include <cstdlib>
+#include <new>
+#include "TestSupport.h"
+#include "CascadedShadows.h"
+#include "ClusteredLights.h"
+#include "FrameData.h"
+#include "FrustumCuller.h"
+#include "ObjectConstants.h"
+#include "PassTimers.h"
+#include "RenderQueue.h"
+#include "RingBuffer.h"
+#include "SceneBVH.h"
+#include "ShaderLOD.h"
+#include "StaticBatcher.h"
+
+// only the test's own thread is counted (the driver's threads can allocate whenever they like)
+static thread_local bool countAllocations = false;
+static size_t allocations = 0;
+
+void* operator new(std::size_t size)
+{
+	if (countAllocations)
+		++allocations;
+	if (void* memory = std::malloc(size ? size : 1))
+		return memory;
+	throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* memory) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete[](void* memory) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete[](void* memory, std::size_t) noexcept
+{
+	std::free(memory);
+}
+
+const int WIDTH = 256, HEIGHT = 256;
+const float NEAR_PLANE = 0.1f, FAR_PLANE = 100.0f;
+const int ORBIT_FRAMES = 24;		// the camera circles the crates once in this many frames
+
+int main(void)
+{
+	HeadlessContext context;
+	if (!context.create(WIDTH, HEIGHT))
+		return TEST_SKIPPED;
+
+	std::string defines = ShaderLOD::defines(ShaderLOD::FULL);
+	ShaderProgram program(ShaderFile(REPO_DIR "VertexShader.vert", "vertex", defines), ShaderFile(REPO_DIR "FragmentShader.frag", "fragment", defines));
+	ShaderProgram shadowProgram(ShaderFile(REPO_DIR "ShadowVertexShader.vert", "vertex"), ShaderFile(REPO_DIR "ShadowFragmentShader.frag", "fragment"));
+
+	// a textured crate and an untextured one (both Material paths), drawn through the queue, directly, and from a static batch
+	ModelData crateData;
+	MeshData textured = boxMesh(glm::vec3(-0.5f), glm::vec3(0.5f));
+	addSolidTexture(crateData, textured, "crate.png", glm::vec3(0.6f, 0.4f, 0.2f));
+	crateData.meshes.push_back(textured);
+	crateData.meshes.push_back(boxMesh(glm::vec3(-0.25f, 0.5f, -0.25f), glm::vec3(0.25f, 1.0f, 0.25f), glm::vec3(0.2f, 0.3f, 0.8f)));
+	std::shared_ptr<Model> crate = uploadModel(crateData);
+	std::shared_ptr<Model> ground = uploadModel(groundMesh(20.0f, -0.5f, 4));
+
+	std::vector<std::unique_ptr<Object>> owned;
+	std::vector<Object*> objects;
+	for (int i = 0; i < 16; ++i) {
+		owned.emplace_back(new Object(crate));
+		owned.back()->Translate(float(i % 4) * 2.0f - 3.0f, 0.0f, float(i / 4) * 2.0f - 3.0f);
+		owned.back()->setStatic(i % 2 == 0);
+		objects.push_back(owned.back().get());
+	}
+	owned.emplace_back(new Object(ground));
+	owned.back()->setStatic(true);
+	objects.push_back(owned.back().get());
+
+	StaticBatcher staticBatcher;
+	staticBatcher.build(objects);
+
+	std::vector<AABB> worldBounds;
+	for (Object* object : objects)
+		worldBounds.push_back(object->getWorldBounds());
+	SceneBVH sceneIndex;
+	sceneIndex.build(worldBounds);
+	FrustumCuller frustumCuller;
+
+	RingBuffer ring;
+	ObjectConstants objectConstants;
+	FrameDataBuffer frameData;
+	ClusteredLights clusteredLights;
+	CascadedShadows cascadedShadows(shadowProgram);
+	PassTimers passTimers;
+	RenderQueue renderQueue;
+	renderQueue.setDepthRange(NEAR_PLANE, FAR_PLANE);
+
+	std::vector<Light> lights(4);
+	for (size_t i = 0; i < lights.size(); ++i) {
+		lights[i].position = glm::vec3(float(i) * 2.0f - 3.0f, 2.0f, 0.0f);
+		lights[i].range = 5.0f;
+	}
+	std::vector<Object*> visibleObjects;
+	std::vector<const unsigned char*> batchedMeshes;
+	glm::mat4 projection = glm::perspective(glm::radians(45.0f), float(WIDTH) / HEIGHT, NEAR_PLANE, FAR_PLANE);
+	glm::vec3 sunDirection = glm::normalize(glm::vec3(-0.5f, 1.0f, 0.3f));
+
+	size_t countedAllocations = 0;
+	for (int frame = 0; frame < ORBIT_FRAMES * 2; ++frame) {
+		float angle = glm::radians(360.0f) * float(frame % ORBIT_FRAMES) / ORBIT_FRAMES;
+		glm::vec3 cameraPos(std::sin(angle) * 8.0f, 4.0f, std::cos(angle) * 8.0f);
+		glm::mat4 view = glm::lookAt(cameraPos, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+		allocations = 0;
+		countAllocations = true;
+
+		GLState::get().beginFrame();
+		ring.beginFrame();
+		passTimers.beginFrame();
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+		visibleObjects.assign(objects.begin(), objects.end());
+		visibleObjects.push_back(&staticBatcher.getWorldObject());
+		objectConstants.update(ring, visibleObjects, view, projection);
+		objectConstants.bind();
+		MaterialTable::get().bind();
+
+		FrameData data = FrameData();
+		data.sunPosition = sunDirection;
+		data.sunAmbientIntensity = 0.3f;
+		data.sunAmbientColor = glm::vec3(1.0f);
+		data.sunDiffuse = glm::vec3(1.0f);
+		data.viewPos = cameraPos;
+		frameData.update(ring, data);
+		clusteredLights.update(ring, lights, view, projection, NEAR_PLANE, FAR_PLANE, WIDTH, HEIGHT);
+		clusteredLights.bind();
+		cascadedShadows.update(ring, objects, sunDirection, view, projection, NEAR_PLANE, passTimers);
+		cascadedShadows.bind();
+		context.bindFramebuffer();
+
+		// what's in view: static crates from the batch, every other one through the queue, and the last one drawn directly
+		frustumCuller.cull(objects, projection * view, &sceneIndex);
+		renderQueue.clear();
+		batchedMeshes.assign(objects.size(), nullptr);
+		for (size_t i = 0; i + 2 < objects.size(); ++i) {
+			if (!frustumCuller.isVisible(i))
+				continue;
+			if (objects[i]->isStatic())
+				batchedMeshes[i] = frustumCuller.getMeshVisibility(i);
+			else
+				objects[i]->Submit(renderQueue, program, cameraPos, frustumCuller.getMeshVisibility(i));
+		}
+		if (frustumCuller.isVisible(objects.size() - 1))
+			batchedMeshes.back() = frustumCuller.getMeshVisibility(objects.size() - 1);
+		renderQueue.sort();
+
+		passTimers.begin(PassTimers::OPAQUE_PASS);
+		staticBatcher.draw(program, batchedMeshes);
+		renderQueue.execute(ring);
+		if (frustumCuller.isVisible(objects.size() - 2))
+			objects[objects.size() - 2]->Draw(program, frustumCuller.getMeshVisibility(objects.size() - 2));
+		passTimers.end();
+		ring.endFrame();
+
+		countAllocations = false;
+		if (frame >= ORBIT_FRAMES)
+			countedAllocations += allocations;
+	}
+	glFinish();
+
+	std::printf("%zu heap allocations in %d steady-state frames\n", countedAllocations, ORBIT_FRAMES);
+	CHECK(countedAllocations == 0);
+	CHECK(frustumCuller.getLastStats().nodesVisited > 0);		// the culler really went through the scene index
+	CHECK(glGetError() == GL_NO_ERROR);
+	// the crates' textured faces and the ground reached the framebuffer
+	CHECK(context.readPixel(WIDTH / 2, HEIGHT / 2).a > 0.0f);
+	return testResult();
+}
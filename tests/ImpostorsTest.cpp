@@ -0,0 +1,95 @@
+// Impostors on whatever GL the machine has: a textured crate is baked, drawn far away as an impostor, and baked again
+// (as the program does when its models are reloaded) while another texture is bound to the active unit and the atlases
+// are still bound from the draw. The rebake must write the atlases, not that texture, and draw exactly what the first bake did.
+
+#include <cstring>
+#include "TestSupport.h"
+#include "FrameData.h"
+#include "Impostors.h"
+#include "RingBuffer.h"
+
+const int WIDTH = 128, HEIGHT = 128;
+const float NEAR_PLANE = 0.1f, FAR_PLANE = 100.0f;
+const int SENTINEL_SIZE = 16;
+
+/// <summary>
+/// One frame with the object drawn as an impostor, read back
+/// </summary>
+void drawFrame(Impostors& impostors, const Object& object, RingBuffer& ring, FrameDataBuffer& frameData, std::vector<unsigned char>& pixels)
+{
+	glm::vec3 cameraPos(0.0f, 0.0f, 0.0f);
+	glm::mat4 view = glm::lookAt(cameraPos, glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	glm::mat4 projection = glm::perspective(glm::radians(45.0f), float(WIDTH) / HEIGHT, NEAR_PLANE, FAR_PLANE);
+
+	GLState::get().beginFrame();
+	ring.beginFrame();
+	FrameData data = FrameData();
+	data.sunPosition = glm::vec3(0.3f, 1.0f, 0.6f);
+	data.sunAmbientIntensity = 0.4f;
+	data.sunAmbientColor = glm::vec3(1.0f);
+	data.sunDiffuse = glm::vec3(1.0f);
+	data.viewPos = cameraPos;
+	frameData.update(ring, data);
+
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	impostors.beginFrame(1);
+	CHECK(impostors.submit(object, 0, cameraPos, projection, float(HEIGHT)));
+	impostors.draw(ring, projection * view);
+	glReadPixels(0, 0, WIDTH, HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+	ring.endFrame();
+}
+
+int main(void)
+{
+	HeadlessContext context;
+	if (!context.create(WIDTH, HEIGHT))
+		return TEST_SKIPPED;
+
+	ShaderProgram bakeProgram(ShaderFile(REPO_DIR "ImpostorBakeVertexShader.vert", "vertex"), ShaderFile(REPO_DIR "ImpostorBakeFragmentShader.frag", "fragment"));
+	ShaderProgram impostorProgram(ShaderFile(REPO_DIR "ImpostorVertexShader.vert", "vertex"), ShaderFile(REPO_DIR "ImpostorFragmentShader.frag", "fragment"));
+
+	ModelData crateData;
+	MeshData crateMesh = boxMesh(glm::vec3(-1.0f), glm::vec3(1.0f));
+	addSolidTexture(crateData, crateMesh, "crate.png", glm::vec3(0.6f, 0.4f, 0.2f));
+	crateData.meshes.push_back(crateMesh);
+	std::shared_ptr<Model> crate = uploadModel(crateData);
+	Object object(crate);
+	object.Translate(0.0f, 0.0f, -40.0f);		// a few pixels across, well under the switching size
+
+	RingBuffer ring;
+	FrameDataBuffer frameData;
+	Impostors impostors(bakeProgram, impostorProgram);
+	impostors.add(object.getModel());
+	context.bindFramebuffer();
+
+	std::vector<unsigned char> baked(WIDTH * HEIGHT * 4), rebaked(WIDTH * HEIGHT * 4);
+	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+	drawFrame(impostors, object, ring, frameData, baked);
+
+	// a texture on another unit, left active: the atlases' units are already bound to them, so only selecting the
+	// unit keeps the rebake from reallocating this one
+	unsigned int sentinel;
+	glGenTextures(1, &sentinel);
+	GLState::get().bindTexture(LIGHTMAP_UNIT, GL_TEXTURE_2D, sentinel);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, SENTINEL_SIZE, SENTINEL_SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	impostors.rebake();
+	context.bindFramebuffer();
+
+	int sentinelWidth = 0;
+	GLState::get().bindTexture(LIGHTMAP_UNIT, GL_TEXTURE_2D, sentinel);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &sentinelWidth);
+	drawFrame(impostors, object, ring, frameData, rebaked);
+
+	unsigned int covered = 0;
+	for (size_t i = 3; i < baked.size(); i += 4)
+		covered += baked[i] > 0;
+	std::printf("impostor covers %u pixels; baked in %.2f ms; the texture on the active unit is %dx%d after the rebake\n", covered,
+		impostors.getBakeMilliseconds(), sentinelWidth, sentinelWidth);
+
+	CHECK(covered > 0);
+	CHECK(sentinelWidth == SENTINEL_SIZE);
+	CHECK(std::memcmp(baked.data(), rebaked.data(), baked.size()) == 0);
+	CHECK(glGetError() == GL_NO_ERROR);
+	glDeleteTextures(1, &sentinel);
+	return testResult();
+}
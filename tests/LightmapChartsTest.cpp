@@ -0,0 +1,160 @@
+// LightmapCharts, without GL: a box, a ground of several cells and a sphere are unwrapped into one layout, which must keep
+// every coordinate inside [0, 1], keep charts from overlapping or coming within a gutter of each other, and (on the flat,
+// axis-aligned faces) keep texels texelsPerUnit apart. Then again with a layout too small for that density, which has to
+// be scaled down to fit.
+
+#include "TestSupport.h"
+
+/// <summary>
+/// A sphere of rings and segments, with shared vertices (so its charts are curved patches)
+/// </summary>
+MeshData sphereMesh(const glm::vec3& center, float radius, int rings, int segments)
+{
+	MeshData mesh;
+	for (int ring = 0; ring <= rings; ++ring) {
+		float polar = 3.14159265f * ring / rings;
+		for (int segment = 0; segment < segments; ++segment) {
+			float azimuth = 6.2831853f * segment / segments;
+			Vertex vertex = Vertex();
+			vertex.Normal = glm::vec3(std::sin(polar) * std::cos(azimuth), std::cos(polar), std::sin(polar) * std::sin(azimuth));
+			vertex.Position = center + vertex.Normal * radius;
+			mesh.vertices.push_back(vertex);
+		}
+	}
+	for (int ring = 0; ring < rings; ++ring) {
+		for (int segment = 0; segment < segments; ++segment) {
+			unsigned int a = ring * segments + segment, b = ring * segments + (segment + 1) % segments;
+			unsigned int c = a + segments, d = b + segments;
+			if (ring > 0) {
+				const unsigned int top[3] = { a, b, c };
+				mesh.indices.insert(mesh.indices.end(), top, top + 3);
+			}
+			if (ring + 1 < rings) {
+				const unsigned int bottom[3] = { b, d, c };
+				mesh.indices.insert(mesh.indices.end(), bottom, bottom + 3);
+			}
+		}
+	}
+	return mesh;
+}
+
+float edgeFunction(const glm::vec2& a, const glm::vec2& b, const glm::vec2& p)
+{
+	return (b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x);
+}
+
+int findRoot(std::vector<int>& parents, int i)
+{
+	while (parents[i] != i)
+		i = parents[i] = parents[parents[i]];
+	return i;
+}
+
+/// <summary>
+/// Unwraps the meshes and checks the layout; returns the stats
+/// </summary>
+LightmapCharts::Stats checkLayout(std::vector<MeshData>& meshes, const LightmapCharts::Settings& settings)
+{
+	LightmapCharts charts(settings);
+	for (MeshData& mesh : meshes)
+		charts.addMesh(mesh.vertices, mesh.indices);
+	LightmapCharts::Stats stats = charts.unwrap();
+	CHECK(stats.size > 0 && stats.size <= settings.maxSize);
+	if (stats.size == 0)
+		return stats;
+
+	// charts don't share vertices (unwrap() copies them at seams), so triangles joined by vertices are in the same chart
+	std::vector<int> owner(size_t(stats.size) * stats.size, -1);
+	unsigned int outside = 0, overlapping = 0, stretched = 0, piecesBase = 0;
+	for (const MeshData& mesh : meshes) {
+		std::vector<int> parents(mesh.vertices.size());
+		for (size_t i = 0; i < parents.size(); ++i)
+			parents[i] = (int)i;
+		for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+			parents[findRoot(parents, mesh.indices[i + 1])] = findRoot(parents, mesh.indices[i]);
+			parents[findRoot(parents, mesh.indices[i + 2])] = findRoot(parents, mesh.indices[i]);
+		}
+
+		for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+			int piece = (int)piecesBase + findRoot(parents, mesh.indices[i]);
+			glm::vec2 uv[3];
+			glm::vec3 position[3];
+			for (int k = 0; k < 3; ++k) {
+				const Vertex& vertex = mesh.vertices[mesh.indices[i + k]];
+				uv[k] = vertex.LightmapCoords * float(stats.size);		// in texels
+				position[k] = vertex.Position;
+				glm::vec2 coords = vertex.LightmapCoords;
+				outside += coords.x < 0.0f || coords.y < 0.0f || coords.x > 1.0f || coords.y > 1.0f;
+			}
+
+			// axis-aligned faces are laid out at the density the layout was packed at
+			glm::vec3 normal = glm::cross(position[1] - position[0], position[2] - position[0]);
+			float texelArea = std::abs(edgeFunction(uv[0], uv[1], uv[2])) * 0.5f;
+			float worldArea = glm::length(normal) * 0.5f;
+			glm::vec3 axes = glm::abs(normal) / glm::length(normal);
+			if (std::max(std::max(axes.x, axes.y), axes.z) > 0.9999f && std::abs(texelArea - worldArea * stats.texelsPerUnit * stats.texelsPerUnit) > 0.01f * texelArea)
+				++stretched;
+
+			// the texel centers the triangle covers
+			float area = edgeFunction(uv[0], uv[1], uv[2]);
+			glm::vec2 low = glm::min(glm::min(uv[0], uv[1]), uv[2]), high = glm::max(glm::max(uv[0], uv[1]), uv[2]);
+			for (int y = std::max((int)std::floor(low.y), 0); y <= std::min((int)high.y, stats.size - 1); ++y) {
+				for (int x = std::max((int)std::floor(low.x), 0); x <= std::min((int)high.x, stats.size - 1); ++x) {
+					glm::vec2 p(x + 0.5f, y + 0.5f);
+					float w0 = edgeFunction(uv[1], uv[2], p) * area, w1 = edgeFunction(uv[2], uv[0], p) * area, w2 = edgeFunction(uv[0], uv[1], p) * area;
+					if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+						continue;
+					int& texel = owner[size_t(y) * stats.size + x];
+					overlapping += texel >= 0 && texel != piece;
+					texel = piece;
+				}
+			}
+		}
+		piecesBase += (unsigned int)mesh.vertices.size();
+	}
+
+	// no other chart's texel within a gutter of a chart's texel
+	unsigned int crowded = 0;
+	for (int y = 0; y < stats.size; ++y) {
+		for (int x = 0; x < stats.size; ++x) {
+			int piece = owner[size_t(y) * stats.size + x];
+			if (piece < 0)
+				continue;
+			for (int dy = -settings.gutter; dy <= settings.gutter; ++dy) {
+				for (int dx = -settings.gutter; dx <= settings.gutter; ++dx) {
+					int nx = x + dx, ny = y + dy;
+					if (nx >= 0 && ny >= 0 && nx < stats.size && ny < stats.size) {
+						int other = owner[size_t(ny) * stats.size + nx];
+						crowded += other >= 0 && other != piece;
+					}
+				}
+			}
+		}
+	}
+
+	std::printf("%u charts, %u seam vertices, %dx%d at %.2f texels per unit: %u coordinates outside, %u texels overlapping, %u crowded, %u stretched triangles\n",
+		stats.charts, stats.seamVertices, stats.size, stats.size, stats.texelsPerUnit, outside, overlapping, crowded, stretched);
+	CHECK(outside == 0);
+	CHECK(overlapping == 0);
+	CHECK(crowded == 0);
+	CHECK(stretched == 0);
+	return stats;
+}
+
+int main(void)
+{
+	std::vector<MeshData> meshes = { boxMesh(glm::vec3(-1.0f, 0.0f, -1.0f), glm::vec3(1.0f, 3.0f, 2.0f)), groundMesh(4.0f, 0.0f, 4),
+		sphereMesh(glm::vec3(0.0f, 4.0f, 0.0f), 1.5f, 12, 16) };
+
+	LightmapCharts::Settings settings;
+	LightmapCharts::Stats stats = checkLayout(meshes, settings);
+	CHECK(stats.charts >= 6 + 1 + 6);		// a face of the box each, the ground, and at least one per direction on the sphere
+	CHECK(stats.texelsPerUnit == settings.texelsPerUnit);
+
+	std::vector<MeshData> fresh = { boxMesh(glm::vec3(-1.0f, 0.0f, -1.0f), glm::vec3(1.0f, 3.0f, 2.0f)), groundMesh(4.0f, 0.0f, 4),
+		sphereMesh(glm::vec3(0.0f, 4.0f, 0.0f), 1.5f, 12, 16) };
+	settings.maxSize = 32;
+	stats = checkLayout(fresh, settings);
+	CHECK(stats.texelsPerUnit < settings.texelsPerUnit);
+	return testResult();
+}
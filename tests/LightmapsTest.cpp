@@ -0,0 +1,218 @@
+// Lightmaps' path tracer on whatever GL the machine has. First the rays it casts: TriangleScene's closest hits and occlusion
+// tests against testing every triangle. Then a box on the ground lit by a low sun, baked and drawn from above with the
+// LIGHTMAP shader variant: with no bounces, open ground gets exactly the sun's cosine, ground by the box's lit side gets more
+// (off that side) and the box's shadow, which only sees unlit sides, gets nothing; with bounces, light reaches into the
+// shadow through those sides. Last, a bake saved to a file loads back only for the same scene, draws the same, and stops
+// being up to date once the box moves.
+
+#include <cstring>
+#include <random>
+#include "TestSupport.h"
+#include "ClusteredLights.h"
+#include "FrameData.h"
+#include "Lightmaps.h"
+#include "ObjectConstants.h"
+#include "ShaderLOD.h"
+#include "TriangleScene.h"
+
+const int WIDTH = 256, HEIGHT = 256;
+const float NEAR_PLANE = 0.1f, FAR_PLANE = 100.0f;
+const float ALBEDO = 0.5f;
+const char* const LIGHTMAP_FILE = "LightmapsTest.lightmap";		// in the working directory (the build directory under ctest)
+
+/// <summary>
+/// Where a ray hits a triangle (Möller-Trumbore), or INFINITY
+/// </summary>
+float rayHits(const TriangleScene::Triangle& triangle, const glm::vec3& origin, const glm::vec3& direction)
+{
+	glm::vec3 p = glm::cross(direction, triangle.edge2);
+	float determinant = glm::dot(triangle.edge1, p);
+	if (std::abs(determinant) < 1e-12f)
+		return INFINITY;
+	glm::vec3 t = origin - triangle.v0;
+	float u = glm::dot(t, p) / determinant;
+	glm::vec3 q = glm::cross(t, triangle.edge1);
+	float v = glm::dot(direction, q) / determinant;
+	float distance = glm::dot(triangle.edge2, q) / determinant;
+	return u >= 0.0f && v >= 0.0f && u + v <= 1.0f && distance > 0.0f ? distance : INFINITY;
+}
+
+/// <summary>
+/// Random rays through a field of boxes: the closest hit and whether anything is within a short distance must match testing
+/// every triangle (up to hits within a hair of each other, where either triangle is right)
+/// </summary>
+void testRays(void)
+{
+	std::shared_ptr<Model> box = uploadModel(boxMesh(glm::vec3(-0.5f), glm::vec3(0.5f)));
+	std::vector<std::unique_ptr<Object>> owned;
+	std::vector<Object*> objects;
+	std::mt19937 random(5);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+	for (int i = 0; i < 400; ++i) {
+		owned.emplace_back(new Object(box));
+		owned.back()->Translate(unit(random) * 20.0f, unit(random) * 4.0f, unit(random) * 20.0f);
+		owned.back()->Rotate(unit(random) * 180.0f, axisY);
+		owned.back()->Rotate(unit(random) * 180.0f, axisX);
+		objects.push_back(owned.back().get());
+	}
+	TriangleScene scene;
+	scene.build(objects);
+
+	const int RAYS = 2000;
+	const float SHORT_DISTANCE = 5.0f;
+	unsigned int hits = 0, wrongHits = 0, wrongOcclusion = 0;
+	for (int k = 0; k < RAYS; ++k) {
+		glm::vec3 origin(unit(random) * 22.0f, unit(random) * 5.0f, unit(random) * 22.0f);
+		glm::vec3 direction = glm::normalize(glm::vec3(unit(random), unit(random) * 0.3f, unit(random)));
+
+		float closest = INFINITY;
+		for (size_t i = 0; i < scene.getTriangleCount(); ++i)
+			closest = std::min(closest, rayHits(scene.getTriangle((int)i), origin, direction));
+		TriangleScene::Hit hit;
+		bool found = scene.intersect(origin, direction, INFINITY, hit);
+		hits += found;
+		if (found != (closest != INFINITY) || (found && std::abs(hit.distance - closest) > 1e-4f * std::max(closest, 1.0f)))
+			++wrongHits;
+		if (scene.occluded(origin, direction, SHORT_DISTANCE) != (closest <= SHORT_DISTANCE) && std::abs(closest - SHORT_DISTANCE) > 1e-4f)
+			++wrongOcclusion;
+	}
+	std::printf("%zu triangles, %d rays: %u hit, %u closest hits and %u occlusion tests differ from testing every triangle\n",
+		scene.getTriangleCount(), RAYS, hits, wrongHits, wrongOcclusion);
+	CHECK(hits > RAYS / 10);
+	CHECK(wrongHits == 0);
+	CHECK(wrongOcclusion == 0);
+}
+
+/// <summary>
+/// A box on the ground, with everything a frame drawn with the lightmap needs
+/// </summary>
+struct LitScene {
+	std::vector<std::unique_ptr<Object>> owned;
+	std::vector<Object*> objects;
+	glm::vec3 sunDirection = glm::normalize(glm::vec3(1.0f, 1.0f, 0.0f));		// 45 degrees up, so the box's shadow reaches 2 units to -x
+	RingBuffer ring;
+	ObjectConstants objectConstants;
+	FrameDataBuffer frameData;
+	ClusteredLights clusteredLights;
+	std::vector<Light> noLights;
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 20.0f, 0.0f), glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f));
+	glm::mat4 projection = glm::perspective(glm::radians(45.0f), float(WIDTH) / HEIGHT, NEAR_PLANE, FAR_PLANE);
+
+	LitScene(void)
+	{
+		std::shared_ptr<Model> ground = uploadModel(groundMesh(10.0f, 0.0f, 4, glm::vec3(ALBEDO)));
+		std::shared_ptr<Model> box = uploadModel(boxMesh(glm::vec3(-1.0f, 0.0f, -1.0f), glm::vec3(1.0f, 2.0f, 1.0f), glm::vec3(ALBEDO)));
+		owned.emplace_back(new Object(ground));
+		owned.emplace_back(new Object(box));
+		for (std::unique_ptr<Object>& object : owned) {
+			object->setStatic(true);
+			objects.push_back(object.get());
+		}
+	}
+
+	/// <summary>
+	/// Draws the objects lit by a lightmap and reads the picture back
+	/// </summary>
+	void draw(ShaderProgram& program, const Lightmaps& lightmaps, std::vector<unsigned char>& pixels)
+	{
+		GLState::get().beginFrame();
+		ring.beginFrame();
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		objectConstants.update(ring, objects, view, projection);
+		objectConstants.bind();
+		MaterialTable::get().bind();
+		FrameData data = FrameData();
+		data.sunPosition = sunDirection;
+		data.sunDiffuse = glm::vec3(1.0f);
+		data.viewPos = glm::vec3(0.0f, 20.0f, 0.0f);
+		frameData.update(ring, data);
+		clusteredLights.update(ring, noLights, view, projection, NEAR_PLANE, FAR_PLANE, WIDTH, HEIGHT);
+		clusteredLights.bind();
+		lightmaps.bind();
+		for (Object* object : objects)
+			object->Draw(program);
+		glReadPixels(0, 0, WIDTH, HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+		ring.endFrame();
+	}
+
+	/// <summary>
+	/// The green channel of the pixel a point lands on
+	/// </summary>
+	int valueAt(const std::vector<unsigned char>& pixels, const glm::vec3& point) const
+	{
+		glm::vec4 clip = projection * view * glm::vec4(point, 1.0f);
+		int x = int((clip.x / clip.w * 0.5f + 0.5f) * WIDTH), y = int((clip.y / clip.w * 0.5f + 0.5f) * HEIGHT);
+		return pixels[(size_t(y) * WIDTH + x) * 4 + 1];
+	}
+};
+
+void testBake(ShaderProgram& program)
+{
+	LitScene scene;
+	std::vector<unsigned char> pixels(WIDTH * HEIGHT * 4);
+	const glm::vec3 open(5.0f, 0.0f, 5.0f), shadowed(-2.0f, 0.0f, 0.0f), top(0.0f, 2.0f, 0.0f), facingBox(1.3f, 0.0f, 0.0f);
+	int expected = int(ALBEDO * glm::dot(scene.sunDirection, glm::vec3(0.0f, 1.0f, 0.0f)) * 255.0f + 0.5f);
+
+	// no sky (loadSky() wasn't called) and no bounces: the sun where a path starts and where it first hits
+	Lightmaps sunOnly;
+	Lightmaps::Settings settings;
+	settings.samplesPerTexel = 16;
+	settings.bounces = 0;
+	sunOnly.bake(scene.objects, scene.sunDirection, glm::vec3(1.0f), settings);
+	const Lightmaps::Stats& stats = sunOnly.getLastBakeStats();
+	std::printf("no bounces: %u objects, %dx%d, %zu texels, %llu rays in %.0f ms\n", stats.objects, stats.size, stats.size, stats.texels, stats.rays, stats.bakeMilliseconds);
+	scene.draw(program, sunOnly, pixels);
+	int openSun = scene.valueAt(pixels, open), shadowedSun = scene.valueAt(pixels, shadowed), topSun = scene.valueAt(pixels, top);
+	int facingSun = scene.valueAt(pixels, facingBox);
+	std::printf("open ground %d, box top %d (the sun's cosine gives %d), ground by the lit side %d, shadow %d\n", openSun, topSun, expected, facingSun, shadowedSun);
+	CHECK(stats.objects == 2 && stats.texels > 0 && stats.rays > 0);
+	CHECK(std::abs(openSun - expected) <= 2);
+	CHECK(std::abs(topSun - expected) <= 2);
+	CHECK(facingSun > expected + 5);
+	CHECK(shadowedSun == 0);
+
+	// and bounced off the box's unlit sides into the shadow (faint: lit ground, then an unlit side, then the shadow)
+	Lightmaps bounced;
+	settings.samplesPerTexel = 64;
+	settings.bounces = 2;
+	bounced.bake(scene.objects, scene.sunDirection, glm::vec3(1.0f), settings);
+	scene.draw(program, bounced, pixels);
+	int openBounced = scene.valueAt(pixels, open), shadowedBounced = scene.valueAt(pixels, shadowed), facingBounced = scene.valueAt(pixels, facingBox);
+	std::printf("with 2 bounces: open ground %d, ground by the lit side %d, shadow %d\n", openBounced, facingBounced, shadowedBounced);
+	CHECK(shadowedBounced > shadowedSun);
+	CHECK(std::abs(openBounced - openSun) <= 2);
+	CHECK(facingBounced >= facingSun);
+	CHECK(shadowedBounced < openBounced / 2);
+
+	// saved, then loaded for the same scene only
+	std::vector<unsigned char> loadedPixels(WIDTH * HEIGHT * 4);
+	CHECK(bounced.save(LIGHTMAP_FILE));
+	Lightmaps loaded;
+	CHECK(loaded.load(LIGHTMAP_FILE, scene.objects, scene.sunDirection, glm::vec3(1.0f), settings));
+	CHECK(loaded.isUpToDate(scene.objects, scene.sunDirection, glm::vec3(1.0f)));
+	scene.draw(program, loaded, loadedPixels);
+	CHECK(std::memcmp(pixels.data(), loadedPixels.data(), pixels.size()) == 0);
+
+	Lightmaps other;
+	CHECK(!other.load(LIGHTMAP_FILE, scene.objects, glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(1.0f), settings));		// another sun
+	scene.objects[1]->Translate(0.5f, 0.0f, 0.0f);
+	CHECK(!loaded.isUpToDate(scene.objects, scene.sunDirection, glm::vec3(1.0f)));
+	CHECK(!other.load(LIGHTMAP_FILE, scene.objects, scene.sunDirection, glm::vec3(1.0f), settings));
+	std::remove(LIGHTMAP_FILE);
+}
+
+int main(void)
+{
+	HeadlessContext context;
+	if (!context.create(WIDTH, HEIGHT))
+		return TEST_SKIPPED;
+
+	std::string defines = ShaderLOD::defines(ShaderLOD::FULL) + Lightmaps::defines();
+	ShaderProgram program(ShaderFile(REPO_DIR "VertexShader.vert", "vertex", defines), ShaderFile(REPO_DIR "FragmentShader.frag", "fragment", defines));
+	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+
+	testRays();
+	testBake(program);
+	CHECK(glGetError() == GL_NO_ERROR);
+	return testResult();
+}
@@ -0,0 +1,182 @@
+// The RenderQueue's multi-draw indirect path against its direct one: a grid of crates of a few kinds (so the queue has
+// instanced runs to turn into indirect commands) is drawn through glMultiDrawElementsIndirect, through instanced draws,
+// and one draw per object, and the pictures must be identical. Then the GeometryBuffer is exercised under the scene: a
+// range freed between two others must be reused first-fit, and a mesh bigger than the buffers' initial size must grow
+// them (copying what's there with glCopyBufferSubData), after which the scene must still draw the same picture.
+
+#include <cstring>
+#include "TestSupport.h"
+#include "CascadedShadows.h"
+#include "ClusteredLights.h"
+#include "FrameData.h"
+#include "GLExtensions.h"
+#include "ObjectConstants.h"
+#include "RenderQueue.h"
+#include "ShaderLOD.h"
+
+const int WIDTH = 256, HEIGHT = 256;
+const float NEAR_PLANE = 0.1f, FAR_PLANE = 100.0f;
+const int GRID = 6;		// crates along each side
+
+/// <summary>
+/// A grid of crates of three kinds, with everything a frame needs
+/// </summary>
+struct CrateScene {
+	std::vector<std::shared_ptr<Model>> models;
+	std::vector<std::unique_ptr<Object>> owned;
+	std::vector<Object*> objects;
+	RingBuffer ring;
+	ObjectConstants objectConstants;
+	FrameDataBuffer frameData;
+	ClusteredLights clusteredLights;
+	CascadedShadows cascadedShadows;
+	RenderQueue renderQueue;
+	std::vector<Light> noLights;
+	glm::vec3 cameraPos = glm::vec3(0.0f, 10.0f, 10.0f);
+	glm::mat4 view = glm::lookAt(cameraPos, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	glm::mat4 projection = glm::perspective(glm::radians(45.0f), float(WIDTH) / HEIGHT, NEAR_PLANE, FAR_PLANE);
+
+	enum DrawPath {
+		INDIRECT,
+		INSTANCED,
+		ONE_BY_ONE
+	};
+
+	CrateScene(ShaderProgram& shadowProgram) : cascadedShadows{ shadowProgram }
+	{
+		models.push_back(uploadModel(boxMesh(glm::vec3(-0.4f), glm::vec3(0.4f), glm::vec3(0.8f, 0.3f, 0.2f))));
+		models.push_back(uploadModel(boxMesh(glm::vec3(-0.3f, -0.4f, -0.3f), glm::vec3(0.3f, 0.6f, 0.3f), glm::vec3(0.2f, 0.7f, 0.3f))));
+		models.push_back(uploadModel(boxMesh(glm::vec3(-0.45f, -0.4f, -0.2f), glm::vec3(0.45f, 0.2f, 0.2f), glm::vec3(0.2f, 0.4f, 0.9f))));
+		for (int i = 0; i < GRID * GRID; ++i) {
+			owned.emplace_back(new Object(models[i % models.size()]));
+			owned.back()->Translate(float(i % GRID) * 1.5f - 3.75f, 0.0f, float(i / GRID) * 1.5f - 3.75f);
+			objects.push_back(owned.back().get());
+		}
+		renderQueue.setDepthRange(NEAR_PLANE, FAR_PLANE);
+	}
+
+	/// <summary>
+	/// Draws every crate through the queue one of its ways, and reads the picture back
+	/// </summary>
+	RenderQueue::Stats draw(ShaderProgram& program, DrawPath path, std::vector<unsigned char>& pixels)
+	{
+		GLState::get().beginFrame();
+		ring.beginFrame();
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		objectConstants.update(ring, objects, view, projection);
+		objectConstants.bind();
+		MaterialTable::get().bind();
+		FrameData data = FrameData();
+		data.sunPosition = glm::normalize(glm::vec3(-0.5f, 1.0f, 0.3f));
+		data.sunAmbientIntensity = 0.3f;
+		data.sunAmbientColor = glm::vec3(1.0f);
+		data.sunDiffuse = glm::vec3(1.0f);
+		data.viewPos = cameraPos;
+		frameData.update(ring, data);
+		clusteredLights.update(ring, noLights, view, projection, NEAR_PLANE, FAR_PLANE, WIDTH, HEIGHT);
+		clusteredLights.bind();
+		cascadedShadows.disable(ring);
+		cascadedShadows.bind();
+
+		renderQueue.indirect = path == INDIRECT;
+		renderQueue.instancing = path != ONE_BY_ONE;
+		renderQueue.clear();
+		for (Object* object : objects)
+			object->Submit(renderQueue, program, cameraPos);
+		renderQueue.sort();
+		renderQueue.execute(ring);
+		glReadPixels(0, 0, WIDTH, HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+		ring.endFrame();
+		return renderQueue.getLastStats();
+	}
+};
+
+/// <summary>
+/// Every way the queue draws gives the reference picture, and the indirect path really went through multi-draw indirect
+/// </summary>
+void testPaths(CrateScene& scene, ShaderProgram& program, const std::vector<unsigned char>& reference, const char* when)
+{
+	const char* names[3] = { "indirect", "instanced", "one by one" };
+	bool multiDraw = GLExtensions::get().hasMultiDrawIndirect();
+	std::vector<unsigned char> pixels(WIDTH * HEIGHT * 4);
+	for (int path = CrateScene::INDIRECT; path <= CrateScene::ONE_BY_ONE; ++path) {
+		RenderQueue::Stats stats = scene.draw(program, (CrateScene::DrawPath)path, pixels);
+		unsigned int differing = 0;
+		for (size_t i = 0; i < pixels.size(); i += 4)
+			differing += std::memcmp(&pixels[i], &reference[i], 4) != 0;
+		std::printf("%s, %s: %u draw calls, %u instanced, %u indirect commands, %u pixels differ\n",
+			when, names[path], stats.drawCalls, stats.instancedDraws, stats.indirectCommands, differing);
+		CHECK(differing == 0);
+
+		if (path == CrateScene::INDIRECT && multiDraw)
+			CHECK(stats.indirectCommands == 3 && stats.drawCalls == 1);		// one command per kind of crate, in one call
+		else
+			CHECK(stats.indirectCommands == 0);
+		if (path == CrateScene::INSTANCED)
+			CHECK(stats.instancedDraws == 3);
+		if (path == CrateScene::ONE_BY_ONE)
+			CHECK(stats.drawCalls == GRID * GRID);
+	}
+}
+
+/// <summary>
+/// A range freed between two others is where the next ranges that fit go
+/// </summary>
+void testReuse(void)
+{
+	GeometryBuffer& geometry = GeometryBuffer::get();
+	MeshData box = boxMesh(glm::vec3(-1.0f), glm::vec3(1.0f)), quad = groundMesh(1.0f, 0.0f, 1);
+	GeometryRange freed = geometry.add(box.vertices, box.indices);
+	GeometryRange last = geometry.add(box.vertices, box.indices);
+	geometry.remove(freed);
+
+	// a quad is smaller than a box, so two fit where it was, one after the other
+	GeometryRange reused = geometry.add(quad.vertices, quad.indices);
+	GeometryRange nextReused = geometry.add(quad.vertices, quad.indices);
+	std::printf("freed vertices %zu-%zu and indices %zu-%zu; reused from vertex %zu and %zu, index %zu and %zu\n",
+		freed.baseVertex, freed.baseVertex + freed.vertexCount, freed.firstIndex, freed.firstIndex + freed.indexCount,
+		reused.baseVertex, nextReused.baseVertex, reused.firstIndex, nextReused.firstIndex);
+	CHECK(reused.baseVertex == freed.baseVertex && reused.firstIndex == freed.firstIndex);
+	CHECK(nextReused.baseVertex == freed.baseVertex + reused.vertexCount && nextReused.firstIndex == freed.firstIndex + reused.indexCount);
+	CHECK(last.baseVertex >= nextReused.baseVertex + nextReused.vertexCount);
+
+	geometry.remove(reused);
+	geometry.remove(nextReused);
+	geometry.remove(last);
+}
+
+int main(void)
+{
+	HeadlessContext context;
+	if (!context.create(WIDTH, HEIGHT))
+		return TEST_SKIPPED;
+	if (!GLExtensions::get().hasMultiDrawIndirect())
+		std::printf("no multi-draw indirect, so only the direct paths are compared\n");
+
+	std::string defines = ShaderLOD::defines(ShaderLOD::FULL);
+	ShaderProgram program(ShaderFile(REPO_DIR "VertexShader.vert", "vertex", defines), ShaderFile(REPO_DIR "FragmentShader.frag", "fragment", defines));
+	ShaderProgram shadowProgram(ShaderFile(REPO_DIR "ShadowVertexShader.vert", "vertex"), ShaderFile(REPO_DIR "ShadowFragmentShader.frag", "fragment"));
+	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+
+	CrateScene scene(shadowProgram);
+	std::vector<unsigned char> reference(WIDTH * HEIGHT * 4);
+	scene.draw(program, CrateScene::ONE_BY_ONE, reference);
+	unsigned int covered = 0;
+	for (size_t i = 0; i < reference.size(); i += 4)
+		covered += reference[i] != 0 || reference[i + 1] != 0 || reference[i + 2] != 0;
+	std::printf("crates cover %u pixels\n", covered);
+	CHECK(covered > WIDTH * HEIGHT / 8);		// the crates reached the framebuffer
+	testPaths(scene, program, reference, "before");
+
+	testReuse();
+
+	// more vertices and indices than the buffers start with (1 << 16 and 1 << 18), so both grow under the crates
+	std::shared_ptr<Model> large = uploadModel(groundMesh(50.0f, -10.0f, 300));
+	const GeometryRange& grown = large->getMeshes()[0].getGeometry();
+	std::printf("large mesh at vertices %zu-%zu, indices %zu-%zu\n", grown.baseVertex, grown.baseVertex + grown.vertexCount, grown.firstIndex, grown.firstIndex + grown.indexCount);
+	CHECK(grown.baseVertex + grown.vertexCount > (1 << 16) && grown.firstIndex + grown.indexCount > (1 << 18));
+	testPaths(scene, program, reference, "after growing");
+
+	CHECK(glGetError() == GL_NO_ERROR);
+	return testResult();
+}
@@ -0,0 +1,213 @@
+// OcclusionCuller without a window: a few boxes in front of and behind a wall, then a street of houses with trees around
+// them, where every tree the culler rejects is checked by tracing rays through the pixels of its buffer (none may reach the
+// tree), and the share of draws rejected is reported. Where there's GL, an Object must submit its coarsest level of detail
+// as its occluder.
+
+#include <chrono>
+#include <random>
+#include "TestSupport.h"
+#include "Object.h"
+#include "OcclusionCuller.h"
+
+const int MESHES_PER_TREE = 2;		// the draws each tree stands for, like a trunk and a canopy
+
+AABB makeBox(const glm::vec3& center, const glm::vec3& halfExtent)
+{
+	AABB box;
+	box.min = center - halfExtent;
+	box.max = center + halfExtent;
+	return box;
+}
+
+void addBoxOccluder(OcclusionCuller& culler, const AABB& box)
+{
+	MeshData mesh = boxMesh(box.min, box.max);
+	culler.addOccluder(&mesh.vertices[0].Position.x, sizeof(Vertex), mesh.indices.data(), mesh.indices.size(), glm::mat4(1.0f));
+}
+
+/// <summary>
+/// Where a ray enters a box, or INFINITY if it misses
+/// </summary>
+float rayEnters(const AABB& box, const glm::vec3& origin, const glm::vec3& direction)
+{
+	glm::vec3 t0 = (box.min - origin) / direction, t1 = (box.max - origin) / direction;
+	glm::vec3 tNear = glm::min(t0, t1), tFar = glm::max(t0, t1);
+	float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+	float exit = std::min(std::min(tFar.x, tFar.y), tFar.z);
+	return enter <= exit ? enter : INFINITY;
+}
+
+/// <summary>
+/// Whether a box shows at any pixel center of the culler's buffer: traced exactly, with a ray from the eye through each pixel
+/// the box covers, against the boxes in front of it and the ground (y = 0). The culler's buffer has those pixels, so a
+/// gap between occluders narrower than one of them is closed there, and what shows only through it is fair to cull.
+/// </summary>
+bool showsAtAnyPixel(const AABB& box, const std::vector<AABB>& occluders, const glm::vec3& eye, const glm::mat4& viewProjection, int width, int height)
+{
+	// the pixels inside the box's corners on screen (all in front of the camera here)
+	float minX = INFINITY, minY = INFINITY, maxX = -INFINITY, maxY = -INFINITY;
+	for (int i = 0; i < 8; ++i) {
+		glm::vec4 clip = viewProjection * glm::vec4((i & 1) ? box.max.x : box.min.x, (i & 2) ? box.max.y : box.min.y, (i & 4) ? box.max.z : box.min.z, 1.0f);
+		minX = std::min(minX, (clip.x / clip.w * 0.5f + 0.5f) * width);
+		maxX = std::max(maxX, (clip.x / clip.w * 0.5f + 0.5f) * width);
+		minY = std::min(minY, (clip.y / clip.w * 0.5f + 0.5f) * height);
+		maxY = std::max(maxY, (clip.y / clip.w * 0.5f + 0.5f) * height);
+	}
+
+	glm::mat4 inverse = glm::inverse(viewProjection);
+	for (int y = std::max(int(minY), 0); y <= std::min(int(maxY), height - 1); ++y) {
+		for (int x = std::max(int(minX), 0); x <= std::min(int(maxX), width - 1); ++x) {
+			glm::vec4 far = inverse * glm::vec4((x + 0.5f) / width * 2.0f - 1.0f, (y + 0.5f) / height * 2.0f - 1.0f, 1.0f, 1.0f);
+			glm::vec3 direction = glm::vec3(far) / far.w - eye;
+			float distance = rayEnters(box, eye, direction);
+			if (distance == INFINITY || (direction.y < 0.0f && -eye.y / direction.y < distance))
+				continue;
+
+			bool hidden = false;
+			for (const AABB& occluder : occluders)
+				hidden = hidden || rayEnters(occluder, eye, direction) < distance;
+			if (!hidden)
+				return true;
+		}
+	}
+	return false;
+}
+
+void testWall(void)
+{
+	glm::mat4 projection = glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 100.0f);
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	OcclusionCuller culler;
+	culler.begin(projection * view);
+	addBoxOccluder(culler, makeBox(glm::vec3(0.0f, 0.0f, -10.0f), glm::vec3(2.0f, 2.0f, 0.1f)));
+	addBoxOccluder(culler, makeBox(glm::vec3(0.0f, -1.5f, -25.0f), glm::vec3(50.0f, 0.5f, 25.0f)));		// the ground, reaching past the near plane
+	culler.rasterize();
+
+	CHECK(!culler.isVisible(makeBox(glm::vec3(0.0f, 0.0f, -20.0f), glm::vec3(0.5f))));		// small, behind the wall
+	CHECK(culler.isVisible(makeBox(glm::vec3(0.0f, 0.0f, -20.0f), glm::vec3(5.0f))));		// sticks out around the wall
+	CHECK(culler.isVisible(makeBox(glm::vec3(0.0f, 0.0f, -5.0f), glm::vec3(0.5f))));			// in front of it
+	CHECK(culler.isVisible(makeBox(glm::vec3(6.0f, 0.0f, -20.0f), glm::vec3(0.5f))));		// beside it
+	CHECK(!culler.isVisible(makeBox(glm::vec3(6.0f, -4.0f, -20.0f), glm::vec3(0.5f))));		// under the ground
+	CHECK(culler.isVisible(makeBox(glm::vec3(0.0f), glm::vec3(0.5f))));						// around the camera
+	CHECK(culler.isVisible(makeBox(glm::vec3(0.0f, 0.0f, 20.0f), glm::vec3(0.5f))));		// behind the camera (off screen)
+
+	culler.begin(projection * view);
+	const OcclusionCuller::Stats& stats = culler.getLastFrameStats();
+	CHECK(stats.tested == 7 && stats.occluded == 2);
+}
+
+/// <summary>
+/// A finely divided floor (so it simplifies a lot) submitted by its Object: only its coarsest level is rasterized, and that
+/// still hides what's under it
+/// </summary>
+void testObjectOccluder(void)
+{
+	MeshData floor = groundMesh(10.0f, 0.0f, 32);
+	floor.lods = MeshSimplifier::buildLODs(floor.vertices, floor.indices);
+	CHECK(!floor.lods.empty());
+	if (floor.lods.empty())
+		return;
+	size_t coarsestTriangles = floor.lods.back().indices.size() / 3;
+	Object object(uploadModel(floor));
+
+	glm::mat4 projection = glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 100.0f);
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 30.0f, 0.0f), glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f));		// the whole floor in view
+	OcclusionCuller culler;
+	culler.begin(projection * view);
+	object.SubmitOccluder(culler);
+	culler.rasterize();
+	CHECK(!culler.isVisible(makeBox(glm::vec3(0.0f, -2.0f, 0.0f), glm::vec3(0.5f))));		// under the floor
+	CHECK(culler.isVisible(makeBox(glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.5f))));		// on it
+
+	culler.begin(projection * view);
+	unsigned int submitted = culler.getLastFrameStats().occluderTriangles;
+	std::printf("floor of %zu triangles submitted %u occluder triangles (its coarsest level has %zu)\n", floor.indices.size() / 3, submitted, coarsestTriangles);
+	CHECK(submitted == coarsestTriangles);
+	CHECK(submitted < floor.indices.size() / 3 / 4);
+}
+
+void testStreet(void)
+{
+	glm::vec3 eye(0.0f, 1.7f, 0.0f);
+	glm::mat4 projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 300.0f);
+	glm::mat4 view = glm::lookAt(eye, glm::vec3(0.0f, 1.7f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+	// houses along both sides of the street, with yards between them, and trees all around (and down the street past the last house)
+	std::vector<AABB> houses;
+	for (int i = 0; i < 6; ++i) {
+		houses.push_back(makeBox(glm::vec3(-9.0f, 3.0f, -8.0f - i * 20.0f), glm::vec3(4.0f, 3.0f, 6.0f)));
+		houses.push_back(makeBox(glm::vec3(9.0f, 3.0f, -8.0f - i * 20.0f), glm::vec3(4.0f, 3.0f, 6.0f)));
+	}
+
+	std::mt19937 random(11);
+	std::uniform_real_distribution<float> x(-120.0f, 120.0f), z(-250.0f, -2.0f);
+	std::vector<AABB> trees;
+	while (trees.size() < 5000) {
+		glm::vec3 base(x(random), 0.0f, z(random));
+		if (std::abs(base.x) < 3.0f && base.z > -120.0f)
+			continue;		// nothing grows in the street
+		AABB tree = makeBox(base + glm::vec3(0.0f, 2.0f, 0.0f), glm::vec3(1.0f, 2.0f, 1.0f));
+		bool insideHouse = false;
+		for (const AABB& house : houses)
+			insideHouse = insideHouse || (tree.max.x > house.min.x && tree.min.x < house.max.x && tree.max.z > house.min.z && tree.min.z < house.max.z);
+		if (!insideHouse)
+			trees.push_back(tree);
+	}
+
+	OcclusionCuller culler;
+	auto start = std::chrono::steady_clock::now();
+	culler.begin(projection * view);
+	for (const AABB& house : houses)
+		addBoxOccluder(culler, house);
+	addBoxOccluder(culler, makeBox(glm::vec3(0.0f, -0.5f, -150.0f), glm::vec3(150.0f, 0.5f, 150.0f)));
+	culler.rasterize();
+	double rasterizeMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	Frustum frustum = Frustum::fromMatrix(projection * view);
+	std::vector<AABB> occluders = houses;
+	std::vector<size_t> rejected;
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < trees.size(); ++i) {
+		if (frustum.intersects(trees[i]) && !culler.isVisible(trees[i], MESHES_PER_TREE))
+			rejected.push_back(i);
+	}
+	double testMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	culler.begin(projection * view);
+	const OcclusionCuller::Stats& stats = culler.getLastFrameStats();
+
+	unsigned int wronglyRejected = 0;
+	for (size_t i : rejected)
+		wronglyRejected += showsAtAnyPixel(trees[i], occluders, eye, projection * view, culler.getWidth(), culler.getHeight()) ? 1 : 0;
+	// how many trees in the frustum really are hidden (of the ones the culler kept)
+	unsigned int missed = 0;
+	size_t next = 0;
+	for (size_t i = 0; i < trees.size(); ++i) {
+		if (next < rejected.size() && rejected[next] == i) {
+			++next;
+			continue;
+		}
+		if (frustum.intersects(trees[i]) && !showsAtAnyPixel(trees[i], occluders, eye, projection * view, culler.getWidth(), culler.getHeight()))
+			++missed;
+	}
+
+	float drawsRejected = stats.drawsTested ? 100.0f * stats.drawsRejected / stats.drawsTested : 0.0f;
+	std::printf("%dx%d buffer, %u occluder triangles rasterized in %.2f ms, %u boxes tested in %.2f ms\n", culler.getWidth(), culler.getHeight(),
+		stats.occluderTriangles, rasterizeMilliseconds, stats.tested, testMilliseconds);
+	std::printf("%u of %u draws rejected (%.0f%%); %u hidden boxes kept; %u visible boxes rejected\n", stats.drawsRejected, stats.drawsTested,
+		drawsRejected, missed, wronglyRejected);
+
+	CHECK(wronglyRejected == 0);		// conservative: nothing that shows at one of its pixels is ever culled
+	CHECK(drawsRejected > 50.0f);		// most of what's behind the houses goes
+	CHECK(missed < stats.occluded / 4);
+}
+
+int main(void)
+{
+	testWall();
+	testStreet();
+
+	HeadlessContext context;
+	if (context.create(64, 64))
+		testObjectOccluder();
+	return testResult();
+}
@@ -0,0 +1,141 @@
+// OcclusionQueries on whatever GL the machine has (llvmpipe on a headless one): crates behind a wall, drawn the way the
+// program draws them (the ones last seen as hidden after issueQueries(), under conditional rendering), while the camera
+// first stands still and then steps out from behind the wall. Every frame is compared with the same frame drawn without
+// queries, so an object that was skipped while it showed (or popped in a frame late) fails the test. Reports how long the
+// results took to come back and how many draws the GPU skipped.
+
+#include <cstring>
+#include "TestSupport.h"
+#include "CascadedShadows.h"
+#include "ClusteredLights.h"
+#include "FrameData.h"
+#include "ObjectConstants.h"
+#include "OcclusionQueries.h"
+#include "RingBuffer.h"
+#include "ShaderLOD.h"
+
+const int WIDTH = 256, HEIGHT = 192;
+const float NEAR_PLANE = 0.1f, FAR_PLANE = 100.0f;
+const int STILL_FRAMES = 30, MOVING_FRAMES = 30;
+
+int main(void)
+{
+	HeadlessContext context;
+	if (!context.create(WIDTH, HEIGHT))
+		return TEST_SKIPPED;
+
+	std::string defines = ShaderLOD::defines(ShaderLOD::FULL);
+	ShaderProgram program(ShaderFile(REPO_DIR "VertexShader.vert", "vertex", defines), ShaderFile(REPO_DIR "FragmentShader.frag", "fragment", defines));
+	ShaderProgram boxProgram(ShaderFile(REPO_DIR "BoundingBoxVertexShader.vert", "vertex"), ShaderFile(REPO_DIR "BoundingBoxFragmentShader.frag", "fragment"));
+	ShaderProgram shadowProgram(ShaderFile(REPO_DIR "ShadowVertexShader.vert", "vertex"), ShaderFile(REPO_DIR "ShadowFragmentShader.frag", "fragment"));
+
+	// a wall in front of the camera, and a field of two-mesh crates behind and around it
+	std::shared_ptr<Model> wall = uploadModel(boxMesh(glm::vec3(-2.0f, -1.0f, -0.2f), glm::vec3(2.0f, 2.0f, 0.2f), glm::vec3(0.7f)));
+	ModelData crateData;
+	crateData.meshes.push_back(boxMesh(glm::vec3(-0.5f, -1.0f, -0.5f), glm::vec3(0.5f, 0.0f, 0.5f), glm::vec3(0.6f, 0.4f, 0.2f)));
+	crateData.meshes.push_back(boxMesh(glm::vec3(-0.3f, 0.0f, -0.3f), glm::vec3(0.3f, 0.6f, 0.3f), glm::vec3(0.2f, 0.4f, 0.8f)));
+	std::shared_ptr<Model> crate = uploadModel(crateData);
+
+	std::vector<std::unique_ptr<Object>> owned;
+	std::vector<Object*> objects;
+	owned.emplace_back(new Object(wall));
+	owned.back()->Translate(0.0f, 0.0f, -6.0f);
+	objects.push_back(owned.back().get());
+	for (int z = 0; z < 10; ++z) {
+		for (int x = 0; x < 16; ++x) {
+			owned.emplace_back(new Object(crate));
+			owned.back()->Translate(-15.0f + x * 2.0f, 0.0f, -10.0f - z * 3.0f);
+			objects.push_back(owned.back().get());
+		}
+	}
+	std::vector<unsigned char> candidates(objects.size(), 1);
+
+	RingBuffer ring;
+	ObjectConstants objectConstants;
+	FrameDataBuffer frameData;
+	ClusteredLights clusteredLights;
+	CascadedShadows cascadedShadows(shadowProgram);
+	OcclusionQueries occlusionQueries(boxProgram);
+	std::vector<Light> noLights;
+	glm::mat4 projection = glm::perspective(glm::radians(45.0f), float(WIDTH) / HEIGHT, NEAR_PLANE, FAR_PLANE);
+	std::vector<unsigned char> withQueries(WIDTH * HEIGHT * 4), withoutQueries(WIDTH * HEIGHT * 4);
+
+	unsigned int mismatchedFrames = 0, hiddenWhileStill = 0, queriesIssued = 0, resultsRead = 0, conditionalDraws = 0, drawsSaved = 0;
+	float latencyFrames = 0.0f, latencyMilliseconds = 0.0f;
+	for (int frame = 0; frame < STILL_FRAMES + MOVING_FRAMES; ++frame) {
+		float step = frame < STILL_FRAMES ? 0.0f : float(frame - STILL_FRAMES + 1) / MOVING_FRAMES;
+		glm::vec3 cameraPos(step * 8.0f, 0.5f, 0.0f);
+		glm::mat4 view = glm::lookAt(cameraPos, cameraPos + glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+		GLState::get().beginFrame();
+		ring.beginFrame();
+		occlusionQueries.beginFrame(objects.size());
+		objectConstants.update(ring, objects, view, projection);
+		objectConstants.bind();
+		MaterialTable::get().bind();
+		FrameData data = FrameData();
+		data.sunPosition = glm::vec3(-0.3f, 1.0f, 0.5f);
+		data.sunAmbientIntensity = 0.4f;
+		data.sunAmbientColor = glm::vec3(1.0f);
+		data.sunDiffuse = glm::vec3(1.0f);
+		data.viewPos = cameraPos;
+		frameData.update(ring, data);
+		clusteredLights.update(ring, noLights, view, projection, NEAR_PLANE, FAR_PLANE, WIDTH, HEIGHT);
+		clusteredLights.bind();
+		cascadedShadows.disable(ring);
+		cascadedShadows.bind();
+
+		// as the program draws them: what was last seen, then the queries, then the rest on their queries' results
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		for (size_t i = 0; i < objects.size(); ++i) {
+			if (!occlusionQueries.isHidden(i))
+				objects[i]->Draw(program);
+			else if (frame < STILL_FRAMES)
+				++hiddenWhileStill;
+		}
+		occlusionQueries.issueQueries(objects, candidates.data(), projection * view, cameraPos, NEAR_PLANE);
+		for (size_t i = 0; i < objects.size(); ++i) {
+			if (occlusionQueries.isHidden(i)) {
+				occlusionQueries.beginConditionalRender(i);
+				unsigned int draws = objects[i]->Draw(program);
+				occlusionQueries.endConditionalRender(i, draws);
+			}
+		}
+		glReadPixels(0, 0, WIDTH, HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, withQueries.data());
+
+		// and everything, plainly
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		for (Object* object : objects)
+			object->Draw(program);
+		glReadPixels(0, 0, WIDTH, HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, withoutQueries.data());
+		ring.endFrame();
+
+		if (std::memcmp(withQueries.data(), withoutQueries.data(), withQueries.size()) != 0) {
+			std::printf("frame %d differs from the frame drawn without queries\n", frame);
+			++mismatchedFrames;
+		}
+
+		const OcclusionQueries::Stats& stats = occlusionQueries.getLastFrameStats();		// the frame before this one
+		queriesIssued += stats.queriesIssued;
+		resultsRead += stats.resultsRead;
+		conditionalDraws += stats.conditionalDraws;
+		drawsSaved += stats.drawsSaved;
+		latencyFrames += stats.averageLatencyFrames * stats.resultsRead;
+		latencyMilliseconds += stats.averageLatencyMilliseconds * stats.resultsRead;
+	}
+
+	unsigned int draws = 0;
+	for (Object* object : objects)
+		draws += (unsigned int)object->getModel().getMeshes().size();
+	std::printf("%u objects; %u queries issued, %u results read, %.2f frames (%.3f ms) from query to result on average\n", (unsigned int)objects.size(),
+		queriesIssued, resultsRead, resultsRead ? latencyFrames / resultsRead : 0.0f, resultsRead ? latencyMilliseconds / resultsRead : 0.0f);
+	std::printf("%u conditional draws, %u skipped by the GPU (%.0f%% of all %u draws over %d frames)\n", conditionalDraws, drawsSaved,
+		100.0f * drawsSaved / (draws * (STILL_FRAMES + MOVING_FRAMES)), draws * (STILL_FRAMES + MOVING_FRAMES), STILL_FRAMES + MOVING_FRAMES);
+
+	CHECK(mismatchedFrames == 0);		// nothing was skipped that shows, or drawn a frame late
+	CHECK(hiddenWhileStill > 0);		// the wall hides some crates
+	CHECK(drawsSaved > 0);
+	CHECK(resultsRead > 0);
+	CHECK(glGetError() == GL_NO_ERROR);
+	return testResult();
+}
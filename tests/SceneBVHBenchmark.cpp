@@ -0,0 +1,173 @@
+// SceneBVH from 1k to 1M objects: build time, and the cost of frustum, sphere and ray queries and of moving objects, against
+// testing every box. The objects are spread over a plane at a constant density, with the camera seeing about the same number
+// of them at every size, so a query's cost should grow with the tree's height rather than with the number of objects.
+// Every query's result is also checked against the brute-force one.
+// Pass --quick to stop at 100k objects (what ctest runs).
+
+#include <chrono>
+#include <cstring>
+#include <random>
+#include "TestSupport.h"
+#include "SceneBVH.h"
+
+const int QUERY_REPEATS = 20;
+const int RAYS = 200;
+const int MOVES = 1000;
+
+double millisecondsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/// <summary>
+/// Where a ray enters a box, or INFINITY if it misses
+/// </summary>
+float rayEnters(const AABB& box, const glm::vec3& origin, const glm::vec3& direction)
+{
+	glm::vec3 inverseDirection = 1.0f / direction;
+	glm::vec3 t0 = (box.min - origin) * inverseDirection;
+	glm::vec3 t1 = (box.max - origin) * inverseDirection;
+	glm::vec3 tNear = glm::min(t0, t1), tFar = glm::max(t0, t1);
+	float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+	float exit = std::min(std::min(tFar.x, tFar.y), tFar.z);
+	return enter <= exit ? enter : INFINITY;
+}
+
+/// <summary>
+/// Whether a query returned exactly the items the brute-force test finds
+/// </summary>
+template <typename Test>
+bool sameItems(std::vector<int> items, const std::vector<AABB>& boxes, Test test)
+{
+	std::vector<unsigned char> found(boxes.size(), 0);
+	for (int item : items) {
+		if (found[item])
+			return false;		// returned twice
+		found[item] = 1;
+	}
+	for (size_t i = 0; i < boxes.size(); ++i) {
+		if ((bool)found[i] != test(boxes[i]))
+			return false;
+	}
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	bool quick = argc > 1 && std::strcmp(argv[1], "--quick") == 0;
+	std::vector<size_t> sizes = { 1000, 10000, 100000 };
+	if (!quick)
+		sizes.push_back(1000000);
+
+	std::mt19937 random(7);
+	glm::mat4 projection = glm::perspective(glm::radians(45.0f), 800.0f / 600.0f, 0.1f, 100.0f);
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 3.0f, 0.0f), glm::vec3(1.0f, 3.0f, 1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	Frustum frustum = Frustum::fromMatrix(projection * view);
+
+	std::printf("%9s %9s %6s | %-27s %8s | %-21s | %-21s | %9s\n", "objects", "build ms", "height", "frustum us: bvh / brute", "nodes", "sphere us: bvh/brute",
+		"ray us: bvh / brute", "move us");
+	for (size_t count : sizes) {
+		float halfSize = std::sqrt((float)count) * 4.0f;
+		std::uniform_real_distribution<float> position(-halfSize, halfSize), extent(0.2f, 2.0f), unit(-1.0f, 1.0f);
+		std::vector<AABB> boxes(count);
+		for (AABB& box : boxes) {
+			glm::vec3 center(position(random), 0.0f, position(random)), halfExtent(extent(random), extent(random), extent(random));
+			box.min = center - halfExtent;
+			box.max = center + halfExtent;
+		}
+
+		SceneBVH bvh;
+		auto start = std::chrono::steady_clock::now();
+		bvh.build(boxes);
+		double buildMilliseconds = millisecondsSince(start);
+
+		// frustum
+		std::vector<int> items;
+		bvh.resetStats();
+		start = std::chrono::steady_clock::now();
+		for (int k = 0; k < QUERY_REPEATS; ++k) {
+			items.clear();
+			bvh.queryFrustum(frustum, items);
+		}
+		double frustumMicroseconds = millisecondsSince(start) * 1000.0 / QUERY_REPEATS;
+		unsigned int nodesVisited = bvh.getStats().nodesVisited / QUERY_REPEATS;
+		start = std::chrono::steady_clock::now();
+		size_t bruteVisible = 0;
+		for (int k = 0; k < QUERY_REPEATS; ++k) {
+			for (const AABB& box : boxes)
+				bruteVisible += frustum.intersects(box);
+		}
+		double bruteFrustumMicroseconds = millisecondsSince(start) * 1000.0 / QUERY_REPEATS;
+		CHECK(sameItems(items, boxes, [&frustum](const AABB& box) { return frustum.intersects(box); }));
+
+		// sphere (about as many objects as the frustum sees)
+		BoundingSphere sphere;
+		sphere.center = glm::vec3(halfSize * 0.5f, 0.0f, -halfSize * 0.5f);
+		sphere.radius = 40.0f;
+		auto inSphere = [&sphere](const AABB& box) {
+			glm::vec3 offset = glm::clamp(sphere.center, box.min, box.max) - sphere.center;
+			return glm::dot(offset, offset) <= sphere.radius * sphere.radius;
+		};
+		start = std::chrono::steady_clock::now();
+		for (int k = 0; k < QUERY_REPEATS; ++k) {
+			items.clear();
+			bvh.querySphere(sphere, items);
+		}
+		double sphereMicroseconds = millisecondsSince(start) * 1000.0 / QUERY_REPEATS;
+		start = std::chrono::steady_clock::now();
+		size_t bruteInSphere = 0;
+		for (int k = 0; k < QUERY_REPEATS; ++k) {
+			for (const AABB& box : boxes)
+				bruteInSphere += inSphere(box);
+		}
+		double bruteSphereMicroseconds = millisecondsSince(start) * 1000.0 / QUERY_REPEATS;
+		CHECK(sameItems(items, boxes, inSphere));
+
+		// rays along the ground, the closest box each one enters
+		std::vector<glm::vec3> origins, directions;
+		for (int k = 0; k < RAYS; ++k) {
+			origins.push_back(glm::vec3(position(random), 0.5f, position(random)));
+			directions.push_back(glm::normalize(glm::vec3(unit(random), 0.0f, unit(random))));
+		}
+		std::vector<float> distances(RAYS);
+		start = std::chrono::steady_clock::now();
+		for (int k = 0; k < RAYS; ++k)
+			bvh.raycast(origins[k], directions[k], INFINITY, distances[k]);
+		double rayMicroseconds = millisecondsSince(start) * 1000.0 / RAYS;
+		int rayMismatches = 0;
+		start = std::chrono::steady_clock::now();
+		for (int k = 0; k < RAYS; ++k) {
+			float closest = INFINITY;
+			for (const AABB& box : boxes)
+				closest = std::min(closest, rayEnters(box, origins[k], directions[k]));
+			if (std::abs(closest - distances[k]) > 1e-3f && !(std::isinf(closest) && std::isinf(distances[k])))
+				++rayMismatches;
+		}
+		double bruteRayMicroseconds = millisecondsSince(start) * 1000.0 / RAYS;
+		CHECK(rayMismatches == 0);
+
+		// objects that move a little (most stay inside their fattened boxes) and some that jump far
+		start = std::chrono::steady_clock::now();
+		for (int k = 0; k < MOVES; ++k) {
+			int item = (int)(random() % count);
+			glm::vec3 offset = glm::vec3(unit(random), 0.0f, unit(random)) * (k % 10 == 0 ? halfSize : 0.05f);
+			boxes[item].min += offset;
+			boxes[item].max += offset;
+			bvh.update(item, boxes[item]);
+		}
+		double moveMicroseconds = millisecondsSince(start) * 1000.0 / MOVES;
+		for (int item = 0; item < 100; ++item)
+			bvh.remove(item);
+		for (int item = 0; item < 100; ++item)
+			bvh.insert(item, boxes[item]);
+		items.clear();
+		bvh.queryFrustum(frustum, items);
+		CHECK(sameItems(items, boxes, [&frustum](const AABB& box) { return frustum.intersects(box); }));
+
+		std::printf("%9zu %9.1f %6d | %11.1f / %11.1f %8u | %9.1f / %9.1f | %9.2f / %9.1f | %9.2f\n", count, buildMilliseconds, bvh.getHeight(),
+			frustumMicroseconds, bruteFrustumMicroseconds, nodesVisited, sphereMicroseconds, bruteSphereMicroseconds, rayMicroseconds,
+			bruteRayMicroseconds, moveMicroseconds);
+		std::printf("%9s %zu in the frustum, %zu in the sphere\n", "", bruteVisible / QUERY_REPEATS, bruteInSphere / QUERY_REPEATS);
+	}
+	return testResult();
+}
@@ -0,0 +1,216 @@
+// How much fragment shading ShaderLOD saves on a dense outdoor view: a forest of trees on a ground plane, seen from a little above
+// the ground so the canopies fill the screen into the distance. After a depth pre-pass (so each pixel is shaded once, like the
+// program does it), the objects ShaderLOD puts at each level are drawn on their own, counted with a GL_SAMPLES_PASSED query
+// and timed to glFinish() (llvmpipe's GL_TIME_ELAPSED doesn't cover its rasterizer threads): once with the full program,
+// and once with the level's cheaper one. The difference is the fragment cost the level saves.
+// Pass --quick for a small forest and framebuffer (what ctest runs).
+
+#include <chrono>
+#include <cstring>
+#include "TestSupport.h"
+#include "ClusteredLights.h"
+#include "FrameData.h"
+#include "ObjectConstants.h"
+#include "RenderQueue.h"
+#include "RingBuffer.h"
+#include "ShaderLOD.h"
+#include "CascadedShadows.h"
+
+const float NEAR_PLANE = 0.1f, FAR_PLANE = 300.0f;
+const float TREE_SPACING = 3.0f;
+
+struct LevelResult {
+	unsigned long long samples[2] = {};	// with the full program, with the level's own
+	double milliseconds[2] = {};
+};
+
+/// <summary>
+/// A trunk and a canopy, each with its own texture
+/// </summary>
+ModelData treeData(void)
+{
+	ModelData data;
+	MeshData trunk = boxMesh(glm::vec3(-0.15f, 0.0f, -0.15f), glm::vec3(0.15f, 1.2f, 0.15f));
+	addSolidTexture(data, trunk, "bark.png", glm::vec3(0.4f, 0.25f, 0.1f));
+	MeshData canopy = boxMesh(glm::vec3(-0.9f, 1.0f, -0.9f), glm::vec3(0.9f, 2.6f, 0.9f));
+	addSolidTexture(data, canopy, "leaves.png", glm::vec3(0.2f, 0.5f, 0.15f));
+	data.meshes.push_back(trunk);
+	data.meshes.push_back(canopy);
+	return data;
+}
+
+int main(int argc, char** argv)
+{
+	bool quick = argc > 1 && std::strcmp(argv[1], "--quick") == 0;
+	int width = quick ? 320 : 1280, height = quick ? 180 : 720;
+	int treesPerSide = quick ? 24 : 80;
+	int frames = quick ? 2 : 8;
+
+	HeadlessContext context;
+	if (!context.create(width, height))
+		return TEST_SKIPPED;
+
+	std::unique_ptr<ShaderProgram> programs[ShaderLOD::NUM_LEVELS];
+	for (int level = 0; level < ShaderLOD::NUM_LEVELS; ++level) {
+		std::string defines = ShaderLOD::defines((ShaderLOD::Level)level);
+		programs[level].reset(new ShaderProgram(ShaderFile(REPO_DIR "VertexShader.vert", "vertex", defines), ShaderFile(REPO_DIR "FragmentShader.frag", "fragment", defines)));
+	}
+	ShaderLOD shaderLOD(*programs[ShaderLOD::FULL], *programs[ShaderLOD::PER_VERTEX], *programs[ShaderLOD::DIFFUSE_ONLY]);
+	ShaderProgram depthProgram(ShaderFile(REPO_DIR "DepthVertexShader.vert", "vertex"), ShaderFile(REPO_DIR "DepthFragmentShader.frag", "fragment"));
+	ShaderProgram shadowProgram(ShaderFile(REPO_DIR "ShadowVertexShader.vert", "vertex"), ShaderFile(REPO_DIR "ShadowFragmentShader.frag", "fragment"));
+
+	std::shared_ptr<Model> tree = uploadModel(treeData());
+	float halfSize = treesPerSide * TREE_SPACING * 0.5f;
+	ModelData groundData;
+	MeshData groundMeshData = groundMesh(halfSize + 10.0f, 0.0f, 16);
+	addSolidTexture(groundData, groundMeshData, "grass.png", glm::vec3(0.3f, 0.6f, 0.2f));
+	groundData.meshes.push_back(groundMeshData);
+	std::shared_ptr<Model> ground = uploadModel(groundData);
+
+	// a jittered grid, so rows don't line up with the camera
+	std::vector<std::unique_ptr<Object>> owned;
+	std::vector<Object*> objects;
+	unsigned int seed = 1;
+	auto random = [&seed](void) {
+		seed = seed * 1664525u + 1013904223u;
+		return float(seed >> 8) / float(1 << 24);
+	};
+	for (int z = 0; z < treesPerSide; ++z) {
+		for (int x = 0; x < treesPerSide; ++x) {
+			owned.emplace_back(new Object(tree));
+			owned.back()->Translate(-halfSize + (x + random()) * TREE_SPACING, 0.0f, -halfSize + (z + random()) * TREE_SPACING);
+			objects.push_back(owned.back().get());
+		}
+	}
+	owned.emplace_back(new Object(ground));
+	objects.push_back(owned.back().get());
+
+	// a few lights among the trees near the camera, so the full program has some to loop over
+	std::vector<Light> lights;
+	for (int i = 0; i < 16; ++i) {
+		Light light;
+		light.position = glm::vec3(-halfSize + random() * 2.0f * halfSize, 1.5f, halfSize - random() * 30.0f);
+		light.range = 8.0f;
+		light.color = glm::vec3(0.8f, 0.7f, 0.5f);
+		lights.push_back(light);
+	}
+
+	glm::vec3 cameraPos(0.0f, 8.0f, halfSize + 4.0f);
+	glm::mat4 view = glm::lookAt(cameraPos, glm::vec3(0.0f, 0.0f, halfSize * 0.25f), glm::vec3(0.0f, 1.0f, 0.0f));
+	glm::mat4 projection = glm::perspective(glm::radians(45.0f), float(width) / height, NEAR_PLANE, FAR_PLANE);
+
+	std::vector<ShaderLOD::Level> levels;
+	unsigned int objectsAtLevel[ShaderLOD::NUM_LEVELS] = {};
+	for (Object* object : objects) {
+		levels.push_back(shaderLOD.selectLevel(ShaderLOD::projectedDiameter(object->getWorldSphere(), cameraPos, projection, float(height))));
+		++objectsAtLevel[levels.back()];
+	}
+
+	RingBuffer ring;
+	ObjectConstants objectConstants;
+	FrameDataBuffer frameData;
+	ClusteredLights clusteredLights;
+	CascadedShadows cascadedShadows(shadowProgram);
+	RenderQueue renderQueue;
+	renderQueue.setDepthRange(NEAR_PLANE, FAR_PLANE);
+	unsigned int query;
+	glGenQueries(1, &query);
+
+	LevelResult results[ShaderLOD::NUM_LEVELS];
+	for (int frame = 0; frame <= frames; ++frame) {		// the first frame is a warm-up
+		GLState::get().beginFrame();
+		ring.beginFrame();
+		glClearColor(0.5f, 0.7f, 0.9f, 1.0f);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+		objectConstants.update(ring, objects, view, projection);
+		objectConstants.bind();
+		MaterialTable::get().bind();
+		FrameData data = FrameData();
+		data.sunPosition = glm::vec3(-0.4f, 1.0f, 0.3f);
+		data.sunAmbientIntensity = 0.3f;
+		data.sunAmbientColor = glm::vec3(1.0f);
+		data.sunDiffuse = glm::vec3(1.0f);
+		data.sunSpecular = glm::vec3(0.3f);
+		data.sunShininess = 32;
+		data.viewPos = cameraPos;
+		frameData.update(ring, data);
+		clusteredLights.update(ring, lights, view, projection, NEAR_PLANE, FAR_PLANE, width, height);
+		clusteredLights.bind();
+		cascadedShadows.disable(ring);
+		cascadedShadows.bind();
+
+		renderQueue.clear();
+		for (Object* object : objects)
+			object->Submit(renderQueue, *programs[ShaderLOD::FULL], cameraPos);
+		renderQueue.sort();
+		GeometryBuffer::get().useStream(GeometryBuffer::POSITION_STREAM);
+		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		renderQueue.executeDepth(ring, depthProgram);
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		GeometryBuffer::get().useStream(GeometryBuffer::FULL_STREAM);
+		GLState::get().depthMask(false);
+
+		// each level's objects with the full program, then with their own (which for the full level is the same one)
+		for (int level = 0; level < ShaderLOD::NUM_LEVELS; ++level) {
+			for (int cheaper = 0; cheaper < (level == ShaderLOD::FULL ? 1 : 2); ++cheaper) {
+				renderQueue.clear();
+				for (size_t i = 0; i < objects.size(); ++i) {
+					if (levels[i] == level)
+						objects[i]->Submit(renderQueue, *programs[cheaper ? level : ShaderLOD::FULL], cameraPos);
+				}
+				renderQueue.sort();
+
+				glFinish();
+				auto start = std::chrono::steady_clock::now();
+				glBeginQuery(GL_SAMPLES_PASSED, query);
+				renderQueue.execute(ring);
+				glEndQuery(GL_SAMPLES_PASSED);
+				glFinish();
+				double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+				GLuint64 samples = 0;
+				glGetQueryObjectui64v(query, GL_QUERY_RESULT, &samples);
+				if (frame > 0) {
+					results[level].samples[cheaper] += samples;
+					results[level].milliseconds[cheaper] += milliseconds;
+				}
+			}
+		}
+		results[ShaderLOD::FULL].samples[1] = results[ShaderLOD::FULL].samples[0];
+		results[ShaderLOD::FULL].milliseconds[1] = results[ShaderLOD::FULL].milliseconds[0];
+		GLState::get().depthMask(true);
+		ring.endFrame();
+	}
+
+	const char* names[ShaderLOD::NUM_LEVELS] = { "full", "per-vertex", "diffuse-only" };
+	double fullMilliseconds = 0.0, lodMilliseconds = 0.0;
+	unsigned long long totalSamples = 0;
+	std::printf("%d objects, %dx%d, averaged over %d frames\n", (int)objects.size(), width, height, frames);
+	std::printf("%-13s %8s %12s %12s %12s %8s\n", "level", "objects", "fragments", "full ms", "level ms", "saved");
+	for (int level = 0; level < ShaderLOD::NUM_LEVELS; ++level) {
+		const LevelResult& result = results[level];
+		double full = result.milliseconds[0] / frames, own = result.milliseconds[1] / frames;
+		std::printf("%-13s %8u %12llu %12.2f %12.2f %7.0f%%\n", names[level], objectsAtLevel[level], result.samples[1] / frames, full, own,
+			full > 0.0 ? 100.0 * (full - own) / full : 0.0);
+		fullMilliseconds += full;
+		lodMilliseconds += own;
+		totalSamples += result.samples[1] / frames;
+
+		// the variants only differ in shading, so they cover exactly the same pixels
+		CHECK(result.samples[0] == result.samples[1]);
+	}
+	unsigned long long cheaperSamples = (results[ShaderLOD::PER_VERTEX].samples[1] + results[ShaderLOD::DIFFUSE_ONLY].samples[1]) / frames;
+	std::printf("%.0f%% of fragments shaded by a cheaper variant; fragment shading %.2f ms -> %.2f ms (%.0f%% saved)\n",
+		totalSamples ? 100.0 * cheaperSamples / totalSamples : 0.0, fullMilliseconds, lodMilliseconds,
+		fullMilliseconds > 0.0 ? 100.0 * (fullMilliseconds - lodMilliseconds) / fullMilliseconds : 0.0);
+
+	// a dense view has distant objects at every level
+	for (int level = 0; level < ShaderLOD::NUM_LEVELS; ++level)
+		CHECK(objectsAtLevel[level] > 0);
+	CHECK(cheaperSamples > 0);
+	CHECK(glGetError() == GL_NO_ERROR);
+
+	glDeleteQueries(1, &query);
+	return testResult();
+}
@@ -0,0 +1,264 @@
+#ifndef TEST_SUPPORT_H
+#define TEST_SUPPORT_H
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <glad/glad.h>
+#include <glm/glm/glm.hpp>
+#include <glm/glm/gtc/matrix_transform.hpp>
+#include <glm/glm/gtc/type_ptr.hpp>
+#include "GLExtensions.h"
+#include "GLState.h"
+#include "model.h"
+
+// what a test returns when it can't run here (no OpenGL context); ctest reports it as skipped
+const int TEST_SKIPPED = 77;
+
+inline int& failedChecks(void)
+{
+	static int failed = 0;
+	return failed;
+}
+
+// records a failure (and carries on, so one run reports everything that's wrong)
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			std::printf("FAILED: %s (%s:%d)\n", #condition, __FILE__, __LINE__); \
+			++failedChecks(); \
+		} \
+	} while (0)
+
+/// <summary>
+/// What main() returns: 0 if every CHECK passed
+/// </summary>
+inline int testResult(void)
+{
+	if (failedChecks() > 0)
+		std::printf("%d check(s) failed\n", failedChecks());
+	return failedChecks() > 0 ? 1 : 0;
+}
+
+/// <summary>
+/// An OpenGL context with no window (EGL's surfaceless platform, which Mesa's llvmpipe provides), drawing into a framebuffer
+/// of its own. GL 4.3 core if the driver has it (so the multi-draw paths run), else 3.3 core.
+/// </summary>
+class HeadlessContext
+{
+	private:
+		EGLDisplay display;
+		EGLContext context;
+		unsigned int framebuffer;
+		unsigned int colorBuffer;
+		unsigned int depthBuffer;
+		int width, height;
+
+	public:
+		HeadlessContext() : display{ EGL_NO_DISPLAY }, context{ EGL_NO_CONTEXT }, framebuffer{ 0 }, colorBuffer{ 0 }, depthBuffer{ 0 }, width{ 0 }, height{ 0 } {}
+
+		HeadlessContext(const HeadlessContext&) = delete;
+		HeadlessContext& operator=(const HeadlessContext&) = delete;
+
+		~HeadlessContext()
+		{
+			if (context != EGL_NO_CONTEXT) {
+				eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+				eglDestroyContext(display, context);
+			}
+			if (display != EGL_NO_DISPLAY)
+				eglTerminate(display);
+		}
+
+		/// <summary>
+		/// Creates the context, makes it current, loads GL through glad, and binds a framebuffer of the given size
+		/// </summary>
+		/// <returns>False if there's no driver to make one with (the test should return TEST_SKIPPED)</returns>
+		bool create(int argWidth, int argHeight)
+		{
+			display = eglGetPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+			if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL)) {
+				display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+				if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL)) {
+					std::printf("No EGL display\n");
+					return false;
+				}
+			}
+			eglBindAPI(EGL_OPENGL_API);
+
+			const EGLint versions[2][2] = { { 4, 3 }, { 3, 3 } };
+			for (int i = 0; i < 2 && context == EGL_NO_CONTEXT; ++i) {
+				EGLint attributes[] = { EGL_CONTEXT_MAJOR_VERSION, versions[i][0], EGL_CONTEXT_MINOR_VERSION, versions[i][1],
+					EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT, EGL_NONE };
+				context = eglCreateContext(display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, attributes);
+			}
+			if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+				std::printf("No OpenGL 3.3 context\n");
+				return false;
+			}
+			if (!gladLoadGLLoader((GLADloadproc)eglGetProcAddress)) {
+				std::printf("Couldn't load OpenGL\n");
+				return false;
+			}
+			GLExtensions::get().load((GLADloadproc)eglGetProcAddress);
+
+			width = argWidth;
+			height = argHeight;
+			glGenFramebuffers(1, &framebuffer);
+			glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+			glGenRenderbuffers(1, &colorBuffer);
+			glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+			glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+			glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+			glGenRenderbuffers(1, &depthBuffer);
+			glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+			glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+			glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+			glViewport(0, 0, width, height);
+
+			GLState::get().setEnabled(GL_DEPTH_TEST, true);
+			GLState::get().depthFunc(GL_LEQUAL);
+			std::printf("%s, OpenGL %s\n", (const char*)glGetString(GL_RENDERER), (const char*)glGetString(GL_VERSION));
+			return true;
+		}
+
+		/// <summary>
+		/// Binds the context's framebuffer again (after a pass that renders somewhere else) and resets the viewport to it
+		/// </summary>
+		void bindFramebuffer(void) const
+		{
+			glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+			glViewport(0, 0, width, height);
+		}
+
+		/// <summary>
+		/// The framebuffer's pixel at (x, y), counted from the bottom left
+		/// </summary>
+		glm::vec4 readPixel(int x, int y) const
+		{
+			unsigned char rgba[4];
+			glReadPixels(x, y, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+			return glm::vec4(rgba[0], rgba[1], rgba[2], rgba[3]) / 255.0f;
+		}
+
+		int getWidth(void) const
+		{
+			return width;
+		}
+
+		int getHeight(void) const
+		{
+			return height;
+		}
+};
+
+/// <summary>
+/// A box from min to max, four vertices per face (so each face has its own normal), lit from outside
+/// </summary>
+inline MeshData boxMesh(const glm::vec3& min, const glm::vec3& max, const glm::vec3& color = glm::vec3(1.0f))
+{
+	MeshData mesh;
+	mesh.material.diffuseColor = color;
+	mesh.material.specularColor = glm::vec3(0.0f);
+	mesh.material.albedo = color;
+
+	const int faces[6][4] = { { 0, 2, 3, 1 }, { 4, 5, 7, 6 }, { 0, 1, 5, 4 }, { 2, 6, 7, 3 }, { 0, 4, 6, 2 }, { 1, 3, 7, 5 } };
+	const glm::vec3 normals[6] = { glm::vec3(0, 0, -1), glm::vec3(0, 0, 1), glm::vec3(0, -1, 0), glm::vec3(0, 1, 0), glm::vec3(-1, 0, 0), glm::vec3(1, 0, 0) };
+	const glm::vec2 corners[4] = { glm::vec2(0, 0), glm::vec2(1, 0), glm::vec2(1, 1), glm::vec2(0, 1) };
+	for (int face = 0; face < 6; ++face) {
+		unsigned int first = (unsigned int)mesh.vertices.size();
+		for (int k = 0; k < 4; ++k) {
+			int corner = faces[face][k];
+			Vertex vertex = Vertex();
+			vertex.Position = glm::vec3(corner & 1 ? max.x : min.x, corner & 2 ? max.y : min.y, corner & 4 ? max.z : min.z);
+			vertex.Normal = normals[face];
+			vertex.TexCoords = corners[k];
+			mesh.vertices.push_back(vertex);
+		}
+		const unsigned int quad[6] = { 0, 1, 2, 0, 2, 3 };
+		for (unsigned int index : quad)
+			mesh.indices.push_back(first + index);
+	}
+	return mesh;
+}
+
+/// <summary>
+/// A square facing up at the given height, split into cells x cells quads (so per-vertex data has somewhere to vary)
+/// </summary>
+inline MeshData groundMesh(float halfSize, float height, int cells, const glm::vec3& color = glm::vec3(1.0f))
+{
+	MeshData mesh;
+	mesh.material.diffuseColor = color;
+	mesh.material.specularColor = glm::vec3(0.0f);
+	mesh.material.albedo = color;
+
+	for (int z = 0; z <= cells; ++z) {
+		for (int x = 0; x <= cells; ++x) {
+			Vertex vertex = Vertex();
+			vertex.Position = glm::vec3(-halfSize + 2.0f * halfSize * x / cells, height, -halfSize + 2.0f * halfSize * z / cells);
+			vertex.Normal = glm::vec3(0.0f, 1.0f, 0.0f);
+			vertex.TexCoords = glm::vec2(float(x), float(z));
+			mesh.vertices.push_back(vertex);
+		}
+	}
+	for (int z = 0; z < cells; ++z) {
+		for (int x = 0; x < cells; ++x) {
+			unsigned int corner = z * (cells + 1) + x;
+			const unsigned int quad[6] = { corner, corner + cells + 1, corner + cells + 2, corner, corner + cells + 2, corner + 1 };
+			mesh.indices.insert(mesh.indices.end(), quad, quad + 6);
+		}
+	}
+	return mesh;
+}
+
+/// <summary>
+/// Gives a mesh a diffuse map of one color (a small image, added to the model's images under its own path)
+/// </summary>
+inline void addSolidTexture(ModelData& data, MeshData& mesh, const std::string& path, const glm::vec3& color, int size = 8)
+{
+	ImageData image;
+	image.path = path;
+	image.width = size;
+	image.height = size;
+	image.nrChannels = 3;
+	for (int i = 0; i < size * size; ++i) {
+		image.pixels.push_back((unsigned char)(color.r * 255.0f));
+		image.pixels.push_back((unsigned char)(color.g * 255.0f));
+		image.pixels.push_back((unsigned char)(color.b * 255.0f));
+	}
+	data.images.push_back(image);
+
+	Texture texture;
+	texture.id = 0;
+	texture.type = "texture_diffuse";
+	texture.path = path;
+	mesh.textures.push_back(texture);
+}
+
+/// <summary>
+/// Uploads meshes built in code as a model (unwrapped for lightmaps first, the way Model::import() does it)
+/// </summary>
+inline std::shared_ptr<Model> uploadModel(ModelData data, const LightmapCharts::Settings& chartSettings = LightmapCharts::Settings())
+{
+	data.valid = true;
+	LightmapCharts charts(chartSettings);
+	for (MeshData& mesh : data.meshes)
+		charts.addMesh(mesh.vertices, mesh.indices);
+	data.chartStats = charts.unwrap();
+
+	std::shared_ptr<Model> model = std::make_shared<Model>();
+	model->upload(data);
+	return model;
+}
+
+inline std::shared_ptr<Model> uploadModel(MeshData mesh)
+{
+	ModelData data;
+	data.meshes.push_back(std::move(mesh));
+	return uploadModel(std::move(data));
+}
+
+#endif
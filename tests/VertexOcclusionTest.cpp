@@ -0,0 +1,213 @@
+// VertexOcclusion on whatever GL the machine has: a box on a ground of 1-unit cells under a 45 degree sun is baked, and the
+// bytes must say what the geometry does (open ground far from the box is open, ground in the box's shadow is blocked from
+// the sun, ground next to the box loses some sky, the box's top loses none). Then the scene is drawn from above with shadows
+// off, so the sun's visibility comes from the bake: through the static batches, object by object, and through the
+// RenderQueue (the last two are how static objects hidden by occlusion queries, or with batching off, are drawn), and all
+// three must show the shadow and match each other.
+
+#include <cstring>
+#include "TestSupport.h"
+#include "CascadedShadows.h"
+#include "ClusteredLights.h"
+#include "FrameData.h"
+#include "ObjectConstants.h"
+#include "RenderQueue.h"
+#include "ShaderLOD.h"
+#include "StaticBatcher.h"
+#include "VertexOcclusion.h"
+
+const int WIDTH = 256, HEIGHT = 256;
+const float NEAR_PLANE = 0.1f, FAR_PLANE = 100.0f;
+const float GROUND_COLOR = 0.5f;
+
+/// <summary>
+/// The baked bytes of an object's vertex at a point, facing a direction (null if there's none)
+/// </summary>
+const unsigned char* bakedAt(const VertexOcclusion& occlusion, const std::vector<Object*>& objects, size_t object, const glm::vec3& position, const glm::vec3& normal)
+{
+	const std::vector<Vertex>& vertices = objects[object]->getModel().getMeshes()[0].vertices;
+	const unsigned char* baked = occlusion.get(object, 0, vertices.size());
+	for (size_t k = 0; baked && k < vertices.size(); ++k) {
+		if (glm::length(vertices[k].Position - position) < 1e-4f && glm::dot(vertices[k].Normal, normal) > 0.99f)
+			return baked + k * 2;
+	}
+	return nullptr;
+}
+
+/// <summary>
+/// A box on the ground (both static) and a box that isn't static, with everything a frame needs
+/// </summary>
+struct OccludedScene {
+	std::vector<std::unique_ptr<Object>> owned;
+	std::vector<Object*> objects;
+	glm::vec3 sunDirection = glm::normalize(glm::vec3(1.0f, 1.0f, 0.0f));		// 45 degrees up, so the box's shadow reaches 2 units to -x
+	RingBuffer ring;
+	ObjectConstants objectConstants;
+	FrameDataBuffer frameData;
+	ClusteredLights clusteredLights;
+	CascadedShadows cascadedShadows;
+	StaticBatcher staticBatcher;
+	RenderQueue renderQueue;
+	std::vector<Light> noLights;
+	std::vector<Object*> visibleObjects;
+	std::vector<const unsigned char*> batchedMeshes;
+	glm::vec3 cameraPos = glm::vec3(0.0f, 20.0f, 0.0f);
+	glm::mat4 view = glm::lookAt(cameraPos, glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f));
+	glm::mat4 projection = glm::perspective(glm::radians(45.0f), float(WIDTH) / HEIGHT, NEAR_PLANE, FAR_PLANE);
+
+	enum DrawPath {
+		BATCHES,
+		OBJECTS,
+		QUEUE
+	};
+
+	OccludedScene(ShaderProgram& shadowProgram) : cascadedShadows{ shadowProgram }
+	{
+		owned.emplace_back(new Object(uploadModel(groundMesh(10.0f, 0.0f, 20, glm::vec3(GROUND_COLOR)))));
+		owned.emplace_back(new Object(uploadModel(boxMesh(glm::vec3(-1.0f, 0.0f, -1.0f), glm::vec3(1.0f, 2.0f, 1.0f), glm::vec3(GROUND_COLOR)))));
+		owned.emplace_back(new Object(uploadModel(boxMesh(glm::vec3(-0.5f), glm::vec3(0.5f)))));
+		owned[0]->setStatic(true);
+		owned[1]->setStatic(true);
+		owned[2]->Translate(30.0f, 0.0f, 0.0f);		// off screen
+		for (std::unique_ptr<Object>& object : owned)
+			objects.push_back(object.get());
+		renderQueue.setDepthRange(NEAR_PLANE, FAR_PLANE);
+	}
+
+	/// <summary>
+	/// Draws the static objects one of the ways main.cpp can, lit by the sun without shadow maps, and reads the picture back
+	/// </summary>
+	void draw(ShaderProgram& program, const VertexOcclusion& occlusion, DrawPath path, std::vector<unsigned char>& pixels)
+	{
+		GLState::get().beginFrame();
+		ring.beginFrame();
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		visibleObjects.assign(objects.begin(), objects.end());
+		visibleObjects.push_back(&staticBatcher.getWorldObject());
+		objectConstants.update(ring, visibleObjects, view, projection);
+		objectConstants.bind();
+		MaterialTable::get().bind();
+		FrameData data = FrameData();
+		data.sunPosition = sunDirection;
+		data.sunAmbientIntensity = 0.2f;
+		data.sunAmbientColor = glm::vec3(1.0f);
+		data.sunDiffuse = glm::vec3(1.0f);
+		data.viewPos = cameraPos;
+		frameData.update(ring, data);
+		clusteredLights.update(ring, noLights, view, projection, NEAR_PLANE, FAR_PLANE, WIDTH, HEIGHT);
+		clusteredLights.bind();
+		cascadedShadows.disable(ring);
+		cascadedShadows.bind();
+		occlusion.bind();
+
+		if (path == BATCHES) {
+			batchedMeshes.assign(objects.size(), nullptr);
+			const unsigned char allMeshes[1] = { 1 };
+			batchedMeshes[0] = batchedMeshes[1] = allMeshes;
+			staticBatcher.draw(program, batchedMeshes);
+		}
+		else if (path == OBJECTS) {
+			objects[0]->Draw(program);
+			objects[1]->Draw(program);
+		}
+		else {
+			renderQueue.clear();
+			objects[0]->Submit(renderQueue, program, cameraPos);
+			objects[1]->Submit(renderQueue, program, cameraPos);
+			renderQueue.sort();
+			renderQueue.execute(ring);
+		}
+		glReadPixels(0, 0, WIDTH, HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+		ring.endFrame();
+	}
+
+	/// <summary>
+	/// The green channel of the pixel a point lands on
+	/// </summary>
+	int valueAt(const std::vector<unsigned char>& pixels, const glm::vec3& point) const
+	{
+		glm::vec4 clip = projection * view * glm::vec4(point, 1.0f);
+		int x = int((clip.x / clip.w * 0.5f + 0.5f) * WIDTH), y = int((clip.y / clip.w * 0.5f + 0.5f) * HEIGHT);
+		return pixels[(size_t(y) * WIDTH + x) * 4 + 1];
+	}
+};
+
+/// <summary>
+/// What the bake says about a few vertices whose occlusion is plain from the geometry
+/// </summary>
+void testBake(OccludedScene& scene, const VertexOcclusion& occlusion)
+{
+	const VertexOcclusion::Stats& stats = occlusion.getLastBakeStats();
+	std::printf("%u objects, %zu vertices, %llu rays in %.0f ms\n", stats.objects, stats.vertices, stats.rays, stats.bakeMilliseconds);
+	CHECK(stats.objects == 2);
+
+	const glm::vec3 up(0.0f, 1.0f, 0.0f);
+	const unsigned char* open = bakedAt(occlusion, scene.objects, 0, glm::vec3(7.0f, 0.0f, 7.0f), up);
+	const unsigned char* shadowed = bakedAt(occlusion, scene.objects, 0, glm::vec3(-2.0f, 0.0f, 0.0f), up);
+	const unsigned char* lit = bakedAt(occlusion, scene.objects, 0, glm::vec3(2.0f, 0.0f, 0.0f), up);
+	const unsigned char* top = bakedAt(occlusion, scene.objects, 1, glm::vec3(1.0f, 2.0f, 1.0f), up);
+	const unsigned char* away = bakedAt(occlusion, scene.objects, 1, glm::vec3(-1.0f, 2.0f, 1.0f), glm::vec3(-1.0f, 0.0f, 0.0f));
+	CHECK(open && shadowed && lit && top && away);
+	CHECK(occlusion.get(2, 0, scene.objects[2]->getModel().getMeshes()[0].vertices.size()) == nullptr);		// not static
+	if (!open || !shadowed || !lit || !top || !away)
+		return;
+
+	std::printf("sky blocked (of 255): open ground %d, ground in the shadow %d, ground on the lit side %d, box top %d\n", open[0], shadowed[0], lit[0], top[0]);
+	std::printf("sun blocked (of 255): open ground %d, ground in the shadow %d, ground on the lit side %d, box top %d, box side facing away %d\n",
+		open[1], shadowed[1], lit[1], top[1], away[1]);
+	CHECK(open[0] == 0 && open[1] == 0);
+	CHECK(shadowed[1] == 255);
+	CHECK(shadowed[0] > 20);		// a box a unit away, out of a short hemisphere
+	CHECK(lit[1] == 0);
+	CHECK(lit[0] > 20);
+	CHECK(top[0] == 0 && top[1] == 0);
+	CHECK(away[1] == 255);
+}
+
+/// <summary>
+/// Drawn from the batches, object by object, and through the queue: the baked shadow shows in each, and they match
+/// </summary>
+void testDraws(OccludedScene& scene, const VertexOcclusion& occlusion, ShaderProgram& program)
+{
+	CHECK(scene.objects[0]->getOcclusionOffset() >= 0 && scene.objects[1]->getOcclusionOffset() >= 0);
+	CHECK(scene.objects[2]->getOcclusionOffset() == -1);
+
+	const char* names[3] = { "batches", "objects", "queue" };
+	const glm::vec3 open(7.0f, 0.0f, 7.0f), shadowed(-2.0f, 0.0f, 0.0f);
+	std::vector<unsigned char> batched(WIDTH * HEIGHT * 4), pixels(WIDTH * HEIGHT * 4);
+	for (int path = OccludedScene::BATCHES; path <= OccludedScene::QUEUE; ++path) {
+		scene.draw(program, occlusion, (OccludedScene::DrawPath)path, path == OccludedScene::BATCHES ? batched : pixels);
+		const std::vector<unsigned char>& drawn = path == OccludedScene::BATCHES ? batched : pixels;
+		int openValue = scene.valueAt(drawn, open), shadowedValue = scene.valueAt(drawn, shadowed);
+
+		unsigned int differing = 0;
+		for (size_t i = 1; i < drawn.size(); i += 4)
+			differing += std::abs(drawn[i] - batched[i]) > 1;
+		std::printf("%s: open ground %d, shadow %d, %u pixels differ from the batches\n", names[path], openValue, shadowedValue, differing);
+		CHECK(openValue > 100);
+		CHECK(shadowedValue < openValue / 3);
+		CHECK(differing == 0);
+	}
+}
+
+int main(void)
+{
+	HeadlessContext context;
+	if (!context.create(WIDTH, HEIGHT))
+		return TEST_SKIPPED;
+
+	std::string defines = ShaderLOD::defines(ShaderLOD::FULL);
+	ShaderProgram program(ShaderFile(REPO_DIR "VertexShader.vert", "vertex", defines), ShaderFile(REPO_DIR "FragmentShader.frag", "fragment", defines));
+	ShaderProgram shadowProgram(ShaderFile(REPO_DIR "ShadowVertexShader.vert", "vertex"), ShaderFile(REPO_DIR "ShadowFragmentShader.frag", "fragment"));
+	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+
+	OccludedScene scene(shadowProgram);
+	VertexOcclusion occlusion;
+	occlusion.bake(scene.objects, scene.sunDirection);
+	scene.staticBatcher.build(scene.objects, &occlusion);
+
+	testBake(scene, occlusion);
+	testDraws(scene, occlusion, program);
+	CHECK(glGetError() == GL_NO_ERROR);
+	return testResult();
+}